@@ -1,37 +1,41 @@
 #include "compile.h"
 #include <assert.h>
 
-static int alloc_scoped_env(env_t *env, int offset) {
-    pair_t *pair;
-
-    // Allocate homes for each variable at the current level
-    map_for_each(env->homes, pair) {
-        var_info_t *v = pair->value;
-        string_t *name = pair->key;
+// Lays out the stack frame for one function and returns how much of it is used. Scopes are
+// numbered in the order they were opened, and each one's variables go right after everything in
+// the scopes before it.
+static int alloc_fn_vars(var_table_t *table) {
+    if (!table->num_scopes)
+        return 0;
 
-        offset -= 8;
-        debug("Found variable %s\n", string_get(name));
-        v->home.reg = REG_RBP;
-        v->home.offset = offset;
+    // next free offset in each scope
+    int *next = malloc(sizeof(int) * table->num_scopes);
+    int offset = 0;
+    for (int i = 0; i < table->num_scopes; i++) {
+        next[i] = offset;
+        offset -= 8 * table->scopes[i].num_vars;
     }
 
-    // Recursively allocate vars for all child envs
-    env_t *child_env;
-    list_for_each(env->children, child_env) {
-        int child_offset = alloc_scoped_env(child_env, offset); 
-        if (child_offset < offset)
-            offset = child_offset;
+    for (int i = 0; i < table->num_vars; i++) {
+        var_info_t *v = table->vars[i];
+        debug("Found variable %s\n", string_get(v->name));
+        next[v->scope] -= 8;
+        v->home.reg = REG_RBP;
+        v->home.offset = next[v->scope];
     }
 
+    free(next);
     return offset;
 }
 
+void alloc_fn_homes(fn_def_t *fn_def) {
+    debug("allocating for function %s\n", string_get(fn_def->name));
+    fn_def->sp_offset = alloc_fn_vars(fn_def->vars);
+}
+
 void alloc_homes(program_t *prog) {
     pair_t *pair;
     map_for_each(prog->fn_defs, pair) {
-        fn_def_t *curr_fn = pair->value;
-        debug("allocating for function %s\n", string_get(curr_fn->name));
-        curr_fn->sp_offset = alloc_scoped_env(curr_fn->env, 0);
+        alloc_fn_homes(pair->value);
     }
 }
-
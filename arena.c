@@ -0,0 +1,113 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN (16)
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static arena_block_t *arena_block_new(size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+arena_t *arena_new(void) {
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (!arena)
+        return NULL;
+    arena->head = NULL;
+    return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (!arena)
+        return malloc(size);
+
+    size = align_up(size);
+    arena_block_t *block = arena->head;
+    if (!block || block->used + size > block->size) {
+        // Big allocations get a block to themselves
+        block = arena_block_new(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        if (!block)
+            return NULL;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void *ret = block->data + block->used;
+    block->used += size;
+    return ret;
+}
+
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (!arena)
+        return realloc(ptr, new_size);
+
+    if (!ptr)
+        return arena_alloc(arena, new_size);
+
+    // If ptr was the last thing allocated, try to grow it in place
+    arena_block_t *block = arena->head;
+    old_size = align_up(old_size);
+    if ((char*)ptr + old_size == block->data + block->used
+            && (char*)ptr - block->data + align_up(new_size) <= block->size) {
+        block->used = (char*)ptr - block->data + align_up(new_size);
+        return ptr;
+    }
+
+    // Big allocations that have a block to themselves can just be reallocated, which lets growing
+    // arrays get past the block size without leaving every old copy behind
+    if ((char*)ptr == block->data && block->used == old_size && new_size > ARENA_BLOCK_SIZE) {
+        block = realloc(block, sizeof(arena_block_t) + align_up(new_size));
+        if (!block)
+            return NULL;
+        block->used = block->size = align_up(new_size);
+        arena->head = block;
+        return block->data;
+    }
+
+    void *ret = arena_alloc(arena, new_size);
+    if (!ret)
+        return NULL;
+    memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+    return ret;
+}
+
+void arena_free(arena_t *arena) {
+    if (!arena)
+        return;
+    arena_block_t *block = arena->head;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+void arena_adopt(arena_t *arena, arena_t *other) {
+    arena_block_t *tail = other->head;
+    if (!tail) {
+        free(other);
+        return;
+    }
+    while (tail->next)
+        tail = tail->next;
+
+    if (arena->head) {
+        tail->next = arena->head->next;
+        arena->head->next = other->head;
+    } else {
+        arena->head = other->head;
+    }
+    free(other);
+}
@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+
+/*
+ * A bump allocator. Allocations are carved out of large blocks and are never freed individually -
+ * everything in the arena is released at once by arena_free. Each compiler phase allocates into
+ * its own arena so that its data can be dropped once the next phase is done with it.
+ *
+ * Passing a NULL arena to arena_alloc/arena_realloc falls back to malloc/realloc, which lets the
+ * containers support both heap and arena backed instances with the same code.
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    // most recently allocated block, which is the only one we bump allocate from
+    arena_block_t *head;
+} arena_t;
+
+arena_t *arena_new(void);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+void arena_free(arena_t *arena);
+
+// Moves everything allocated in other into arena, so it's released along with arena, and frees
+// other. arena keeps bump allocating from the block it was already using.
+void arena_adopt(arena_t *arena, arena_t *other);
+
+#endif
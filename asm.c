@@ -1,7 +1,59 @@
 #include "compile.h"
+#include <stdatomic.h>
 
-static list_t *expr_to_instrs(expr_t *expr, env_t *env);
-static list_t *stmt_to_instrs(stmt_t *stmt, context_t context);
+// gen_asm can generate several functions at once (see gen_parallel), so everything that's
+// about the function being generated is per thread. The AST is only read. Everything else is per
+// thread too, so separate compiles can run on separate threads.
+
+// Instruction buffers are allocated here. It's released once print_asm is done with them.
+static _Thread_local arena_t *instr_arena = NULL;
+
+// How many functions gen_asm_each generates before handing them over and freeing their code. Enough
+// to keep every thread busy, but few enough that their code is small next to the program's AST.
+#define GEN_BATCH_SIZE (256)
+
+static _Thread_local ast_t *ast = NULL;
+
+// Variables of the function being generated, which NODE_VAR and NODE_DECLARE refer to by index
+static _Thread_local var_table_t *fn_vars = NULL;
+
+static var_info_t *node_var(node_id_t node) {
+    return fn_vars->vars[ast->a[node]];
+}
+
+// Whether code is being generated one pass while parsing, rather than by gen_asm
+static _Thread_local bool fast = false;
+
+// Where var_info lives. In one-pass mode the frame can't be laid out until the whole function has
+// been parsed, so its index stands in for its offset until the function is backpatched.
+static mem_loc_t var_home(var_info_t *var_info) {
+    if (fast)
+        return (mem_loc_t){.reg = REG_RBP, .offset = var_info->index};
+    return var_info->home;
+}
+
+// A node that's partway through being generated
+typedef struct {
+    node_id_t node;
+
+    // how many of its children have been generated so far
+    int state;
+
+    // local labels it allocated, which its later steps need
+    int labels[3];
+
+    // what the node's statements should use
+    context_t context;
+} gen_frame_t;
+
+// Returned by a step once the node is finished
+#define GEN_DONE ((node_id_t)-1)
+
+static _Thread_local gen_frame_t *gen_frames = NULL;
+static _Thread_local int num_gen_frames = 0;
+static _Thread_local int gen_frames_capacity = 0;
+
+#define OUTPUT_BUF_DEFAULT_CAPACITY (64)
 
 static int op_to_num_args(opcode_t op) {
     switch (op) {
@@ -35,59 +87,112 @@ static int op_to_num_args(opcode_t op) {
     }
 }
 
-static string_t *unique_label(char *seed) {
-    static int count = 0;
-    char buf[32];
-
-    string_t *name = string_new();
-    string_append(name, seed, strnlen(seed, 100));
+// In one-pass mode, labels get provisional ids which are kept in a list in the order gen_asm would
+// have allocated them, and are renumbered by their place in it once the function is done.
+// label_next links each one to the next, starting from 0, which is never a label itself. 0 also ends
+// the list.
+static _Thread_local int *label_next = NULL;
+static _Thread_local int label_next_capacity = 0;
+static _Thread_local int num_fast_labels = 0;
+static _Thread_local int label_tail = 0;
+
+// Local labels gen_asm has handed out so far
+static _Thread_local int num_labels = 0;
+
+// Makes room for one more element in a heap array that's full
+static void *grow(void *items, int len, int *capacity, size_t size) {
+    if (len < *capacity)
+        return items;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    items = realloc(items, size * *capacity);
+    if (!items) {
+        UNREACHABLE("asm: out of memory\n");
+    }
+    return items;
+}
 
-    snprintf(buf, 32, "%d", count++);
-    string_append(name, buf, strnlen(buf, 32));
-    return name;
+// Allocates a provisional label that comes right after prev in the list
+static int fast_label_after(int prev) {
+    label_next = grow(label_next, num_fast_labels, &label_next_capacity, sizeof(int));
+    int label = num_fast_labels++;
+    label_next[label] = label_next[prev];
+    label_next[prev] = label;
+    if (label_tail == prev)
+        label_tail = label;
+    return label;
 }
 
-static output_t *new_label(string_t *name, int linkage) {
-    output_t *ret = malloc(sizeof(output_t));
-    ret->type = OUTPUT_LABEL;
-    ret->label.name = name;
-    ret->label.linkage = linkage;
-    return ret;
+// Returns the id of a new local label
+static int unique_label(void) {
+    if (fast)
+        return fast_label_after(label_tail);
+    return num_labels++;
 }
 
-static output_t *instr_r2r(opcode_t op, reg_t src, reg_t dst) {
-    output_t *out = malloc(sizeof(output_t));
-    if (!out) {
-        UNREACHABLE("instr_r2r: malloc failed\n");
+// Appends a new output to the end of buf and returns it. The pointer is only good until the next
+// append, since growing the buffer can move it.
+static output_t *output_push(output_buf_t *buf) {
+    if (buf->len >= buf->capacity) {
+        int capacity = buf->capacity ? buf->capacity * 2 : OUTPUT_BUF_DEFAULT_CAPACITY;
+        output_t *outputs = arena_realloc(buf->arena, buf->outputs, sizeof(output_t) * buf->capacity,
+                                          sizeof(output_t) * capacity);
+        if (!outputs) {
+            UNREACHABLE("output_push: failed to grow output buffer\n");
+        }
+        buf->outputs = outputs;
+        buf->capacity = capacity;
     }
+    return &buf->outputs[buf->len++];
+}
+
+static output_buf_t *output_buf_new(void) {
+    output_buf_t *buf = arena_alloc(instr_arena, sizeof(output_buf_t));
+    buf->outputs = NULL;
+    buf->len = 0;
+    buf->capacity = 0;
+    buf->arena = instr_arena;
+    return buf;
+}
+
+static void new_label(output_buf_t *buf, string_t *name, int linkage) {
+    output_t *out = output_push(buf);
+    out->type = OUTPUT_LABEL;
+    out->label.name = name;
+    out->label.linkage = linkage;
+}
+
+static void new_local_label(output_buf_t *buf, int id) {
+    output_t *out = output_push(buf);
+    out->type = OUTPUT_LABEL;
+    out->label.name = NULL;
+    out->label.id = id;
+    out->label.linkage = LABEL_LOCAL;
+}
 
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 2) {
+static void instr_r2r(output_buf_t *buf, opcode_t op, reg_t src, reg_t dst) {
+    if (op_to_num_args(op) != 2) {
         UNREACHABLE("instr_r2r: num args != 2\n");
     }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 2;
     out->instr.op = op;
     out->instr.src.type = OPERAND_REG;
     out->instr.src.reg = src;
 
     out->instr.dst.type = OPERAND_REG;
     out->instr.dst.reg = dst;
-    return out;
 }
 
-static output_t *instr_i2r(opcode_t op, imm_t src, reg_t dst) {
-    output_t *out = malloc(sizeof(output_t));
-    if (!out) {
-        UNREACHABLE("instr_i2r: malloc failed\n");
-    }
-
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 2) {
+static void instr_i2r(output_buf_t *buf, opcode_t op, imm_t src, reg_t dst) {
+    if (op_to_num_args(op) != 2) {
         UNREACHABLE("instr_i2r: num args != 2\n");
     }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 2;
     out->instr.op = op;
 
     out->instr.src.type = OPERAND_IMM;
@@ -95,17 +200,16 @@ static output_t *instr_i2r(opcode_t op, imm_t src, reg_t dst) {
 
     out->instr.dst.type = OPERAND_REG;
     out->instr.dst.reg = dst;
-    return out;
 }
 
-static output_t *instr_r2m(opcode_t op, reg_t src, mem_loc_t dst) {
-    output_t *out = malloc(sizeof(output_t)); 
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 2) {
+static void instr_r2m(output_buf_t *buf, opcode_t op, reg_t src, mem_loc_t dst) {
+    if (op_to_num_args(op) != 2) {
         UNREACHABLE("instr_r2m requires opcode that uses 2 args\n");
     }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 2;
     out->instr.op = op;
 
     out->instr.src.type = OPERAND_REG;
@@ -113,17 +217,16 @@ static output_t *instr_r2m(opcode_t op, reg_t src, mem_loc_t dst) {
 
     out->instr.dst.type = OPERAND_MEM_LOC;
     out->instr.dst.mem = dst;
-    return out;
 }
 
-static output_t *instr_i2m(opcode_t op, imm_t src, mem_loc_t dst) {
-    output_t *out = malloc(sizeof(output_t)); 
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 2) {
+static void instr_i2m(output_buf_t *buf, opcode_t op, imm_t src, mem_loc_t dst) {
+    if (op_to_num_args(op) != 2) {
         UNREACHABLE("instr_r2m requires opcode that uses 2 args\n");
     }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 2;
     out->instr.op = op;
 
     out->instr.src.type = OPERAND_IMM;
@@ -131,21 +234,17 @@ static output_t *instr_i2m(opcode_t op, imm_t src, mem_loc_t dst) {
 
     out->instr.dst.type = OPERAND_MEM_LOC;
     out->instr.dst.mem = dst;
-    return out;
 }
 
-static output_t *instr_m2r(opcode_t op, mem_loc_t src, reg_t dst) {
+static void instr_m2r(output_buf_t *buf, opcode_t op, mem_loc_t src, reg_t dst) {
     if (op != OP_MOV) {
         // TODO find instrs where this is illegal
         UNREACHABLE("instr_m2r is only legal for MOV opcode for now\n");
     }
-    output_t *out = malloc(sizeof(output_t)); 
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 2) {
-        UNREACHABLE("instr_m2r requires opcode that uses 2 args\n");
-    }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 2;
     out->instr.op = op;
 
     out->instr.src.type = OPERAND_MEM_LOC;
@@ -153,66 +252,67 @@ static output_t *instr_m2r(opcode_t op, mem_loc_t src, reg_t dst) {
 
     out->instr.dst.type = OPERAND_REG;
     out->instr.dst.reg = dst;
-    return out;
 }
 
-static output_t *instr_r(opcode_t op, reg_t src) {
-    output_t *out = malloc(sizeof(output_t));
-    if (!out) {
-        UNREACHABLE("instr_r: malloc failed\n");
-    }
-
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 1) {
+static void instr_r(output_buf_t *buf, opcode_t op, reg_t src) {
+    if (op_to_num_args(op) != 1) {
         UNREACHABLE("instr_r: num args != 1 for this opcode\n");
     }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 1;
     out->instr.op = op;
 
     out->instr.src.type = OPERAND_REG;
     out->instr.src.reg = src;
-    return out;
 }
 
-static output_t *instr_label(opcode_t op, string_t *label) {
-    if (op != OP_JMP && op != OP_JE && op != OP_JNE && op != OP_CALL) {
-        UNREACHABLE("intsr_label: not a jmp or call opcode\n");
+// Call a named label
+static void instr_label(output_buf_t *buf, opcode_t op, string_t *label) {
+    if (op != OP_CALL) {
+        UNREACHABLE("intsr_label: not a call opcode\n");
     }
 
     if (!label) {
         UNREACHABLE("intsr_label: null label\n");
     }
 
-    output_t *out = malloc(sizeof(output_t));
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
- 
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 1) {
-        UNREACHABLE("instr_label: opcode has wrong number of args, not even sure how this happens\n");
-    }
-
+    out->instr.num_args = 1;
     out->instr.op = op;
     out->instr.src.type = OPERAND_LABEL;
     out->instr.src.label = label;
-    return out;
 }
 
-static output_t *instr_noarg(opcode_t op) {
-    output_t *out = malloc(sizeof(output_t));
-    if (!out) {
-        UNREACHABLE("instr: malloc failed");
+// Jump to a local label
+static void instr_jump(output_buf_t *buf, opcode_t op, int label) {
+    if (op != OP_JMP && op != OP_JE && op != OP_JNE) {
+        UNREACHABLE("instr_jump: not a jmp opcode\n");
     }
 
-    out->instr.num_args = op_to_num_args(op);
-    if (out->instr.num_args != 0) {
-        UNREACHABLE("instr: opcode has nonzero number of args\n");
+    if (label < 0) {
+        UNREACHABLE("instr_jump: null label\n");
     }
 
+    output_t *out = output_push(buf);
     out->type = OUTPUT_INSTR;
+    out->instr.num_args = 1;
     out->instr.op = op;
+    out->instr.src.type = OPERAND_LOCAL_LABEL;
+    out->instr.src.local_label = label;
+}
 
-    return out;
+static void instr_noarg(output_buf_t *buf, opcode_t op) {
+    if (op_to_num_args(op) != 0) {
+        UNREACHABLE("instr: opcode has nonzero number of args\n");
+    }
+
+    output_t *out = output_push(buf);
+    out->type = OUTPUT_INSTR;
+    out->instr.num_args = 0;
+    out->instr.op = op;
 }
 
 static const reg_t ordered_param_regs[] = {
@@ -224,648 +324,1283 @@ static const reg_t ordered_param_regs[] = {
     REG_R9,
 };
 
-static list_t *fn_caller_prepare(list_t *params, env_t *env) {
-    debug("fn_caller_prepare\n");
-    list_t *ret = list_new();
+static void fn_caller_save(output_buf_t *buf, uint32_t num_args) {
+    debug("fn_caller_save\n");
 
     // Push all caller save regs onto the stack
-    list_push(ret, instr_r(OP_PUSH, REG_R10));
-    list_push(ret, instr_r(OP_PUSH, REG_R11));
+    instr_r(buf, OP_PUSH, REG_R10);
+    instr_r(buf, OP_PUSH, REG_R11);
     for (int i = 0; i < 6; i++) {
-        list_push(ret, instr_r(OP_PUSH, ordered_param_regs[i]));
+        instr_r(buf, OP_PUSH, ordered_param_regs[i]);
     }
 
-    if (!params || !params->len)
-        return ret;
-
-    if (params->len > 6) {
+    if (num_args > 6) {
         UNREACHABLE("fn_caller_before: Don't support more than 6 parameters yet\n");
     }
-
-    // Generate code for each parameter and put it into the correct register 
-    int param_number = 0;
-    expr_t *param_expr = list_pop(params);
-    for (; param_expr; param_expr = list_pop(params)) {
-        debug("dealing with param %d\n", param_number);
-        list_concat(ret, expr_to_instrs(param_expr, env));
-        list_push(ret, instr_r2r(OP_MOV, REG_RAX, ordered_param_regs[param_number++]));
-    }
-
-    debug("prepare done\n");
-    return ret;
 }
 
-static list_t *fn_caller_restore(void) {
+static void fn_caller_restore(output_buf_t *buf) {
     debug("fn_caller_restore\n");
-    list_t *ret = list_new();
     for (int i = 5; i >= 0; i--) {
-        list_push(ret, instr_r(OP_POP, ordered_param_regs[i]));
+        instr_r(buf, OP_POP, ordered_param_regs[i]);
     }
 
-    list_push(ret, instr_r(OP_POP, REG_R11));
-    list_push(ret, instr_r(OP_POP, REG_R10));
-    return ret;
+    instr_r(buf, OP_POP, REG_R11);
+    instr_r(buf, OP_POP, REG_R10);
 }
 
-static list_t *fn_callee_prologue(fn_def_t *fn_def) {
+static void fn_callee_prologue(output_buf_t *buf, fn_def_t *fn_def) {
     // function prologue
-    list_t *ret = list_new();
 
     // Allocate space for locals
-    list_push(ret, instr_r(OP_PUSH, REG_RBP));
-    list_push(ret, instr_r2r(OP_MOV, REG_RSP, REG_RBP));
-    list_push(ret, instr_i2r(OP_ADD, fn_def->sp_offset, REG_RSP));
+    instr_r(buf, OP_PUSH, REG_RBP);
+    instr_r2r(buf, OP_MOV, REG_RSP, REG_RBP);
+    instr_i2r(buf, OP_ADD, fn_def->sp_offset, REG_RSP);
 
     // Save callee-save registers
-    list_push(ret, instr_r(OP_PUSH, REG_RBX));
-    //list_push(ret, instr_r(OP_PUSH, REG_R12));
-    //list_push(ret, instr_r(OP_PUSH, REG_R13));
-    //list_push(ret, instr_r(OP_PUSH, REG_R14));
-    //list_push(ret, instr_r(OP_PUSH, REG_R15));
+    instr_r(buf, OP_PUSH, REG_RBX);
+    //instr_r(buf, OP_PUSH, REG_R12);
+    //instr_r(buf, OP_PUSH, REG_R13);
+    //instr_r(buf, OP_PUSH, REG_R14);
+    //instr_r(buf, OP_PUSH, REG_R15);
 
     if (!fn_def->params || !fn_def->params->len)
-        return ret;
-
-    // Move parameters from registers into their homes on the stack
-    string_t *var_name;
-    var_info_t *var_info;
-    int param_number = 0;
-    list_for_each(fn_def->params, var_name) {
-        var_info = map_get(fn_def->env->homes, var_name);
-        list_push(ret, instr_r2m(OP_MOV, ordered_param_regs[param_number++], var_info->home));
+        return;
+    if (fn_def->params->len > 6) {
+        UNREACHABLE("fn_callee_prologue: Don't support more than 6 parameters yet\n");
     }
-    return ret;
-}
 
-static list_t *fn_callee_epilogue(void) {
-    list_t *ret = list_new();
+    // Move parameters from registers into their homes on the stack. They're the first vars, which
+    // saves walking the params list with its shared cursor.
+    for (int i = 0; i < fn_def->params->len; i++)
+        instr_r2m(buf, OP_MOV, ordered_param_regs[i], var_home(fn_def->vars->vars[i]));
+}
 
+static void fn_callee_epilogue(output_buf_t *buf) {
     // Restore callee-save registers
-    //list_push(ret, instr_r(OP_PUSH, REG_R15));
-    //list_push(ret, instr_r(OP_PUSH, REG_R14));
-    //list_push(ret, instr_r(OP_PUSH, REG_R13));
-    //list_push(ret, instr_r(OP_PUSH, REG_R12));
-    list_push(ret, instr_r(OP_PUSH, REG_RBX));
-
-    list_push(ret, instr_r2r(OP_MOV, REG_RBP, REG_RSP));
-    list_push(ret, instr_r(OP_POP, REG_RBP));
-
-    return ret;
+    //instr_r(buf, OP_PUSH, REG_R15);
+    //instr_r(buf, OP_PUSH, REG_R14);
+    //instr_r(buf, OP_PUSH, REG_R13);
+    //instr_r(buf, OP_PUSH, REG_R12);
+    instr_r(buf, OP_PUSH, REG_RBX);
+
+    instr_r2r(buf, OP_MOV, REG_RBP, REG_RSP);
+    instr_r(buf, OP_POP, REG_RBP);
 }
 
-static list_t *primary_to_instrs(primary_t *primary, env_t *env) {
-    if (!primary) {
-        UNREACHABLE("primary_to_instrs: wtf are you doing, primary is null\n");
-    }
-
-    debug("primary to instrs: %u\n", primary->type);
+// The code for each construct is emitted in pieces, one before each of its children and one at the
+// end. These are those pieces. Both the tree walk below and one-pass mode at the bottom of this file
+// are built out of them, so the two always generate the same code.
 
-    if (primary->type == PRIMARY_INT) {
-        list_t *ret = list_new();
-        list_push(ret, instr_i2r(OP_MOV, primary->integer, REG_RAX));
-        debug("int %u\n", primary->integer);
-        return ret;
-    }
+static void gen_load(output_buf_t *buf, var_info_t *var_info) {
+    // Do i just move the variable from its home to RAX?
+    debug("Got primary var: %s\n", string_get(var_info->name));
 
-    if (primary->type == PRIMARY_CHAR) {
-        UNREACHABLE("primary_to_instrs: Got a char???\n");
-    }
-
-    if (primary->type == PRIMARY_EXPR) {
-        return expr_to_instrs(primary->expr, env);
-    }
-
-    if (primary->type == PRIMARY_VAR) {
-        // Do i just move the variable from its home to RAX?
-        list_t *ret = list_new();
-        debug("Got primary var: %s\n", string_get(primary->var));
-
-        var_info_t *var_info = env_get_declared(env, primary->var);
-        if (!var_info) {
-            UNREACHABLE("Compilation error: variable referenced before declaration\n");
-        }
-        list_push(ret, instr_m2r(OP_MOV, var_info->home, REG_RAX));
-        return ret;
+    if (!var_info->declared) {
+        UNREACHABLE("Compilation error: variable referenced before declaration\n");
     }
+    instr_m2r(buf, OP_MOV, var_home(var_info), REG_RAX);
+}
 
-    if (primary->type == PRIMARY_FN_CALL) {
-        // Parsing checks if this was declared before it was used, so assume this call is good
-        debug("Got fn call for function %s\n", string_get(primary->fn_call->fn_name));
-        list_t *ret = fn_caller_prepare(primary->fn_call->param_exprs, env);
-        list_push(ret, instr_label(OP_CALL, primary->fn_call->fn_name));
-        list_concat(ret, fn_caller_restore());
+// The arg that was just generated goes in the register for param i
+static void gen_call_arg(output_buf_t *buf, int i) {
+    instr_r2r(buf, OP_MOV, REG_RAX, ordered_param_regs[i]);
+}
 
-        // Return value should still be in RAX
-        return ret;
-    }
+static void gen_call(output_buf_t *buf, string_t *fn_name) {
+    // Parsing checks if this was declared before it was used, so assume this call is good
+    debug("Got fn call for function %s\n", string_get(fn_name));
+    instr_label(buf, OP_CALL, fn_name);
+    fn_caller_restore(buf);
 
-    UNREACHABLE("Unexpected primary expr\n");
-    return NULL;
+    // Return value should still be in RAX
 }
 
-static list_t *unary_to_instrs(unary_expr_t *unary, env_t *env) {
-    list_t *ret = expr_to_instrs(unary->expr, env);
-    if (!ret) {
-        UNREACHABLE("unary_to_instrs: unary expr could not be generated\n");
-    }
+// var_info is the operand of ++ and --, and is ignored for everything else
+static void gen_unary(output_buf_t *buf, enum unary_op op, var_info_t *var_info) {
     debug("unary to instrs\n");
-    if (unary->op == UNARY_MATH_NEG) {
-        list_push(ret, instr_r(OP_NEG, REG_RAX));
-        return ret;
+    if (op == UNARY_MATH_NEG) {
+        instr_r(buf, OP_NEG, REG_RAX);
+        return;
     } 
 
-    if (unary->op == UNARY_LOGICAL_NEG) {
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETE, REG_AL));
-        return ret;
+    if (op == UNARY_LOGICAL_NEG) {
+        instr_i2r(buf, OP_CMP, 0, REG_RAX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETE, REG_AL);
+        return;
     }
 
-    if (unary->op == UNARY_BITWISE_COMP) {
-        list_push(ret, instr_r(OP_NOT, REG_RAX));
-        return ret;
+    if (op == UNARY_BITWISE_COMP) {
+        instr_r(buf, OP_NOT, REG_RAX);
+        return;
     }
 
-    if (unary->op == UNARY_POSTINC) {
+    if (op == UNARY_POSTINC) {
         debug("post inc\n");
-        var_info_t *var_info = env_get_declared(env, unary->expr->primary->var);
-        if (!var_info) {
+        if (!var_info->declared) {
             UNREACHABLE("assign_to_instrs: variable is used before declaration");
         }
 
         // Note that while we could add 1 directly to the memory location, this code is more
         // generic and will be easier to use when dereference/array code is supported
-        list_push(ret, instr_i2m(OP_ADD, 1, var_info->home));
-        //list_push(ret, instr_r2m(OP_MOV, REG_RAX, var_info->home));
-        return ret;
+        instr_i2m(buf, OP_ADD, 1, var_home(var_info));
+        //instr_r2m(buf, OP_MOV, REG_RAX, var_info->home);
+        return;
     }
 
-    if (unary->op == UNARY_POSTDEC) {
-        var_info_t *var_info = env_get_declared(env, unary->expr->primary->var);
+    if (op == UNARY_POSTDEC) {
         debug("Found postdec\n");
-        if (!var_info) {
+        if (!var_info->declared) {
             UNREACHABLE("assign_to_instrs: variable is used before declaration");
         }
-        //list_push(ret, instr_i2r(OP_SUB, 1, REG_RAX));
-        //list_push(ret, instr_r2m(OP_MOV, REG_RAX, var_info->home));
-        list_push(ret, instr_i2m(OP_SUB, 1, var_info->home));
-        return ret;
+        //instr_i2r(buf, OP_SUB, 1, REG_RAX);
+        //instr_r2m(buf, OP_MOV, REG_RAX, var_info->home);
+        instr_i2m(buf, OP_SUB, 1, var_home(var_info));
+        return;
     }
 
     UNREACHABLE("unexpected unary expr\n");
-    return NULL;
 }
 
-static list_t *binop_to_instrs(bin_expr_t *bin, env_t *env) {
-    if (!bin) {
-        UNREACHABLE("binop_to_instrs: bin is null wtf are you doing\n");
-    }
-
-    list_t *ret = expr_to_instrs(bin->lhs, env);
-    if (!ret) {
-        UNREACHABLE("binop_to_instrs: failed to generate lhs\n");
+// Combines the lhs in RCX with the rhs in RAX, leaving the result in RAX
+static void binop_apply(output_buf_t *buf, enum bin_op op) {
+    if (op == BIN_ADD) {
+        instr_r2r(buf, OP_ADD, REG_RCX, REG_RAX);
+        return;
     }
 
-    // AND and OR short circuit, so we don't want to evaluate the RHS if we're not certain we need
-    // to.
-    debug("Found bin op expr\n");
-    if (bin->op == BIN_OR) {
-        string_t *or_clause_2 = unique_label("second_or_clause");
-        string_t *end = unique_label("or_end");
-
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_label(OP_JE, or_clause_2));
-        list_push(ret, instr_i2r(OP_MOV, 1, REG_RAX));
-        list_push(ret, instr_label(OP_JMP, end));
-        list_push(ret, new_label(or_clause_2, LABEL_STATIC));
-
-        list_concat(ret, expr_to_instrs(bin->rhs, env));
-
-        list_push(ret, new_label(end, LABEL_STATIC));
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETNE, REG_AL));
-        return ret;
-    }
-
-    if (bin->op == BIN_AND) {
-        string_t *and_clause_2 = unique_label("second_and_clause");
-        string_t *end = unique_label("and_end");
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_label(OP_JNE, and_clause_2));
-        list_push(ret, instr_label(OP_JMP, end));
-        list_push(ret, new_label(and_clause_2, LABEL_STATIC));
-        list_concat(ret, expr_to_instrs(bin->rhs, env));
-        list_push(ret, new_label(end, LABEL_STATIC));
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETNE, REG_AL));
-        return ret;
-    }
-
-    list_push(ret, instr_r(OP_PUSH, REG_RAX));
-    list_concat(ret, expr_to_instrs(bin->rhs, env));
-    list_push(ret, instr_r(OP_POP, REG_RCX));
-
-    if (bin->op == BIN_ADD) {
-        list_push(ret, instr_r2r(OP_ADD, REG_RCX, REG_RAX));
-        return ret;
-    }
-
-    if (bin->op == BIN_SUB) {
+    if (op == BIN_SUB) {
         // sub src, dst computes dst - src
         // so we want to compute e1 - e2, and e1 is in rcx
         // so we'll do rcx - rax, then move rcx into rax
-        list_push(ret, instr_r2r(OP_SUB, REG_RAX, REG_RCX));
-        list_push(ret, instr_r2r(OP_MOV, REG_RCX, REG_RAX));
-        return ret;
+        instr_r2r(buf, OP_SUB, REG_RAX, REG_RCX);
+        instr_r2r(buf, OP_MOV, REG_RCX, REG_RAX);
+        return;
     }
 
-    if (bin->op == BIN_MUL) {
-        list_push(ret, instr_r2r(OP_MUL, REG_RCX, REG_RAX));
-        return ret;
+    if (op == BIN_MUL) {
+        instr_r2r(buf, OP_MUL, REG_RCX, REG_RAX);
+        return;
     }
 
-    if (bin->op == BIN_DIV) {
-        list_push(ret, instr_r2r(OP_XCHG, REG_RAX, REG_RCX));
-        list_push(ret, instr_noarg(OP_CQO));
-        list_push(ret, instr_r(OP_DIV, REG_RCX));
-        return ret;
+    if (op == BIN_DIV) {
+        instr_r2r(buf, OP_XCHG, REG_RAX, REG_RCX);
+        instr_noarg(buf, OP_CQO);
+        instr_r(buf, OP_DIV, REG_RCX);
+        return;
     } 
 
-    if (bin->op == BIN_MODULO) {
+    if (op == BIN_MODULO) {
         // idivq puts quotient in RAX, remainder in RDX
-        list_push(ret, instr_r2r(OP_XCHG, REG_RAX, REG_RCX));
-        list_push(ret, instr_noarg(OP_CQO));
-        list_push(ret, instr_r(OP_DIV, REG_RCX));
-        list_push(ret, instr_r2r(OP_MOV, REG_RDX, REG_RAX));
-        return ret;
+        instr_r2r(buf, OP_XCHG, REG_RAX, REG_RCX);
+        instr_noarg(buf, OP_CQO);
+        instr_r(buf, OP_DIV, REG_RCX);
+        instr_r2r(buf, OP_MOV, REG_RDX, REG_RAX);
+        return;
     }
 
-    if (bin->op == BIN_EQ) {
-        list_push(ret, instr_r2r(OP_CMP, REG_RAX, REG_RCX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETE, REG_AL));
-        return ret;
+    if (op == BIN_EQ) {
+        instr_r2r(buf, OP_CMP, REG_RAX, REG_RCX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETE, REG_AL);
+        return;
     }
 
-    if (bin->op == BIN_NE) {
-        list_push(ret, instr_r2r(OP_CMP, REG_RAX, REG_RCX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETNE, REG_AL));
-        return ret;
+    if (op == BIN_NE) {
+        instr_r2r(buf, OP_CMP, REG_RAX, REG_RCX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETNE, REG_AL);
+        return;
     }
 
-    if (bin->op == BIN_LT) {
-        list_push(ret, instr_r2r(OP_CMP, REG_RAX, REG_RCX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETL, REG_AL));
-        return ret;
+    if (op == BIN_LT) {
+        instr_r2r(buf, OP_CMP, REG_RAX, REG_RCX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETL, REG_AL);
+        return;
     }
 
-    if (bin->op == BIN_LTE) {
-        list_push(ret, instr_r2r(OP_CMP, REG_RAX, REG_RCX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETLE, REG_AL));
-        return ret;
+    if (op == BIN_LTE) {
+        instr_r2r(buf, OP_CMP, REG_RAX, REG_RCX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETLE, REG_AL);
+        return;
     }
 
-    if (bin->op == BIN_GT) {
-        list_push(ret, instr_r2r(OP_CMP, REG_RAX, REG_RCX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETG, REG_AL));
-        return ret;
+    if (op == BIN_GT) {
+        instr_r2r(buf, OP_CMP, REG_RAX, REG_RCX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETG, REG_AL);
+        return;
     }
 
-    if (bin->op == BIN_GTE) {
-        list_push(ret, instr_r2r(OP_CMP, REG_RAX, REG_RCX));
-        list_push(ret, instr_i2r(OP_MOV, 0, REG_RAX));
-        list_push(ret, instr_r(OP_SETGE, REG_AL));
-        return ret;
+    if (op == BIN_GTE) {
+        instr_r2r(buf, OP_CMP, REG_RAX, REG_RCX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETGE, REG_AL);
+        return;
     }
     UNREACHABLE("Unknown binary op\n");
-    return NULL;
 }
 
-static list_t *ternary_to_instrs(ternary_t *ternary, env_t *env) {
-    debug("ternary\n");
-    list_t *ret = list_new();
-    string_t *els_label = unique_label("else");
-    string_t *post_cond_label = unique_label("post_cond");
-
-    list_concat(ret, expr_to_instrs(ternary->cond, env));
+// Goes between the lhs and rhs of a binary op. AND and OR short circuit, so we don't want to
+// evaluate the RHS if we're not certain we need to. They allocate two labels here.
+static void gen_bin_lhs(output_buf_t *buf, enum bin_op op, int *labels) {
+    debug("Found bin op expr\n");
+    if (op == BIN_OR) {
+        // or_clause_2, end
+        labels[0] = unique_label();
+        labels[1] = unique_label();
+
+        instr_i2r(buf, OP_CMP, 0, REG_RAX);
+        instr_jump(buf, OP_JE, labels[0]);
+        instr_i2r(buf, OP_MOV, 1, REG_RAX);
+        instr_jump(buf, OP_JMP, labels[1]);
+        new_local_label(buf, labels[0]);
+    } else if (op == BIN_AND) {
+        // and_clause_2, end
+        labels[0] = unique_label();
+        labels[1] = unique_label();
+        instr_i2r(buf, OP_CMP, 0, REG_RAX);
+        instr_jump(buf, OP_JNE, labels[0]);
+        instr_jump(buf, OP_JMP, labels[1]);
+        new_local_label(buf, labels[0]);
+    } else {
+        instr_r(buf, OP_PUSH, REG_RAX);
+    }
+}
 
-    list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-    list_push(ret, instr_label(OP_JE, els_label));
+static void gen_bin(output_buf_t *buf, enum bin_op op, int *labels) {
+    if (op == BIN_OR || op == BIN_AND) {
+        new_local_label(buf, labels[1]);
+        instr_i2r(buf, OP_CMP, 0, REG_RAX);
+        instr_i2r(buf, OP_MOV, 0, REG_RAX);
+        instr_r(buf, OP_SETNE, REG_AL);
+        return;
+    }
 
-    list_concat(ret, expr_to_instrs(ternary->then, env));
-    list_push(ret, instr_label(OP_JMP, post_cond_label));
+    instr_r(buf, OP_POP, REG_RCX);
+    binop_apply(buf, op);
+}
 
-    list_push(ret, new_label(els_label, LABEL_STATIC));
-    list_concat(ret, expr_to_instrs(ternary->els, env));
-    list_push(ret, new_label(post_cond_label, LABEL_STATIC));
-    return ret;
+// Jumps to label if the condition that was just generated is (JE) or isn't (JNE) false
+static void gen_test(output_buf_t *buf, opcode_t jump, int label) {
+    instr_i2r(buf, OP_CMP, 0, REG_RAX);
+    instr_jump(buf, jump, label);
 }
 
-static bool is_valid_assign_lhs(expr_t *expr) {
-    return expr->type == PRIMARY && expr->primary->type == PRIMARY_VAR;
+// Goes between the then and else clauses of an if or ternary
+static void gen_else(output_buf_t *buf, int post_label, int else_label) {
+    instr_jump(buf, OP_JMP, post_label);
+    new_local_label(buf, else_label);
 }
 
-static list_t *assign_to_instrs(assign_t *assign, env_t *env) {
-    debug("Found assignment statement\n");
-    if (!is_valid_assign_lhs(assign->lhs)) {
-        UNREACHABLE("assign_to_instrs: invalid lhs to assignment statement\n");
+static void gen_assign(output_buf_t *buf, var_info_t *var_info) {
+    if (!var_info->declared) {
+        UNREACHABLE("assign_to_instrs: variable is used before declaration");
     }
+    instr_r2m(buf, OP_MOV, REG_RAX, var_home(var_info));
+}
 
-    list_t *ret = list_new();
-    list_concat(ret, expr_to_instrs(assign->rhs, env));
-    var_info_t *var_info = env_get_declared(env, assign->lhs->primary->var);
-    if (!var_info) {
-        UNREACHABLE("assign_to_instrs: variable is used before declaration");
+static void gen_declare(var_info_t *var_info) {
+    debug("Found a declare statement for var %s\n", string_get(var_info->name));
+    if (var_info->declared) {
+        UNREACHABLE("Compilation error: variable has multiple definitions in the same scope");
     }
-    output_t *mov = instr_r2m(OP_MOV, REG_RAX, var_info->home);
-    list_push(ret, mov);
-    return ret;
+
+    debug("Set declared for var\n");
+    var_info->declared = true;
 }
 
-// TODO how to not put everything into eax
-static list_t *expr_to_instrs(expr_t *expr, env_t *env) {
-    if (!expr) {
-        UNREACHABLE("expr_to_instrs: expr is invalid\n");
+// expr should be in rax, so move it to the variable home.
+static void gen_init(output_buf_t *buf, var_info_t *var_info) {
+    instr_r2m(buf, OP_MOV, REG_RAX, var_home(var_info));
+}
+
+// Every kind of node has a step function, which is called once before each of the node's children
+// and once more at the end. Each call emits whatever comes before the next child and returns that
+// child, or returns GEN_DONE once the node is finished.
+
+static node_id_t fn_call_step(output_buf_t *buf, gen_frame_t *frame) {
+    // extra holds the name index, then the number of args, then the args
+    uint32_t *call = &ast->extra[ast->a[frame->node]];
+    uint32_t num_args = call[1];
+    uint32_t *args = call + 2;
+
+    // Generate code for each parameter and put it into the correct register 
+    if (frame->state == 0) {
+        fn_caller_save(buf, num_args);
+    } else {
+        gen_call_arg(buf, frame->state - 1);
     }
 
-    debug("expr to instrs\n");
-    if (expr->type == PRIMARY) {
-        return primary_to_instrs(expr->primary, env);
+    if ((uint32_t)frame->state < num_args) {
+        debug("dealing with param %d\n", frame->state);
+        return args[frame->state];
     }
 
-    if (expr->type == UNARY_OP) {
-        return unary_to_instrs(expr->unary, env);
+    gen_call(buf, ast->names[call[0]]);
+    return GEN_DONE;
+}
+
+static node_id_t unary_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t inner = ast->a[frame->node];
+    if (frame->state == 0)
+        return inner;
+
+    enum unary_op op = ast->op[frame->node];
+    bool is_post = op == UNARY_POSTINC || op == UNARY_POSTDEC;
+    gen_unary(buf, op, is_post ? node_var(inner) : NULL);
+    return GEN_DONE;
+}
+
+static node_id_t binop_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t expr = frame->node;
+    switch (frame->state) {
+        case 0:
+            return ast->a[expr];
+        case 1:
+            gen_bin_lhs(buf, ast->op[expr], frame->labels);
+            return ast->b[expr];
+        default:
+            gen_bin(buf, ast->op[expr], frame->labels);
+            return GEN_DONE;
     }
+}
 
-    if (expr->type == BIN_OP) {
-        return binop_to_instrs(expr->bin, env);
+static node_id_t ternary_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t expr = frame->node;
+    uint32_t *clauses = &ast->extra[ast->b[expr]];
+
+    // els_label, post_cond_label
+    int *labels = frame->labels;
+    switch (frame->state) {
+        case 0:
+            debug("ternary\n");
+            labels[0] = unique_label();
+            labels[1] = unique_label();
+            return ast->a[expr];
+        case 1:
+            gen_test(buf, OP_JE, labels[0]);
+            return clauses[0];
+        case 2:
+            gen_else(buf, labels[1], labels[0]);
+            return clauses[1];
+        default:
+            new_local_label(buf, labels[1]);
+            return GEN_DONE;
     }
+}
+
+static bool is_valid_assign_lhs(node_id_t expr) {
+    return ast->kind[expr] == NODE_VAR;
+}
+
+static node_id_t assign_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t lhs = ast->a[frame->node];
+    if (frame->state == 0) {
+        debug("Found assignment statement\n");
+        if (!is_valid_assign_lhs(lhs)) {
+            UNREACHABLE("assign_to_instrs: invalid lhs to assignment statement\n");
+        }
+        return ast->b[frame->node];
+    }
+
+    gen_assign(buf, node_var(lhs));
+    return GEN_DONE;
+}
+
+static node_id_t block_step(gen_frame_t *frame) {
+    node_id_t block = frame->node;
+    if ((uint32_t)frame->state == ast->b[block])
+        return GEN_DONE;
+    return ast->extra[ast->a[block] + frame->state];
+}
 
-    if (expr->type == TERNARY) {
-        return ternary_to_instrs(expr->ternary, env);
+static node_id_t if_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t stmt = frame->node;
+    uint32_t *clauses = &ast->extra[ast->b[stmt]];
+    bool has_else = clauses[1] != NODE_NONE;
+
+    // post_cond_label, else_label
+    int *labels = frame->labels;
+    switch (frame->state) {
+        case 0:
+            debug("Found if statement\n");
+            return ast->a[stmt];
+        case 1:
+            labels[0] = unique_label();
+            if (has_else) {
+                labels[1] = unique_label();
+                gen_test(buf, OP_JE, labels[1]);
+            } else {
+                // No else statement, just emit the then instructions
+                gen_test(buf, OP_JE, labels[0]);
+            }
+            return clauses[0];
+        case 2:
+            if (has_else) {
+                gen_else(buf, labels[0], labels[1]);
+                return clauses[1];
+            }
+            // fallthrough
+        default:
+            new_local_label(buf, labels[0]);
+            return GEN_DONE;
     }
+}
 
-    if (expr->type == ASSIGN) {
-        return assign_to_instrs(expr->assign, env);
+static node_id_t declare_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t stmt = frame->node;
+    var_info_t *var_info = node_var(stmt);
+    if (frame->state == 0) {
+        gen_declare(var_info);
+        if (ast->b[stmt] != NODE_NONE)
+            return ast->b[stmt];
+        return GEN_DONE;
     }
 
-    if (expr->type == NULL_EXPR) {
-        return list_new();
+    gen_init(buf, var_info);
+    return GEN_DONE;
+}
+
+static node_id_t for_step(output_buf_t *buf, gen_frame_t *frame) {
+    // init, cond, post, body
+    uint32_t *clauses = &ast->extra[ast->a[frame->node]];
+
+    // begin_for_label, post_for_label, post_body_label
+    int *labels = frame->labels;
+    switch (frame->state) {
+        case 0:
+            labels[0] = unique_label();
+            labels[1] = unique_label();
+            labels[2] = unique_label();
+            frame->context.iter_continue_label = labels[2];
+            frame->context.iter_break_label = labels[1];
+            return clauses[0];
+        case 1:
+            new_local_label(buf, labels[0]);
+            return clauses[1];
+        case 2:
+            gen_test(buf, OP_JE, labels[1]);
+            return clauses[3];
+        case 3:
+            new_local_label(buf, labels[2]);
+            return clauses[2];
+        default:
+            instr_jump(buf, OP_JMP, labels[0]);
+            new_local_label(buf, labels[1]);
+            return GEN_DONE;
     }
+}
 
-    UNREACHABLE("unhandled expression\n");
-    return NULL;
+static node_id_t while_step(output_buf_t *buf, gen_frame_t *frame) {
+    // begin_while_label, post_while_label
+    int *labels = frame->labels;
+    switch (frame->state) {
+        case 0:
+            labels[0] = unique_label();
+            labels[1] = unique_label();
+            frame->context.iter_continue_label = labels[0];
+            frame->context.iter_break_label = labels[1];
+            new_local_label(buf, labels[0]);
+            return ast->a[frame->node];
+        case 1:
+            gen_test(buf, OP_JE, labels[1]);
+            return ast->b[frame->node];
+        default:
+            instr_jump(buf, OP_JMP, labels[0]);
+            new_local_label(buf, labels[1]);
+            return GEN_DONE;
+    }
 }
 
-static list_t *block_to_instrs(block_t *block, context_t context) {
-    list_t *ret = list_new();
-    stmt_t *curr_stmt = list_pop(block->stmts);
-    context.env = block->env;
-    for (; curr_stmt; curr_stmt = list_pop(block->stmts)) {
-        list_concat(ret, stmt_to_instrs(curr_stmt, context));
+static node_id_t do_step(output_buf_t *buf, gen_frame_t *frame) {
+    // begin_do_label, end_do_label
+    int *labels = frame->labels;
+    switch (frame->state) {
+        case 0:
+            labels[0] = unique_label();
+            labels[1] = unique_label();
+            frame->context.iter_continue_label = labels[0];
+            frame->context.iter_break_label = labels[1];
+            new_local_label(buf, labels[0]);
+            return ast->a[frame->node];
+        case 1:
+            return ast->b[frame->node];
+        default:
+            gen_test(buf, OP_JNE, labels[0]);
+            new_local_label(buf, labels[1]);
+            return GEN_DONE;
     }
-    return ret;
 }
 
-static list_t *block_or_single_to_instrs(block_or_single_t *block_or_single, context_t context) {
-    list_t *ret = list_new();
-    if (block_or_single->type == SINGLE) {
-        list_concat(ret, stmt_to_instrs(block_or_single->single, context));
-    } else {
-        list_concat(ret, block_to_instrs(block_or_single->block, context));
+// TODO how to not put everything into eax
+static node_id_t node_step(output_buf_t *buf, gen_frame_t *frame) {
+    node_id_t node = frame->node;
+    switch (ast->kind[node]) {
+        case NODE_NULL_EXPR:
+        case NODE_EMPTY:
+            return GEN_DONE;
+        case NODE_INT:
+            debug("int %d\n", (int)ast->a[node]);
+            instr_i2r(buf, OP_MOV, (int32_t)ast->a[node], REG_RAX);
+            return GEN_DONE;
+        case NODE_VAR:
+            gen_load(buf, node_var(node));
+            return GEN_DONE;
+        case NODE_FN_CALL:
+            return fn_call_step(buf, frame);
+        case NODE_UNARY:
+            return unary_step(buf, frame);
+        case NODE_BIN:
+            return binop_step(buf, frame);
+        case NODE_TERNARY:
+            return ternary_step(buf, frame);
+        case NODE_ASSIGN:
+            return assign_step(buf, frame);
+        case NODE_RETURN:
+            if (frame->state == 0) {
+                debug("Found return statement\n");
+                return ast->a[node];
+            }
+            instr_jump(buf, OP_JMP, frame->context.return_label);
+            return GEN_DONE;
+        case NODE_BREAK:
+            instr_jump(buf, OP_JMP, frame->context.iter_break_label);
+            return GEN_DONE;
+        case NODE_CONTINUE:
+            instr_jump(buf, OP_JMP, frame->context.iter_continue_label);
+            return GEN_DONE;
+        case NODE_IF:
+            return if_step(buf, frame);
+        case NODE_BLOCK:
+            return block_step(frame);
+        case NODE_DECLARE:
+            return declare_step(buf, frame);
+        case NODE_EXPR_STMT:
+            if (frame->state == 0) {
+                debug("Found an expr statement\n");
+                return ast->a[node];
+            }
+            return GEN_DONE;
+        case NODE_FOR:
+            return for_step(buf, frame);
+        case NODE_WHILE:
+            return while_step(buf, frame);
+        case NODE_DO:
+            return do_step(buf, frame);
+        default:
+            UNREACHABLE("Unrecognized node type\n");
     }
-    return ret;
 }
 
-static list_t *stmt_to_instrs(stmt_t *stmt, context_t context) {
-    if (!stmt) {
-        UNREACHABLE("stmt_to_instrs: stmt is invalid\n");
+static void push_gen_frame(node_id_t node, context_t context) {
+    if (num_gen_frames == gen_frames_capacity) {
+        gen_frames_capacity = gen_frames_capacity ? gen_frames_capacity * 2 : 64;
+        gen_frames = realloc(gen_frames, sizeof(gen_frame_t) * gen_frames_capacity);
+        if (!gen_frames) {
+            UNREACHABLE("push_gen_frame: out of memory\n");
+        }
     }
-    
-    if (stmt->type == STMT_NULL) {
-        return list_new();
-    }
-
-    if (stmt->type == STMT_RETURN) {
-        list_t *ret = list_new();
-        debug("Found return statement\n");
-        list_t *expr_instrs = expr_to_instrs(stmt->ret->expr, context.env);
-        list_concat(ret, expr_instrs);
-        list_push(ret, instr_label(OP_JMP, context.return_label));
-        return ret;
-    }
-
-    if (stmt->type == STMT_BREAK) {
-        list_t *ret = list_new();
-        list_push(ret, instr_label(OP_JMP, context.iter_break_label));
-        return ret;
-    }
-
-    if (stmt->type == STMT_CONTINUE) {
-        list_t *ret = list_new();
-        list_push(ret, instr_label(OP_JMP, context.iter_continue_label));
-        return ret;
-    }
-
-    if (stmt->type == STMT_IF) {
-        debug("Found if statement\n");
-        list_t *ret = list_new();
-        
-        list_concat(ret, expr_to_instrs(stmt->if_stmt->cond, context.env));
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-
-        string_t *post_cond_label = unique_label("post_cond");
-        output_t *post_cond_label_output = new_label(post_cond_label, LABEL_STATIC);
-        list_t *then_instrs = block_or_single_to_instrs(stmt->if_stmt->then, context);
-
-        if (stmt->if_stmt->els) {
-            string_t *else_label = unique_label("else");
-            list_push(ret, instr_label(OP_JE, else_label));
-            list_concat(ret, then_instrs);
-            list_push(ret, instr_label(OP_JMP, post_cond_label));
-            list_push(ret, new_label(else_label, LABEL_STATIC));
-            list_concat(ret, block_or_single_to_instrs(stmt->if_stmt->els, context));
-            list_push(ret, post_cond_label_output);
-        } else {
-            // No else statement, just emit the then instructions
-            list_push(ret, instr_label(OP_JE, post_cond_label));
-            list_concat(ret, then_instrs);
-            list_push(ret, post_cond_label_output);
+    gen_frame_t *frame = &gen_frames[num_gen_frames++];
+    frame->node = node;
+    frame->state = 0;
+    frame->context = context;
+}
+
+// Generates the code for a whole tree. Children are pushed on an explicit stack instead of being
+// generated recursively, so how deeply the code can nest is only limited by memory.
+static void node_to_instrs(output_buf_t *buf, node_id_t root, context_t context) {
+    int base = num_gen_frames;
+    push_gen_frame(root, context);
+    while (num_gen_frames > base) {
+        gen_frame_t *frame = &gen_frames[num_gen_frames - 1];
+        node_id_t child = node_step(buf, frame);
+        if (child == GEN_DONE) {
+            num_gen_frames--;
+            continue;
         }
-        return ret;
+
+        // The push can move the stack, so don't touch frame after it
+        frame->state++;
+        push_gen_frame(child, frame->context);
     }
+}
 
-    if (stmt->type == STMT_BLOCK) {
-        debug("Found block statement\n");
-        return block_to_instrs(stmt->block, context);
+// transforms an fn_def_t ast node to a buffer of x86 instructions
+static output_buf_t *fn_def_to_asm(fn_def_t *fn_def) {
+    if (!fn_def || !fn_def->name || fn_def->body == NODE_NONE) {
+        UNREACHABLE("fn_def_to_asm: malformed fn_def\n");
     }
 
-    if (stmt->type == STMT_DECLARE) {
-        debug("Found a declare statement for var %s\n", string_get(stmt->declare->name));
+    debug("Compiling function %s\n", string_get(fn_def->name));
 
-        // only check if the variable is declared in this scope.
-        var_info_t *var_info = map_get(context.env->homes, stmt->declare->name);
-        if (var_info->declared) {
-            UNREACHABLE("Compilation error: variable has multiple definitions in the same scope");
-        }
+    // TODO totally skipping params now
+    // TODO type checking on return type, but also skipping that for now 
+    output_buf_t *buf = output_buf_new();
+    new_label(buf, fn_def->name, LABEL_GLOBAL);
+    fn_callee_prologue(buf, fn_def);
+    
+    // function epilogue label
+    int fn_epilogue = unique_label();
+
+    context_t context;
+    context.return_label = fn_epilogue;
+    context.iter_continue_label = -1;
+    context.iter_break_label = -1;
 
-        debug("Set declared for var\n");
-        var_info->declared = true;
-        if (stmt->declare->init_expr) {
-            list_t *ret = list_new();
-            list_concat(ret, expr_to_instrs(stmt->declare->init_expr, context.env));
+    fn_vars = fn_def->vars;
+    node_to_instrs(buf, fn_def->body, context);
 
-            // expr should be in rax, so move it to the variable home.
-            output_t *mov = instr_r2m(OP_MOV, REG_RAX, var_info->home);
-            list_push(ret, mov);
-            return ret;
-        }
-        return list_new();
+    // function epilogue
+    new_local_label(buf, fn_epilogue);
+    fn_callee_epilogue(buf);
+    instr_noarg(buf, OP_RET);
+
+    debug("fn_def_to_asm done\n");
+    return buf;
+}
+
+// Gives labels their final ids by adding base, for code that was finished with a base of 0
+static void shift_labels(output_buf_t *buf, int base) {
+    for (int i = 0; i < buf->len; i++) {
+        output_t *out = &buf->outputs[i];
+        if (out->type == OUTPUT_LABEL && out->label.linkage == LABEL_LOCAL)
+            out->label.id += base;
+        else if (out->type == OUTPUT_INSTR && out->instr.src.type == OPERAND_LOCAL_LABEL)
+            out->instr.src.local_label += base;
     }
+}
+
+// Returns fn_def's code with its labels starting at 0, and how many it used. It comes from cache if
+// it's there, and is generated and put there if not.
+static output_buf_t *fn_def_to_asm_cached(fn_def_t *fn_def, fn_cache_t *cache, int *labels) {
+    output_buf_t *buf = fn_cache_load(cache, fn_def, instr_arena, labels);
+    if (buf)
+        return buf;
+    num_labels = 0;
+    buf = fn_def_to_asm(fn_def);
+    *labels = num_labels;
+    fn_cache_store(cache, fn_def, buf, *labels);
+    return buf;
+}
+
+// Functions for gen_asm's threads to generate, which they take one at a time
+typedef struct {
+    fn_def_t **fns;
+    int num_fns;
+    atomic_int next;
+
+    // each function's code
+    output_buf_t **bufs;
+
+    // how many local labels each function used, and then the first one's final id
+    int *labels;
 
-    if (stmt->type == STMT_EXPR) {
-        list_t *ret = list_new();
-        debug("Found an expr statement\n");
-        list_t *expr_instrs = expr_to_instrs(stmt->expr, context.env);
-        if (!expr_instrs) {
-            UNREACHABLE("expr_instrs is invalid")
+    // NULL if there's no cache
+    fn_cache_t *cache;
+    ast_t *ast;
+
+    // Set once any function has an error, which stops the rest
+    atomic_bool failed;
+} gen_work_t;
+
+// An error can leave frames behind, so the count is reset too
+static void gen_frames_free(void) {
+    free(gen_frames);
+    gen_frames = NULL;
+    num_gen_frames = 0;
+    gen_frames_capacity = 0;
+}
+
+// Generates functions with its own arena and returns it. Each function's labels start at 0.
+static void *gen_worker(void *arg) {
+    gen_work_t *work = arg;
+    instr_arena = arena_new();
+    ast = work->ast;
+    jmp_buf on_error;
+    error_jump_use(&on_error);
+    if (setjmp(on_error)) {
+        atomic_store(&work->failed, true);
+        error_jump_use(NULL);
+        gen_frames_free();
+        return instr_arena;
+    }
+
+    for (int i; !atomic_load(&work->failed) && (i = atomic_fetch_add(&work->next, 1)) < work->num_fns;) {
+        if (work->cache) {
+            work->bufs[i] = fn_def_to_asm_cached(work->fns[i], work->cache, &work->labels[i]);
+            continue;
         }
-        list_concat(ret, expr_instrs);
-        return ret;
+        num_labels = 0;
+        work->bufs[i] = fn_def_to_asm(work->fns[i]);
+        work->labels[i] = num_labels;
     }
+    error_jump_use(NULL);
+    gen_frames_free();
+    return instr_arena;
+}
+
+static void *shift_worker(void *arg) {
+    gen_work_t *work = arg;
+    for (int i; (i = atomic_fetch_add(&work->next, 1)) < work->num_fns;)
+        shift_labels(work->bufs[i], work->labels[i]);
+    return NULL;
+}
 
-    if (stmt->type == STMT_FOR) {
-        string_t *begin_for_label = unique_label("begin_for");
-        string_t *post_for_label = unique_label("end_for");
-        string_t *post_body_label = unique_label("post_for_body");
+// Generates every function at once, then numbers their labels the way generating them one after
+// another would have, so the output is the same
+static bool gen_parallel(gen_work_t *work, int num_threads, arena_t *arena, int *base) {
+    if (num_threads > work->num_fns)
+        num_threads = work->num_fns;
+    atomic_store(&work->next, 0);
+    run_threads(num_threads, gen_worker, work, arena);
+    if (atomic_load(&work->failed))
+        return false;
+
+    for (int i = 0; i < work->num_fns; i++) {
+        int len = work->labels[i];
+        work->labels[i] = *base;
+        *base += len;
+    }
+    atomic_store(&work->next, 0);
+    run_threads(num_threads, shift_worker, work, arena);
+    return true;
+}
 
-        context.env = stmt->for_stmt->env;
-        context.iter_continue_label = post_body_label;
-        context.iter_break_label = post_for_label;
+static bool gen_serial(gen_work_t *work, arena_t *arena, int *base) {
+    instr_arena = arena;
+    ast = work->ast;
+    num_labels = *base;
+    jmp_buf on_error;
+    jmp_buf *prev_jump = error_jump_use(&on_error);
+    if (setjmp(on_error)) {
+        error_jump_use(prev_jump);
+        gen_frames_free();
+        return false;
+    }
+
+    for (int i = 0; i < work->num_fns; i++) {
+        if (work->cache) {
+            int fn_base = num_labels;
+            int labels;
+            work->bufs[i] = fn_def_to_asm_cached(work->fns[i], work->cache, &labels);
+            shift_labels(work->bufs[i], fn_base);
+            num_labels = fn_base + labels;
+        } else {
+            work->bufs[i] = fn_def_to_asm(work->fns[i]);
+        }
+        if (!work->bufs[i]) {
+            UNREACHABLE("gen_asm: null fn_instrs\n");
+        }
+    }
+    *base = num_labels;
+    error_jump_use(prev_jump);
+    gen_frames_free();
+    return true;
+}
 
-        list_t *ret = list_new();
-        list_concat(ret, stmt_to_instrs(stmt->for_stmt->init, context));
+// Fills work->bufs with the code for each of work->fns, in arena. Labels are numbered on from *base,
+// which is advanced past them. Returns false if there was an error, which has been reported.
+static bool gen_fns(gen_work_t *work, int num_threads, arena_t *arena, int *base) {
+    if (num_threads > 1)
+        return gen_parallel(work, num_threads, arena, base);
+    return gen_serial(work, arena, base);
+}
 
-        list_push(ret, new_label(begin_for_label, LABEL_STATIC));
-        list_concat(ret, expr_to_instrs(stmt->for_stmt->cond, context.env));
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_label(OP_JE, post_for_label));
+// Sets work up with every function in prog that has a body, in the order they were defined
+static void gen_work_init(gen_work_t *work, program_t *prog, fn_cache_t *cache) {
+    if (!prog || !prog->fn_defs) {
+        UNREACHABLE("gen_asm: malformed program\n");
+    }
+    work->cache = cache;
+    work->ast = prog->ast;
+    atomic_init(&work->failed, false);
+    work->fns = malloc(sizeof(fn_def_t *) * (prog->fn_defs->len ? prog->fn_defs->len : 1));
+    work->num_fns = 0;
+    pair_t *fn_pair;
+    map_for_each(prog->fn_defs, fn_pair) {
+        fn_def_t *fn_def = fn_pair->value;
+        if (fn_def->body != NODE_NONE)
+            work->fns[work->num_fns++] = fn_def;
+    }
+    work->bufs = malloc(sizeof(output_buf_t *) * (work->num_fns ? work->num_fns : 1));
+    work->labels = malloc(sizeof(int) * (work->num_fns ? work->num_fns : 1));
+}
 
-        list_concat(ret, block_or_single_to_instrs(stmt->for_stmt->body, context));
-        list_push(ret, new_label(post_body_label, LABEL_STATIC));
+static void gen_work_free(gen_work_t *work) {
+    free(work->fns);
+    free(work->bufs);
+    free(work->labels);
+}
 
-        list_concat(ret, expr_to_instrs(stmt->for_stmt->post, context.env));
-        list_push(ret, instr_label(OP_JMP, begin_for_label));
-        list_push(ret, new_label(post_for_label, LABEL_STATIC));
-        return ret;
+// Returns a list of output_buf_t, one for each function in the order they were defined
+list_t *gen_asm(program_t *prog, arena_t *arena, int num_threads, fn_cache_t *cache) {
+    gen_work_t work;
+    gen_work_init(&work, prog, cache);
+    debug("=====================Generating ASM=====================\n");
+    int base = 0;
+    if (!gen_fns(&work, num_threads, arena, &base)) {
+        gen_work_free(&work);
+        return NULL;
     }
 
-    if (stmt->type == STMT_WHILE) {
-        list_t *ret = list_new();
-        string_t *begin_while_label = unique_label("begin_while");
-        string_t *post_while_label = unique_label("post_while");
-        context.iter_continue_label = begin_while_label;
-        context.iter_break_label = post_while_label;
+    list_t *output = list_new_in(arena);
+    for (int i = 0; i < work.num_fns; i++)
+        list_push(output, work.bufs[i]);
+    debug("length: %d\n", output->len);
+    gen_work_free(&work);
+    return output;
+}
 
-        list_push(ret, new_label(begin_while_label, LABEL_STATIC));
+bool gen_asm_each(program_t *prog, int num_threads, fn_cache_t *cache,
+                  void (*emit)(output_buf_t *buf, void *arg), void *arg) {
+    gen_work_t work;
+    gen_work_init(&work, prog, cache);
+    debug("=====================Generating ASM=====================\n");
+    fn_def_t **fns = work.fns;
+    int num_fns = work.num_fns;
+    int base = 0;
+    bool ok = true;
+    for (int first = 0; ok && first < num_fns; first += GEN_BATCH_SIZE) {
+        arena_t *batch_arena = arena_new();
+        work.fns = fns + first;
+        work.num_fns = num_fns - first < GEN_BATCH_SIZE ? num_fns - first : GEN_BATCH_SIZE;
+        ok = gen_fns(&work, num_threads, batch_arena, &base);
+        for (int i = 0; ok && i < work.num_fns; i++)
+            emit(work.bufs[i], arg);
+        arena_free(batch_arena);
+    }
+    work.fns = fns;
+    gen_work_free(&work);
+    return ok;
+}
+
+output_buf_t *gen_fn_asm(ast_t *fn_ast, fn_def_t *fn_def, arena_t *arena, int *labels) {
+    instr_arena = arena;
+    ast = fn_ast;
+    num_labels = *labels;
+    jmp_buf on_error;
+    jmp_buf *prev_jump = error_jump_use(&on_error);
+    if (setjmp(on_error)) {
+        error_jump_use(prev_jump);
+        gen_frames_free();
+        return NULL;
+    }
+
+    output_buf_t *buf = fn_def_to_asm(fn_def);
+    *labels = num_labels;
+    error_jump_use(prev_jump);
+    gen_frames_free();
+    return buf;
+}
 
-        list_concat(ret, expr_to_instrs(stmt->while_stmt->cond, context.env));
 
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_label(OP_JE, post_while_label));
+/*
+ * One-pass mode. Instead of building a tree for gen_asm to walk, the parser calls the fast_*
+ * functions below as it recognizes each construct, and the code for it is emitted right away. They
+ * use the same gen_* pieces that the step functions do, in the same order, so the code is the same.
+ *
+ * A few things aren't known until a function has been parsed, so they're backpatched once it's done:
+ *  - The frame isn't laid out until every variable has been seen. Until then homes are var indices
+ *    (see var_home), and the prologue reserves no stack.
+ *  - gen_asm allocates a ternary's labels before generating its cond, but the parser only finds out
+ *    it was a cond at the ?. So labels are provisional, and a ternary's are inserted in the list
+ *    where its cond started.
+ *  - A for loop's post clause is parsed before its body, but goes after it. Its code and labels are
+ *    set aside until the body is done.
+ *  - An if doesn't know if it has an else until its then clause is done, so the jump around the then
+ *    clause is patched once it does.
+ *
+ * Each function is printed as soon as it's finished, unless a function declared before it still
+ * hasn't been defined. gen_asm goes in order of first declaration, so it waits for that one.
+ */
+
+// Where finished functions go
+static _Thread_local int fast_fd = -1;
+static _Thread_local bool fast_object = false;
+static _Thread_local list_t *fast_fns = NULL;
+
+static _Thread_local fn_def_t *fast_fn = NULL;
+static _Thread_local output_buf_t *fast_buf = NULL;
+static _Thread_local int fast_return_label = -1;
+
+// The first label of the function being generated
+static _Thread_local int fast_label_base = 0;
+
+// Index in fn_defs of the next function to print
+static _Thread_local int fast_next_fn = 0;
+
+// Functions that are finished but are waiting for one declared before them, indexed like fn_defs
+typedef struct {
+    output_buf_t *code;
+    int num_labels;
+} held_fn_t;
+
+static _Thread_local held_fn_t *held_fns = NULL;
+static _Thread_local int held_fns_capacity = 0;
+
+// For loop post clauses waiting for their loop's body to finish, innermost last
+typedef struct {
+    // where the clause started in fast_buf, and where its code is in held_code once it's done
+    int buf_start;
+    int held_start;
+
+    // The last label before the clause. Once it's done, its labels are the list from label_head to
+    // label_tail, or label_head is 0 if it didn't have any.
+    int label_mark;
+    int label_head;
+    int label_tail;
+} held_post_t;
+
+static _Thread_local held_post_t *held_posts = NULL;
+static _Thread_local int num_held_posts = 0;
+static _Thread_local int held_posts_capacity = 0;
+
+static _Thread_local output_t *held_code = NULL;
+static _Thread_local int held_code_len = 0;
+static _Thread_local int held_code_capacity = 0;
+
+void fast_begin(arena_t *arena, int fd, bool object) {
+    instr_arena = arena;
+    fast = true;
+    fast_fd = fd;
+    fast_object = object;
+    fast_fns = list_new_in(arena);
+    fast_buf = output_buf_new();
+    fast_label_base = 0;
+    fast_next_fn = 0;
+}
 
-        list_concat(ret, block_or_single_to_instrs(stmt->while_stmt->body, context));
-        list_push(ret, instr_label(OP_JMP, begin_while_label));
-        list_push(ret, new_label(post_while_label, LABEL_STATIC));
+static output_buf_t *output_buf_copy(output_buf_t *buf) {
+    output_buf_t *copy = output_buf_new();
+    copy->outputs = arena_alloc(instr_arena, sizeof(output_t) * buf->len);
+    memcpy(copy->outputs, buf->outputs, sizeof(output_t) * buf->len);
+    copy->len = copy->capacity = buf->len;
+    return copy;
+}
 
-        return ret;
+static void fast_emit(output_buf_t *buf) {
+    if (fast_object) {
+        list_push(fast_fns, buf);
+    } else {
+        print_fn_asm(buf, fast_fd);
     }
+}
 
-    if (stmt->type == STMT_DO) {
-        list_t *ret = list_new();
-        string_t *begin_do_label = unique_label("begin_do");
-        string_t *end_do_label = unique_label("end_do");
+// Prints every function that's no longer waiting on an earlier one. At the end of the program,
+// functions that were declared but never defined are skipped like gen_asm does.
+static void fast_emit_ready(map_t *fn_defs, bool at_end) {
+    for (; fast_next_fn < fn_defs->len; fast_next_fn++) {
+        held_fn_t *held = fast_next_fn < held_fns_capacity ? &held_fns[fast_next_fn] : NULL;
+        if (!held || !held->code) {
+            fn_def_t *fn_def = fn_defs->pairs[fast_next_fn].value;
+            if (at_end && fn_def->body == NODE_NONE)
+                continue;
+            return;
+        }
 
-        context.iter_continue_label = begin_do_label;
-        context.iter_break_label = end_do_label;
-        list_push(ret, new_label(begin_do_label, LABEL_STATIC));
-        list_concat(ret, block_or_single_to_instrs(stmt->do_stmt->body, context));
-        list_concat(ret, expr_to_instrs(stmt->do_stmt->cond, context.env));
-        list_push(ret, instr_i2r(OP_CMP, 0, REG_RAX));
-        list_push(ret, instr_label(OP_JNE, begin_do_label));
-        list_push(ret, new_label(end_do_label, LABEL_STATIC));
-        return ret;
+        shift_labels(held->code, fast_label_base);
+        fast_label_base += held->num_labels;
+        fast_emit(held->code);
+        held->code = NULL;
     }
+}
 
-    UNREACHABLE("Unrecognized statement type\n");
-    return NULL;
-} 
+// Replaces var indices with homes and provisional labels with final ones, and returns how many
+// labels the function has
+static int fast_backpatch(output_buf_t *buf, int base) {
+    // Where each provisional label ended up
+    int *final = malloc(sizeof(int) * num_fast_labels);
+    int num_final = 0;
+    for (int label = label_next[0]; label; label = label_next[label])
+        final[label] = base + num_final++;
+
+    var_info_t **vars = fast_fn->vars->vars;
+    for (int i = 0; i < buf->len; i++) {
+        output_t *out = &buf->outputs[i];
+        if (out->type == OUTPUT_LABEL) {
+            if (out->label.linkage == LABEL_LOCAL)
+                out->label.id = final[out->label.id];
+            continue;
+        }
 
-// transforms an fn_def_t ast node to a list of x86 instructions
-static list_t *fn_def_to_asm(fn_def_t *fn_def) {
-    if (!fn_def || !fn_def->name || !fn_def->stmts) {
-        UNREACHABLE("fn_def_to_asm: malformed fn_def\n");
+        operand_t *operands[] = {&out->instr.src, &out->instr.dst};
+        for (int j = 0; j < out->instr.num_args; j++) {
+            if (operands[j]->type == OPERAND_LOCAL_LABEL)
+                operands[j]->local_label = final[operands[j]->local_label];
+            else if (operands[j]->type == OPERAND_MEM_LOC)
+                operands[j]->mem = vars[operands[j]->mem.offset]->home;
+        }
     }
+    free(final);
+    return num_final;
+}
 
+void fast_fn_begin(fn_def_t *fn_def) {
     debug("Compiling function %s\n", string_get(fn_def->name));
+    fast_fn = fn_def;
+    fn_vars = fn_def->vars;
+    if (fast_object)
+        fast_buf = output_buf_new();
+    fast_buf->len = 0;
+
+    label_next = grow(label_next, 0, &label_next_capacity, sizeof(int));
+    label_next[0] = 0;
+    num_fast_labels = 1;
+    label_tail = 0;
+
+    new_label(fast_buf, fn_def->name, LABEL_GLOBAL);
+    fn_def->sp_offset = 0;
+    fn_callee_prologue(fast_buf, fn_def);
+    fast_return_label = unique_label();
+}
 
-    // TODO totally skipping params now
-    // TODO type checking on return type, but also skipping that for now 
-    list_t *ret = list_new();
-    output_t *fn_label = new_label(fn_def->name, LABEL_GLOBAL);
-    list_push(ret, fn_label);
-    list_concat(ret, fn_callee_prologue(fn_def));
-    
-    // function epilogue label
-    string_t *fn_epilogue = unique_label("fn_epilogue");
-    output_t *epilogue_label = new_label(fn_epilogue, LABEL_STATIC);
+void fast_fn_end(program_t *prog) {
+    output_buf_t *buf = fast_buf;
+    new_local_label(buf, fast_return_label);
+    fn_callee_epilogue(buf);
+    instr_noarg(buf, OP_RET);
+
+    // The prologue's stack adjustment comes right after the function's label and its first two
+    // instructions
+    alloc_fn_homes(fast_fn);
+    buf->outputs[3].instr.src.imm = fast_fn->sp_offset;
+
+    // It can go out right away unless it's waiting on an earlier function
+    map_t *fn_defs = prog->fn_defs;
+    int i = fast_fn->index;
+    if (i == fast_next_fn) {
+        fast_label_base += fast_backpatch(buf, fast_label_base);
+        fast_emit(buf);
+        fast_next_fn++;
+        fast_emit_ready(fn_defs, false);
+        return;
+    }
+
+    while (held_fns_capacity <= i) {
+        int old_capacity = held_fns_capacity;
+        held_fns = grow(held_fns, old_capacity, &held_fns_capacity, sizeof(held_fn_t));
+        memset(held_fns + old_capacity, 0, sizeof(held_fn_t) * (held_fns_capacity - old_capacity));
+    }
+    held_fns[i].num_labels = fast_backpatch(buf, 0);
+    held_fns[i].code = fast_object ? buf : output_buf_copy(buf);
+}
 
-    context_t context;
-    context.return_label = fn_epilogue;
-    context.iter_continue_label = NULL;
-    context.iter_break_label = NULL;
-    context.env = fn_def->env;
+list_t *fast_end(program_t *prog) {
+    if (!prog) {
+        print_asm_discard();
+        fast_object = false;
+    } else {
+        fast_emit_ready(prog->fn_defs, true);
+    }
+
+    free(label_next);
+    free(held_fns);
+    free(held_posts);
+    free(held_code);
+    label_next = NULL;
+    held_fns = NULL;
+    held_posts = NULL;
+    held_code = NULL;
+    label_next_capacity = held_fns_capacity = held_posts_capacity = held_code_capacity = 0;
+    num_held_posts = held_code_len = 0;
+    fast = false;
+    return fast_object ? fast_fns : NULL;
+}
 
-    stmt_t *curr_stmt = list_pop(fn_def->stmts);
-    for (; curr_stmt; curr_stmt = list_pop(fn_def->stmts)) {
-        list_t *instrs = stmt_to_instrs(curr_stmt, context);
-        list_concat(ret, instrs);
-    }
+bool fast_enabled(void) {
+    return fast;
+}
 
-    // function epilogue
-    list_push(ret, epilogue_label);
-    list_concat(ret, fn_callee_epilogue());
-    list_push(ret, instr_noarg(OP_RET));
+int fast_label_mark(void) {
+    return label_tail;
+}
 
-    debug("fn_def_to_asm done\n");
-    return ret;
+// Expressions
+
+void fast_int(int val) {
+    debug("int %d\n", val);
+    instr_i2r(fast_buf, OP_MOV, val, REG_RAX);
 }
 
-list_t *gen_asm(program_t *prog) {
-    if (!prog || !prog->fn_defs) {
-        UNREACHABLE("gen_asm: malformed program\n");
+void fast_var(var_info_t *var_info) {
+    gen_load(fast_buf, var_info);
+}
+
+// The var that was just loaded turned out to be the lhs of an =, which isn't loaded
+void fast_assign_lhs(void) {
+    fast_buf->len--;
+}
+
+void fast_assign(var_info_t *var_info) {
+    gen_assign(fast_buf, var_info);
+}
+
+void fast_call_begin(fn_def_t *fn_def) {
+    fn_caller_save(fast_buf, fn_def->params ? fn_def->params->len : 0);
+}
+
+void fast_call_arg(int i) {
+    gen_call_arg(fast_buf, i);
+}
+
+void fast_call_end(fn_def_t *fn_def) {
+    gen_call(fast_buf, fn_def->name);
+}
+
+void fast_unary(enum unary_op op, var_info_t *var_info) {
+    gen_unary(fast_buf, op, var_info);
+}
+
+// ++x and --x are x = x + 1 and x = x - 1, and x has been loaded already
+void fast_prefix_inc(enum bin_op op, var_info_t *var_info) {
+    int labels[2];
+    gen_bin_lhs(fast_buf, op, labels);
+    fast_int(1);
+    gen_bin(fast_buf, op, labels);
+    gen_assign(fast_buf, var_info);
+}
+
+void fast_bin_lhs(enum bin_op op, int *labels) {
+    gen_bin_lhs(fast_buf, op, labels);
+}
+
+void fast_bin(enum bin_op op, int *labels) {
+    gen_bin(fast_buf, op, labels);
+}
+
+// cond_mark is fast_label_mark from when the cond started
+void fast_ternary_cond(int cond_mark, int *labels) {
+    debug("ternary\n");
+    labels[0] = fast_label_after(cond_mark);
+    labels[1] = fast_label_after(labels[0]);
+    gen_test(fast_buf, OP_JE, labels[0]);
+}
+
+void fast_ternary_then(int *labels) {
+    gen_else(fast_buf, labels[1], labels[0]);
+}
+
+void fast_ternary_end(int *labels) {
+    new_local_label(fast_buf, labels[1]);
+}
+
+// Statements
+
+void fast_return(void) {
+    debug("Found return statement\n");
+    instr_jump(fast_buf, OP_JMP, fast_return_label);
+}
+
+void fast_jump(int label) {
+    instr_jump(fast_buf, OP_JMP, label);
+}
+
+void fast_declare(var_info_t *var_info) {
+    gen_declare(var_info);
+}
+
+void fast_init(var_info_t *var_info) {
+    gen_init(fast_buf, var_info);
+}
+
+// labels[2] is where the jump around the then clause is, in case there's no else to jump to
+void fast_if_cond(int *labels) {
+    debug("Found if statement\n");
+    labels[0] = unique_label();
+    labels[1] = unique_label();
+    gen_test(fast_buf, OP_JE, labels[1]);
+    labels[2] = fast_buf->len - 1;
+}
+
+void fast_if_else(int *labels) {
+    gen_else(fast_buf, labels[0], labels[1]);
+}
+
+void fast_if_end(int *labels, bool has_else) {
+    if (!has_else) {
+        // Nothing was allocated after the else label, so it comes right after the post label
+        fast_buf->outputs[labels[2]].instr.src.local_label = labels[0];
+        label_next[labels[0]] = label_next[labels[1]];
+        if (label_tail == labels[1])
+            label_tail = labels[0];
     }
-    debug("=====================Generating ASM=====================\n");
-    list_t *output = list_new();
+    new_local_label(fast_buf, labels[0]);
+}
 
-    pair_t *fn_pair;
-    map_for_each(prog->fn_defs, fn_pair) {
-        fn_def_t *fn_def = fn_pair->value;
-        if (!fn_def->stmts)
-            continue;
-        list_t *fn_instrs = fn_def_to_asm(fn_def);
-        if (!fn_instrs) {
-            UNREACHABLE("gen_asm: null fn_instrs\n");
-        }
-        list_concat(output, fn_instrs);
+// begin_for_label, post_for_label, post_body_label
+void fast_for_begin(int *labels) {
+    labels[0] = unique_label();
+    labels[1] = unique_label();
+    labels[2] = unique_label();
+}
+
+void fast_for_cond(int *labels) {
+    new_local_label(fast_buf, labels[0]);
+}
+
+void fast_for_post(int *labels) {
+    gen_test(fast_buf, OP_JE, labels[1]);
+
+    held_posts = grow(held_posts, num_held_posts, &held_posts_capacity, sizeof(held_post_t));
+    held_post_t *post = &held_posts[num_held_posts++];
+    post->buf_start = fast_buf->len;
+    post->label_mark = label_tail;
+}
+
+// The post clause is done, so set it aside until the body is
+void fast_for_body(void) {
+    held_post_t *post = &held_posts[num_held_posts - 1];
+    int len = fast_buf->len - post->buf_start;
+    while (held_code_len + len > held_code_capacity)
+        held_code = grow(held_code, held_code_capacity, &held_code_capacity, sizeof(output_t));
+    post->held_start = held_code_len;
+    memcpy(held_code + held_code_len, fast_buf->outputs + post->buf_start, sizeof(output_t) * len);
+    held_code_len += len;
+    fast_buf->len = post->buf_start;
+
+    post->label_head = label_next[post->label_mark];
+    post->label_tail = label_tail;
+    label_next[post->label_mark] = 0;
+    label_tail = post->label_mark;
+}
+
+void fast_for_end(int *labels) {
+    new_local_label(fast_buf, labels[2]);
+
+    held_post_t *post = &held_posts[--num_held_posts];
+    for (int i = post->held_start; i < held_code_len; i++)
+        *output_push(fast_buf) = held_code[i];
+    held_code_len = post->held_start;
+    if (post->label_head) {
+        label_next[label_tail] = post->label_head;
+        label_tail = post->label_tail;
     }
-    debug("length: %d\n", output->len);
-    return output;
+
+    instr_jump(fast_buf, OP_JMP, labels[0]);
+    new_local_label(fast_buf, labels[1]);
+}
+
+// begin_label, end_label for while and do loops
+void fast_loop_begin(int *labels) {
+    labels[0] = unique_label();
+    labels[1] = unique_label();
+    new_local_label(fast_buf, labels[0]);
+}
+
+void fast_while_body(int *labels) {
+    gen_test(fast_buf, OP_JE, labels[1]);
+}
+
+void fast_while_end(int *labels) {
+    instr_jump(fast_buf, OP_JMP, labels[0]);
+    new_local_label(fast_buf, labels[1]);
 }
 
+void fast_do_end(int *labels) {
+    gen_test(fast_buf, OP_JNE, labels[0]);
+    new_local_label(fast_buf, labels[1]);
+}
@@ -14,13 +14,19 @@ typedef enum {
     OPERAND_VAR,
     OPERAND_IMM,
     OPERAND_LABEL,
+    OPERAND_LOCAL_LABEL,
 } operand_type_t;
 
 typedef struct {
-    string_t *name; 
+    // Labels we make up (for branches, loops, etc) are just numbered, and are printed as
+    // assembler local .L<id> labels so they stay out of the object's symbol table. Everything
+    // else has a name.
+    string_t *name;
+    int id;
     enum {
         LABEL_STATIC,
         LABEL_GLOBAL,
+        LABEL_LOCAL,
     } linkage;
 } label_t;
 
@@ -32,6 +38,7 @@ typedef struct {
         //var_t var;
         imm_t imm;
         string_t *label;
+        int local_label;
     };
 } operand_t;
 
@@ -56,11 +63,20 @@ typedef struct {
     };
 } output_t;
 
+// The code for one function, stored contiguously in the order it was generated so that later
+// passes can walk it linearly or rewrite it in place.
 typedef struct {
-    string_t *return_label;
-    string_t *iter_continue_label;
-    string_t *iter_break_label;
-    env_t *env;
+    output_t *outputs;
+    int len;
+    int capacity;
+    arena_t *arena;
+} output_buf_t;
+
+// Labels are local label ids, or -1 if there isn't one (e.g. break outside of a loop)
+typedef struct {
+    int return_label;
+    int iter_continue_label;
+    int iter_break_label;
 } context_t;
 
 #endif
@@ -0,0 +1,286 @@
+#include "compile.h"
+#include <string.h>
+
+#define AST_DEFAULT_CAPACITY (256)
+
+static void *grow(void *items, uint32_t capacity, size_t size) {
+    void *ret = realloc(items, size * capacity);
+    if (!ret) {
+        UNREACHABLE("ast: out of memory\n");
+    }
+    return ret;
+}
+
+ast_t *ast_new(void) {
+    ast_t *ast = calloc(1, sizeof(ast_t));
+    if (!ast)
+        return NULL;
+
+    // Reserve node 0 for the null expression
+    ast_add(ast, NODE_NULL_EXPR, 0, TYPE_VOID, 0, 0);
+    ast_forget_shared(ast);
+    return ast;
+}
+
+void ast_free(ast_t *ast) {
+    if (!ast)
+        return;
+    free(ast->kind);
+    free(ast->op);
+    free(ast->c_type);
+    free(ast->a);
+    free(ast->b);
+    free(ast->extra);
+    free(ast->names);
+    free(ast->shared);
+    free(ast);
+}
+
+node_id_t ast_add(ast_t *ast, node_kind_t kind, int op, builtin_type_t c_type, uint32_t a, uint32_t b) {
+    if (ast->len == ast->capacity) {
+        ast->capacity = ast->capacity ? ast->capacity * 2 : AST_DEFAULT_CAPACITY;
+        ast->kind = grow(ast->kind, ast->capacity, sizeof(uint8_t));
+        ast->op = grow(ast->op, ast->capacity, sizeof(uint8_t));
+        ast->c_type = grow(ast->c_type, ast->capacity, sizeof(uint8_t));
+        ast->a = grow(ast->a, ast->capacity, sizeof(uint32_t));
+        ast->b = grow(ast->b, ast->capacity, sizeof(uint32_t));
+    }
+
+    node_id_t id = ast->len++;
+    ast->kind[id] = kind;
+    ast->op[id] = op;
+    ast->c_type[id] = c_type;
+    ast->a[id] = a;
+    ast->b[id] = b;
+    return id;
+}
+
+uint32_t ast_add_extra(ast_t *ast, const uint32_t *children, uint32_t n) {
+    if (ast->extra_len + n > ast->extra_capacity) {
+        uint32_t capacity = ast->extra_capacity ? ast->extra_capacity : AST_DEFAULT_CAPACITY;
+        while (capacity < ast->extra_len + n)
+            capacity *= 2;
+        ast->extra = grow(ast->extra, capacity, sizeof(uint32_t));
+        ast->extra_capacity = capacity;
+    }
+
+    uint32_t start = ast->extra_len;
+    if (n)
+        memcpy(ast->extra + start, children, sizeof(uint32_t) * n);
+    ast->extra_len += n;
+    return start;
+}
+
+uint32_t ast_add_name(ast_t *ast, string_t *name) {
+    if (ast->names_len == ast->names_capacity) {
+        ast->names_capacity = ast->names_capacity ? ast->names_capacity * 2 : AST_DEFAULT_CAPACITY;
+        ast->names = grow(ast->names, ast->names_capacity, sizeof(string_t *));
+    }
+    ast->names[ast->names_len] = name;
+    return ast->names_len++;
+}
+
+static uint32_t hash_node(uint8_t kind, uint8_t op, uint8_t c_type, uint32_t a, uint32_t b) {
+    uint64_t h = ((uint64_t)kind << 16 | (uint64_t)op << 8 | c_type) * 0x9e3779b97f4a7c15ull;
+    h = (h ^ a) * 0x9e3779b97f4a7c15ull;
+    h = (h ^ b) * 0x9e3779b97f4a7c15ull;
+    return h >> 32;
+}
+
+// Returns the slot that holds the node with these fields, or the empty slot where it would go
+static uint32_t find_shared(ast_t *ast, uint8_t kind, uint8_t op, uint8_t c_type, uint32_t a,
+                            uint32_t b) {
+    uint32_t mask = ast->shared_capacity - 1;
+    uint32_t slot = hash_node(kind, op, c_type, a, b) & mask;
+    while (true) {
+        node_id_t id = ast->shared[slot];
+        if (id < ast->shared_base)
+            return slot;
+        if (ast->kind[id] == kind && ast->op[id] == op && ast->c_type[id] == c_type
+                && ast->a[id] == a && ast->b[id] == b)
+            return slot;
+        slot = (slot + 1) & mask;
+    }
+}
+
+static bool is_shared(ast_t *ast, node_id_t id) {
+    uint32_t slot = find_shared(ast, ast->kind[id], ast->op[id], ast->c_type[id], ast->a[id], ast->b[id]);
+    return ast->shared[slot] == id;
+}
+
+static bool is_shareable(ast_t *ast, node_kind_t kind, int op, uint32_t a, uint32_t b) {
+    switch (kind) {
+        case NODE_INT:
+        case NODE_VAR:
+            return true;
+        case NODE_UNARY:
+            return op != UNARY_POSTINC && op != UNARY_POSTDEC && is_shared(ast, a);
+        case NODE_BIN:
+            return is_shared(ast, a) && is_shared(ast, b);
+        default:
+            return false;
+    }
+}
+
+static void grow_shared(ast_t *ast) {
+    node_id_t *old = ast->shared;
+    uint32_t old_capacity = ast->shared_capacity;
+
+    ast->shared_capacity = old_capacity ? old_capacity * 2 : AST_DEFAULT_CAPACITY;
+    ast->shared = calloc(ast->shared_capacity, sizeof(node_id_t));
+    if (!ast->shared) {
+        UNREACHABLE("ast: out of memory\n");
+    }
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        node_id_t id = old[i];
+        if (id < ast->shared_base)
+            continue;
+        uint32_t slot = find_shared(ast, ast->kind[id], ast->op[id], ast->c_type[id], ast->a[id], ast->b[id]);
+        ast->shared[slot] = id;
+    }
+    free(old);
+}
+
+node_id_t ast_add_expr(ast_t *ast, node_kind_t kind, int op, builtin_type_t c_type, uint32_t a, uint32_t b) {
+    if (!ast->share)
+        return ast_add(ast, kind, op, c_type, a, b);
+
+    // Keep the table at most half full
+    if ((ast->shared_len + 1) * 2 > ast->shared_capacity)
+        grow_shared(ast);
+
+    if (!is_shareable(ast, kind, op, a, b))
+        return ast_add(ast, kind, op, c_type, a, b);
+
+    uint32_t slot = find_shared(ast, kind, op, c_type, a, b);
+    if (ast->shared[slot] >= ast->shared_base)
+        return ast->shared[slot];
+
+    node_id_t id = ast_add(ast, kind, op, c_type, a, b);
+    ast->shared[slot] = id;
+    ast->shared_len++;
+    return id;
+}
+
+void ast_forget_shared(ast_t *ast) {
+    ast->shared_base = ast->len;
+    ast->shared_len = 0;
+}
+
+ast_mark_t ast_mark(ast_t *ast) {
+    return (ast_mark_t){ast->len, ast->extra_len, ast->names_len};
+}
+
+void ast_rewind(ast_t *ast, ast_mark_t mark) {
+    ast->len = mark.len;
+    ast->extra_len = mark.extra_len;
+    ast->names_len = mark.names_len;
+    ast_forget_shared(ast);
+
+    // The dropped nodes' ids are about to be handed out again, so the table can't tell the ones it
+    // holds from the new ones anymore. It starts over small, rather than being cleared at its
+    // biggest for every function.
+    free(ast->shared);
+    ast->shared = NULL;
+    ast->shared_capacity = 0;
+}
+
+void ast_resize(ast_t *ast, ast_mark_t mark) {
+    if (mark.len > ast->capacity) {
+        ast->capacity = mark.len;
+        ast->kind = grow(ast->kind, ast->capacity, sizeof(uint8_t));
+        ast->op = grow(ast->op, ast->capacity, sizeof(uint8_t));
+        ast->c_type = grow(ast->c_type, ast->capacity, sizeof(uint8_t));
+        ast->a = grow(ast->a, ast->capacity, sizeof(uint32_t));
+        ast->b = grow(ast->b, ast->capacity, sizeof(uint32_t));
+    }
+    if (mark.extra_len > ast->extra_capacity) {
+        ast->extra_capacity = mark.extra_len;
+        ast->extra = grow(ast->extra, ast->extra_capacity, sizeof(uint32_t));
+    }
+    if (mark.names_len > ast->names_capacity) {
+        ast->names_capacity = mark.names_len;
+        ast->names = grow(ast->names, ast->names_capacity, sizeof(string_t *));
+    }
+    ast->len = mark.len;
+    ast->extra_len = mark.extra_len;
+    ast->names_len = mark.names_len;
+}
+
+// NODE_NONE stays put
+static uint32_t moved(uint32_t node, uint32_t by) {
+    return node ? node + by : NODE_NONE;
+}
+
+uint32_t ast_copy(ast_t *ast, ast_mark_t at, ast_t *src, ast_mark_t start, ast_mark_t end) {
+    uint32_t n = end.len - start.len;
+    memcpy(ast->kind + at.len, src->kind + start.len, n);
+    memcpy(ast->op + at.len, src->op + start.len, n);
+    memcpy(ast->c_type + at.len, src->c_type + start.len, n);
+    memcpy(ast->a + at.len, src->a + start.len, sizeof(uint32_t) * n);
+    memcpy(ast->b + at.len, src->b + start.len, sizeof(uint32_t) * n);
+    memcpy(ast->extra + at.extra_len, src->extra + start.extra_len,
+           sizeof(uint32_t) * (end.extra_len - start.extra_len));
+    memcpy(ast->names + at.names_len, src->names + start.names_len,
+           sizeof(string_t *) * (end.names_len - start.names_len));
+
+    // Every child and extra index is in the same range as its parent, so they all move by the same
+    // amount as it did
+    uint32_t by = at.len - start.len;
+    uint32_t extra_by = at.extra_len - start.extra_len;
+    uint32_t names_by = at.names_len - start.names_len;
+    for (uint32_t id = at.len; id < at.len + n; id++) {
+        uint32_t *a = &ast->a[id];
+        uint32_t *b = &ast->b[id];
+        uint32_t *extra;
+        switch (ast->kind[id]) {
+            case NODE_FN_CALL:
+                *a += extra_by;
+                extra = ast->extra + *a;
+                extra[0] += names_by;
+                for (uint32_t i = 0; i < extra[1]; i++)
+                    extra[2 + i] = moved(extra[2 + i], by);
+                break;
+            case NODE_TERNARY:
+            case NODE_IF:
+                *a = moved(*a, by);
+                *b += extra_by;
+                extra = ast->extra + *b;
+                extra[0] = moved(extra[0], by);
+                extra[1] = moved(extra[1], by);
+                break;
+            case NODE_BLOCK:
+                *a += extra_by;
+                extra = ast->extra + *a;
+                for (uint32_t i = 0; i < *b; i++)
+                    extra[i] = moved(extra[i], by);
+                break;
+            case NODE_FOR:
+                *a += extra_by;
+                extra = ast->extra + *a;
+                for (int i = 0; i < 4; i++)
+                    extra[i] = moved(extra[i], by);
+                break;
+            case NODE_UNARY:
+            case NODE_RETURN:
+            case NODE_EXPR_STMT:
+                *a = moved(*a, by);
+                break;
+            case NODE_BIN:
+            case NODE_ASSIGN:
+            case NODE_WHILE:
+            case NODE_DO:
+                *a = moved(*a, by);
+                *b = moved(*b, by);
+                break;
+            case NODE_DECLARE:
+                *b = moved(*b, by);
+                break;
+            default:
+                // Ints, vars, and statements with no children
+                break;
+        }
+    }
+    return by;
+}
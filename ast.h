@@ -2,209 +2,182 @@
 #define AST_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "string.h"
 #include "list.h"
 #include "map.h"
 #include "env.h"
 #include "asm.h" // for mem_loc_t
 
-struct expr;
-typedef struct expr expr_t;
-typedef struct stmt stmt_t;
+enum unary_op {
+    UNARY_MATH_NEG,
+    UNARY_BITWISE_COMP,
+    UNARY_LOGICAL_NEG,
+    UNARY_POSTINC,
+    UNARY_POSTDEC,
+};
+
+enum bin_op {
+    BIN_ADD,
+    BIN_SUB,
+    BIN_MUL,
+    BIN_DIV,
+    BIN_LT,
+    BIN_GT,
+    BIN_LTE,
+    BIN_GTE,
+    BIN_EQ,
+    BIN_NE,
+    BIN_AND,
+    BIN_OR,
+    BIN_MODULO,
+};
+
+// Nodes are referred to by their index in the ast_t.
+typedef uint32_t node_id_t;
+
+// Node 0 is always the null expression, which is used wherever an expression or statement is
+// optional. Since it's 0, "no node" and "the null expression" are the same thing.
+#define NODE_NONE ((node_id_t)0)
+
+// What a and b hold for each kind of node. "extra" means a is an index into ast_t.extra where the
+// children are stored one after another. Variables are referred to by their index in the
+// function's var_table_t.
+typedef enum {
+    NODE_NULL_EXPR,
+
+    // Expressions
+    NODE_INT,       // a: value
+    NODE_VAR,       // a: var index
+    NODE_FN_CALL,   // a: extra {name index, number of args, args...}
+    NODE_UNARY,     // op: unary_op, a: operand
+    NODE_BIN,       // op: bin_op, a: lhs, b: rhs
+    NODE_TERNARY,   // a: cond, b: extra {then, else}
+    NODE_ASSIGN,    // a: lhs, b: rhs
+
+    // Statements
+    NODE_RETURN,    // a: expr
+    NODE_DECLARE,   // a: var index, b: init expr or NODE_NONE
+    NODE_IF,        // a: cond, b: extra {then, else or NODE_NONE}
+    NODE_BLOCK,     // a: extra index of the first stmt, b: number of stmts
+    NODE_EXPR_STMT, // a: expr
+    NODE_EMPTY,
+    NODE_FOR,       // a: extra {init, cond, post, body}
+    NODE_WHILE,     // a: cond, b: body
+    NODE_DO,        // a: body, b: cond
+    NODE_BREAK,
+    NODE_CONTINUE,
+} node_kind_t;
+
+/*
+ * The whole program's syntax tree, stored as parallel arrays indexed by node id instead of as
+ * individually allocated structs that point at each other. A node is a kind, an operator, a type
+ * and two 32 bit operands, which is enough to hold the children of most nodes directly. Nodes with
+ * more children than that, like calls and blocks, keep them contiguously in extra.
+ *
+ * The arrays are heap allocated so they can be grown with realloc rather than leaving every old
+ * copy behind in an arena. They're released by ast_free.
+ */
+typedef struct {
+    uint8_t *kind;
+    uint8_t *op;
+    uint8_t *c_type;
+    uint32_t *a;
+    uint32_t *b;
+    uint32_t len;
+    uint32_t capacity;
+
+    uint32_t *extra;
+    uint32_t extra_len;
+    uint32_t extra_capacity;
+
+    // names of called functions
+    string_t **names;
+    uint32_t names_len;
+    uint32_t names_capacity;
+
+    // When share is set, ast_add_expr hash-conses expressions with no side effects, so identical
+    // ones are the same node. shared is an open addressing table of those nodes, and anything in it
+    // older than shared_base is treated as an empty slot. That way the table can be forgotten at the
+    // start of every function without clearing it.
+    bool share;
+    node_id_t *shared;
+    uint32_t shared_len;
+    uint32_t shared_capacity;
+    node_id_t shared_base;
+} ast_t;
+
+ast_t *ast_new(void);
+void ast_free(ast_t *ast);
+
+node_id_t ast_add(ast_t *ast, node_kind_t kind, int op, builtin_type_t c_type, uint32_t a, uint32_t b);
+
+// Same as ast_add, except that if sharing is on and the expression has no side effects, an identical
+// node that was already added since the last ast_forget_shared is returned instead of a new one.
+// Ints, vars, unary ops other than ++ and --, and binary ops are shared as long as their operands
+// were shared too. Vars are compared by var index rather than name, so the same name declared in
+// two scopes is never mixed up.
+node_id_t ast_add_expr(ast_t *ast, node_kind_t kind, int op, builtin_type_t c_type, uint32_t a, uint32_t b);
+
+// Nodes added after this are never shared with ones added before it. Var indices start over in
+// every function, so this is called whenever a new function starts.
+void ast_forget_shared(ast_t *ast);
+
+// Where the ast ends, so everything added after this point can be dropped again.
+typedef struct {
+    uint32_t len;
+    uint32_t extra_len;
+    uint32_t names_len;
+} ast_mark_t;
+
+ast_mark_t ast_mark(ast_t *ast);
+
+// Drops every node added since mark. Nothing may refer to them anymore.
+void ast_rewind(ast_t *ast, ast_mark_t mark);
+
+// Grows or shrinks the ast to end at mark. Nodes it grows by are left for ast_copy to fill in.
+void ast_resize(ast_t *ast, ast_mark_t mark);
+
+// Copies what src added between start and end into ast at at, which ast_resize has already made
+// room for, and returns how much node ids moved by (mod 2^32). Only a whole function's nodes can be
+// copied, since its children are moved along with it. Different ranges can be copied at once.
+uint32_t ast_copy(ast_t *ast, ast_mark_t at, ast_t *src, ast_mark_t start, ast_mark_t end);
+
+// Appends n children to extra and returns the index of the first one.
+uint32_t ast_add_extra(ast_t *ast, const uint32_t *children, uint32_t n);
+uint32_t ast_add_name(ast_t *ast, string_t *name);
 
 typedef struct {
-    enum unary_op {
-        UNARY_MATH_NEG,
-        UNARY_BITWISE_COMP,
-        UNARY_LOGICAL_NEG,
-        UNARY_POSTINC,
-        UNARY_POSTDEC,
-    } op;
-    expr_t *expr;
-} unary_expr_t;
-
-typedef struct {
-    enum bin_op {
-        BIN_ADD,
-        BIN_SUB,
-        BIN_MUL,
-        BIN_DIV,
-        BIN_LT,
-        BIN_GT,
-        BIN_LTE,
-        BIN_GTE,
-        BIN_EQ,
-        BIN_NE,
-        BIN_AND,
-        BIN_OR,
-        BIN_MODULO,
-    } op;
-    expr_t *lhs;
-    expr_t *rhs;
-} bin_expr_t;
-
-typedef struct {
-    string_t *fn_name; 
-
-    // The parameters to a function call are a list of expressions
-    list_t *param_exprs;
-} fn_call_t;
-
-typedef struct {
-    enum primary_type {
-        PRIMARY_INT,
-        PRIMARY_CHAR,
-        PRIMARY_VAR,
-        PRIMARY_EXPR,
-        PRIMARY_FN_CALL,
-    } type;
-
-    union {
-        int integer;
-        char character;
-        string_t *var;
-
-        // TODO is this necessary? seems like I could parse these as just another expr_t instead of
-        // nesting it like this
-        expr_t *expr;
-        fn_call_t *fn_call;
-    };
-} primary_t;
-
-typedef struct {
-    expr_t *lhs;
-    expr_t *rhs;
-} assign_t;
-
-typedef struct {
-    expr_t *cond;
-    expr_t *then;
-    expr_t *els;
-} ternary_t;
-
-typedef struct expr {
-    enum {
-        PRIMARY,
-        UNARY_OP,
-        BIN_OP,
-        TERNARY,
-        ASSIGN,
-        NULL_EXPR, // used for optional
-    } type;
-
-    builtin_type_t c_type;
-    union {
-        primary_t *primary;
-        unary_expr_t *unary;
-        bin_expr_t *bin;
-        ternary_t *ternary;
-        assign_t *assign;
-    };
-} expr_t;
-
-typedef struct {
-    list_t *stmts;
-    env_t *env;
-} block_t;
-
-typedef struct {
-    // a return statement just has an expression to be evaluated and returned
-    expr_t *expr; 
-} return_stmt_t;
-
-// Note that a declaration is different from an assign statement. A declaration is the first time
-// some variable is referenced (e.g., int x; or int x = 0;), but an assignment occurs when the
-// variable is actually assigned a value.
-typedef struct {
-    // TODO this won't always be a builtin type, but it's okay for now.
-    builtin_type_t type;    
     string_t *name;
+    builtin_type_t ret_type;
 
-    // This expression is optional. In a statement like "int a;", there's no init_expr."
-    expr_t *init_expr;
-} declare_stmt_t;
-
-typedef struct {
-    enum {
-        BLOCK,
-        SINGLE,
-    } type;
-    union {
-        block_t *block;
-        stmt_t *single;
-    };
-} block_or_single_t;
-
-typedef struct {
-    expr_t *cond;
-    block_or_single_t *then;
-    block_or_single_t *els;
-} if_stmt_t;
-
-typedef struct {
-    stmt_t *init;
-    expr_t *cond;
-    expr_t *post;
-    block_or_single_t *body;
-    env_t *env; // basically just for the init clause
-} for_stmt_t;
-
-typedef struct {
-    expr_t *cond;
-    block_or_single_t *body;
-} while_stmt_t;
-
-typedef struct {
-    expr_t *cond;
-    block_or_single_t *body;
-} do_stmt_t;
-
-typedef struct stmt {
-    enum {
-        STMT_RETURN,
-        STMT_DECLARE,
-        STMT_IF,
-        STMT_BLOCK,
-        STMT_EXPR,
-        STMT_NULL,
-        STMT_FOR,
-        STMT_WHILE,
-        STMT_DO,
-        STMT_BREAK,
-        STMT_CONTINUE,
-    } type;
-    union {
-        return_stmt_t *ret;
-        declare_stmt_t *declare;
-        if_stmt_t *if_stmt;
-        block_t *block;
-        for_stmt_t *for_stmt;
-        while_stmt_t *while_stmt;
-        do_stmt_t *do_stmt;
-
-        // Apparently, standalone expressions (ie, not in an assign or return statement) is totally
-        // valid C. GCC will compile it, but will warn you.
-        expr_t *expr;
-    };
-} stmt_t;
+    // A NODE_BLOCK, or NODE_NONE if the function has only been declared
+    node_id_t body;
 
-typedef struct {
-    string_t *name;
-    builtin_type_t ret_type;
-    list_t *stmts;
+    // var_info_t for each parameter
     list_t *params;
 
-    // parameters are bound in the environment
-    env_t *env;
+    // every variable in the function, parameters first
+    var_table_t *vars;
     uint64_t sp_offset;
+
+    // position in program_t.fn_defs, which is the order functions were first declared in
+    int index;
+
+    // where it is in the tokens: its first token, and one past its closing brace (or semicolon)
+    int first_token;
+    int end_token;
 } fn_def_t;
 
 typedef struct {
     // A program consists of a bunch of function definitions.
     // This maps from function name to fn_def_t.
-    // On a declaration, stmts will be NULL.
-    // When the definition is found, stmts will be nonnull.
+    // On a declaration, body will be NODE_NONE.
+    // When the definition is found, body will be set.
     map_t *fn_defs;
+
+    // every function's body
+    ast_t *ast;
 } program_t;
 
 #endif
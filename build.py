@@ -6,27 +6,49 @@ import pathlib
 compiler_path = pathlib.Path(__file__).parent.absolute()/'COMPILERBABY'
 
 if __name__ == '__main__':
-    if len(sys.argv) != 2:
-        print('usage: build.py <filename>')
-        sys.exit(-1)
+    # -S goes through gas with the textual assembly instead of having the compiler write the object
+    args = sys.argv[1:]
+    use_asm = '-S' in args
+    if use_asm:
+        args.remove('-S')
 
-    input_file = sys.argv[1]
-    if not input_file.endswith('.c'):
-        print('error: filename must end with \'.c\' extension')
+    # -j N compiles N files at once. Every file is compiled by the same compiler process either way.
+    jobs = []
+    if '-j' in args:
+        i = args.index('-j')
+        jobs = args[i:i + 2]
+        del args[i:i + 2]
 
-    asm_file = input_file.replace('.c', '.s')
-    compile_args = [compiler_path, input_file]
-    result = subprocess.Popen(compile_args, stdout=subprocess.PIPE)
-    output, _ = result.communicate()
-    err = result.returncode
-    if err != 0:
-        print("Compilation failed")
+    if len(args) < 1 or len(jobs) == 1:
+        print('usage: build.py [-S] [-j N] <filename>...')
         sys.exit(-1)
 
-    with open(asm_file, 'w+') as out:
-        out.write(output.decode('utf-8'))
+    for input_file in args:
+        if not input_file.endswith('.c'):
+            print('error: filename must end with \'.c\' extension')
+            sys.exit(-1)
+
+    # The compiler names each output after its input
+    executables = [input_file[:-len('.c')] for input_file in args]
+    out_files = [executable + ('.s' if use_asm else '.o') for executable in executables]
+    for out_file in out_files:
+        pathlib.Path(out_file).unlink(missing_ok=True)
+
+    if len(args) == 1:
+        compile_args = [compiler_path, '-o', out_files[0]] + args
+    else:
+        compile_args = [compiler_path] + jobs + args
+    if not use_asm:
+        compile_args.insert(1, '-c')
 
-    executable = asm_file.replace('.s', '')
-    assemble_args = ['gcc', '-no-pie', asm_file, '-o', executable]
-    subprocess.run(assemble_args)
-    
+    failed = subprocess.run(compile_args).returncode != 0
+    if failed:
+        print("Compilation failed")
+
+    # Link whatever did compile
+    for executable, out_file in zip(executables, out_files):
+        if pathlib.Path(out_file).exists():
+            link_args = ['gcc', '-no-pie', out_file, '-o', executable]
+            subprocess.run(link_args)
+    if failed:
+        sys.exit(-1)
@@ -0,0 +1,445 @@
+#include "compile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Code from a different build of the compiler might not be the same, so every key starts with when
+// it was built. The Makefile builds every file at once, so this changes whenever any of them do.
+static const char build_id[] = __DATE__ " " __TIME__;
+
+#define LOG_NAME "fns.log"
+#define ENTRY_MAGIC (0x43424332)
+
+// Once the log is bigger than this, compacting it drops the oldest entries until it's half this
+#define LOG_MAX_LEN ((size_t)64 << 20)
+
+// Marks an empty slot in the log's hash table
+#define NO_ENTRY ((size_t)-1)
+
+/*
+ * An entry is this header, then the function's output_t array exactly as it is in memory, then the
+ * names it refers to, then zeros up to a multiple of 8 bytes. Only the build that wrote an entry can
+ * find it, so the layout always matches, and build says which one that was so entries from other
+ * builds can be dropped. Names are stored as an index into the names that follow instead of a
+ * pointer, and each of those is its length and then its characters.
+ */
+typedef struct {
+    uint32_t magic;
+    int32_t num_labels;
+
+    // of the whole entry
+    uint64_t size;
+    fn_key_t key;
+    int32_t num_outputs;
+    int32_t num_names;
+    uint64_t names_size;
+    uint64_t build;
+} entry_header_t;
+
+// Two different 64 bit hashes side by side: FNV-1a, and a multiply and shift one
+static void hash_bytes(fn_key_t *key, const void *p, size_t len) {
+    const unsigned char *bytes = p;
+    for (size_t i = 0; i < len; i++) {
+        key->lo = (key->lo ^ bytes[i]) * 1099511628211ull;
+        key->hi = (key->hi + bytes[i]) * 0x9e3779b97f4a7c15ull;
+        key->hi ^= key->hi >> 29;
+    }
+}
+
+static uint64_t build_hash(void) {
+    fn_key_t key = {.lo = 14695981039346656037ull, .hi = 0};
+    hash_bytes(&key, build_id, sizeof(build_id));
+    return key.lo;
+}
+
+static void hash_signature(fn_key_t *key, fn_def_t *fn_def) {
+    int32_t num_params = fn_def->params ? fn_def->params->len : 0;
+    hash_bytes(key, &fn_def->ret_type, sizeof(fn_def->ret_type));
+    hash_bytes(key, &num_params, sizeof(num_params));
+    for (int i = 0; i < num_params; i++)
+        hash_bytes(key, &fn_def->vars->vars[i]->type, sizeof(builtin_type_t));
+}
+
+// Hashes the tokens from first_token to end_token. Any identifier followed by a paren is a call (or
+// the function's own name), so its signature goes in too.
+static fn_key_t make_key(program_t *prog, token_buf_t *tokens, fn_def_t *fn_def) {
+    fn_key_t key = {.lo = 14695981039346656037ull, .hi = 0};
+    hash_bytes(&key, build_id, sizeof(build_id));
+    for (int i = fn_def->first_token; i < fn_def->end_token; i++) {
+        token_t *token = &tokens->tokens[i];
+        uint8_t type = token->type;
+        hash_bytes(&key, &type, sizeof(type));
+        if (token->type == TOK_IDENT) {
+            hash_bytes(&key, &token->len, sizeof(token->len));
+            hash_bytes(&key, tokens->src + token->offset, token->len);
+            if (i + 1 < fn_def->end_token && tokens->tokens[i + 1].type == TOK_OPEN_PAREN) {
+                string_t name = {.buf = tokens->src + token->offset, .len = token->len, .hash = 0};
+                fn_def_t *callee = map_get(prog->fn_defs, &name);
+                if (callee)
+                    hash_signature(&key, callee);
+            }
+        } else if (token->type == TOK_INT_LIT) {
+            hash_bytes(&key, &token->int_literal, sizeof(token->int_literal));
+        } else if (token->type == TOK_CHAR_LIT) {
+            hash_bytes(&key, &token->char_literal, sizeof(token->char_literal));
+        }
+    }
+    return key;
+}
+
+static bool key_eq(fn_key_t a, fn_key_t b) {
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+static bool key_is_none(fn_key_t key) {
+    return !key.lo && !key.hi;
+}
+
+// Returns the entry at offset in log if there's a whole one there, or NULL
+static entry_header_t *entry_at(char *log, size_t len, size_t offset) {
+    if (len - offset < sizeof(entry_header_t))
+        return NULL;
+    entry_header_t *header = (entry_header_t *)(log + offset);
+    if (header->magic != ENTRY_MAGIC || header->size % 8 || header->size > len - offset
+            || header->num_outputs <= 0 || header->num_names < 0)
+        return NULL;
+    uint64_t outputs_size = sizeof(output_t) * (uint64_t)header->num_outputs;
+    if (sizeof(entry_header_t) + outputs_size + header->names_size > header->size)
+        return NULL;
+    return header;
+}
+
+static fn_cache_slot_t *find_slot(fn_cache_slot_t *slots, int num_slots, fn_key_t key) {
+    int mask = num_slots - 1;
+    for (int i = key.lo & mask;; i = (i + 1) & mask) {
+        if (slots[i].offset == NO_ENTRY || key_eq(slots[i].key, key))
+            return &slots[i];
+    }
+}
+
+// Maps the whole log and makes a table of where every entry this build can use is. If the same
+// function is in it twice, the first one is used.
+static void index_log(fn_cache_t *cache) {
+    struct stat st;
+    cache->log = NULL;
+    cache->log_len = 0;
+    if (fstat(cache->fd, &st) == 0 && st.st_size > 0) {
+        char *log = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cache->fd, 0);
+        if (log != MAP_FAILED) {
+            cache->log = log;
+            cache->log_len = st.st_size;
+        }
+    }
+
+    int num_entries = 0;
+    size_t offset = 0;
+    entry_header_t *header;
+    while ((header = entry_at(cache->log, cache->log_len, offset))) {
+        num_entries++;
+        offset += header->size;
+    }
+    cache->valid_len = offset;
+
+    cache->num_slots = 64;
+    while (cache->num_slots < num_entries * 2)
+        cache->num_slots *= 2;
+    cache->slots = malloc(sizeof(fn_cache_slot_t) * cache->num_slots);
+    for (int i = 0; i < cache->num_slots; i++)
+        cache->slots[i].offset = NO_ENTRY;
+    cache->live_len = 0;
+    uint64_t build = build_hash();
+    for (offset = 0; (header = entry_at(cache->log, cache->log_len, offset)); offset += header->size) {
+        fn_cache_slot_t *slot = find_slot(cache->slots, cache->num_slots, header->key);
+        if (header->build == build && slot->offset == NO_ENTRY) {
+            slot->key = header->key;
+            slot->offset = offset;
+            cache->live_len += header->size;
+        }
+    }
+}
+
+static void unmap_log(fn_cache_t *cache) {
+    if (cache->log)
+        munmap(cache->log, cache->log_len);
+    free(cache->slots);
+    cache->log = NULL;
+    cache->slots = NULL;
+}
+
+static bool write_full(int fd, const void *p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p = (const char *)p + n;
+        len -= n;
+    }
+    return true;
+}
+
+// Writes a new log with every entry this build can use, and puts it in place of the old one. Other
+// programs' entries go first, oldest first, and the oldest of those are left out if there's too
+// much. This program's go last, so they're the last to go. Returns false if it couldn't.
+static bool compact_log(fn_cache_t *cache) {
+    size_t tmp_len = strlen(cache->dir) + sizeof("/.tmp-XXXXXX");
+    char *tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s/.tmp-XXXXXX", cache->dir);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        free(tmp_path);
+        return false;
+    }
+
+    // Which slots are this program's
+    bool *mine = calloc(cache->num_slots, sizeof(bool));
+    for (int i = 0; i < cache->num_fns; i++) {
+        fn_cache_slot_t *slot = find_slot(cache->slots, cache->num_slots, cache->keys[i]);
+        if (!key_is_none(cache->keys[i]) && slot->offset != NO_ENTRY)
+            mine[slot - cache->slots] = true;
+    }
+
+    bool ok = true;
+    size_t drop = 0;
+    if (cache->live_len > LOG_MAX_LEN)
+        drop = cache->live_len - LOG_MAX_LEN / 2;
+    for (int pass = 0; pass < 2; pass++) {
+        entry_header_t *header;
+        for (size_t offset = 0; ok && offset < cache->valid_len; offset += header->size) {
+            header = (entry_header_t *)(cache->log + offset);
+            fn_cache_slot_t *slot = find_slot(cache->slots, cache->num_slots, header->key);
+            if (slot->offset != offset || mine[slot - cache->slots] != pass)
+                continue;
+            if (drop && !pass) {
+                drop = header->size < drop ? drop - header->size : 0;
+                continue;
+            }
+            ok = write_full(fd, header, header->size);
+        }
+    }
+    free(mine);
+    fchmod(fd, 0644);
+    close(fd);
+    if (!ok || rename(tmp_path, cache->path) < 0) {
+        unlink(tmp_path);
+        ok = false;
+    }
+    free(tmp_path);
+    return ok;
+}
+
+fn_cache_t *fn_cache_open(char *dir) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return NULL;
+    }
+    size_t path_len = strlen(dir) + sizeof("/" LOG_NAME);
+    char *path = malloc(path_len);
+    snprintf(path, path_len, "%s/%s", dir, LOG_NAME);
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        perror(path);
+        free(path);
+        return NULL;
+    }
+
+    fn_cache_t *cache = malloc(sizeof(fn_cache_t));
+    cache->dir = dir;
+    cache->path = path;
+    cache->fd = fd;
+    cache->keys = NULL;
+    cache->num_fns = 0;
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    index_log(cache);
+
+    // Anything appended after a torn entry would never be found, so cut it off first
+    if (cache->valid_len != cache->log_len && compact_log(cache)) {
+        unmap_log(cache);
+        close(cache->fd);
+        cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (cache->fd < 0) {
+            perror(path);
+            free(path);
+            free(cache);
+            return NULL;
+        }
+        index_log(cache);
+    }
+    return cache;
+}
+
+void fn_cache_add_keys(fn_cache_t *cache, program_t *prog, token_buf_t *tokens) {
+    cache->num_fns = prog->fn_defs->len;
+    cache->keys = calloc(cache->num_fns, sizeof(fn_key_t));
+    pair_t *fn_pair;
+    map_for_each(prog->fn_defs, fn_pair) {
+        fn_def_t *fn_def = fn_pair->value;
+        if (fn_def->body != NODE_NONE)
+            cache->keys[fn_def->index] = make_key(prog, tokens, fn_def);
+    }
+}
+
+// Returns where out refers to a name, or NULL if it doesn't
+static string_t **name_ref(output_t *out) {
+    if (out->type == OUTPUT_LABEL && out->label.linkage != LABEL_LOCAL)
+        return &out->label.name;
+    if (out->type == OUTPUT_INSTR && out->instr.num_args >= 1 && out->instr.src.type == OPERAND_LABEL)
+        return &out->instr.src.label;
+    if (out->type == OUTPUT_INSTR && out->instr.num_args == 2 && out->instr.dst.type == OPERAND_LABEL)
+        return &out->instr.dst.label;
+    return NULL;
+}
+
+// Turns a name's index back into the name, or returns false if it's out of range
+static bool load_name(string_t **name, string_t **names, int num_names) {
+    uintptr_t i = (uintptr_t)*name;
+    if (i >= (uintptr_t)num_names)
+        return false;
+    *name = names[i];
+    return true;
+}
+
+// Reads the names at the end of an entry and points buf's outputs at them
+static bool load_names(output_buf_t *buf, char *p, char *end, int num_names) {
+    string_t **names = malloc(sizeof(string_t *) * (num_names ? num_names : 1));
+    bool ok = true;
+    for (int i = 0; ok && i < num_names; i++) {
+        int32_t len;
+        if (end - p < (ptrdiff_t)sizeof(len)) {
+            ok = false;
+            break;
+        }
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        ok = len > 0 && len <= end - p;
+        if (ok)
+            names[i] = intern(p, len);
+        p += len;
+    }
+    ok = ok && p == end;
+
+    for (int i = 0; ok && i < buf->len; i++) {
+        string_t **name = name_ref(&buf->outputs[i]);
+        if (name)
+            ok = load_name(name, names, num_names);
+    }
+    free(names);
+    return ok;
+}
+
+output_buf_t *fn_cache_load(fn_cache_t *cache, fn_def_t *fn_def, arena_t *arena, int *num_labels) {
+    fn_key_t key = cache->keys[fn_def->index];
+    fn_cache_slot_t *slot = find_slot(cache->slots, cache->num_slots, key);
+
+    output_buf_t *buf = NULL;
+    if (slot->offset != NO_ENTRY) {
+        entry_header_t *header = (entry_header_t *)(cache->log + slot->offset);
+        size_t outputs_size = sizeof(output_t) * header->num_outputs;
+        char *names = (char *)header + sizeof(entry_header_t) + outputs_size;
+
+        buf = arena_alloc(arena, sizeof(output_buf_t));
+        buf->outputs = arena_alloc(arena, outputs_size);
+        buf->len = buf->capacity = header->num_outputs;
+        buf->arena = arena;
+        memcpy(buf->outputs, names - outputs_size, outputs_size);
+        *num_labels = header->num_labels;
+        if (!load_names(buf, names, names + header->names_size, header->num_names))
+            buf = NULL;
+    }
+
+    atomic_fetch_add(buf ? &cache->hits : &cache->misses, 1);
+    debug("fn_cache_load: %s for %s\n", buf ? "hit" : "miss", string_get(fn_def->name));
+    return buf;
+}
+
+// Swaps a name for its index in names, adding it if it isn't there yet
+static void store_name(string_t **name, string_t **names, int *num_names) {
+    int i = 0;
+    while (i < *num_names && names[i] != *name)
+        i++;
+    if (i == *num_names)
+        names[(*num_names)++] = *name;
+    *name = (string_t *)(uintptr_t)i;
+}
+
+void fn_cache_store(fn_cache_t *cache, fn_def_t *fn_def, output_buf_t *buf, int num_labels) {
+    size_t outputs_size = sizeof(output_t) * buf->len;
+    char *entry = malloc(sizeof(entry_header_t) + outputs_size);
+    output_t *outputs = (output_t *)(entry + sizeof(entry_header_t));
+    memcpy(outputs, buf->outputs, outputs_size);
+
+    // Every output refers to at most one name
+    string_t **names = malloc(sizeof(string_t *) * buf->len);
+    int num_names = 0;
+    size_t names_size = 0;
+    for (int i = 0; i < buf->len; i++) {
+        string_t **name = name_ref(&outputs[i]);
+        if (name)
+            store_name(name, names, &num_names);
+    }
+    for (int i = 0; i < num_names; i++)
+        names_size += sizeof(int32_t) + names[i]->len;
+
+    size_t size = (sizeof(entry_header_t) + outputs_size + names_size + 7) / 8 * 8;
+    entry = realloc(entry, size);
+    char *p = entry + sizeof(entry_header_t) + outputs_size;
+    for (int i = 0; i < num_names; i++) {
+        int32_t len = names[i]->len;
+        memcpy(p, &len, sizeof(len));
+        memcpy(p + sizeof(len), names[i]->buf, len);
+        p += sizeof(len) + len;
+    }
+    memset(p, 0, entry + size - p);
+
+    entry_header_t *header = (entry_header_t *)entry;
+    memset(header, 0, sizeof(entry_header_t));
+    header->magic = ENTRY_MAGIC;
+    header->num_labels = num_labels;
+    header->size = size;
+    header->key = cache->keys[fn_def->index];
+    header->num_outputs = buf->len;
+    header->num_names = num_names;
+    header->names_size = names_size;
+    header->build = build_hash();
+
+    // One write with O_APPEND always lands after everything else, so it's never mixed up with
+    // another thread's or compiler's. If it's cut short, the log is torn until it's compacted.
+    if (write(cache->fd, entry, size) != (ssize_t)size)
+        debug("fn_cache_store: couldn't write %s\n", string_get(fn_def->name));
+    free(entry);
+    free(names);
+}
+
+void fn_cache_close(fn_cache_t *cache) {
+    // The compile failed before it got to the cache
+    if (!cache->keys) {
+        unmap_log(cache);
+        close(cache->fd);
+        free(cache->path);
+        free(cache);
+        return;
+    }
+
+    // Look at the log again, with what this compile added
+    unmap_log(cache);
+    index_log(cache);
+
+    // Repeats of the same function and entries from other builds are never used
+    if (cache->valid_len != cache->log_len || cache->log_len - cache->live_len > cache->live_len
+            || cache->live_len > LOG_MAX_LEN) {
+        debug("fn_cache_close: compacting %zu bytes, %zu of them live\n", cache->log_len,
+              cache->live_len);
+        compact_log(cache);
+    }
+
+    unmap_log(cache);
+    close(cache->fd);
+    free(cache->path);
+    free(cache->keys);
+    free(cache);
+}
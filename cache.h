@@ -0,0 +1,84 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "tokenize.h"
+#include "ast.h"
+#include "asm.h"
+
+/*
+ * An on-disk cache of each function's code, so recompiling a file where only a few functions
+ * changed only generates those. Each function's code is looked up by its key: a 128 bit hash of its
+ * tokens, the signature of every function it calls, and which build of the compiler this is.
+ *
+ * Entries are appended to one log file in the cache's directory, which is read in once when the
+ * cache is opened. Every entry is a single append, so other compilers can be adding to the same log
+ * at the same time, and different programs can share one cache. Once more than half of it is entries
+ * that are never used, because the same function was added twice or a different build of the
+ * compiler added them, it's rewritten without them. Past 64MB, the oldest of other programs'
+ * entries are dropped too.
+ *
+ * Code is stored with its local labels starting at 0, like gen_asm's threads generate it, and gets
+ * shifted to where it goes in the program after it's loaded.
+ *
+ * Loads and stores for different functions can happen on different threads at once.
+ */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} fn_key_t;
+
+// Where an entry is in the log
+typedef struct {
+    fn_key_t key;
+    size_t offset;
+} fn_cache_slot_t;
+
+typedef struct {
+    char *dir;
+    char *path;
+
+    // The log as it was when the cache was opened, and a hash table of where each entry in it is
+    int fd;
+    char *log;
+    size_t log_len;
+    fn_cache_slot_t *slots;
+    int num_slots;
+
+    // How much of the log is whole entries. Anything after that is garbage, or an entry that's
+    // still being written.
+    size_t valid_len;
+
+    // How much of it is entries that can be used
+    size_t live_len;
+
+    // Each defined function's key, by index in program_t.fn_defs
+    fn_key_t *keys;
+    int num_fns;
+
+    atomic_int hits;
+    atomic_int misses;
+} fn_cache_t;
+
+// Creates dir and its log if they aren't there. Returns NULL if they can't be.
+fn_cache_t *fn_cache_open(char *dir);
+
+// Works out every defined function's key. This has to happen before the tokens are freed.
+void fn_cache_add_keys(fn_cache_t *cache, program_t *prog, token_buf_t *tokens);
+
+// Returns fn_def's code allocated in arena and sets num_labels to how many local labels it uses, or
+// returns NULL if it isn't cached. Names in the code are interned, and they're all in fn_def's
+// tokens, so loading never adds a new one.
+output_buf_t *fn_cache_load(fn_cache_t *cache, fn_def_t *fn_def, arena_t *arena, int *num_labels);
+
+// Adds fn_def's code, whose labels start at 0, to the log. Failing to write it isn't an error, it
+// just won't be there next time.
+void fn_cache_store(fn_cache_t *cache, fn_def_t *fn_def, output_buf_t *buf, int num_labels);
+
+// Compacts the log if it's mostly entries that are never used, or too big. If fn_cache_add_keys was
+// never called, the log is left as it is.
+void fn_cache_close(fn_cache_t *cache);
+
+#endif
@@ -3,19 +3,23 @@
 
 #include <stdio.h>
 
+#include "arena.h"
 #include "list.h"
 #include "string.h"
 #include "map.h"
+#include "intern.h"
 #include "env.h"
+#include "threads.h"
 
 #include "tokenize.h"
 #include "ast.h"
 #include "asm.h"
+#include "cache.h"
+#include "obj.h"
 
 #define UNREACHABLE(msg) \
     do {\
-    printf("%s line %d: Reached unreachable branch with message - %s\n", __FILE__, __LINE__, msg);\
-    exit(-1);\
+    compile_error(__FILE__, __LINE__, msg);\
     } while(0);
 
 #ifdef DEBUG
@@ -24,14 +28,137 @@
 #define debug(...) do {} while(0)
 #endif
 
-list_t *tokenize(string_t *input);
-program_t *parse(list_t *tokens);
+// With num_threads > 1, big inputs are split into chunks that are lexed on that many threads at once.
+// Errors are reported, and NULL is returned.
+token_buf_t *tokenize(source_t *input, arena_t *arena, int num_threads);
+
+// Streaming mode's tokenizer. tokenize_next replaces the tokens with the next top-level declaration's:
+// everything up to a ; outside of any braces, or the } that closes them. The source before it is
+// released. Returns false if there's an unrecognized token, which is reported. At the end of the
+// input, there are no tokens left.
+token_stream_t *tokenize_begin(source_t *input, arena_t *arena);
+bool tokenize_next(token_stream_t *stream);
+
+// With share_exprs, identical expressions with no side effects in a function share one node. With
+// num_threads > 1, function bodies are parsed on that many threads at once. Errors are reported, and
+// NULL is returned.
+program_t *parse(token_buf_t *tokens, arena_t *arena, bool share_exprs, int num_threads);
+
+// Streaming mode's parser. parse_begin starts an empty program in arena, and parse_decl parses the
+// one declaration in tokens into it. What's only needed while the function's code is generated goes
+// in fn_arena, and its nodes are added to the end of fn_ast. That's either the program's ast, for the
+// caller to rewind, or one of the function's own that can be handed to another thread. Its names are
+// interned into the current table, which can go once the function does: the program only keeps a
+// copy of what later declarations need to know about it. Returns the function, whose body is
+// NODE_NONE if it was only declared, or NULL if there was an error, which is reported. parse_end
+// frees what the program kept, along with its ast.
+program_t *parse_begin(arena_t *arena, bool share_exprs);
+fn_def_t *parse_decl(token_buf_t *tokens, ast_t *fn_ast, arena_t *fn_arena);
+void parse_end(program_t *prog);
 
 // Allocates homes in place.
 void alloc_homes(program_t *prog);
-list_t *gen_asm(program_t *prog);
-void print_asm(list_t *output);
+void alloc_fn_homes(fn_def_t *fn_def);
+
+// With num_threads > 1, functions are generated on that many threads at once. With a cache, only
+// functions that aren't in it are generated. The code is the same either way. Some errors, like a
+// break outside of a loop, are only found here. They're reported, and NULL is returned.
+list_t *gen_asm(program_t *prog, arena_t *arena, int num_threads, fn_cache_t *cache);
+
+// gen_asm for when the code only has to be looked at once. Functions are generated a batch at a time,
+// and each one's code is handed to emit, in the order they were defined, then freed along with the
+// rest of its batch. So only one batch's code is ever held at once, however big the program. Returns
+// false if there was an error, in which case the batch it was in isn't handed over.
+bool gen_asm_each(program_t *prog, int num_threads, fn_cache_t *cache,
+                  void (*emit)(output_buf_t *buf, void *arg), void *arg);
+
+// Generates one function's code into arena, for streaming mode. Its labels are numbered on from
+// *num_labels, which is advanced past them, so functions generated one after another get the labels
+// gen_asm would have given them in that order. Returns NULL if there was an error.
+output_buf_t *gen_fn_asm(ast_t *ast, fn_def_t *fn_def, arena_t *arena, int *num_labels);
+
+// Writing output never exits. A write that fails is reported, nothing more is written, and the
+// function that finishes the output returns false.
+bool print_asm(list_t *fns, int fd);
+
+// Prints one function's code after whatever's been printed so far. print_asm_flush writes out
+// anything that's still buffered, and print_asm_discard throws it away.
+void print_fn_asm(output_buf_t *buf, int fd);
+bool print_asm_flush(void);
+void print_asm_discard(void);
+
+/*
+ * One-pass mode (--fast). Between fast_begin and fast_end, the parser calls the rest of these as it
+ * goes, and each function's code is generated while it's parsed, then printed to fd (or kept for
+ * encode if object is set) as soon as it's finished. See asm.c.
+ */
+void fast_begin(arena_t *arena, int fd, bool object);
+bool fast_enabled(void);
+
+// Returns every function's code if object was set, or NULL. Otherwise, some of what's been printed
+// may still be buffered for print_asm_flush. If parsing failed, prog is NULL, and anything that
+// hasn't been printed yet is thrown away.
+list_t *fast_end(program_t *prog);
+
+void fast_fn_begin(fn_def_t *fn_def);
+void fast_fn_end(program_t *prog);
+
+// Identifies the labels allocated so far, so a ternary's can go before its cond's
+int fast_label_mark(void);
+
+void fast_int(int val);
+void fast_var(var_info_t *var_info);
+void fast_assign_lhs(void);
+void fast_assign(var_info_t *var_info);
+void fast_call_begin(fn_def_t *fn_def);
+void fast_call_arg(int i);
+void fast_call_end(fn_def_t *fn_def);
+void fast_unary(enum unary_op op, var_info_t *var_info);
+void fast_prefix_inc(enum bin_op op, var_info_t *var_info);
+void fast_bin_lhs(enum bin_op op, int *labels);
+void fast_bin(enum bin_op op, int *labels);
+void fast_ternary_cond(int cond_mark, int *labels);
+void fast_ternary_then(int *labels);
+void fast_ternary_end(int *labels);
+
+void fast_return(void);
+void fast_jump(int label);
+void fast_declare(var_info_t *var_info);
+void fast_init(var_info_t *var_info);
+void fast_if_cond(int *labels);
+void fast_if_else(int *labels);
+void fast_if_end(int *labels, bool has_else);
+void fast_for_begin(int *labels);
+void fast_for_cond(int *labels);
+void fast_for_post(int *labels);
+void fast_for_body(void);
+void fast_for_end(int *labels);
+void fast_loop_begin(int *labels);
+void fast_while_body(int *labels);
+void fast_while_end(int *labels);
+void fast_do_end(int *labels);
+bool write_all(int fd, const char *buf, size_t len);
+
+// Assembles output ourselves instead of going through gas
+object_t *encode(list_t *fns, arena_t *arena);
+
+// Encodes a function at a time instead, for streaming mode. Each one's code is appended to an object
+// that object_new started in arena.
+object_t *object_new(arena_t *arena);
+void encode_fn(object_t *obj, output_buf_t *buf);
+bool write_elf(object_t *obj, int fd);
+
+/*
+ * Writes an object while it's still being encoded, so its code isn't all kept until the end. Start
+ * with write_elf_begin, call write_elf_text after each encode_fn, which writes out the code so far
+ * once there's a batch of it, and finish with write_elf_end, which goes back to fill in the header.
+ * That means fd has to be a file that's at its start, not a pipe, or write_elf_begin fails. They all
+ * return false if they couldn't write, after saying why.
+ */
+bool write_elf_begin(int fd);
+bool write_elf_text(object_t *obj, int fd);
+bool write_elf_end(object_t *obj, int fd);
 
-void print_token(token_t *token);
+void print_token(char *src, token_t *token);
 void print_ast(program_t *prog);
 #endif
@@ -0,0 +1,689 @@
+#include "compile.h"
+#include "compiler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Where a compile's output goes. Nothing is written to the output file itself: the output goes to a
+ * temporary file next to it, which is only renamed over it once the whole compile has worked. So a
+ * compile that fails never leaves an empty or partial file behind for a build to link. Output to
+ * stdout, or to something that's already there and isn't a regular file (like a device, a pipe or a
+ * symlink), goes straight there instead.
+ */
+typedef struct {
+    // NULL for stdout
+    char *name;
+
+    // NULL unless the output is going to a temporary file
+    char *tmp_name;
+
+    // -1 until it's opened
+    int fd;
+} output_file_t;
+
+// Makes temporary names unique between compiles running on different threads
+static atomic_uint next_tmp_name = 0;
+
+// Returns the output's fd, opening it the first time. Returns -1 if it can't be opened, which is
+// reported.
+static int open_output(output_file_t *out) {
+    if (!out->name)
+        return out->fd = STDOUT_FILENO;
+    if (out->fd >= 0)
+        return out->fd;
+
+    struct stat st;
+    if (lstat(out->name, &st) == 0 && !S_ISREG(st.st_mode)) {
+        out->fd = open(out->name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out->fd < 0)
+            fprintf(error_file(stderr), "%s: %s\n", out->name, strerror(errno));
+        return out->fd;
+    }
+
+    size_t len = strlen(out->name) + 32;
+    out->tmp_name = malloc(len);
+    snprintf(out->tmp_name, len, "%s.tmp.%d.%u", out->name, (int)getpid(),
+             atomic_fetch_add(&next_tmp_name, 1));
+    out->fd = open(out->tmp_name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out->fd < 0) {
+        fprintf(error_file(stderr), "%s: %s\n", out->name, strerror(errno));
+        free(out->tmp_name);
+        out->tmp_name = NULL;
+    }
+    return out->fd;
+}
+
+// Puts the output in place if the compile worked, or throws it away if it didn't. Returns ret, or
+// -1 if the output couldn't be put in place, which is reported.
+static int close_output(output_file_t *out, int ret) {
+    if (out->name && out->fd >= 0)
+        close(out->fd);
+    out->fd = -1;
+    if (!out->tmp_name)
+        return ret;
+    if (ret == 0 && rename(out->tmp_name, out->name) < 0) {
+        fprintf(error_file(stderr), "%s: %s\n", out->name, strerror(errno));
+        ret = -1;
+    }
+    if (ret != 0)
+        unlink(out->tmp_name);
+    free(out->tmp_name);
+    out->tmp_name = NULL;
+    return ret;
+}
+
+static bool write_object(list_t *fns, int out_fd) {
+    debug("Encoding...\n");
+    arena_t *obj_arena = arena_new();
+    bool ok = write_elf(encode(fns, obj_arena), out_fd);
+    arena_free(obj_arena);
+    return ok;
+}
+
+// Code is printed while parsing, so the output has to be open before anything is parsed
+static int compile_fast(compiler_options_t *options, source_t *input, output_file_t *out) {
+    arena_t *token_arena = arena_new();
+    arena_t *ast_arena = arena_new();
+    arena_t *instr_arena = arena_new();
+    int ret = -1;
+
+    debug("Tokenizing...\n");
+    token_buf_t *tokens = tokenize(input, token_arena, options->num_threads);
+    int out_fd = tokens && tokens->len ? open_output(out) : -1;
+    if (out_fd >= 0) {
+        debug("Parsing and generating asm...\n");
+        fast_begin(instr_arena, out_fd, options->object);
+        program_t *prog = parse(tokens, ast_arena, false, 1);
+        list_t *fns = fast_end(prog);
+        arena_free(token_arena);
+        token_arena = NULL;
+        source_close(input);
+        input = NULL;
+
+        if (prog) {
+            ast_free(prog->ast);
+            arena_free(ast_arena);
+            ast_arena = NULL;
+            if (options->object ? write_object(fns, out_fd) : print_asm_flush())
+                ret = 0;
+        }
+    }
+
+    if (input)
+        source_close(input);
+    if (token_arena)
+        arena_free(token_arena);
+    if (ast_arena)
+        arena_free(ast_arena);
+    arena_free(instr_arena);
+    return ret;
+}
+
+// Where compile sends each function's code once it's generated
+typedef struct {
+    int fd;
+
+    // NULL unless the output is an object
+    object_t *obj;
+} emit_t;
+
+static void emit_fn(output_buf_t *code, void *arg) {
+    emit_t *emit = arg;
+    if (emit->obj)
+        encode_fn(emit->obj, code);
+    else
+        print_fn_asm(code, emit->fd);
+}
+
+static bool has_code(program_t *prog) {
+    pair_t *fn_pair;
+    map_for_each(prog->fn_defs, fn_pair) {
+        if (((fn_def_t *)fn_pair->value)->body != NODE_NONE)
+            return true;
+    }
+    return false;
+}
+
+static int compile(compiler_options_t *options, source_t *input, output_file_t *out) {
+    fn_cache_t *cache = NULL;
+    if (options->cache_dir && !(cache = fn_cache_open(options->cache_dir))) {
+        source_close(input);
+        return -1;
+    }
+
+    // Each phase allocates into its own arena, which is released once the next phase is done
+    // with it. Identifiers are interned by the parser, so they outlive all of these. Code isn't
+    // kept for the whole program at all: each batch of functions is written out as soon as it's
+    // generated, and only the object being built (with -c) grows with the program.
+    arena_t *token_arena = arena_new();
+    arena_t *ast_arena = arena_new();
+
+    debug("Tokenizing...\n");
+    token_buf_t *tokens = tokenize(input, token_arena, options->num_threads);
+    program_t *prog = NULL;
+    if (tokens && tokens->len) {
+        debug("Parsing...\n");
+        prog = parse(tokens, ast_arena, options->share_exprs, options->num_threads);
+    }
+
+    // Cache keys are made from the tokens. Tokens point into the source, but nothing after this does.
+    if (prog && cache)
+        fn_cache_add_keys(cache, prog, tokens);
+    arena_free(token_arena);
+    source_close(input);
+
+    // Only create the output file once there's something to put in it
+    int ret = -1;
+    int out_fd = prog && has_code(prog) ? open_output(out) : -1;
+    if (out_fd >= 0) {
+        /*
+         * TODO - do variable allocation here.
+         */
+        debug("Allocating variable homes...\n");
+        alloc_homes(prog);
+
+        arena_t *obj_arena = options->object ? arena_new() : NULL;
+        emit_t emit = {out_fd, obj_arena ? object_new(obj_arena) : NULL};
+        debug("Generating and outputting asm...\n");
+        if (!gen_asm_each(prog, options->num_threads, cache, emit_fn, &emit))
+            print_asm_discard();
+        else if (emit.obj ? write_elf(emit.obj, out_fd) : print_asm_flush())
+            ret = 0;
+        if (obj_arena)
+            arena_free(obj_arena);
+    }
+    if (prog)
+        ast_free(prog->ast);
+    if (cache) {
+        if (prog && options->cache_stats)
+            fprintf(error_file(stderr), "cache: %d hits, %d misses\n", atomic_load(&cache->hits),
+                    atomic_load(&cache->misses));
+        fn_cache_close(cache);
+    }
+    arena_free(ast_arena);
+    return ret;
+}
+
+// Compiles a declaration at a time. Nothing about a function outlives it but what calls to it need,
+// so only the output file is opened before the input has all been read. Even its names are interned
+// into a table of its own.
+static int compile_stream(compiler_options_t *options, source_t *input, output_file_t *out) {
+    arena_t *token_arena = arena_new();
+    arena_t *program_arena = arena_new();
+    arena_t *obj_arena = options->object ? arena_new() : NULL;
+    object_t *obj = obj_arena ? object_new(obj_arena) : NULL;
+    token_stream_t *stream = tokenize_begin(input, token_arena);
+    program_t *prog = parse_begin(program_arena, options->share_exprs);
+    ast_mark_t mark = ast_mark(prog->ast);
+    int out_fd = -1;
+    int num_labels = 0;
+
+    debug("Streaming...\n");
+    bool ok;
+    while ((ok = tokenize_next(stream)) && stream->tokens->len) {
+        arena_t *fn_arena = arena_new();
+        intern_table_t *names = intern_table_new();
+        intern_table_t *prev_names = intern_use(names);
+        fn_def_t *fn_def = parse_decl(stream->tokens, prog->ast, fn_arena);
+        ok = fn_def != NULL;
+
+        if (ok && fn_def->body != NODE_NONE && out_fd < 0) {
+            // Only create the output file once there's something to put in it
+            out_fd = open_output(out);
+            ok = out_fd >= 0 && (!obj || write_elf_begin(out_fd));
+        }
+        if (ok && fn_def->body != NODE_NONE) {
+            alloc_fn_homes(fn_def);
+            arena_t *instr_arena = arena_new();
+            output_buf_t *code = gen_fn_asm(prog->ast, fn_def, instr_arena, &num_labels);
+            ok = code != NULL;
+            if (ok && obj) {
+                encode_fn(obj, code);
+                ok = write_elf_text(obj, out_fd);
+            } else if (ok) {
+                print_fn_asm(code, out_fd);
+            }
+            arena_free(instr_arena);
+        }
+        ast_rewind(prog->ast, mark);
+        arena_free(fn_arena);
+        intern_use(prev_names);
+        intern_table_free(names);
+        if (!ok)
+            break;
+    }
+
+    int ret = -1;
+    if (!ok || out_fd < 0)
+        print_asm_discard();
+    else if (obj ? write_elf_end(obj, out_fd) : print_asm_flush())
+        ret = 0;
+
+    parse_end(prog);
+    source_close(input);
+    arena_free(token_arena);
+    arena_free(program_arena);
+    if (obj_arena)
+        arena_free(obj_arena);
+    return ret;
+}
+
+// How many functions can be waiting between one pipeline stage and the next
+#define PIPELINE_QUEUE_SIZE 16
+
+// A function on its way through the pipeline. Everything it needs lives in arena, which the stage
+// that's done with it frees. After parsing it has fn_def and ast, and after codegen it has code.
+// Its names are interned in names, which emit frees once they're written out.
+typedef struct {
+    arena_t *arena;
+    intern_table_t *names;
+    fn_def_t *fn_def;
+    ast_t *ast;
+    output_buf_t *code;
+} pipeline_fn_t;
+
+typedef struct {
+    compiler_options_t *options;
+    source_t *input;
+    output_file_t *out;
+
+    // Each thread takes the next stage. The end of the input is a NULL in each queue.
+    atomic_int next_stage;
+    spsc_queue_t *to_gen;
+    spsc_queue_t *to_emit;
+
+    // Set by whichever stage fails. The stages before it stop, and the ones after throw away what
+    // they're sent.
+    atomic_bool failed;
+    int ret;
+} pipeline_t;
+
+static void pipeline_parse(pipeline_t *pipeline) {
+    arena_t *token_arena = arena_new();
+    arena_t *program_arena = arena_new();
+    token_stream_t *stream = tokenize_begin(pipeline->input, token_arena);
+    program_t *prog = parse_begin(program_arena, pipeline->options->share_exprs);
+
+    // Every function gets an ast of its own, since codegen is still reading the last one
+    while (!atomic_load(&pipeline->failed)) {
+        if (!tokenize_next(stream)) {
+            atomic_store(&pipeline->failed, true);
+            break;
+        }
+        if (!stream->tokens->len)
+            break;
+
+        arena_t *fn_arena = arena_new();
+        ast_t *fn_ast = ast_new();
+        fn_ast->share = pipeline->options->share_exprs;
+        intern_table_t *names = intern_table_new();
+        intern_table_t *prev_names = intern_use(names);
+        fn_def_t *fn_def = parse_decl(stream->tokens, fn_ast, fn_arena);
+        intern_use(prev_names);
+        if (!fn_def)
+            atomic_store(&pipeline->failed, true);
+        if (!fn_def || fn_def->body == NODE_NONE) {
+            ast_free(fn_ast);
+            arena_free(fn_arena);
+            intern_table_free(names);
+            continue;
+        }
+
+        pipeline_fn_t *fn = arena_alloc(fn_arena, sizeof(pipeline_fn_t));
+        fn->arena = fn_arena;
+        fn->names = names;
+        fn->fn_def = fn_def;
+        fn->ast = fn_ast;
+        spsc_push(pipeline->to_gen, fn);
+    }
+    spsc_push(pipeline->to_gen, NULL);
+
+    parse_end(prog);
+    source_close(pipeline->input);
+    arena_free(token_arena);
+    arena_free(program_arena);
+}
+
+static void pipeline_gen(pipeline_t *pipeline) {
+    int num_labels = 0;
+    pipeline_fn_t *fn;
+    while ((fn = spsc_pop(pipeline->to_gen))) {
+        pipeline_fn_t *out = NULL;
+        if (!atomic_load(&pipeline->failed)) {
+            arena_t *instr_arena = arena_new();
+            out = arena_alloc(instr_arena, sizeof(pipeline_fn_t));
+            out->arena = instr_arena;
+            out->names = fn->names;
+            alloc_fn_homes(fn->fn_def);
+            out->code = gen_fn_asm(fn->ast, fn->fn_def, instr_arena, &num_labels);
+            if (!out->code) {
+                atomic_store(&pipeline->failed, true);
+                arena_free(instr_arena);
+                out = NULL;
+            }
+        }
+        if (out)
+            spsc_push(pipeline->to_emit, out);
+        else
+            intern_table_free(fn->names);
+        ast_free(fn->ast);
+        arena_free(fn->arena);
+    }
+    spsc_push(pipeline->to_emit, NULL);
+}
+
+static void pipeline_emit(pipeline_t *pipeline) {
+    arena_t *obj_arena = pipeline->options->object ? arena_new() : NULL;
+    object_t *obj = obj_arena ? object_new(obj_arena) : NULL;
+    volatile int out_fd = -1;
+    pipeline_fn_t *volatile fn = NULL;
+    volatile bool drained = false;
+
+    // An error here can't jump to the thread that started the pipeline, so it just fails it. What's
+    // still on its way is thrown away as usual.
+    jmp_buf on_error;
+    error_jump_use(&on_error);
+    if (setjmp(on_error)) {
+        atomic_store(&pipeline->failed, true);
+        if (fn) {
+            intern_table_free(fn->names);
+            arena_free(fn->arena);
+        }
+    }
+    while (!drained && (fn = spsc_pop(pipeline->to_emit))) {
+        // Only create the output file once there's something to put in it
+        if (out_fd < 0 && !atomic_load(&pipeline->failed)) {
+            out_fd = open_output(pipeline->out);
+            if (out_fd < 0 || (obj && !write_elf_begin(out_fd)))
+                atomic_store(&pipeline->failed, true);
+        }
+        if (!atomic_load(&pipeline->failed)) {
+            if (obj) {
+                encode_fn(obj, fn->code);
+                if (!write_elf_text(obj, out_fd))
+                    atomic_store(&pipeline->failed, true);
+            } else {
+                print_fn_asm(fn->code, out_fd);
+            }
+        }
+        intern_table_free(fn->names);
+        arena_free(fn->arena);
+    }
+    drained = true;
+
+    pipeline->ret = -1;
+    if (atomic_load(&pipeline->failed) || out_fd < 0)
+        print_asm_discard();
+    else if (obj ? write_elf_end(obj, out_fd) : print_asm_flush())
+        pipeline->ret = 0;
+    error_jump_use(NULL);
+    if (obj_arena)
+        arena_free(obj_arena);
+}
+
+static void *pipeline_stage(void *arg) {
+    pipeline_t *pipeline = arg;
+    switch (atomic_fetch_add(&pipeline->next_stage, 1)) {
+    case 0:
+        pipeline_parse(pipeline);
+        break;
+    case 1:
+        pipeline_gen(pipeline);
+        break;
+    default:
+        pipeline_emit(pipeline);
+        break;
+    }
+    return NULL;
+}
+
+// The NULL at the end was pushed too, so there's always at least one push
+static void print_queue_stats(char *name, spsc_queue_t *queue) {
+    fprintf(error_file(stderr), "pipeline: %s queue: %zu functions, max depth %zu, mean depth %.1f\n",
+            name, queue->pushes - 1, queue->max_depth, (double)queue->depth_sum / queue->pushes);
+}
+
+// The same as compile_stream, but each of its steps is a stage on a thread of its own
+static int compile_pipeline(compiler_options_t *options, source_t *input, output_file_t *out) {
+    pipeline_t pipeline;
+    pipeline.options = options;
+    pipeline.input = input;
+    pipeline.out = out;
+    atomic_init(&pipeline.next_stage, 0);
+    atomic_init(&pipeline.failed, false);
+    pipeline.to_gen = spsc_queue_new(PIPELINE_QUEUE_SIZE);
+    pipeline.to_emit = spsc_queue_new(PIPELINE_QUEUE_SIZE);
+
+    debug("Streaming through the pipeline...\n");
+    run_threads(3, pipeline_stage, &pipeline, NULL);
+
+    if (options->pipeline_stats) {
+        FILE *f = error_file(stderr);
+        fprintf(f, "pipeline: parse stalled %zu times waiting for room\n", pipeline.to_gen->push_stalls);
+        fprintf(f, "pipeline: codegen stalled %zu times waiting for input, %zu times waiting for room\n",
+                pipeline.to_gen->pop_stalls, pipeline.to_emit->push_stalls);
+        fprintf(f, "pipeline: emit stalled %zu times waiting for input\n", pipeline.to_emit->pop_stalls);
+        print_queue_stats("codegen", pipeline.to_gen);
+        print_queue_stats("emit", pipeline.to_emit);
+    }
+    spsc_queue_free(pipeline.to_gen);
+    spsc_queue_free(pipeline.to_emit);
+    return pipeline.ret;
+}
+
+compiler_ctx_t *compiler_new(compiler_options_t *options) {
+    compiler_ctx_t *ctx = malloc(sizeof(compiler_ctx_t));
+    ctx->options = *options;
+    ctx->names = NULL;
+    ctx->errors = NULL;
+    return ctx;
+}
+
+int compiler_compile(compiler_ctx_t *ctx, char *filename, char *outfile) {
+    FILE *prev_errors = error_file_use(ctx->errors);
+    source_t *input = source_open(filename);
+    if (!input) {
+        fprintf(error_file(stderr), "%s: %s\n", filename, strerror(errno));
+        error_file_use(prev_errors);
+        return -1;
+    }
+
+    // Names are interned into a table of this compile's own, which goes away along with everything
+    // else once it's done
+    ctx->names = intern_table_new();
+    intern_table_t *prev_names = intern_use(ctx->names);
+    output_file_t out = {.name = outfile, .tmp_name = NULL, .fd = -1};
+
+    // Errors in the program are caught where they're found, so anything that gets here is a bug in
+    // the compiler. It still only fails this compile, but whatever the compile had allocated is
+    // leaked.
+    jmp_buf on_error;
+    jmp_buf *prev_jump = error_jump_use(&on_error);
+    int ret;
+    if (setjmp(on_error)) {
+        print_asm_discard();
+        ret = -1;
+    } else if (ctx->options.pipeline) {
+        ret = compile_pipeline(&ctx->options, input, &out);
+    } else if (ctx->options.stream) {
+        ret = compile_stream(&ctx->options, input, &out);
+    } else if (ctx->options.fast) {
+        ret = compile_fast(&ctx->options, input, &out);
+    } else {
+        ret = compile(&ctx->options, input, &out);
+    }
+    error_jump_use(prev_jump);
+    ret = close_output(&out, ret);
+    intern_use(prev_names);
+    intern_table_free(ctx->names);
+    ctx->names = NULL;
+    error_file_use(prev_errors);
+    return ret;
+}
+
+void compiler_free(compiler_ctx_t *ctx) {
+    free(ctx);
+}
+
+// a.c goes to a.s, or a.o for an object file. Anything else just gets the extension added.
+static char *output_name(char *filename, bool object) {
+    size_t len = strlen(filename);
+    if (len > 2 && strcmp(filename + len - 2, ".c") == 0)
+        len -= 2;
+    char *name = malloc(len + 3);
+    memcpy(name, filename, len);
+    strcpy(name + len, object ? ".o" : ".s");
+    return name;
+}
+
+typedef struct {
+    compiler_options_t options;
+    char **filenames;
+    int num_files;
+    atomic_int next;
+    atomic_bool failed;
+
+    // Held while a file's messages are printed, so they come out together
+    pthread_mutex_t report_lock;
+} batch_work_t;
+
+// Prints each line of what compiling filename printed with its name in front, unless it's already
+// there. Blank lines are left out, rather than printed as just the name.
+static void report(batch_work_t *work, char *filename, char *messages, size_t len) {
+    size_t name_len = strlen(filename);
+    pthread_mutex_lock(&work->report_lock);
+    while (len) {
+        char *end = memchr(messages, '\n', len);
+        size_t line_len = end ? (size_t)(end - messages) : len;
+        bool named = line_len > name_len && !memcmp(messages, filename, name_len) && messages[name_len] == ':';
+        if (line_len)
+            fprintf(stderr, "%s%s%.*s\n", named ? "" : filename, named ? "" : ": ", (int)line_len, messages);
+        line_len += end != NULL;
+        messages += line_len;
+        len -= line_len;
+    }
+    pthread_mutex_unlock(&work->report_lock);
+}
+
+// Compiles files until there are none left. Each file's messages are collected while it compiles,
+// and reported once it's done.
+static void *batch_worker(void *arg) {
+    batch_work_t *work = arg;
+    compiler_ctx_t *ctx = compiler_new(&work->options);
+    for (int i; (i = atomic_fetch_add(&work->next, 1)) < work->num_files;) {
+        char *filename = work->filenames[i];
+        char *outfile = output_name(filename, work->options.object);
+
+        char *messages = NULL;
+        size_t len = 0;
+        ctx->errors = open_memstream(&messages, &len);
+        if (compiler_compile(ctx, filename, outfile)) {
+            atomic_store(&work->failed, true);
+            fprintf(ctx->errors, "%s: failed\n", filename);
+        }
+        fclose(ctx->errors);
+        report(work, filename, messages, len);
+
+        free(messages);
+        free(outfile);
+    }
+    compiler_free(ctx);
+    return NULL;
+}
+
+int compiler_compile_all(compiler_options_t *options, char **filenames, int num_files) {
+    batch_work_t work;
+    work.options = *options;
+    work.options.num_threads = 1;
+    work.filenames = filenames;
+    work.num_files = num_files;
+    atomic_init(&work.next, 0);
+    atomic_init(&work.failed, false);
+    pthread_mutex_init(&work.report_lock, NULL);
+
+    int num_threads = options->num_threads;
+    if (num_threads > num_files)
+        num_threads = num_files;
+    if (num_threads < 1)
+        num_threads = 1;
+    run_threads(num_threads, batch_worker, &work, NULL);
+    pthread_mutex_destroy(&work.report_lock);
+    return atomic_load(&work.failed) ? -1 : 0;
+}
+
+static void usage(void) {
+    printf("COMPILERBABY [-c] [--share-exprs] [--fast | -O0 | --stream | --pipeline [--pipeline-stats]]\n"
+           "             [-j threads] [--cache dir [--cache-stats]] [-o outfile] <filename>\n"
+           "COMPILERBABY [options as above, but not -o] <filename> <filename>...\n"
+           "COMPILERBABY --daemon socket\n"
+           "COMPILERBABY --connect socket <arguments as above>\n");
+}
+
+int compiler_main(int argc, char **argv) {
+    compiler_options_t options;
+    options.object = false;
+    options.share_exprs = false;
+    options.fast = false;
+    options.num_threads = 1;
+    options.cache_dir = NULL;
+    options.cache_stats = false;
+    options.stream = false;
+    options.pipeline = false;
+    options.pipeline_stats = false;
+    char *outfile = NULL;
+
+    // Every argument that isn't an option is a file to compile
+    char **filenames = malloc(sizeof(char *) * (argc + 1));
+    int num_files = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            options.object = true;
+        } else if (strcmp(argv[i], "--share-exprs") == 0) {
+            options.share_exprs = true;
+        } else if (strcmp(argv[i], "--fast") == 0 || strcmp(argv[i], "-O0") == 0) {
+            options.fast = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options.stream = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            options.pipeline = true;
+        } else if (strcmp(argv[i], "--pipeline-stats") == 0) {
+            options.pipeline_stats = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.num_threads = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            options.num_threads = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            options.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            options.cache_stats = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outfile = argv[++i];
+        } else if (argv[i][0] != '-') {
+            filenames[num_files++] = argv[i];
+        } else {
+            num_files = 0;
+            break;
+        }
+    }
+
+    // Several files each get an output file of their own
+    int ret;
+    if (!num_files || (outfile && num_files > 1)) {
+        usage();
+        ret = -1;
+    } else if (num_files > 1) {
+        ret = compiler_compile_all(&options, filenames, num_files);
+    } else {
+        compiler_ctx_t *ctx = compiler_new(&options);
+        ret = compiler_compile(ctx, filenames[0], outfile);
+        compiler_free(ctx);
+    }
+    free(filenames);
+    return ret;
+}
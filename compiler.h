@@ -0,0 +1,106 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "intern.h"
+
+/*
+ * The whole compiler as a library. A compiler_ctx_t holds the options to compile with, and compiles
+ * one translation unit at a time with them, as many as you like. Everything a compile allocates is
+ * released before compiler_compile returns, whether it worked or not, so a process that stays up
+ * doesn't grow.
+ *
+ * All of the compiler's state is either per thread or belongs to the compile, so compiles can run
+ * on separate threads at once, each with its own context. A context is only used by one thread at a
+ * time.
+ *
+ * Errors in the program are reported the same way the command line compiler reports them, unless
+ * the context says to write them somewhere else, and make compiler_compile return -1. That includes
+ * the ones only codegen finds, and failing to write the output. Nothing a compile does exits the
+ * process, so it's safe to embed: even a bug in the compiler itself only fails the compile, though
+ * whatever that compile had allocated is leaked.
+ */
+typedef struct {
+    // Write an object file instead of assembly
+    bool object;
+
+    // Hash-cons identical pure expressions into one AST node
+    bool share_exprs;
+
+    // Generate each function's code while it's parsed, instead of building the whole AST first. The
+    // output is the same either way.
+    bool fast;
+
+    // Tokenize, parse and generate code on this many threads. With several files, this is how many
+    // are compiled at once instead, each on one thread.
+    int num_threads;
+
+    // If set, keep each function's code in this directory, and only generate the ones that aren't
+    // there yet. cache_stats prints how many functions were and weren't. One-pass mode doesn't use it.
+    // Every file in a batch shares the same cache as compiling them one at a time.
+    char *cache_dir;
+    bool cache_stats;
+
+    // Read, parse, generate and write out one function at a time, and forget it before the next one
+    // is read, so memory use goes with the biggest function rather than the whole input. All that's
+    // kept of each function is its name and signature, about 40 bytes, which calls to it are checked
+    // against. An object file's code is written out as it goes too, but its symbols and relocations
+    // are kept until the end, and then its header is filled in, so it has to go to a file rather than
+    // a pipe. Functions come out in the order they're defined, instead of the order they were first
+    // declared in. Overrides fast, and uses neither the cache nor more than one thread.
+    bool stream;
+
+    // Stream, but with parsing, code generation and writing the output each on a thread of its own,
+    // working on different functions at once. Each hands its functions to the next through a queue.
+    // The output is the same as stream's. pipeline_stats prints how full the queues got and how often
+    // each stage had to wait.
+    bool pipeline;
+    bool pipeline_stats;
+} compiler_options_t;
+
+typedef struct {
+    compiler_options_t options;
+
+    // Identifiers of the compile in progress. The table is made fresh for every compile.
+    intern_table_t *names;
+
+    // If set, errors in the program are written here instead of to stdout and stderr
+    FILE *errors;
+} compiler_ctx_t;
+
+// Returns a context that compiles with a copy of options
+compiler_ctx_t *compiler_new(compiler_options_t *options);
+
+// Compiles filename to outfile, or to stdout if outfile is NULL. Returns 0, or -1 if it failed.
+int compiler_compile(compiler_ctx_t *ctx, char *filename, char *outfile);
+
+void compiler_free(compiler_ctx_t *ctx);
+
+// Compiles each of filenames to an output file next to it, named after it with .c replaced by .s
+// (or .o for an object file), on options->num_threads threads at once. Each file's errors are
+// reported together, with its name in front of each line, and don't stop the rest from compiling.
+// Returns 0 if every file compiled, or -1.
+int compiler_compile_all(compiler_options_t *options, char **filenames, int num_files);
+
+// Does what the command line arguments in argv (without the program name) say, or prints how to use
+// them if they don't make sense. Returns the exit status.
+int compiler_main(int argc, char **argv);
+
+/*
+ * Compile server mode. compiler_serve listens on a Unix socket at socket_path and compiles whatever
+ * compiler_request sends it. Each connection is served by its own child process forked from the
+ * server, so no input can take the server down and a client that never sends anything doesn't hold
+ * up the rest. Only the user running the server can connect, and a client that stops sending its
+ * request for 30 seconds is dropped. A request is the same arguments the command line takes, along
+ * with the client's working directory, stdout and stderr, so errors go where they would have if
+ * the client had compiled it itself.
+ *
+ * compiler_serve only returns if it can't listen. compiler_request returns the compile's result, or
+ * -1 if it couldn't reach the server.
+ */
+int compiler_serve(char *socket_path);
+int compiler_request(char *socket_path, int argc, char **argv);
+
+#endif
@@ -0,0 +1,237 @@
+#include "compile.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * Writes an object as an ELF64 relocatable file that the system linker can take in place of the
+ * one gas would have produced. The layout is fixed:
+ *
+ *   ELF header | .text | .symtab | .strtab | .rela.text | .shstrtab | section headers
+ *
+ * Only the header depends on what comes after .text, so a streamed object is written front to back
+ * with a blank header that's filled in at the end.
+ */
+enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_RELA_TEXT,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NOTE_GNU_STACK,
+    NUM_SECS,
+};
+
+static const char *sec_names[NUM_SECS] = {
+    [SEC_NULL] = "",
+    [SEC_TEXT] = ".text",
+    [SEC_RELA_TEXT] = ".rela.text",
+    [SEC_SYMTAB] = ".symtab",
+    [SEC_STRTAB] = ".strtab",
+    [SEC_SHSTRTAB] = ".shstrtab",
+    [SEC_NOTE_GNU_STACK] = ".note.GNU-stack",
+};
+
+// Streamed .text is written out once there's at least this much of it
+#define TEXT_BATCH_LEN (64 * 1024)
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+static Elf64_Sym elf_sym(obj_sym_t *sym, Elf64_Word name) {
+    Elf64_Sym ret = {0};
+    ret.st_name = name;
+    if (sym->offset < 0) {
+        // Called but not defined here, the linker will find it
+        ret.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        ret.st_shndx = SHN_UNDEF;
+        return ret;
+    }
+    ret.st_info = ELF64_ST_INFO(sym->binding == SYM_GLOBAL ? STB_GLOBAL : STB_LOCAL, STT_FUNC);
+    ret.st_shndx = SEC_TEXT;
+    ret.st_value = sym->offset;
+    ret.st_size = sym->size;
+    return ret;
+}
+
+static bool is_local(obj_sym_t *sym) {
+    return sym->offset >= 0 && sym->binding == SYM_LOCAL;
+}
+
+static void elf_header(Elf64_Ehdr *ehdr, size_t shdrs_off) {
+    memset(ehdr, 0, sizeof(*ehdr));
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr->e_type = ET_REL;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_shoff = shdrs_off;
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_shentsize = sizeof(Elf64_Shdr);
+    ehdr->e_shnum = NUM_SECS;
+    ehdr->e_shstrndx = SEC_SHSTRTAB;
+}
+
+// Lays out everything that goes after .text, from the end of .text on, in obj's arena. Sets
+// tail_len to how long it is and shoff to where the section headers are in the file.
+static char *elf_tail(object_t *obj, size_t *tail_len, size_t *shoff) {
+    int num_syms = obj->syms->len + 1;
+
+    // String tables. Both start with an empty string so that 0 means no name.
+    size_t strtab_len = 1;
+    pair_t *pair;
+    map_for_each(obj->syms, pair) {
+        strtab_len += pair->key->len + 1;
+    }
+    size_t shstrtab_len = 0;
+    for (int i = 0; i < NUM_SECS; i++)
+        shstrtab_len += strlen(sec_names[i]) + 1;
+
+    size_t text_off = sizeof(Elf64_Ehdr);
+    size_t text_end = text_off + obj->text_len;
+    size_t symtab_off = align_up(text_end, 8);
+    size_t symtab_len = sizeof(Elf64_Sym) * num_syms;
+    size_t strtab_off = symtab_off + symtab_len;
+    size_t rela_off = align_up(strtab_off + strtab_len, 8);
+    size_t rela_len = sizeof(Elf64_Rela) * obj->num_relocs;
+    size_t shstrtab_off = rela_off + rela_len;
+    size_t shdrs_off = align_up(shstrtab_off + shstrtab_len, 8);
+    size_t file_len = shdrs_off + sizeof(Elf64_Shdr) * NUM_SECS;
+
+    *tail_len = file_len - text_end;
+    *shoff = shdrs_off;
+    char *tail = arena_alloc(obj->arena, *tail_len);
+    memset(tail, 0, *tail_len);
+
+    // ELF wants all the local symbols before the global ones
+    Elf64_Sym *syms = (Elf64_Sym *)(tail + (symtab_off - text_end));
+    char *strtab = tail + (strtab_off - text_end);
+    size_t str_pos = 1;
+    int sym_index = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        map_for_each(obj->syms, pair) {
+            obj_sym_t *sym = pair->value;
+            if (is_local(sym) != (pass == 0))
+                continue;
+            memcpy(strtab + str_pos, sym->name->buf, sym->name->len);
+            syms[sym_index] = elf_sym(sym, str_pos);
+            sym->index = sym_index++;
+            str_pos += sym->name->len + 1;
+        }
+    }
+    int first_global = 1;
+    map_for_each(obj->syms, pair) {
+        if (is_local(pair->value))
+            first_global++;
+    }
+
+    Elf64_Rela *relas = (Elf64_Rela *)(tail + (rela_off - text_end));
+    for (int i = 0; i < obj->num_relocs; i++) {
+        obj_reloc_t *reloc = &obj->relocs[i];
+        relas[i].r_offset = reloc->offset;
+        relas[i].r_info = ELF64_R_INFO(reloc->sym->index, R_X86_64_PLT32);
+        relas[i].r_addend = reloc->addend;
+    }
+
+    Elf64_Shdr *shdrs = (Elf64_Shdr *)(tail + (shdrs_off - text_end));
+    char *shstrtab = tail + (shstrtab_off - text_end);
+    size_t shstr_pos = 0;
+    for (int i = 0; i < NUM_SECS; i++) {
+        size_t len = strlen(sec_names[i]);
+        memcpy(shstrtab + shstr_pos, sec_names[i], len);
+        shdrs[i].sh_name = shstr_pos;
+        shstr_pos += len + 1;
+    }
+
+    shdrs[SEC_TEXT].sh_type = SHT_PROGBITS;
+    shdrs[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    shdrs[SEC_TEXT].sh_offset = text_off;
+    shdrs[SEC_TEXT].sh_size = obj->text_len;
+    shdrs[SEC_TEXT].sh_addralign = 1;
+
+    shdrs[SEC_RELA_TEXT].sh_type = SHT_RELA;
+    shdrs[SEC_RELA_TEXT].sh_flags = SHF_INFO_LINK;
+    shdrs[SEC_RELA_TEXT].sh_offset = rela_off;
+    shdrs[SEC_RELA_TEXT].sh_size = rela_len;
+    shdrs[SEC_RELA_TEXT].sh_link = SEC_SYMTAB;
+    shdrs[SEC_RELA_TEXT].sh_info = SEC_TEXT;
+    shdrs[SEC_RELA_TEXT].sh_addralign = 8;
+    shdrs[SEC_RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+
+    shdrs[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    shdrs[SEC_SYMTAB].sh_offset = symtab_off;
+    shdrs[SEC_SYMTAB].sh_size = symtab_len;
+    shdrs[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    shdrs[SEC_SYMTAB].sh_info = first_global;
+    shdrs[SEC_SYMTAB].sh_addralign = 8;
+    shdrs[SEC_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+
+    shdrs[SEC_STRTAB].sh_type = SHT_STRTAB;
+    shdrs[SEC_STRTAB].sh_offset = strtab_off;
+    shdrs[SEC_STRTAB].sh_size = strtab_len;
+    shdrs[SEC_STRTAB].sh_addralign = 1;
+
+    shdrs[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+    shdrs[SEC_SHSTRTAB].sh_offset = shstrtab_off;
+    shdrs[SEC_SHSTRTAB].sh_size = shstrtab_len;
+    shdrs[SEC_SHSTRTAB].sh_addralign = 1;
+
+    // Empty, but its presence tells the linker we don't need an executable stack
+    shdrs[SEC_NOTE_GNU_STACK].sh_type = SHT_PROGBITS;
+    shdrs[SEC_NOTE_GNU_STACK].sh_offset = shstrtab_off;
+    shdrs[SEC_NOTE_GNU_STACK].sh_addralign = 1;
+
+    return tail;
+}
+
+bool write_elf(object_t *obj, int fd) {
+    size_t tail_len, shoff;
+    char *tail = elf_tail(obj, &tail_len, &shoff);
+    Elf64_Ehdr ehdr;
+    elf_header(&ehdr, shoff);
+    return write_all(fd, (char *)&ehdr, sizeof(ehdr)) && write_all(fd, (char *)obj->text, obj->text_len)
+           && write_all(fd, tail, tail_len);
+}
+
+bool write_elf_begin(int fd) {
+    if (lseek(fd, 0, SEEK_CUR) != 0) {
+        fprintf(error_file(stderr), "can't stream an object file to output that can't be rewound, "
+                "like a pipe\n");
+        return false;
+    }
+    Elf64_Ehdr ehdr = {0};
+    return write_all(fd, (char *)&ehdr, sizeof(ehdr));
+}
+
+// Writes out all the text that hasn't been yet
+static bool write_elf_rest_of_text(object_t *obj, int fd) {
+    size_t len = obj->text_len - obj->text_base;
+    obj->text_base = obj->text_len;
+    return write_all(fd, (char *)obj->text, len);
+}
+
+bool write_elf_text(object_t *obj, int fd) {
+    return obj->text_len - obj->text_base < TEXT_BATCH_LEN || write_elf_rest_of_text(obj, fd);
+}
+
+bool write_elf_end(object_t *obj, int fd) {
+    size_t tail_len, shoff;
+    if (!write_elf_rest_of_text(obj, fd))
+        return false;
+    char *tail = elf_tail(obj, &tail_len, &shoff);
+    Elf64_Ehdr ehdr;
+    elf_header(&ehdr, shoff);
+    if (!write_all(fd, tail, tail_len))
+        return false;
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        fprintf(error_file(stderr), "write failed: %s\n", strerror(errno));
+        return false;
+    }
+    return write_all(fd, (char *)&ehdr, sizeof(ehdr));
+}
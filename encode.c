@@ -0,0 +1,510 @@
+#include "compile.h"
+#include <limits.h>
+
+/*
+ * Encodes the output of gen_asm straight into x86-64 machine code, without going through the
+ * assembler. Jumps only ever target local labels in the same program, so they are resolved here.
+ * Calls go through a relocation against the function's symbol, the same way gas would emit them.
+ */
+
+// Hardware register numbers, indexed by reg_t
+static const uint8_t reg_nums[] = {
+    [REG_RAX] = 0,
+    [REG_RCX] = 1,
+    [REG_RDX] = 2,
+    [REG_RBX] = 3,
+    [REG_RSP] = 4,
+    [REG_RBP] = 5,
+    [REG_RSI] = 6,
+    [REG_RDI] = 7,
+    [REG_R8] = 8,
+    [REG_R9] = 9,
+    [REG_R10] = 10,
+    [REG_R11] = 11,
+    [REG_R12] = 12,
+    [REG_R13] = 13,
+    [REG_R14] = 14,
+    [REG_R15] = 15,
+    [REG_AL] = 0,
+};
+
+#define REX_W (0x48)
+#define REX_R (0x04)
+#define REX_B (0x01)
+
+// Longest instruction we ever encode is movabs, at 10 bytes
+#define MAX_INSN_LEN (16)
+
+// Short jumps are 2 bytes, long ones are 5 (jmp) or 6 (jcc)
+#define SHORT_JUMP_LEN (2)
+
+typedef struct {
+    uint8_t bytes[MAX_INSN_LEN];
+    int len;
+} insn_t;
+
+typedef struct {
+    output_t *out;
+    int64_t offset;
+    int len;
+
+    // only for jumps
+    bool is_long;
+} item_t;
+
+static void put8(insn_t *insn, uint8_t byte) {
+    insn->bytes[insn->len++] = byte;
+}
+
+static void put32(insn_t *insn, int32_t value) {
+    uint32_t v = (uint32_t)value;
+    for (int i = 0; i < 4; i++)
+        put8(insn, (v >> (8 * i)) & 0xff);
+}
+
+static void put64(insn_t *insn, int64_t value) {
+    uint64_t v = (uint64_t)value;
+    for (int i = 0; i < 8; i++)
+        put8(insn, (v >> (8 * i)) & 0xff);
+}
+
+static bool fits_in_8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits_in_32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static uint8_t reg_num(reg_t reg) {
+    if (reg >= sizeof(reg_nums) / sizeof(reg_nums[0]) || (reg != REG_RAX && reg != REG_AL && !reg_nums[reg])) {
+        UNREACHABLE("reg_num: unknown register\n");
+    }
+    return reg_nums[reg];
+}
+
+// REX.W prefix + opcode + ModRM for a register (reg field) and register/memory (rm field) pair
+static void put_modrm_reg(insn_t *insn, int opcode_len, const uint8_t *opcode, int reg, int rm) {
+    put8(insn, REX_W | ((reg & 8) ? REX_R : 0) | ((rm & 8) ? REX_B : 0));
+    for (int i = 0; i < opcode_len; i++)
+        put8(insn, opcode[i]);
+    put8(insn, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void put_modrm_mem(insn_t *insn, int opcode_len, const uint8_t *opcode, int reg, mem_loc_t mem) {
+    int base = reg_num(mem.reg);
+    if (!fits_in_32(mem.offset)) {
+        UNREACHABLE("put_modrm_mem: memory offset doesn't fit in 32 bits\n");
+    }
+
+    put8(insn, REX_W | ((reg & 8) ? REX_R : 0) | ((base & 8) ? REX_B : 0));
+    for (int i = 0; i < opcode_len; i++)
+        put8(insn, opcode[i]);
+
+    // rbp/r13 can't be used without a displacement, since that encoding means rip relative
+    int mod;
+    if (mem.offset == 0 && (base & 7) != 5)
+        mod = 0x00;
+    else if (fits_in_8(mem.offset))
+        mod = 0x40;
+    else
+        mod = 0x80;
+    put8(insn, mod | ((reg & 7) << 3) | (base & 7));
+
+    // rsp/r12 as a base need a SIB byte
+    if ((base & 7) == 4)
+        put8(insn, 0x24);
+
+    if (mod == 0x40)
+        put8(insn, (uint8_t)mem.offset);
+    else if (mod == 0x80)
+        put32(insn, (int32_t)mem.offset);
+}
+
+// Encodes the rm operand of an instruction, which is either a register or a memory location
+static void put_modrm(insn_t *insn, int opcode_len, const uint8_t *opcode, int reg, operand_t rm) {
+    if (rm.type == OPERAND_REG) {
+        put_modrm_reg(insn, opcode_len, opcode, reg, reg_num(rm.reg));
+    } else if (rm.type == OPERAND_MEM_LOC) {
+        put_modrm_mem(insn, opcode_len, opcode, reg, rm.mem);
+    } else {
+        UNREACHABLE("put_modrm: operand must be a register or memory location\n");
+    }
+}
+
+// Group 1 instructions (add/sub/cmp) all share encodings, and are only told apart by these
+typedef struct {
+    uint8_t rm_reg;
+    uint8_t ext;
+} alu_op_t;
+
+static bool alu_op(opcode_t op, alu_op_t *alu) {
+    switch (op) {
+        case OP_ADD:
+            *alu = (alu_op_t){.rm_reg = 0x01, .ext = 0};
+            return true;
+        case OP_SUB:
+            *alu = (alu_op_t){.rm_reg = 0x29, .ext = 5};
+            return true;
+        case OP_CMP:
+            *alu = (alu_op_t){.rm_reg = 0x39, .ext = 7};
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint8_t setcc_opcode(opcode_t op) {
+    switch (op) {
+        case OP_SETE: return 0x94;
+        case OP_SETNE: return 0x95;
+        case OP_SETL: return 0x9c;
+        case OP_SETGE: return 0x9d;
+        case OP_SETLE: return 0x9e;
+        case OP_SETG: return 0x9f;
+        default:
+            UNREACHABLE("setcc_opcode: not a setcc\n");
+    }
+    return 0;
+}
+
+static void encode_two(insn_t *insn, instr_t *instr) {
+    operand_t src = instr->src;
+    operand_t dst = instr->dst;
+    alu_op_t alu;
+
+    if (instr->op == OP_MOV) {
+        if (src.type == OPERAND_REG) {
+            put_modrm(insn, 1, (uint8_t[]){0x89}, reg_num(src.reg), dst);
+        } else if (src.type == OPERAND_MEM_LOC && dst.type == OPERAND_REG) {
+            put_modrm_mem(insn, 1, (uint8_t[]){0x8b}, reg_num(dst.reg), src.mem);
+        } else if (src.type == OPERAND_IMM && fits_in_32(src.imm)) {
+            put_modrm(insn, 1, (uint8_t[]){0xc7}, 0, dst);
+            put32(insn, (int32_t)src.imm);
+        } else if (src.type == OPERAND_IMM && dst.type == OPERAND_REG) {
+            // movabs
+            int r = reg_num(dst.reg);
+            put8(insn, REX_W | ((r & 8) ? REX_B : 0));
+            put8(insn, 0xb8 + (r & 7));
+            put64(insn, src.imm);
+        } else {
+            UNREACHABLE("encode_two: unsupported mov operands\n");
+        }
+        return;
+    }
+
+    if (alu_op(instr->op, &alu)) {
+        if (src.type == OPERAND_REG) {
+            put_modrm(insn, 1, &alu.rm_reg, reg_num(src.reg), dst);
+        } else if (src.type == OPERAND_IMM && fits_in_8(src.imm)) {
+            put_modrm(insn, 1, (uint8_t[]){0x83}, alu.ext, dst);
+            put8(insn, (uint8_t)src.imm);
+        } else if (src.type == OPERAND_IMM && fits_in_32(src.imm)) {
+            put_modrm(insn, 1, (uint8_t[]){0x81}, alu.ext, dst);
+            put32(insn, (int32_t)src.imm);
+        } else {
+            UNREACHABLE("encode_two: unsupported operands\n");
+        }
+        return;
+    }
+
+    if (src.type != OPERAND_REG || dst.type != OPERAND_REG) {
+        UNREACHABLE("encode_two: expected register operands\n");
+    }
+
+    if (instr->op == OP_MUL) {
+        // imul src, dst computes dst *= src, and the destination goes in the reg field
+        put_modrm_reg(insn, 2, (uint8_t[]){0x0f, 0xaf}, reg_num(dst.reg), reg_num(src.reg));
+        return;
+    }
+
+    if (instr->op == OP_XCHG) {
+        // Swapping with rax has its own one byte opcode
+        if (src.reg == REG_RAX || dst.reg == REG_RAX) {
+            int r = reg_num(src.reg == REG_RAX ? dst.reg : src.reg);
+            put8(insn, REX_W | ((r & 8) ? REX_B : 0));
+            put8(insn, 0x90 + (r & 7));
+            return;
+        }
+        put_modrm_reg(insn, 1, (uint8_t[]){0x87}, reg_num(src.reg), reg_num(dst.reg));
+        return;
+    }
+
+    UNREACHABLE("encode_two: unknown opcode\n");
+}
+
+static void encode_one(insn_t *insn, instr_t *instr) {
+    operand_t src = instr->src;
+    switch (instr->op) {
+        case OP_PUSH:
+        case OP_POP: {
+            int r = reg_num(src.reg);
+            if (r & 8)
+                put8(insn, 0x40 | REX_B);
+            put8(insn, (instr->op == OP_PUSH ? 0x50 : 0x58) + (r & 7));
+            return;
+        }
+        case OP_NEG:
+            put_modrm(insn, 1, (uint8_t[]){0xf7}, 3, src);
+            return;
+        case OP_NOT:
+            put_modrm(insn, 1, (uint8_t[]){0xf7}, 2, src);
+            return;
+        case OP_DIV:
+            put_modrm(insn, 1, (uint8_t[]){0xf7}, 7, src);
+            return;
+        case OP_SETE:
+        case OP_SETNE:
+        case OP_SETL:
+        case OP_SETLE:
+        case OP_SETG:
+        case OP_SETGE:
+            // Only ever used with al, which doesn't need a REX prefix
+            if (src.type != OPERAND_REG || src.reg != REG_AL) {
+                UNREACHABLE("encode_one: setcc only supports %al\n");
+            }
+            put8(insn, 0x0f);
+            put8(insn, setcc_opcode(instr->op));
+            put8(insn, 0xc0);
+            return;
+        case OP_CALL:
+            // Displacement is filled in by the linker
+            put8(insn, 0xe8);
+            put32(insn, 0);
+            return;
+        default:
+            UNREACHABLE("encode_one: unknown opcode\n");
+    }
+}
+
+// Encodes anything that isn't a jump, since those depend on where everything else ends up
+static void encode_instr(insn_t *insn, instr_t *instr) {
+    insn->len = 0;
+    if (instr->num_args == 2) {
+        encode_two(insn, instr);
+    } else if (instr->num_args == 1) {
+        encode_one(insn, instr);
+    } else if (instr->op == OP_RET) {
+        put8(insn, 0xc3);
+    } else if (instr->op == OP_CQO) {
+        put8(insn, REX_W);
+        put8(insn, 0x99);
+    } else {
+        UNREACHABLE("encode_instr: unknown opcode\n");
+    }
+}
+
+static bool is_jump(output_t *out) {
+    return out->type == OUTPUT_INSTR && out->instr.num_args == 1 && out->instr.src.type == OPERAND_LOCAL_LABEL;
+}
+
+static void encode_jump(insn_t *insn, opcode_t op, bool is_long, int64_t disp) {
+    insn->len = 0;
+    if (!is_long) {
+        put8(insn, op == OP_JMP ? 0xeb : op == OP_JE ? 0x74 : 0x75);
+        put8(insn, (uint8_t)disp);
+        return;
+    }
+
+    if (op == OP_JMP) {
+        put8(insn, 0xe9);
+    } else {
+        put8(insn, 0x0f);
+        put8(insn, op == OP_JE ? 0x84 : 0x85);
+    }
+    put32(insn, (int32_t)disp);
+}
+
+static int long_jump_len(opcode_t op) {
+    return op == OP_JMP ? 5 : 6;
+}
+
+static obj_sym_t *get_sym(object_t *obj, string_t *name) {
+    obj_sym_t *sym = map_get(obj->syms, name);
+    if (sym)
+        return sym;
+
+    // The name is copied, since the object can outlive the names the code was generated with
+    string_t *copy = string_new_in(obj->arena);
+    string_append(copy, name->buf, name->len);
+    sym = arena_alloc(obj->arena, sizeof(obj_sym_t));
+    sym->name = copy;
+    sym->offset = -1;
+    sym->size = 0;
+    sym->binding = SYM_GLOBAL;
+    sym->index = 0;
+    map_set(obj->syms, copy, sym);
+    return sym;
+}
+
+static void add_reloc(object_t *obj, int64_t offset, obj_sym_t *sym, int64_t addend) {
+    if (obj->num_relocs >= obj->relocs_capacity) {
+        int capacity = obj->relocs_capacity ? obj->relocs_capacity * 2 : 16;
+        obj->relocs = arena_realloc(obj->arena, obj->relocs, sizeof(obj_reloc_t) * obj->relocs_capacity,
+                                    sizeof(obj_reloc_t) * capacity);
+        obj->relocs_capacity = capacity;
+    }
+    obj->relocs[obj->num_relocs++] = (obj_reloc_t){.offset = offset, .sym = sym, .addend = addend};
+}
+
+// Lays out items, returning the total code size. Label offsets are filled in as we go.
+static int64_t layout(item_t *items, int num_items, int64_t *label_offsets) {
+    int64_t offset = 0;
+    for (int i = 0; i < num_items; i++) {
+        items[i].offset = offset;
+        output_t *out = items[i].out;
+        if (out->type == OUTPUT_LABEL && out->label.linkage == LABEL_LOCAL)
+            label_offsets[out->label.id] = offset;
+        offset += items[i].len;
+    }
+    return offset;
+}
+
+object_t *object_new(arena_t *arena) {
+    object_t *obj = arena_alloc(arena, sizeof(object_t));
+    obj->arena = arena;
+    obj->text = NULL;
+    obj->text_base = 0;
+    obj->text_len = 0;
+    obj->text_capacity = 0;
+    obj->syms = map_new_in(arena);
+    obj->relocs = NULL;
+    obj->num_relocs = 0;
+    obj->relocs_capacity = 0;
+    return obj;
+}
+
+// Appends len more bytes of text to obj, and returns where they go
+static uint8_t *text_push(object_t *obj, int64_t len) {
+    size_t used = obj->text_len - obj->text_base;
+    if (used + len > obj->text_capacity) {
+        size_t capacity = obj->text_capacity ? obj->text_capacity : 256;
+        while (capacity < used + len)
+            capacity *= 2;
+        obj->text = arena_realloc(obj->arena, obj->text, obj->text_capacity, capacity);
+        obj->text_capacity = capacity;
+    }
+    obj->text_len += len;
+    return obj->text + used;
+}
+
+// Jumps never leave the function they're in, so each function is laid out on its own, with offsets
+// from its start. It comes out the same as it would have as part of the whole program.
+void encode_fn(object_t *obj, output_buf_t *buf) {
+    item_t *items = malloc(sizeof(item_t) * (buf->len ? buf->len : 1));
+    int min_label = INT_MAX;
+    int max_label = -1;
+    insn_t insn;
+
+    // Size everything, assuming all jumps are short for now
+    for (int i = 0; i < buf->len; i++) {
+        output_t *out = &buf->outputs[i];
+        item_t *item = &items[i];
+        item->out = out;
+        item->is_long = false;
+        if (out->type == OUTPUT_LABEL) {
+            item->len = 0;
+            if (out->label.linkage == LABEL_LOCAL) {
+                if (out->label.id > max_label)
+                    max_label = out->label.id;
+                if (out->label.id < min_label)
+                    min_label = out->label.id;
+            } else {
+                obj_sym_t *sym = get_sym(obj, out->label.name);
+                sym->binding = out->label.linkage == LABEL_GLOBAL ? SYM_GLOBAL : SYM_LOCAL;
+            }
+        } else if (is_jump(out)) {
+            item->len = SHORT_JUMP_LEN;
+            if (out->instr.src.local_label > max_label)
+                max_label = out->instr.src.local_label;
+            if (out->instr.src.local_label < min_label)
+                min_label = out->instr.src.local_label;
+        } else {
+            encode_instr(&insn, &out->instr);
+            item->len = insn.len;
+        }
+    }
+
+    // Indexed by label id from min_label
+    if (max_label < 0)
+        min_label = 0;
+    int num_labels = max_label - min_label + 1;
+    int64_t *label_offsets = malloc(sizeof(int64_t) * (num_labels ? num_labels : 1));
+    for (int i = 0; i < num_labels; i++)
+        label_offsets[i] = -1;
+
+    // Growing a jump can only push other jumps further from their targets, so keep widening the
+    // ones that don't fit until nothing changes.
+    int64_t text_len;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        text_len = layout(items, buf->len, label_offsets - min_label);
+        for (int i = 0; i < buf->len; i++) {
+            if (!is_jump(items[i].out) || items[i].is_long)
+                continue;
+
+            int64_t target = label_offsets[items[i].out->instr.src.local_label - min_label];
+            if (target < 0) {
+                UNREACHABLE("encode: jump to a label that was never placed\n");
+            }
+            if (!fits_in_8(target - (items[i].offset + SHORT_JUMP_LEN))) {
+                items[i].is_long = true;
+                items[i].len = long_jump_len(items[i].out->instr.op);
+                changed = true;
+            }
+        }
+    }
+
+    int64_t start = obj->text_len;
+    uint8_t *text = text_push(obj, text_len);
+    obj_sym_t *curr_fn = NULL;
+    for (int i = 0; i < buf->len; i++) {
+        item_t *item = &items[i];
+        output_t *out = item->out;
+        if (out->type == OUTPUT_LABEL) {
+            if (out->label.linkage == LABEL_LOCAL)
+                continue;
+
+            // Functions run until the next one starts
+            if (curr_fn)
+                curr_fn->size = start + item->offset - curr_fn->offset;
+            curr_fn = get_sym(obj, out->label.name);
+            curr_fn->offset = start + item->offset;
+            continue;
+        }
+
+        if (is_jump(out)) {
+            int64_t target = label_offsets[out->instr.src.local_label - min_label];
+            encode_jump(&insn, out->instr.op, item->is_long, target - (item->offset + item->len));
+        } else {
+            encode_instr(&insn, &out->instr);
+            if (out->instr.op == OP_CALL) {
+                // The displacement is relative to the end of the instruction, which is 4 bytes
+                // after where the relocation is applied
+                add_reloc(obj, start + item->offset + 1, get_sym(obj, out->instr.src.label), -4);
+            }
+        }
+
+        if (insn.len != item->len) {
+            UNREACHABLE("encode: instruction changed size after layout\n");
+        }
+        memcpy(text + item->offset, insn.bytes, insn.len);
+    }
+    if (curr_fn)
+        curr_fn->size = start + text_len - curr_fn->offset;
+
+    free(items);
+    free(label_offsets);
+}
+
+// Encodes the output_buf_t for each function in fns into machine code. The object and everything in
+// it is allocated in arena.
+object_t *encode(list_t *fns, arena_t *arena) {
+    object_t *obj = object_new(arena);
+    output_buf_t *buf;
+    list_for_each(fns, buf) {
+        encode_fn(obj, buf);
+    }
+    return obj;
+}
@@ -1,43 +1,95 @@
 #include "env.h"
 
-env_t *env_new(env_t *parent) {
-    env_t *new_env = malloc(sizeof(env_t));
+#define ENV_DEFAULT_CAPACITY (16)
+
+// Makes room for one more element in the array at *items, doubling it if it's full
+static void *grow(arena_t *arena, void *items, int len, int *capacity, size_t size) {
+    if (len < *capacity)
+        return items;
+    int new_capacity = *capacity ? *capacity * 2 : ENV_DEFAULT_CAPACITY;
+    items = arena_realloc(arena, items, size * *capacity, size * new_capacity);
+    *capacity = new_capacity;
+    return items;
+}
+
+env_t *env_new(arena_t *arena) {
+    env_t *new_env = arena_alloc(arena, sizeof(env_t));
     if (!new_env)
         return NULL;
 
-    new_env->parent = parent;
-    new_env->children = list_new();
-    new_env->homes = map_new();
+    new_env->arena = arena;
+    new_env->bindings = map_new_in(arena);
+    new_env->undo = NULL;
+    new_env->undo_len = 0;
+    new_env->undo_capacity = 0;
+    new_env->open = NULL;
+    new_env->depth = 0;
+    new_env->depth_capacity = 0;
+    new_env->fn = NULL;
+    return new_env;
+}
 
-    if (parent)
-        list_push(parent->children, new_env);
+var_table_t *env_push_fn(env_t *env) {
+    var_table_t *table = arena_alloc(env->arena, sizeof(var_table_t));
+    table->vars = NULL;
+    table->num_vars = 0;
+    table->vars_capacity = 0;
+    table->scopes = NULL;
+    table->num_scopes = 0;
+    table->scopes_capacity = 0;
 
-    return new_env;
+    env->fn = table;
+    env_push_scope(env);
+    return table;
 }
 
-var_info_t *env_get(env_t *env, string_t *var) {
-    var_info_t *ret = NULL;
-    while (env) {
-        if ((ret = map_get(env->homes, var)))
-            return ret;
-        env = env->parent;
-    }
-    return NULL;
+void env_push_scope(env_t *env) {
+    var_table_t *fn = env->fn;
+    int parent = env->depth ? env->open[env->depth - 1].id : -1;
+
+    fn->scopes = grow(env->arena, fn->scopes, fn->num_scopes, &fn->scopes_capacity, sizeof(scope_t));
+    fn->scopes[fn->num_scopes].parent = parent;
+    fn->scopes[fn->num_scopes].num_vars = 0;
+
+    env->open = grow(env->arena, env->open, env->depth, &env->depth_capacity, sizeof(open_scope_t));
+    env->open[env->depth].undo_mark = env->undo_len;
+    env->open[env->depth].id = fn->num_scopes++;
+    env->depth++;
 }
 
-var_info_t *env_get_declared(env_t *env, string_t *var) {
-    var_info_t *ret = NULL;
-    while (env) {
-        if ((ret = map_get(env->homes, var)) && ret->declared)
-            return ret;
-        env = env->parent;
+void env_pop_scope(env_t *env) {
+    int mark = env->open[--env->depth].undo_mark;
+    while (env->undo_len > mark) {
+        var_info_t *var = env->undo[--env->undo_len];
+        map_set(env->bindings, var->name, var->shadowed);
     }
-    return NULL;
 }
 
-void env_add(env_t *env, string_t *name, builtin_type_t type, bool declared) {
-    var_info_t *info = malloc(sizeof(var_info_t)); 
+var_info_t *env_get(env_t *env, string_t *var) {
+    return map_get(env->bindings, var);
+}
+
+bool env_in_scope(env_t *env, string_t *var) {
+    var_info_t *info = env_get(env, var);
+    return info && env->depth && info->scope == env->open[env->depth - 1].id;
+}
+
+var_info_t *env_add(env_t *env, string_t *name, builtin_type_t type, bool declared) {
+    var_table_t *fn = env->fn;
+    var_info_t *info = arena_alloc(env->arena, sizeof(var_info_t));
     info->type = type;
     info->declared = declared;
-    map_set(env->homes, name, info);
+    info->name = name;
+    info->scope = env->open[env->depth - 1].id;
+    info->shadowed = env_get(env, name);
+    map_set(env->bindings, name, info);
+
+    env->undo = grow(env->arena, env->undo, env->undo_len, &env->undo_capacity, sizeof(var_info_t *));
+    env->undo[env->undo_len++] = info;
+
+    fn->vars = grow(env->arena, fn->vars, fn->num_vars, &fn->vars_capacity, sizeof(var_info_t *));
+    info->index = fn->num_vars;
+    fn->vars[fn->num_vars++] = info;
+    fn->scopes[info->scope].num_vars++;
+    return info;
 }
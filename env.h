@@ -13,33 +13,89 @@ typedef enum {
     TYPE_VOID,
 } builtin_type_t;
 
-typedef struct {
+typedef struct var_info {
     builtin_type_t type;
     mem_loc_t home;
     bool declared;
+
+    string_t *name;
+
+    // index of this var and of the scope it was declared in, in its function's var_table_t
+    int index;
+    int scope;
+
+    // The variable with the same name that this one shadows, if any. It becomes visible again
+    // when this one's scope is popped.
+    struct var_info *shadowed;
 } var_info_t;
 
-// An environment contains all the variable idents mapped to their types in the current scope
-// The pointer to the parent scope lets the user search other scopes to see if a variable is defined
-// The list of children environments is useful for allocating homes.
+typedef struct {
+    // -1 for the function's outermost scope
+    int parent;
+    int num_vars;
+} scope_t;
+
+// Every variable in a function, and the scopes they were declared in. Scopes are numbered in the
+// order they were opened, so a scope always comes after its parent. Variables are in the order
+// they were declared. This is all alloc_homes needs to lay out the stack frame.
+typedef struct {
+    var_info_t **vars;
+    int num_vars;
+    int vars_capacity;
+
+    scope_t *scopes;
+    int num_scopes;
+    int scopes_capacity;
+} var_table_t;
+
+typedef struct {
+    // length of the undo log when the scope was opened
+    int undo_mark;
+
+    // index in the function's var_table_t
+    int id;
+} open_scope_t;
+
+// The environment is a single symbol table for the whole parse. Each name maps to its innermost
+// visible variable, and entering a scope just records where the undo log is. Leaving a scope walks
+// the log back to there and restores whatever each variable shadowed, so looking a name up is one
+// hash table probe no matter how deeply scopes are nested.
 typedef struct env {
-    // Maps from var name (string) to var_t type, which contains home info.
-    map_t *homes;
-    list_t *children; // list of children environments
-    struct env *parent;
+    // Maps from var name (string) to the innermost var_info_t with that name, or NULL
+    map_t *bindings;
+
+    // every variable added in a scope that's still open, oldest first
+    var_info_t **undo;
+    int undo_len;
+    int undo_capacity;
+
+    // innermost open scope last
+    open_scope_t *open;
+    int depth;
+    int depth_capacity;
+
+    // function currently being parsed
+    var_table_t *fn;
+
+    // where everything above is allocated
+    arena_t *arena;
 } env_t;
 
-env_t *env_new(env_t *parent);
+env_t *env_new(arena_t *arena);
+
+// Starts a new function whose variables go in a new var_table_t, and opens its outermost scope.
+var_table_t *env_push_fn(env_t *env);
+
+void env_push_scope(env_t *env);
+void env_pop_scope(env_t *env);
 
-// Searches for var in current env. If not found, keeps checking parents until it is found or
-// we run out of envs.
+// Returns the innermost visible var, or NULL if there isn't one.
 var_info_t *env_get(env_t *env, string_t *var);
 
-// Searches for first declared var starting in current env. If not found, keeps checking
-// parents until it is found or we run out of envs. If it is found but undeclared, keeps searching.
-var_info_t *env_get_declared(env_t *env, string_t *var);
+// Returns true if var was declared in the innermost scope.
+bool env_in_scope(env_t *env, string_t *var);
 
-// Adds var to env at current level. 
-void env_add(env_t *env, string_t *var, builtin_type_t type, bool declared);
+// Adds var to env at current level and returns its info.
+var_info_t *env_add(env_t *env, string_t *var, builtin_type_t type, bool declared);
 
 #endif
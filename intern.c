@@ -0,0 +1,55 @@
+#include "intern.h"
+#include "map.h"
+
+// Maps each spelling to its canonical string_t
+static _Thread_local intern_table_t *intern_table = NULL;
+
+intern_table_t *intern_table_new(void) {
+    intern_table_t *table = malloc(sizeof(intern_table_t));
+    table->arena = arena_new();
+    table->map = map_new_in(table->arena);
+    return table;
+}
+
+void intern_table_free(intern_table_t *table) {
+    if (!table)
+        return;
+    arena_free(table->arena);
+    free(table);
+}
+
+intern_table_t *intern_use(intern_table_t *table) {
+    intern_table_t *prev = intern_table;
+    intern_table = table;
+    return prev;
+}
+
+intern_table_t *intern_current(void) {
+    if (!intern_table)
+        intern_table = intern_table_new();
+    return intern_table;
+}
+
+string_t *intern(char *s, int len) {
+    intern_table_t *table = intern_current();
+
+    // Wrap the characters in a temporary string so we can look them up without copying
+    string_t lookup = {.buf = s, .len = len, .hash = 0};
+    string_t *ret = map_get(table->map, &lookup);
+    if (ret)
+        return ret;
+
+    ret = arena_alloc(table->arena, sizeof(string_t));
+    ret->buf = arena_alloc(table->arena, len + 1);
+    for (int i = 0; i < len; i++)
+        ret->buf[i] = s[i];
+
+    // Keep a terminator past the end so string_get never has to grow an interned string
+    ret->buf[len] = '\0';
+    ret->len = len;
+    ret->capacity = len + 1;
+    ret->hash = lookup.hash;
+    ret->arena = table->arena;
+    map_set(table->map, ret, ret);
+    return ret;
+}
@@ -0,0 +1,36 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "string.h"
+#include "map.h"
+
+/*
+ * Every distinct identifier spelling is stored exactly once. Interning the same characters twice
+ * returns the same string_t, so interned strings can be compared by pointer.
+ *
+ * Interned strings are shared - don't modify them.
+ *
+ * Interning isn't thread safe, but interning a spelling that's already there only reads the table.
+ * So threads can do that at the same time, as long as none of them adds a new one.
+ *
+ * Each thread interns into its own current table, so compiles on different threads never see each
+ * other's names. run_threads gives its workers the table of the thread that started them.
+ */
+typedef struct {
+    // the strings and the map both live here, so freeing the table is one arena_free
+    arena_t *arena;
+    map_t *map;
+} intern_table_t;
+
+intern_table_t *intern_table_new(void);
+void intern_table_free(intern_table_t *table);
+
+// Makes table this thread's current table, and returns the one that was current before
+intern_table_t *intern_use(intern_table_t *table);
+
+// Returns this thread's current table, making a new one if it doesn't have one
+intern_table_t *intern_current(void);
+
+string_t *intern(char *s, int len);
+
+#endif
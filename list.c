@@ -2,15 +2,25 @@
 #include <stdio.h>
 
 list_t *list_new(void) {
-    list_t *list = malloc(sizeof(list_t));
-    if (list_init(list) < 0)
+    return list_new_in(NULL);
+}
+
+// Allocates the list and all of its nodes in arena
+list_t *list_new_in(arena_t *arena) {
+    list_t *list = arena_alloc(arena, sizeof(list_t));
+    if (!list)
         return NULL;
+    list->arena = arena;
+    list->len = 0;
+    list->head = list->tail = arena_alloc(arena, sizeof(list_node_t));
+    list->head->next = NULL;
     return list;
 }
 
 int list_init(list_t *list) {
     if (!list)
         return -1;
+    list->arena = NULL;
     list->len = 0;
     list->head = list->tail = malloc(sizeof(list_node_t));
     list->head->next = NULL;
@@ -21,7 +31,7 @@ int list_push(list_t *list, void *data) {
     if (!data)
         return -1;
 
-    list_node_t *new_node = malloc(sizeof(list_node_t));
+    list_node_t *new_node = arena_alloc(list->arena, sizeof(list_node_t));
     if (!new_node)
         return -1;
 
@@ -43,8 +53,10 @@ int list_concat(list_t *l1, list_t *l2) {
     if (l2->len)
         l1->tail = l2->tail;
     l1->len += l2->len;
-    free(l2->head);
-    free(l2);
+    if (!l2->arena) {
+        free(l2->head);
+        free(l2);
+    }
     return 0;
 }
 
@@ -62,7 +74,8 @@ void *list_pop(list_t *list) {
     if (list->len == 0)
         list->tail = NULL;
 
-    free(removed);
+    if (!list->arena)
+        free(removed);
     return ret_data;
 }
 
@@ -76,8 +89,9 @@ void *list_peek(list_t *list) {
 }
 
 // free entire list, including the data pointers that are contained in it
+// Arena backed lists are released along with their arena, so this does nothing for them.
 void list_free(list_t *list) {
-    if (!list)
+    if (!list || list->arena)
         return;
     void *data;
     while ((data = list_pop(list))) {
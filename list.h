@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include <assert.h>
 
+#include "arena.h"
+
 typedef struct  _list_node {
     void *data;
     struct _list_node *next;
@@ -17,9 +19,13 @@ typedef struct {
     // extra node used for iterating
     list_node_t *__iter;
     int len;
+
+    // NULL if the nodes are heap allocated
+    arena_t *arena;
 } list_t;
 
 list_t *list_new(void);
+list_t *list_new_in(arena_t *arena);
 int list_init(list_t *list);
 int list_push(list_t *list, void *data);
 int list_concat(list_t *l1, list_t *l2);
@@ -1,48 +1,13 @@
-#include <stdio.h>
 #include <string.h>
-#include <assert.h>
 #include "compile.h"
-
-// From parse.c
-extern env_t *global_env;
-
-void usage(void) {
-    printf("COMPILERBABY <filename>\n");
-}
+#include "compiler.h"
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        usage();
-        return -1;
-    }
-   
-    char *filename = argv[1];
-    string_t *input = file_to_string(filename);
-    if (!input || !input->len)
-        return -1;
-
-    debug("Tokenizing...\n");
-    list_t *tokens = tokenize(input);
-    if (!tokens || !tokens->len)
-        return -1;
-
-    debug("Parsing...\n");
-    program_t *prog = parse(tokens);
-    if (!prog || !prog->fn_defs)
-        return -1;
-
-    /*
-     * TODO - do variable allocation here.
-     */
-    debug("Allocating variable homes...\n");
-    alloc_homes(prog);
-
-    debug("Generating asm...\n");
-    list_t *instrs = gen_asm(prog);
-    if (!instrs || !instrs->len)
-        return -1;
-
-    debug("Outputting asm...\n");
-    print_asm(instrs);
-    return 0;
+    // --daemon SOCKET stays up and compiles whatever's sent to SOCKET. --connect SOCKET sends the
+    // rest of the arguments to it to compile, instead of compiling them here.
+    if (argc == 3 && strcmp(argv[1], "--daemon") == 0)
+        return compiler_serve(argv[2]);
+    if (argc >= 3 && strcmp(argv[1], "--connect") == 0)
+        return compiler_request(argv[2], argc - 3, argv + 3);
+    return compiler_main(argc - 1, argv + 1);
 }
@@ -2,24 +2,80 @@
 
 #include <stdio.h>
 
+#define MAP_DEFAULT_CAPACITY (4)
+#define MAP_DEFAULT_SLOTS (8)
+
+// Grow the slots array once it's more than 3/4 full
+#define MAP_MAX_LOAD_NUM (3)
+#define MAP_MAX_LOAD_DEN (4)
+
+static int *new_slots(arena_t *arena, int num_slots) {
+    int *slots = arena_alloc(arena, sizeof(int) * num_slots);
+    if (!slots)
+        return NULL;
+    for (int i = 0; i < num_slots; i++)
+        slots[i] = -1;
+    return slots;
+}
+
 map_t *map_new(void) {
-    map_t *ret = malloc(sizeof(map_t)); 
+    return map_new_in(NULL);
+}
+
+// Allocates the map and its tables in arena
+map_t *map_new_in(arena_t *arena) {
+    map_t *ret = arena_alloc(arena, sizeof(map_t));
     if (!ret)
         return NULL;
-    ret->pairs = list_new();
-    if (!ret->pairs)
+    ret->arena = arena;
+    ret->len = 0;
+    ret->capacity = MAP_DEFAULT_CAPACITY;
+    ret->pairs = arena_alloc(arena, sizeof(pair_t) * ret->capacity);
+    ret->num_slots = MAP_DEFAULT_SLOTS;
+    ret->slots = new_slots(arena, ret->num_slots);
+    if (!ret->pairs || !ret->slots)
         return NULL;
     return ret;
 }
 
-static pair_t *map_get_pair_from_key(map_t *map, string_t *key) {
-    pair_t *pair;
-    list_for_each(map->pairs, pair) {
-        if (string_eq(key, pair->key) == 0) {
-            return pair;
-        }
+// Returns the slot that either holds key or is the empty slot where key should go.
+static int map_find_slot(map_t *map, string_t *key, uint32_t hash) {
+    int mask = map->num_slots - 1;
+    int slot = hash & mask;
+    while (map->slots[slot] != -1) {
+        pair_t *pair = &map->pairs[map->slots[slot]];
+        if (pair->hash == hash && string_eq(key, pair->key) == 0)
+            return slot;
+        slot = (slot + 1) & mask;
     }
-    return NULL;
+    return slot;
+}
+
+static int map_grow_slots(map_t *map) {
+    int num_slots = map->num_slots * 2;
+    int *slots = new_slots(map->arena, num_slots);
+    if (!slots)
+        return -1;
+
+    // The pairs array doesn't move, only the indices into it need to be rehashed
+    int mask = num_slots - 1;
+    for (int i = 0; i < map->len; i++) {
+        int slot = map->pairs[i].hash & mask;
+        while (slots[slot] != -1)
+            slot = (slot + 1) & mask;
+        slots[slot] = i;
+    }
+
+    if (!map->arena)
+        free(map->slots);
+    map->slots = slots;
+    map->num_slots = num_slots;
+    return 0;
+}
+
+static pair_t *map_get_pair_from_key(map_t *map, string_t *key) {
+    int index = map->slots[map_find_slot(map, key, string_hash(key))];
+    return index == -1 ? NULL : &map->pairs[index];
 }
 
 void *map_get(map_t *map, string_t *key) {
@@ -34,18 +90,33 @@ int map_set(map_t *map, string_t *key, void *value) {
         return -1;
 
     // Overwrite the value if the key already exists in the map
-    pair_t *pair = map_get_pair_from_key(map, key);
-    if (pair) {
-        pair->value = value;
+    uint32_t hash = string_hash(key);
+    int slot = map_find_slot(map, key, hash);
+    if (map->slots[slot] != -1) {
+        map->pairs[map->slots[slot]].value = value;
         return 0;
     }
-   
-    pair = malloc(sizeof(pair_t));
-    if (!pair)
-        return -1;
+
+    if ((map->len + 1) * MAP_MAX_LOAD_DEN > map->num_slots * MAP_MAX_LOAD_NUM) {
+        if (map_grow_slots(map) < 0)
+            return -1;
+        slot = map_find_slot(map, key, hash);
+    }
+
+    if (map->len >= map->capacity) {
+        pair_t *pairs = arena_realloc(map->arena, map->pairs, sizeof(pair_t) * map->capacity,
+                                      sizeof(pair_t) * map->capacity * 2);
+        if (!pairs)
+            return -1;
+        map->pairs = pairs;
+        map->capacity *= 2;
+    }
+
+    pair_t *pair = &map->pairs[map->len];
     pair->key = key;
     pair->value = value;
-    list_push(map->pairs, pair);
+    pair->hash = hash;
+    map->slots[slot] = map->len++;
     return 0;
 }
 
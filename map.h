@@ -1,26 +1,46 @@
 #ifndef MAP_H
 #define MAP_H
 
-#include "list.h"
+#include <stdint.h>
+#include <stdbool.h>
 #include "string.h"
+#include "arena.h"
 
 /*
- * Maps are wrappers around the list type. Each node contains a pair, which maps a key to a value.
+ * Maps are open addressing hash tables. The pairs themselves live in a dense array in insertion
+ * order, so iterating over a map is deterministic. The slots array is the actual hash table - each
+ * slot holds an index into pairs, or -1 if the slot is empty.
  */
 typedef struct {
     string_t *key;
     void *value;
+
+    // cached hash of key so that resizing and probing don't rehash the string
+    uint32_t hash;
 } pair_t;
 
 typedef struct map {
-    list_t *pairs;
+    pair_t *pairs;
+    int len;
+    int capacity;
+
+    // always a power of 2
+    int *slots;
+    int num_slots;
+
+    // NULL if the map is heap allocated
+    arena_t *arena;
 } map_t;
 
 map_t *map_new(void);
+map_t *map_new_in(arena_t *arena);
 void *map_get(map_t *map, string_t *key);
 int map_set(map_t *map, string_t *key, void *value);
 bool map_contains(map_t *map, string_t *key);
 
-#define map_for_each(map, pair) list_for_each(map->pairs, pair)
+// Iterates over the pairs in the order they were first inserted.
+// Don't call map_set on the same map while iterating over it.
+#define map_for_each(map, pair)\
+    for (int __map_i = 0; __map_i < (map)->len && ((pair) = &(map)->pairs[__map_i]); __map_i++)
 
 #endif
@@ -0,0 +1,58 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "string.h"
+#include "map.h"
+
+/*
+ * An object is the machine code for the whole program plus everything the ELF writer needs to
+ * describe it: the symbols for function labels (both the ones we define and the ones we call but
+ * don't define), and a relocation for every call. Local labels never make it this far, since every
+ * jump to one is resolved by the encoder.
+ */
+typedef struct {
+    string_t *name;
+
+    // offset into text, or -1 if the symbol is undefined
+    int64_t offset;
+    int64_t size;
+    enum {
+        SYM_LOCAL,
+        SYM_GLOBAL,
+    } binding;
+
+    // position in the ELF symbol table, filled in by the writer
+    int index;
+} obj_sym_t;
+
+// A 32-bit pc-relative reference to sym at offset into text
+typedef struct {
+    int64_t offset;
+    obj_sym_t *sym;
+    int64_t addend;
+} obj_reloc_t;
+
+typedef struct {
+    // The part of text that hasn't been written out yet, which starts text_base bytes in. Streaming
+    // writes it out as it goes, so only the rest of the object grows with the program. text_len is
+    // how long the whole of it is, and offsets everywhere else are from its start.
+    uint8_t *text;
+    size_t text_base;
+    size_t text_len;
+    size_t text_capacity;
+
+    // obj_sym_t *, in the order they were first seen
+    map_t *syms;
+
+    obj_reloc_t *relocs;
+    int num_relocs;
+    int relocs_capacity;
+
+    arena_t *arena;
+} object_t;
+
+#endif
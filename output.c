@@ -1,138 +1,259 @@
 #include "compile.h"
 
-typedef struct reg_pair {
-    reg_t reg;
-    char *string;
-} reg_pair_t;
-
-static const reg_pair_t reg_pairs[] = {
-    {.reg = REG_RAX, .string = "%rax"},
-    {.reg = REG_RBX, .string = "%rbx"},
-    {.reg = REG_RCX, .string = "%rcx"},
-    {.reg = REG_RDX, .string = "%rdx"},
-    {.reg = REG_AL, .string = "%al"},
-    {.reg = REG_RBP, .string = "%rbp"},
-    {.reg = REG_RSP, .string = "%rsp"},
-    {.reg = REG_RSI, .string = "%rsi"},
-    {.reg = REG_RDI, .string = "%rdi"},
-
-    {.reg = REG_R8, .string = "%r8"},
-    {.reg = REG_R9, .string = "%r9"},
-    {.reg = REG_R10, .string = "%r10"},
-    {.reg = REG_R11, .string = "%r11"},
-
-    {0, NULL},
+#include <unistd.h>
+#include <errno.h>
+
+// Indexed by reg_t
+static const char *reg_strings[] = {
+    [REG_RAX] = "%rax",
+    [REG_RBX] = "%rbx",
+    [REG_RCX] = "%rcx",
+    [REG_RDX] = "%rdx",
+    [REG_AL] = "%al",
+    [REG_RBP] = "%rbp",
+    [REG_RSP] = "%rsp",
+    [REG_RSI] = "%rsi",
+    [REG_RDI] = "%rdi",
+
+    [REG_R8] = "%r8",
+    [REG_R9] = "%r9",
+    [REG_R10] = "%r10",
+    [REG_R11] = "%r11",
 };
 
-static char *reg_to_string(reg_t reg) {
-    int i = 0;
-    while (reg_pairs[i].string != NULL) {
-        if (reg == reg_pairs[i].reg) {
-            return reg_pairs[i].string;
-        }
-        i++;
+static const char *reg_to_string(reg_t reg) {
+    if (reg >= sizeof(reg_strings) / sizeof(reg_strings[0]) || !reg_strings[reg]) {
+        debug("reg_to_string failed: reg = %d\n", (int)reg);
+        return NULL;
     }
-    debug("reg_to_string failed: reg = %d\n", (int)reg);
-    return NULL;
-}
-
-typedef struct op_pair {
-    opcode_t op;
-    char *string;
-} op_pair_t;
-
-static const op_pair_t op_pairs[] = {
-    {.op = OP_MOV, .string = "movq"},
-    {.op = OP_RET, .string = "retq"},
-    {.op = OP_CMP, .string = "cmpq"},
-    {.op = OP_SETE, .string = "sete"},
-    {.op = OP_NEG, .string = "negq"},
-    {.op = OP_NOT, .string = "notq"},
-    {.op = OP_ADD, .string = "addq"},
-    {.op = OP_SUB, .string = "subq"},
-    {.op = OP_MUL, .string = "imulq"},
-    {.op = OP_DIV, .string = "idivq"},
-    {.op = OP_PUSH, .string = "pushq"},
-    {.op = OP_POP, .string = "popq"},
-    {.op = OP_XCHG, .string = "xchg"},
-    {.op = OP_CQO, .string = "cqo"},
-    {.op = OP_SETNE, .string = "setne"},
-    {.op = OP_SETL, .string = "setl"},
-    {.op = OP_SETLE, .string = "setle"},
-    {.op = OP_SETG, .string = "setg"},
-    {.op = OP_SETGE, .string = "setge"},
-    {.op = OP_JMP, .string = "jmp"},
-    {.op = OP_JE, .string = "je"},
-    {.op = OP_JNE, .string = "jne"},
-    {.op = OP_CALL, .string = "call"},
-    {0, NULL},
+    return reg_strings[reg];
+}
+
+// Indexed by opcode_t
+static const char *op_strings[] = {
+    [OP_MOV] = "movq",
+    [OP_RET] = "retq",
+    [OP_CMP] = "cmpq",
+    [OP_SETE] = "sete",
+    [OP_NEG] = "negq",
+    [OP_NOT] = "notq",
+    [OP_ADD] = "addq",
+    [OP_SUB] = "subq",
+    [OP_MUL] = "imulq",
+    [OP_DIV] = "idivq",
+    [OP_PUSH] = "pushq",
+    [OP_POP] = "popq",
+    [OP_XCHG] = "xchg",
+    [OP_CQO] = "cqo",
+    [OP_SETNE] = "setne",
+    [OP_SETL] = "setl",
+    [OP_SETLE] = "setle",
+    [OP_SETG] = "setg",
+    [OP_SETGE] = "setge",
+    [OP_JMP] = "jmp",
+    [OP_JE] = "je",
+    [OP_JNE] = "jne",
+    [OP_CALL] = "call",
 };
 
-static char *op_to_string(opcode_t op) {
-    int i = 0;
-    while (op_pairs[i].string != NULL) {
-        if (op == op_pairs[i].op) {
-            return op_pairs[i].string;
+static const char *op_to_string(opcode_t op) {
+    if (op >= sizeof(op_strings) / sizeof(op_strings[0]) || !op_strings[op]) {
+        UNREACHABLE("op_to_string: unknown opcode\n");
+    }
+    return op_strings[op];
+}
+
+/*
+ * Everything is formatted straight into one big buffer, which is written out with a single write
+ * call whenever it fills up (so usually just once at the end). Each thread gets its own buffer the
+ * first time it prints, which is freed once it's flushed. Nothing else here allocates.
+ */
+#define WRITER_BUF_SIZE (1 << 20)
+
+typedef struct {
+    char buf[WRITER_BUF_SIZE];
+    size_t len;
+    int fd;
+
+    // Once a write fails, nothing more is written, and flushing says so
+    bool failed;
+} writer_t;
+
+// Writes all of buf to fd. Returns false if that fails, which is reported.
+bool write_all(int fd, const char *p, size_t left) {
+    while (left) {
+        ssize_t written = write(fd, p, left);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(error_file(stderr), "write failed: %s\n", strerror(errno));
+            return false;
         }
-        i++;
+        p += written;
+        left -= written;
     }
-    return NULL;
+    return true;
+}
+
+static void writer_flush(writer_t *w) {
+    w->failed = w->failed || !write_all(w->fd, w->buf, w->len);
+    w->len = 0;
+}
+
+static void emit(writer_t *w, const char *s, size_t len) {
+    if (w->len + len > WRITER_BUF_SIZE) {
+        writer_flush(w);
+
+        // Too big to ever fit, just write it directly
+        if (len > WRITER_BUF_SIZE) {
+            w->failed = w->failed || !write_all(w->fd, s, len);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+}
+
+static void emit_str(writer_t *w, const char *s) {
+    emit(w, s, strlen(s));
+}
+
+static void emit_char(writer_t *w, char c) {
+    if (w->len + 1 > WRITER_BUF_SIZE)
+        writer_flush(w);
+    w->buf[w->len++] = c;
 }
 
-static char *operand_to_string(operand_t operand) {
-    if (operand.type == OPERAND_REG) {
-        return reg_to_string(operand.reg);
+static void emit_int(writer_t *w, int64_t n) {
+    char digits[24];
+    int i = sizeof(digits);
+
+    // Work with the magnitude as unsigned so INT64_MIN doesn't overflow
+    uint64_t mag = n < 0 ? -(uint64_t)n : (uint64_t)n;
+    do {
+        digits[--i] = '0' + mag % 10;
+        mag /= 10;
+    } while (mag);
+    if (n < 0)
+        digits[--i] = '-';
+    emit(w, digits + i, sizeof(digits) - i);
+}
+
+static void emit_string(writer_t *w, string_t *s) {
+    emit(w, s->buf, s->len);
+}
+
+static void emit_local_label(writer_t *w, int id) {
+    emit(w, ".L", 2);
+    emit_int(w, id);
+}
+
+static void emit_operand(writer_t *w, operand_t operand) {
+    switch (operand.type) {
+        case OPERAND_REG:
+            emit_str(w, reg_to_string(operand.reg));
+            return;
+        case OPERAND_LABEL:
+            emit_string(w, operand.label);
+            return;
+        case OPERAND_LOCAL_LABEL:
+            emit_local_label(w, operand.local_label);
+            return;
+        case OPERAND_IMM:
+            emit_char(w, '$');
+            emit_int(w, operand.imm);
+            return;
+        case OPERAND_MEM_LOC:
+            emit_int(w, operand.mem.offset);
+            emit_char(w, '(');
+            emit_str(w, reg_to_string(operand.mem.reg));
+            emit_char(w, ')');
+            return;
+        case OPERAND_VAR:
+            UNREACHABLE("VARs should not be in output\n");
     }
+}
 
-    if (operand.type == OPERAND_LABEL) {
-        return string_get(operand.label);
+static void emit_label(writer_t *w, label_t *label) {
+    if (label->linkage == LABEL_LOCAL) {
+        emit_local_label(w, label->id);
+        emit(w, ":\n", 2);
+        return;
     }
 
-    if (operand.type == OPERAND_VAR) {
-        UNREACHABLE("VARs should not be in output\n");
+    if (label->linkage == LABEL_GLOBAL) {
+        emit(w, ".globl ", 7);
+        emit_string(w, label->name);
+        emit_char(w, '\n');
     }
+    emit_string(w, label->name);
+    emit(w, ":\n", 2);
+}
 
-    string_t string;
-    char buf[100];
-    if (string_init(&string) < 0)
-        return NULL;
-    
-    if (operand.type == OPERAND_IMM) {
-        snprintf(buf, 100, "$%ld", operand.imm);
-    } else if (operand.type == OPERAND_MEM_LOC) {
-        snprintf(buf, 100, "%ld(%s)", operand.mem.offset, reg_to_string(operand.mem.reg));
+static void emit_instr(writer_t *w, instr_t *instr) {
+    emit_char(w, '\t');
+    emit_str(w, op_to_string(instr->op));
+    if (instr->num_args == 2) {
+        emit_char(w, ' ');
+        emit_operand(w, instr->src);
+        emit(w, ", ", 2);
+        emit_operand(w, instr->dst);
+    } else if (instr->num_args == 1) {
+        emit_char(w, ' ');
+        emit_operand(w, instr->src);
+    } else if (instr->num_args != 0) {
+        UNREACHABLE("emit_instr: bad number of args\n");
     }
-    string_append(&string, buf, strlen(buf));
-    return string_get(&string);
+    emit_char(w, '\n');
 }
 
-void print_asm(list_t *output) {
-    if (!output)
-        return;
+// Too big for the stack, or to give every thread a copy of whether it prints or not
+static _Thread_local writer_t *writer = NULL;
 
-    output_t *curr = list_pop(output);
-    for (; curr; curr = list_pop(output)) {
+void print_fn_asm(output_buf_t *buf, int fd) {
+    if (!writer) {
+        writer = malloc(sizeof(writer_t));
+        writer->len = 0;
+        writer->fd = fd;
+        writer->failed = false;
+    } else if (writer->fd != fd) {
+        writer_flush(writer);
+        writer->fd = fd;
+    }
+
+    for (int i = 0; i < buf->len; i++) {
+        output_t *curr = &buf->outputs[i];
         if (curr->type == OUTPUT_LABEL) {
-            if (curr->label.linkage == LABEL_GLOBAL) {
-                printf(".globl %s\n", string_get(curr->label.name));
-            }
-            printf("%s:\n", string_get(curr->label.name));
-            continue;
+            emit_label(writer, &curr->label);
+        } else if (curr->type == OUTPUT_INSTR) {
+            emit_instr(writer, &curr->instr);
         }
+    }
+}
 
-        if (curr->type == OUTPUT_INSTR) {
-            instr_t instr = curr->instr;
-            if (instr.num_args == 2) {
-                printf("\t%s %s, %s\n", op_to_string(instr.op), operand_to_string(instr.src), operand_to_string(instr.dst));
-            } else if (instr.num_args == 1) {
-                printf("\t%s %s\n", op_to_string(instr.op), operand_to_string(instr.src));
-            } else if (instr.num_args == 0) {
-                printf("\t%s\n", op_to_string(instr.op));
-            } else {
-                printf("BAD NUM ARGS\n");
-                exit(-1);
-            }
-            continue;
-        }
+bool print_asm_flush(void) {
+    bool ok = true;
+    if (writer) {
+        writer_flush(writer);
+        ok = !writer->failed;
+    }
+    print_asm_discard();
+    return ok;
+}
+
+void print_asm_discard(void) {
+    free(writer);
+    writer = NULL;
+}
+
+// Writes the assembly for each function's output_buf_t in fns to fd
+bool print_asm(list_t *fns, int fd) {
+    if (!fns)
+        return true;
+
+    output_buf_t *buf;
+    list_for_each(fns, buf) {
+        print_fn_asm(buf, fd);
     }
+    return print_asm_flush();
 }
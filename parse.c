@@ -1,17 +1,255 @@
 #include "compile.h"
-// global - needed for home allocation
-env_t *global_env = NULL;
-program_t *program = NULL;
+#include <limits.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+
+// Function bodies can be parsed on several threads at once (see parse_parallel). Each thread has
+// its own copy of everything below that's about the function it's parsing. The program is shared,
+// and only read while they run. Everything is per thread, so separate compiles can run on separate
+// threads too.
+
+// The symbol table for every scope of every function
+static _Thread_local env_t *global_env = NULL;
+static _Thread_local program_t *program = NULL;
+
+// Everything but the AST nodes themselves is allocated here. It's released once gen_asm is done
+// with it.
+static _Thread_local arena_t *ast_arena = NULL;
+static _Thread_local ast_t *ast = NULL;
+
+/*
+ * In streaming mode, each declaration is parsed into an arena that's released once its code is
+ * written, along with the intern table its names are in. All the program remembers of a function
+ * is what calls to it and later declarations of it are checked against: its name, return type and
+ * parameter types, and whether it has a body. Those are packed into arrays that grow with realloc,
+ * since an arena would keep every old copy, and found through an open addressing table of indices
+ * into fns. A name is copied into chars, and looked up by its characters. NULL when not streaming.
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t name;   // offset of its characters in chars
+    uint32_t name_len;
+    uint32_t params; // offset of its parameters' types in param_types
+    uint16_t num_params;
+    uint8_t ret_type;
+    bool defined;
+} kept_fn_t;
+
+typedef struct {
+    kept_fn_t *fns;
+    uint32_t num_fns;
+    uint32_t fns_capacity;
+
+    char *chars;
+    uint32_t chars_len;
+    uint32_t chars_capacity;
+
+    uint8_t *param_types;
+    uint32_t param_types_len;
+    uint32_t param_types_capacity;
+
+    // a power of 2, each an index into fns or -1
+    int *slots;
+    int num_slots;
+} kept_fns_t;
+
+static _Thread_local kept_fns_t *kept_fns = NULL;
+
+// How many functions in program->fn_defs were declared before the one being parsed. Those are the
+// only ones it can call.
+static _Thread_local int num_visible_fns = 0;
+
+// Where an error jumps to, so parse can return NULL. Errors are only reported on one thread: when
+// parsing in parallel fails, the whole program is parsed again on one thread, which reports the same
+// error it always has.
+static _Thread_local jmp_buf *error_jmp = NULL;
+static _Thread_local bool report_errors = false;
+
+static _Noreturn void parse_error(const char *file, int line, const char *msg) {
+    if (error_jmp && !report_errors)
+        longjmp(*error_jmp, 1);
+    compile_error(file, line, msg);
+}
+
+// Sends errors to on_error until parse_jump_done, including the ones that one-pass mode's codegen
+// finds along the way. Returns where compile errors went before.
+static jmp_buf *parse_jump_use(jmp_buf *on_error, bool report) {
+    error_jmp = on_error;
+    report_errors = report;
+    return error_jump_use(on_error);
+}
+
+static void parse_jump_done(jmp_buf *prev_jump) {
+    error_jmp = NULL;
+    report_errors = false;
+    error_jump_use(prev_jump);
+}
 
-static expr_t *parse_expr(list_t *tokens, env_t *env);
-static stmt_t *parse_stmt(list_t *tokens, env_t *env);
-static block_t *parse_block(list_t *tokens, env_t *env);
+#undef UNREACHABLE
+#define UNREACHABLE(msg) parse_error(__FILE__, __LINE__, msg)
+
+// Whether code is being generated as the program is parsed (see fast_begin). If so, the code for
+// each construct is generated as soon as it's recognized, and each function's nodes are thrown away
+// once it's done.
+static _Thread_local bool fast = false;
+
+// Children of the lists being parsed, innermost list last. A list's children are copied out to
+// ast->extra in one piece once it's finished, so that they end up contiguous even though nested
+// lists are parsed in the middle of them.
+static _Thread_local uint32_t *scratch = NULL;
+static _Thread_local int scratch_len = 0;
+static _Thread_local int scratch_capacity = 0;
+
+// How tightly each operator binds, loosest first. PREC_NONE is for anything that isn't an operator.
+typedef enum {
+    PREC_NONE,
+    PREC_ASSIGN,
+    PREC_TERNARY,
+    PREC_LOGICAL_OR,
+    PREC_LOGICAL_AND,
+    PREC_EQUALITY,
+    PREC_RELATIONAL,
+    PREC_ADDITIVE,
+    PREC_MULTIPLICATIVE,
+    PREC_PREFIX,
+} prec_t;
+
+// Something on the expression parser's stack. Groups are waiting for the token that closes them,
+// and have PREC_NONE. Everything else is an operator waiting for its last operand.
+typedef struct {
+    enum {
+        EXPR_BOTTOM,        // the whole expression
+        EXPR_PAREN,         // closed by )
+        EXPR_CALL,          // the current argument, closed by , or )
+        EXPR_TERNARY_THEN,  // closed by :
+        EXPR_TERNARY_ELSE,
+        EXPR_BINARY,
+        EXPR_ASSIGN,
+        EXPR_PREFIX,
+    } kind;
+    prec_t prec;
+
+    // bin_op for EXPR_BINARY and EXPR_ASSIGN (-1 for plain =), the token for EXPR_PREFIX
+    int op;
+
+    // For EXPR_CALL, the function, the parameter the current argument is for, where the call's
+    // name and args start in scratch, and fast_label_mark from before the call
+    fn_def_t *fn_def;
+    list_node_t *param;
+    int mark;
+    int label_mark;
+
+    // Labels that one-pass mode allocated for the operator
+    int labels[2];
+} expr_frame_t;
+
+static _Thread_local expr_frame_t *expr_frames = NULL;
+static _Thread_local int num_expr_frames = 0;
+static _Thread_local int expr_frames_capacity = 0;
+
+// Finished operands that haven't been attached to an operator yet, and fast_label_mark from
+// before each one started
+static _Thread_local node_id_t *operands = NULL;
+static _Thread_local int *operand_label_marks = NULL;
+static _Thread_local int num_operands = 0;
+static _Thread_local int operands_capacity = 0;
+static _Thread_local int operand_label_marks_capacity = 0;
+
+// A statement that's waiting on the statements nested inside of it.
+typedef struct {
+    enum {
+        STMT_LIST,          // closed by }
+        STMT_IF_THEN,
+        STMT_IF_ELSE,
+        STMT_FOR_BODY,
+        STMT_WHILE_BODY,
+        STMT_DO_BODY,
+    } kind;
+
+    // What's been parsed so far: the if's cond and then, the for's init, cond and post, or the
+    // while's cond
+    node_id_t nodes[3];
+
+    // For STMT_LIST, where its statements start in scratch and whether it opened a scope
+    int mark;
+    bool scoped;
+
+    // What break and continue inside of it jump to in one-pass mode, and labels it allocated
+    int break_label;
+    int continue_label;
+    int labels[3];
+} stmt_frame_t;
+
+static _Thread_local stmt_frame_t *stmt_frames = NULL;
+static _Thread_local int num_stmt_frames = 0;
+static _Thread_local int stmt_frames_capacity = 0;
+
+static node_id_t parse_expr(token_buf_t *tokens, env_t *env);
 
 // for now, only idents can be used in assign statements
 // Later we want this to check for specific unary ops, like pointer derefs and pre/postinc and array
 // refs
-static bool is_valid_lhs(expr_t *expr) {
-    return expr && expr->type == PRIMARY && expr->primary->type == PRIMARY_VAR;
+static bool is_valid_lhs(node_id_t expr) {
+    return ast->kind[expr] == NODE_VAR;
+}
+
+static var_info_t *node_var(node_id_t expr) {
+    return global_env->fn->vars[ast->a[expr]];
+}
+
+// Makes room for one more element in the stack at items, doubling it if it's full
+static void *grow(void *items, int len, int *capacity, size_t size) {
+    if (len < *capacity)
+        return items;
+    int new_capacity = *capacity ? *capacity * 2 : 64;
+    items = arena_realloc(ast_arena, items, size * *capacity, size * new_capacity);
+    if (!items) {
+        UNREACHABLE("parse: out of memory\n");
+    }
+    *capacity = new_capacity;
+    return items;
+}
+
+static void scratch_push(uint32_t child) {
+    scratch = grow(scratch, scratch_len, &scratch_capacity, sizeof(uint32_t));
+    scratch[scratch_len++] = child;
+}
+
+static void push_operand(node_id_t operand, int label_mark) {
+    operands = grow(operands, num_operands, &operands_capacity, sizeof(node_id_t));
+    operand_label_marks = grow(operand_label_marks, num_operands, &operand_label_marks_capacity, sizeof(int));
+    operands[num_operands] = operand;
+    operand_label_marks[num_operands++] = label_mark;
+}
+
+static node_id_t pop_operand(void) {
+    return operands[--num_operands];
+}
+
+static expr_frame_t *push_expr_frame(int kind, prec_t prec, int op) {
+    expr_frames = grow(expr_frames, num_expr_frames, &expr_frames_capacity, sizeof(expr_frame_t));
+    expr_frame_t *frame = &expr_frames[num_expr_frames++];
+    frame->kind = kind;
+    frame->prec = prec;
+    frame->op = op;
+    return frame;
+}
+
+// Loops replace the break and continue labels they inherit from the frame around them
+static stmt_frame_t *push_stmt_frame(int kind) {
+    stmt_frames = grow(stmt_frames, num_stmt_frames, &stmt_frames_capacity, sizeof(stmt_frame_t));
+    stmt_frame_t *frame = &stmt_frames[num_stmt_frames++];
+    frame->kind = kind;
+    frame->break_label = num_stmt_frames > 1 ? frame[-1].break_label : -1;
+    frame->continue_label = num_stmt_frames > 1 ? frame[-1].continue_label : -1;
+    return frame;
+}
+
+// Moves everything pushed since mark into ast->extra and returns where it starts
+static uint32_t scratch_pop_to_extra(int mark) {
+    uint32_t start = ast_add_extra(ast, scratch + mark, scratch_len - mark);
+    scratch_len = mark;
+    return start;
 }
 
 static bool is_type(token_type_t type) {
@@ -24,19 +262,42 @@ static bool is_type(token_type_t type) {
     }
 }
 
+static bool tokens_left(token_buf_t *tokens) {
+    return tokens->pos < tokens->len;
+}
+
+// Returns the next token without consuming it, or NULL if there are none left
+static token_t *peek_token(token_buf_t *tokens) {
+    if (!tokens_left(tokens))
+        return NULL;
+    return &tokens->tokens[tokens->pos];
+}
+
+// Consumes and returns the next token, or NULL if there are none left
+static token_t *pop_token(token_buf_t *tokens) {
+    if (!tokens_left(tokens))
+        return NULL;
+    return &tokens->tokens[tokens->pos++];
+}
+
+// Tokens only hold a span of the source, so look up the interned name for it
+static string_t *token_ident(token_buf_t *tokens, token_t *token) {
+    return intern(tokens->src + token->offset, token->len);
+}
+
 // Consumes the next token. Program fails if expectation is not met.
-static token_t *expect_next(list_t *tokens, token_type_t expectation) {
-    token_t *next = list_pop(tokens);
+static token_t *expect_next(token_buf_t *tokens, token_type_t expectation) {
+    token_t *next = pop_token(tokens);
     if (!next || next->type != expectation) {
-        debug("Unexpected token: %u\n", (unsigned)next->type);
+        debug("Unexpected token: %d\n", next ? (int)next->type : -1);
         UNREACHABLE("Parse failed");
     }
     return next;
 }
 
 // Just peeks at the next token. Doesn't consume.
-static bool check_next(list_t *tokens, token_type_t expectation) {
-    token_t *next = list_peek(tokens);
+static bool check_next(token_buf_t *tokens, token_type_t expectation) {
+    token_t *next = peek_token(tokens);
     if (!next || next->type != expectation) {
         return false;
     }
@@ -44,13 +305,13 @@ static bool check_next(list_t *tokens, token_type_t expectation) {
 }
 
 // Helper to check the next token and consume if it matches the expectation.
-static bool match(list_t *tokens, token_type_t expectation) {
-    token_t *next = list_peek(tokens);
+static bool match(token_buf_t *tokens, token_type_t expectation) {
+    token_t *next = peek_token(tokens);
     if (!next || next->type != expectation) {
         return false;
     }
     debug("Found expected\n");
-    list_pop(tokens);
+    pop_token(tokens);
     return true;
 }
 
@@ -66,767 +327,928 @@ static builtin_type_t token_to_builtin_type(token_type_t t) {
     }
 }
 
-static expr_t *new_bin_expr(enum bin_op op, expr_t *lhs, expr_t *rhs) {
-    if (!rhs || !lhs) {
-        UNREACHABLE("");
-    }
-
-    if (rhs->c_type != lhs->c_type) {
+static node_id_t new_bin_expr(enum bin_op op, node_id_t lhs, node_id_t rhs) {
+    if (ast->c_type[rhs] != ast->c_type[lhs]) {
         UNREACHABLE("new_bin_expr: lhs type doesn't match rhs type\n");
     }
+    return ast_add_expr(ast, NODE_BIN, op, ast->c_type[lhs], lhs, rhs);
+}
 
-    expr_t *expr = malloc(sizeof(bin_expr_t));
-    if (!expr) {
-        UNREACHABLE("");
-    }
+static node_id_t new_unary_expr(enum unary_op op, node_id_t inner) {
+    return ast_add_expr(ast, NODE_UNARY, op, ast->c_type[inner], inner, 0);
+}
 
-    expr->bin = malloc(sizeof(bin_expr_t));
-    if (!expr->bin) {
-        UNREACHABLE("");
+static node_id_t new_assign(node_id_t lhs, node_id_t rhs) {
+    if (ast->c_type[lhs] != ast->c_type[rhs]) {
+        // TODO implicit type conversions?
+        UNREACHABLE("new_assign: lhs type doesn't equal rhs type\n");
     }
-    expr->type = BIN_OP;
-    expr->bin->op = op;
-    expr->bin->lhs = lhs;
-    expr->bin->rhs = rhs;
-    expr->c_type = lhs->c_type;
-    return expr;
+    return ast_add(ast, NODE_ASSIGN, 0, ast->c_type[lhs], lhs, rhs);
 }
 
-static expr_t *new_unary_expr(enum unary_op op, expr_t *inner) {
-    if (!inner) {
-        UNREACHABLE("");
-    }
+static node_id_t new_primary_int(int val) {
+    return ast_add_expr(ast, NODE_INT, 0, TYPE_INT, (uint32_t)val, 0);
+}
 
-    expr_t *expr = malloc(sizeof(unary_expr_t));
-    if (!expr) {
-        UNREACHABLE("");
-    }
-    expr->unary = malloc(sizeof(unary_expr_t));
-    if (!expr->unary) {
-        UNREACHABLE("");
+static node_id_t new_primary_char(char c) {
+    (void)c;
+    UNREACHABLE("NO CHARS!\n");
+}
+
+static node_id_t new_primary_var(var_info_t *var_info) {
+    return ast_add_expr(ast, NODE_VAR, 0, var_info->type, var_info->index, 0);
+}
+
+static node_id_t new_ternary(node_id_t cond, node_id_t then, node_id_t els) {
+    if (ast->c_type[then] != ast->c_type[els]) {
+        UNREACHABLE("new_ternary: then clause doesn't match else clause type\n");
     }
-    expr->type = UNARY_OP;
-    expr->unary->op = op;
-    expr->unary->expr = inner;
-    expr->c_type = inner->c_type;
-    return expr;
+    uint32_t clauses[] = {then, els};
+    return ast_add(ast, NODE_TERNARY, 0, ast->c_type[then], cond, ast_add_extra(ast, clauses, 2));
 }
 
-static expr_t *new_assign(expr_t *lhs, expr_t *rhs) {
-    if (lhs->c_type != rhs->c_type) {
-        // TODO implicit type conversions?
-        UNREACHABLE("new_assign: lhs type doesn't equal rhs type\n");
+// Grows p, which has room for *capacity items of size bytes, until there's room for needed of them.
+// These outlive every declaration's arena, so they're on the heap.
+static void *kept_grow(void *p, uint32_t *capacity, uint32_t needed, size_t size) {
+    if (needed <= *capacity)
+        return p;
+    while (*capacity < needed)
+        *capacity = *capacity ? *capacity * 2 : 64;
+    p = realloc(p, size * *capacity);
+    if (!p) {
+        UNREACHABLE("kept_fns: out of memory\n");
+    }
+    return p;
+}
+
+// Returns the slot that either holds the function called name or is the empty one where it goes
+static int kept_fn_slot(string_t *name) {
+    uint32_t hash = string_hash(name);
+    int mask = kept_fns->num_slots - 1;
+    int slot = hash & mask;
+    for (; kept_fns->slots[slot] != -1; slot = (slot + 1) & mask) {
+        kept_fn_t *kept = &kept_fns->fns[kept_fns->slots[slot]];
+        if (kept->hash == hash && kept->name_len == (uint32_t)name->len
+                && !memcmp(kept_fns->chars + kept->name, name->buf, name->len))
+            break;
     }
-    expr_t *ret = malloc(sizeof(expr_t)); 
-    ret->type = ASSIGN;
-    ret->assign = malloc(sizeof(assign_t));
-    ret->assign->lhs = lhs;
-    ret->assign->rhs = rhs;
-    ret->c_type = lhs->c_type;
-    return ret;
+    return slot;
 }
 
-static expr_t *new_primary_int(int val) {
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = PRIMARY;
-    expr->primary = malloc(sizeof(primary_t));
-    expr->primary->type = PRIMARY_INT;
-    expr->primary->integer = val;
-    expr->c_type = TYPE_INT;
-    return expr;
+// Makes the table num_slots big, and puts every kept function back in it
+static void kept_fns_resize(int num_slots) {
+    int *slots = malloc(sizeof(int) * num_slots);
+    for (int i = 0; i < num_slots; i++)
+        slots[i] = -1;
+    for (uint32_t i = 0; i < kept_fns->num_fns; i++) {
+        int slot = kept_fns->fns[i].hash & (num_slots - 1);
+        while (slots[slot] != -1)
+            slot = (slot + 1) & (num_slots - 1);
+        slots[slot] = i;
+    }
+    free(kept_fns->slots);
+    kept_fns->slots = slots;
+    kept_fns->num_slots = num_slots;
 }
 
-static expr_t *new_primary_char(char c) {
-    UNREACHABLE("NO CHARS!\n");
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = PRIMARY;
-    expr->primary = malloc(sizeof(primary_t));
-    expr->primary->type = PRIMARY_CHAR;
-    expr->primary->integer = c;
-    expr->c_type = TYPE_CHAR;
-    return expr;
-}
-
-static expr_t *new_primary_var(string_t *var, builtin_type_t type) {
-    if (!var) {
-        UNREACHABLE("new_primary_var: invalid var\n");
-    }
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = PRIMARY;
-    expr->primary = malloc(sizeof(primary_t));
-    expr->primary->type = PRIMARY_VAR;
-    expr->primary->var = var;
-    expr->c_type = type;
-    return expr;
-}
-
-static expr_t *new_primary_expr(expr_t *e) {
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = PRIMARY;
-    expr->primary = malloc(sizeof(primary_t));
-    expr->primary->type = PRIMARY_EXPR;
-    expr->primary->expr = e;
-    expr->c_type = e->c_type;
-    return expr;
-}
-
-static expr_t *new_ternary(expr_t *cond, expr_t *then, expr_t *els) {
-    if (then->c_type != els->c_type) {
-        UNREACHABLE("new_ternary: then clause doesn't match else clause type\n");
+// Adds fn to kept_fns and returns its index, which is also the order it was first declared in
+static int keep_fn(fn_def_t *fn) {
+    // Keep the table no more than half full
+    if (2 * (kept_fns->num_fns + 1) > (uint32_t)kept_fns->num_slots)
+        kept_fns_resize(kept_fns->num_slots * 2);
+
+    kept_fns->slots[kept_fn_slot(fn->name)] = kept_fns->num_fns;
+    kept_fns->fns = kept_grow(kept_fns->fns, &kept_fns->fns_capacity, kept_fns->num_fns + 1, sizeof(kept_fn_t));
+    int index = kept_fns->num_fns++;
+    kept_fn_t *kept = &kept_fns->fns[index];
+    kept->hash = string_hash(fn->name);
+    kept->ret_type = fn->ret_type;
+    kept->defined = false;
+
+    kept->name = kept_fns->chars_len;
+    kept->name_len = fn->name->len;
+    kept_fns->chars = kept_grow(kept_fns->chars, &kept_fns->chars_capacity, kept->name + kept->name_len, 1);
+    memcpy(kept_fns->chars + kept->name, fn->name->buf, kept->name_len);
+    kept_fns->chars_len += kept->name_len;
+
+    kept->params = kept_fns->param_types_len;
+    kept->num_params = fn->params ? fn->params->len : 0;
+    kept_fns->param_types = kept_grow(kept_fns->param_types, &kept_fns->param_types_capacity,
+                                      kept->params + kept->num_params, 1);
+    if (fn->params) {
+        var_info_t *param;
+        list_for_each(fn->params, param) {
+            kept_fns->param_types[kept_fns->param_types_len++] = param->type;
+        }
     }
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = TERNARY;
-    expr->ternary = malloc(sizeof(ternary_t));
-    expr->ternary->cond = cond;
-    expr->ternary->then = then;
-    expr->ternary->els = els;
-    expr->c_type = then->c_type;
-    return expr;
+    return index;
 }
 
-static expr_t *new_null_expr(void) {
-    debug("new_null_expr called\n");
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = NULL_EXPR;
-    expr->c_type = TYPE_VOID;
-    return expr;
+// Makes a fn_def_t in this declaration's arena for the kept function called name, for a call to
+// it to be checked against. Returns NULL if there isn't one.
+static fn_def_t *kept_fn_def(string_t *name) {
+    int index = kept_fns->slots[kept_fn_slot(name)];
+    if (index == -1)
+        return NULL;
+
+    kept_fn_t *kept = &kept_fns->fns[index];
+    fn_def_t *fn = arena_alloc(ast_arena, sizeof(fn_def_t));
+    memset(fn, 0, sizeof(fn_def_t));
+    fn->name = name;
+    fn->ret_type = kept->ret_type;
+    fn->index = index;
+    if (!kept->num_params)
+        return fn;
+
+    fn->params = list_new_in(ast_arena);
+    for (int i = 0; i < kept->num_params; i++) {
+        var_info_t *param = arena_alloc(ast_arena, sizeof(var_info_t));
+        memset(param, 0, sizeof(var_info_t));
+        param->type = kept_fns->param_types[kept->params + i];
+        list_push(fn->params, param);
+    }
+    return fn;
 }
 
-static expr_t *new_fn_call(fn_def_t *fn_def, list_t *tokens, env_t *env) {
-    expr_t *expr = malloc(sizeof(expr_t));
-    expr->type = PRIMARY;
+static bool kept_fn_matches(kept_fn_t *kept, fn_def_t *fn) {
+    if (kept->ret_type != fn->ret_type || kept->num_params != (fn->params ? fn->params->len : 0))
+        return false;
+    if (!fn->params)
+        return true;
+
+    int i = kept->params;
+    var_info_t *param;
+    list_for_each(fn->params, param) {
+        if (kept_fns->param_types[i++] != param->type)
+            return false;
+    }
+    return true;
+}
 
-    expr->primary = malloc(sizeof(primary_t));
-    expr->primary->type = PRIMARY_FN_CALL;
+// Streaming mode's declare_fn. Returns the index in kept_fns of the function fn declares.
+static int declare_kept_fn(fn_def_t *fn) {
+    int index = kept_fns->slots[kept_fn_slot(fn->name)];
+    if (index == -1) {
+        index = keep_fn(fn);
+    } else if (!kept_fn_matches(&kept_fns->fns[index], fn)) {
+        UNREACHABLE("Compilation error: Function declarations don't match\n");
+    }
+    fn->index = index;
+    num_visible_fns = kept_fns->num_fns;
+    return index;
+}
 
-    expr->primary->fn_call = malloc(sizeof(fn_call_t));
-    expr->primary->fn_call->fn_name = fn_def->name;
-    expr->primary->fn_call->param_exprs = NULL;
-    expr->c_type = fn_def->ret_type;
+// Starts parsing a call to fn_def, whose name has just been consumed. Returns true if the call was
+// finished and pushed as an operand, or false if its first argument needs to be parsed.
+static bool begin_fn_call(fn_def_t *fn_def, token_buf_t *tokens, int label_mark) {
+    // The name and number of args go in front of the args themselves
+    int mark = scratch_len;
+    scratch_push(ast_add_name(ast, fn_def->name));
+    scratch_push(0);
 
     // Parse parameter expressions
     expect_next(tokens, TOK_OPEN_PAREN);
+    if (fast)
+        fast_call_begin(fn_def);
     
     // Handle functions without parameters.
     if (!fn_def->params || fn_def->params->len == 0) {
-        if (match(tokens, TOK_CLOSE_PAREN)) {
-            return expr;
-        } else {
+        if (!match(tokens, TOK_CLOSE_PAREN)) {
             UNREACHABLE("new_fn_call: Mismatching function call - declaration has no params, but call has some\n");
         }
+        if (fast)
+            fast_call_end(fn_def);
+        push_operand(ast_add(ast, NODE_FN_CALL, 0, fn_def->ret_type, scratch_pop_to_extra(mark), 0), label_mark);
+        return true;
     }
 
-    expr->primary->fn_call->param_exprs = list_new();
+    expr_frame_t *frame = push_expr_frame(EXPR_CALL, PREC_NONE, 0);
+    frame->fn_def = fn_def;
+    frame->param = list_first(fn_def->params);
+    frame->mark = mark;
+    frame->label_mark = label_mark;
+    return false;
+}
 
-    string_t *param_name;
-    list_for_each(fn_def->params, param_name) {
-        expr_t *param_expr = parse_expr(tokens, env); 
-        var_info_t *param_info = map_get(fn_def->env->homes, param_name); 
-        debug("parsing param %s\n", string_get(param_name));
-        debug("declared type %u, expr type %u\n", param_info->type, param_expr->c_type);
-        if (param_expr->c_type != param_info->type) {
-            UNREACHABLE("new_fn_call: param expr type doesn't match declaration\n");
-        }
-        list_push(expr->primary->fn_call->param_exprs, param_expr);
-        if (match(tokens, TOK_CLOSE_PAREN)) {
-            break;
-        }
+// Called when the top frame is an EXPR_CALL and its current argument is the top operand. Returns
+// true if that was the last argument, in which case the call replaces the frame as an operand.
+static bool end_fn_call_arg(token_buf_t *tokens) {
+    expr_frame_t *frame = &expr_frames[num_expr_frames - 1];
+    var_info_t *param_info = frame->param->data;
+    node_id_t param_expr = pop_operand();
+    debug("parsing param %d\n", scratch_len - frame->mark - 2);
+    debug("declared type %u, expr type %u\n", param_info->type, ast->c_type[param_expr]);
+    if (ast->c_type[param_expr] != param_info->type) {
+        UNREACHABLE("new_fn_call: param expr type doesn't match declaration\n");
+    }
+    scratch_push(param_expr);
+    if (fast)
+        fast_call_arg(scratch_len - frame->mark - 3);
+
+    if (!match(tokens, TOK_CLOSE_PAREN)) {
         expect_next(tokens, TOK_COMMA);
+        frame->param = frame->param->next;
+        if (frame->param)
+            return false;
     }
 
-    if (fn_def->params->len != expr->primary->fn_call->param_exprs->len) {
+    fn_def_t *fn_def = frame->fn_def;
+    int mark = frame->mark;
+    if (fn_def->params->len != scratch_len - mark - 2) {
         UNREACHABLE("new_fn_call: number of parsed param exprs doesn't match number in declaration\n");
     }
 
+    scratch[mark + 1] = scratch_len - mark - 2;
     debug("new_fn_call: done\n");
-    return expr;
+    if (fast)
+        fast_call_end(fn_def);
+    num_expr_frames--;
+    push_operand(ast_add(ast, NODE_FN_CALL, 0, fn_def->ret_type, scratch_pop_to_extra(mark), 0), frame->label_mark);
+    return true;
 }
 
-static expr_t *parse_primary(list_t *tokens, env_t *env) {
+// Parses a literal, variable or call. Returns true if it was pushed as an operand, or false if it
+// was a call whose arguments still need to be parsed.
+static bool parse_primary(token_buf_t *tokens, env_t *env) {
     debug("parse primary\n");
-    token_t *curr = list_peek(tokens);
+    token_t *curr = peek_token(tokens);
+    int label_mark = fast ? fast_label_mark() : 0;
 
     if (curr->type == TOK_INT_LIT) {
-        list_pop(tokens);
+        pop_token(tokens);
         debug("Found integer literal: %d\n", curr->int_literal);
-        return new_primary_int(curr->int_literal);
+        if (fast)
+            fast_int(curr->int_literal);
+        push_operand(new_primary_int(curr->int_literal), label_mark);
+        return true;
     }
 
     if (curr->type == TOK_CHAR_LIT) {
-        list_pop(tokens);
+        pop_token(tokens);
         debug("Found character literal\n");
-        return new_primary_char(curr->char_literal);
+        push_operand(new_primary_char(curr->char_literal), label_mark);
+        return true;
     }
 
     if (curr->type == TOK_IDENT) {
         // Ident can be either a variable or function call
         // It seems like really, functions are variables in the global
         // environment.
-        list_pop(tokens);
+        pop_token(tokens);
 
+        string_t *ident = token_ident(tokens, curr);
         var_info_t *var_info;
-        if ((var_info = env_get(env, curr->ident))) {
+        if ((var_info = env_get(env, ident))) {
             // First, assume that the identifier is a variable.
-            debug("Found variable: %s\n", string_get(curr->ident));
-            return new_primary_var(curr->ident, var_info->type);
+            debug("Found variable: %s\n", string_get(ident));
+            if (fast)
+                fast_var(var_info);
+            push_operand(new_primary_var(var_info), label_mark);
+            return true;
         }
 
-        fn_def_t *fn_def;
-        if ((fn_def = map_get(program->fn_defs, curr->ident))) {
+        fn_def_t *fn_def = kept_fns ? kept_fn_def(ident) : map_get(program->fn_defs, ident);
+        if (fn_def && fn_def->index < num_visible_fns) {
             // Otherwise, try to see if it's a function call.
-            debug("Found function call: %s\n", string_get(curr->ident));
-            return new_fn_call(fn_def, tokens, env);
+            debug("Found function call: %s\n", string_get(ident));
+            return begin_fn_call(fn_def, tokens, label_mark);
         }
 
         UNREACHABLE("Primary: bad ident\n");
     }
 
-    if (curr->type == TOK_OPEN_PAREN) {
-        list_pop(tokens);
-        debug("Found nested expr\n");
-        expr_t *expr = parse_expr(tokens, env);
-        expect_next(tokens, TOK_CLOSE_PAREN);
-        return new_primary_expr(expr);
-    }
     UNREACHABLE("parse: Unrecognized expression\n");
 }
 
-static expr_t *parse_postfix(list_t *tokens, env_t *env) {
-    if (!tokens || !tokens->len) {
-        UNREACHABLE("wtf you doin\n");
-    }
-
-    expr_t *primary_expr = parse_primary(tokens, env);
-    if (!tokens->len) {
+// Applies a postfix operator, if there is one, to the primary that was just finished
+static void parse_postfix(token_buf_t *tokens) {
+    if (!tokens_left(tokens)) {
         UNREACHABLE("compile error? should at least be a semicolon here\n");
     }
 
-    if (match(tokens, TOK_INCREMENT)) {
-        debug("Found postinc\n");
-        if (!is_valid_lhs(primary_expr)) {
-            UNREACHABLE("compile error: trying to postinc invalid lhs\n");
-        }
-        return new_unary_expr(UNARY_POSTINC, primary_expr);
-    }
-
-    if (match(tokens, TOK_DECREMENT)) {
-        debug("Found postdec\n");
-        if (!is_valid_lhs(primary_expr)) {
-            UNREACHABLE("compile error: trying to postdec invalid lhs\n");
-        }
-        return new_unary_expr(UNARY_POSTDEC, primary_expr);
+    node_id_t primary_expr = operands[num_operands - 1];
+    switch (peek_token(tokens)->type) {
+        case TOK_INCREMENT:
+            debug("Found postinc\n");
+            pop_token(tokens);
+            if (!is_valid_lhs(primary_expr)) {
+                UNREACHABLE("compile error: trying to postinc invalid lhs\n");
+            }
+            if (fast)
+                fast_unary(UNARY_POSTINC, node_var(primary_expr));
+            operands[num_operands - 1] = new_unary_expr(UNARY_POSTINC, primary_expr);
+            return;
+        case TOK_DECREMENT:
+            debug("Found postdec\n");
+            pop_token(tokens);
+            if (!is_valid_lhs(primary_expr)) {
+                UNREACHABLE("compile error: trying to postdec invalid lhs\n");
+            }
+            if (fast)
+                fast_unary(UNARY_POSTDEC, node_var(primary_expr));
+            operands[num_operands - 1] = new_unary_expr(UNARY_POSTDEC, primary_expr);
+            return;
+        default:
+            return;
     }
-
-    return primary_expr;
 }
 
-static expr_t *parse_unary(list_t *tokens, env_t *env) {
-    if (!tokens || !tokens->len) {
-        UNREACHABLE("wtf you doin\n");
-    }
-
-    if (match(tokens, TOK_BANG)) {
-        debug("Found unary bang\n");
-        return new_unary_expr(UNARY_LOGICAL_NEG, parse_unary(tokens, env));
-    }
-
-    if (match(tokens, TOK_TILDE)) {
-        debug("Found unary tilde\n");
-        return new_unary_expr(UNARY_BITWISE_COMP, parse_unary(tokens, env));
-    }
-
-    if (match(tokens, TOK_MINUS)) {
-        debug("Found unary neg\n");
-        return new_unary_expr(UNARY_MATH_NEG, parse_unary(tokens, env));
-    }
-
-    if (match(tokens, TOK_INCREMENT)) {
-        debug("Found preincrement\n");
-        expr_t *lhs = parse_unary(tokens, env);
-        if (!is_valid_lhs(lhs)) {
-            UNREACHABLE("Compile error: invalid lhs for preincrement operator\n");
-        }
-        expr_t *rhs = new_bin_expr(BIN_ADD, lhs, new_primary_int(1));
-        return new_assign(lhs, rhs);
-    }
-
-    if (match(tokens, TOK_DECREMENT)) {
-        debug("Found predecrement\n");
-        expr_t *lhs = parse_unary(tokens, env);
-        if (!is_valid_lhs(lhs)) {
-            debug("lhs type: %d\n", (int)lhs->type);
-            UNREACHABLE("Compile error: invalid lhs for predecrement operator\n");
+// Pops the top operator and replaces its operands with the node it makes.
+static void reduce(void) {
+    expr_frame_t *frame = &expr_frames[--num_expr_frames];
+    node_id_t rhs = pop_operand();
+    node_id_t lhs;
+
+    // The new operand starts where its first operand did
+    int label_mark = operand_label_marks[num_operands - 1];
+    switch (frame->kind) {
+        case EXPR_BINARY:
+            lhs = pop_operand();
+            if (fast)
+                fast_bin(frame->op, frame->labels);
+            push_operand(new_bin_expr(frame->op, lhs, rhs), label_mark);
+            return;
+        case EXPR_ASSIGN:
+            lhs = pop_operand();
+
+            // x += y means x = x + y
+            if (frame->op >= 0) {
+                if (fast)
+                    fast_bin(frame->op, frame->labels);
+                rhs = new_bin_expr(frame->op, lhs, rhs);
+            }
+            if (fast)
+                fast_assign(node_var(lhs));
+            push_operand(new_assign(lhs, rhs), label_mark);
+            return;
+        case EXPR_TERNARY_ELSE: {
+            node_id_t then = pop_operand();
+            node_id_t cond = pop_operand();
+            label_mark = operand_label_marks[num_operands];
+            if (fast)
+                fast_ternary_end(frame->labels);
+            push_operand(new_ternary(cond, then, rhs), label_mark);
+            return;
         }
-        expr_t *rhs = new_bin_expr(BIN_SUB, lhs, new_primary_int(1));
-        return new_assign(lhs, rhs);
-    }
-
-    // Thanks 9cc
-    return parse_postfix(tokens, env);
-}
-
-static expr_t *parse_mul_div(list_t *tokens, env_t *env) {
-    expr_t *ret = parse_unary(tokens, env);
-
-    while (tokens->len) {
-        if (match(tokens, TOK_MULT)) {
-            debug("Found mult\n");
-            ret = new_bin_expr(BIN_MUL, ret, parse_unary(tokens, env));
-        } else if (match(tokens, TOK_DIV)) {
-            debug("Found div\n");
-            ret = new_bin_expr(BIN_DIV, ret, parse_unary(tokens, env));
-        } else if (match(tokens, TOK_MODULO)){
-            debug("Found modulo\n");
-            ret = new_bin_expr(BIN_MODULO, ret, parse_mul_div(tokens, env));
-        } else {
+        case EXPR_PREFIX:
+            label_mark = operand_label_marks[num_operands];
             break;
-        }
+        default:
+            UNREACHABLE("reduce: not an operator\n");
+    }
+
+    switch (frame->op) {
+        case TOK_BANG:
+            debug("Found unary bang\n");
+            if (fast)
+                fast_unary(UNARY_LOGICAL_NEG, NULL);
+            push_operand(new_unary_expr(UNARY_LOGICAL_NEG, rhs), label_mark);
+            return;
+        case TOK_TILDE:
+            debug("Found unary tilde\n");
+            if (fast)
+                fast_unary(UNARY_BITWISE_COMP, NULL);
+            push_operand(new_unary_expr(UNARY_BITWISE_COMP, rhs), label_mark);
+            return;
+        case TOK_MINUS:
+            debug("Found unary neg\n");
+            if (fast)
+                fast_unary(UNARY_MATH_NEG, NULL);
+            push_operand(new_unary_expr(UNARY_MATH_NEG, rhs), label_mark);
+            return;
+        case TOK_INCREMENT:
+            debug("Found preincrement\n");
+            if (!is_valid_lhs(rhs)) {
+                UNREACHABLE("Compile error: invalid lhs for preincrement operator\n");
+            }
+            if (fast)
+                fast_prefix_inc(BIN_ADD, node_var(rhs));
+            push_operand(new_assign(rhs, new_bin_expr(BIN_ADD, rhs, new_primary_int(1))), label_mark);
+            return;
+        case TOK_DECREMENT:
+            debug("Found predecrement\n");
+            if (!is_valid_lhs(rhs)) {
+                debug("lhs kind: %d\n", (int)ast->kind[rhs]);
+                UNREACHABLE("Compile error: invalid lhs for predecrement operator\n");
+            }
+            if (fast)
+                fast_prefix_inc(BIN_SUB, node_var(rhs));
+            push_operand(new_assign(rhs, new_bin_expr(BIN_SUB, rhs, new_primary_int(1))), label_mark);
+            return;
+        default:
+            UNREACHABLE("reduce: unexpected prefix operator\n");
     }
-    return ret;
 }
 
-static expr_t *parse_add_sub(list_t *tokens, env_t *env) {
-    expr_t *ret = parse_mul_div(tokens, env);
-
-    while (tokens->len) {
-        if (match(tokens, TOK_PLUS)) {
-            debug("Found plus\n");
-            ret = new_bin_expr(BIN_ADD, ret, parse_mul_div(tokens, env));
-        } else if (match(tokens, TOK_MINUS)) {
-            debug("Found minus\n");
-            ret = new_bin_expr(BIN_SUB, ret, parse_mul_div(tokens, env));
-        } else {
-            break;
-        }
-    }
-    return ret;
-}
-
-static expr_t *parse_relational(list_t *tokens, env_t *env) {
-    expr_t *ret = parse_add_sub(tokens, env);
-
-    token_t *curr;
-    while ((curr = list_peek(tokens))) {
-        if (curr->type == TOK_GT) {
-            debug("Found gt");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_GT, ret, parse_add_sub(tokens, env));
-        } else if (curr->type == TOK_LT) {
-            debug("Found lt");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_LT, ret, parse_add_sub(tokens, env));
-        } else if (curr->type == TOK_GTE) {
-            debug("Found lte");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_GTE, ret, parse_add_sub(tokens, env));
-        } else if (curr->type == TOK_LTE) {
-            debug("Found lte");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_LTE, ret, parse_add_sub(tokens, env));
-        } else {
-            break;
-        }
-    }
-    return ret;
+typedef struct {
+    prec_t prec;
+
+    // For PREC_ASSIGN this is the operation a compound assignment does, or -1 for plain =
+    int op;
+} binary_op_t;
+
+// Indexed by token type. Tokens that aren't binary operators have PREC_NONE, which ends an
+// expression. Assignment and the ternary are right associative, everything else is left
+// associative.
+static const binary_op_t binary_ops[NUM_TOKEN_TYPES] = {
+    [TOK_ASSIGN] = {PREC_ASSIGN, -1},
+    [TOK_PLUS_EQ] = {PREC_ASSIGN, BIN_ADD},
+    [TOK_MINUS_EQ] = {PREC_ASSIGN, BIN_SUB},
+    [TOK_QUESTION] = {PREC_TERNARY, -1},
+    [TOK_OR] = {PREC_LOGICAL_OR, BIN_OR},
+    [TOK_AND] = {PREC_LOGICAL_AND, BIN_AND},
+    [TOK_EQ] = {PREC_EQUALITY, BIN_EQ},
+    [TOK_NE] = {PREC_EQUALITY, BIN_NE},
+    [TOK_LT] = {PREC_RELATIONAL, BIN_LT},
+    [TOK_LTE] = {PREC_RELATIONAL, BIN_LTE},
+    [TOK_GT] = {PREC_RELATIONAL, BIN_GT},
+    [TOK_GTE] = {PREC_RELATIONAL, BIN_GTE},
+    [TOK_PLUS] = {PREC_ADDITIVE, BIN_ADD},
+    [TOK_MINUS] = {PREC_ADDITIVE, BIN_SUB},
+    [TOK_MULT] = {PREC_MULTIPLICATIVE, BIN_MUL},
+    [TOK_DIV] = {PREC_MULTIPLICATIVE, BIN_DIV},
+    [TOK_MODULO] = {PREC_MULTIPLICATIVE, BIN_MODULO},
+};
+
+// Whether the operator on top of the stack has all its operands once an operator with prec shows up
+static bool top_is_done(prec_t prec) {
+    prec_t top = expr_frames[num_expr_frames - 1].prec;
+    if (top == PREC_NONE)
+        return false;
+    if (top == prec)
+        return prec != PREC_ASSIGN && prec != PREC_TERNARY;
+    return top > prec;
 }
 
-static expr_t *parse_equality(list_t *tokens, env_t *env) {
-    expr_t *ret = parse_relational(tokens, env);
-
-    token_t *curr;
-    while ((curr = list_peek(tokens))) {
-        if (curr->type == TOK_NE) {
-            debug("Found not equal\n");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_NE, ret, parse_relational(tokens, env));
-        } else if (curr->type == TOK_EQ) {
-            debug("Found equal to\n");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_EQ, ret, parse_relational(tokens, env));
-        } else {
-            break;
-        }
-    }
-    return ret;
-}
+// Operator precedence parsing with explicit operator and operand stacks instead of recursion, so
+// how deeply an expression can nest is only limited by memory. Each operator waits on the stack
+// until one that binds more loosely shows up, or its group ends.
+static node_id_t parse_expr(token_buf_t *tokens, env_t *env) {
+    debug("parse_expr\n");
+    int base = num_expr_frames;
+    push_expr_frame(EXPR_BOTTOM, PREC_NONE, 0);
+
+    bool want_operand = true;
+    for (;;) {
+        token_t *curr = peek_token(tokens);
+        if (want_operand) {
+            if (!curr) {
+                UNREACHABLE("wtf you doin\n");
+            }
 
-static expr_t *parse_logical_and(list_t *tokens, env_t *env) {
-    expr_t *ret = parse_equality(tokens, env);
+            switch (curr->type) {
+                case TOK_BANG:
+                case TOK_TILDE:
+                case TOK_MINUS:
+                case TOK_INCREMENT:
+                case TOK_DECREMENT:
+                    pop_token(tokens);
+                    push_expr_frame(EXPR_PREFIX, PREC_PREFIX, curr->type);
+                    continue;
+                case TOK_OPEN_PAREN:
+                    // Parentheses only affect how the expression is parsed, so they don't need a node
+                    debug("Found nested expr\n");
+                    pop_token(tokens);
+                    push_expr_frame(EXPR_PAREN, PREC_NONE, 0);
+                    continue;
+                default:
+                    break;
+            }
 
-    token_t *curr;
-    while ((curr = list_peek(tokens))) {
-        if (curr->type == TOK_AND) {
-            debug("Found logical and expr\n");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_AND, ret, parse_equality(tokens, env));
-        } else {
-            break;
+            if (parse_primary(tokens, env)) {
+                parse_postfix(tokens);
+                want_operand = false;
+            }
+            continue;
         }
-    }
-    return ret;
-}
-
-static expr_t *parse_logical_or(list_t *tokens, env_t *env) {
-    expr_t *ret = parse_logical_and(tokens, env);
 
-    token_t *curr;
-    while ((curr = list_peek(tokens))) {
-        if (curr->type == TOK_OR) {
-            debug("Found logical or expr\n");
-            list_pop(tokens);
-            ret = new_bin_expr(BIN_OR, ret, parse_logical_and(tokens, env));
-        } else {
-            break;
+        const binary_op_t *bin = curr ? &binary_ops[curr->type] : &binary_ops[0];
+        if (bin->prec != PREC_NONE) {
+            while (top_is_done(bin->prec))
+                reduce();
+
+            // If there's nothing to assign to, leave the = for the caller to choke on
+            if (bin->prec != PREC_ASSIGN || is_valid_lhs(operands[num_operands - 1])) {
+                debug("parse_expr: Found operator %u\n", (unsigned)curr->type);
+                pop_token(tokens);
+                expr_frame_t *frame;
+                if (bin->prec == PREC_TERNARY) {
+                    frame = push_expr_frame(EXPR_TERNARY_THEN, PREC_NONE, 0);
+                    if (fast)
+                        fast_ternary_cond(operand_label_marks[num_operands - 1], frame->labels);
+                } else if (bin->prec == PREC_ASSIGN) {
+                    frame = push_expr_frame(EXPR_ASSIGN, bin->prec, bin->op);
+                    if (fast && bin->op < 0)
+                        fast_assign_lhs();
+                    else if (fast)
+                        fast_bin_lhs(bin->op, frame->labels);
+                } else {
+                    frame = push_expr_frame(EXPR_BINARY, bin->prec, bin->op);
+                    if (fast)
+                        fast_bin_lhs(bin->op, frame->labels);
+                }
+                want_operand = true;
+                continue;
+            }
         }
-    }
-    return ret;
-}
-
-static expr_t *parse_ternary(list_t *tokens, env_t *env) {
-    expr_t *cond = parse_logical_or(tokens, env);
-    if (!check_next(tokens, TOK_QUESTION)) {
-        debug("parse_ternary: no question mark found, not a ternary\n");
-        return cond;
-    }
-
-    debug("parse_ternary: Found a ternary\n");
-    expect_next(tokens, TOK_QUESTION);
-    expr_t *then = parse_expr(tokens, env);
-    debug("parse_ternary: got then\n");
-    expect_next(tokens, TOK_COLON);
-    expr_t *els = parse_ternary(tokens, env);
-    debug("parse_ternary: got else\n");
-
-    return new_ternary(cond, then, els);
-}
-
-// Handles += as well as =
-static expr_t *parse_assign(list_t *tokens, env_t *env) {
-    expr_t *maybe_lhs = parse_ternary(tokens, env);
-    if (!is_valid_lhs(maybe_lhs)) {
-        debug("parse_assign: Not a valid lhs so returning\n");
-        return maybe_lhs;
-    }
-
-    // here we might have an assignment statement
-    // we have a valid lhs at least
-    debug("parse_assign: Maybe an assign\n");
-    token_t *next = list_peek(tokens);
-    if (next->type == TOK_ASSIGN) {
-        // ok cool we got an assignment statement
-        debug("parse_assign: got an assignment statement\n");
-        list_pop(tokens);
-        expr_t *rhs = parse_expr(tokens, env);
-        return new_assign(maybe_lhs, rhs);
-    }
-
-    if (next->type == TOK_PLUS_EQ) {
-        debug("parse_assign: Got plus equals assignment statement\n");
-        list_pop(tokens);
-
-        // plus equals means that lhs = lhs + remaining expr 
-        expr_t *rhs = new_bin_expr(BIN_ADD, maybe_lhs, parse_expr(tokens, env));
-        return new_assign(maybe_lhs, rhs);
-    }
 
-    if (next->type == TOK_MINUS_EQ) {
-        debug("parse_assign: Got minus equals assignment statement\n");
-        list_pop(tokens);
-        expr_t *rhs = new_bin_expr(BIN_SUB, maybe_lhs, parse_expr(tokens, env));
-        return new_assign(maybe_lhs, rhs);
+        // Whatever this is ends the innermost group
+        while (expr_frames[num_expr_frames - 1].prec != PREC_NONE)
+            reduce();
+
+        expr_frame_t *group = &expr_frames[num_expr_frames - 1];
+        switch (group->kind) {
+            case EXPR_BOTTOM:
+                num_expr_frames = base;
+                return pop_operand();
+            case EXPR_PAREN:
+                expect_next(tokens, TOK_CLOSE_PAREN);
+                num_expr_frames--;
+                parse_postfix(tokens);
+                break;
+            case EXPR_TERNARY_THEN:
+                debug("parse_expr: got then\n");
+                expect_next(tokens, TOK_COLON);
+                if (fast)
+                    fast_ternary_then(group->labels);
+                group->kind = EXPR_TERNARY_ELSE;
+                group->prec = PREC_TERNARY;
+                want_operand = true;
+                break;
+            case EXPR_CALL:
+                if (end_fn_call_arg(tokens))
+                    parse_postfix(tokens);
+                else
+                    want_operand = true;
+                break;
+            default:
+                UNREACHABLE("parse_expr: unexpected group\n");
+        }
     }
-
-    debug("parse_assign: Didn't actually get an assignment :(\n");
-    return maybe_lhs;
-}
-
-static expr_t *parse_expr(list_t *tokens, env_t *env) {
-    debug("parse_expr\n");
-    return parse_assign(tokens, env);
 }
 
-static expr_t *parse_optional_expr(list_t *tokens, env_t *env, token_type_t delimiter) {
+static node_id_t parse_optional_expr(token_buf_t *tokens, env_t *env, token_type_t delimiter) {
     if (check_next(tokens, delimiter))
-        return new_null_expr();
+        return NODE_NONE;
     return parse_expr(tokens, env);
 }
 
-static return_stmt_t *parse_return_stmt(list_t *tokens, env_t *env) {
+static node_id_t parse_return_stmt(token_buf_t *tokens, env_t *env) {
     debug("parse_return_stmt: parsing return stmt\n");
-    return_stmt_t *ret = malloc(sizeof(return_stmt_t));
     expect_next(tokens, TOK_RETURN);
-    ret->expr = parse_expr(tokens, env);
+    node_id_t expr = parse_expr(tokens, env);
     expect_next(tokens, TOK_SEMICOLON);
-    return ret;
+    if (fast)
+        fast_return();
+    return ast_add(ast, NODE_RETURN, 0, TYPE_VOID, expr, 0);
 }
 
-static declare_stmt_t *parse_declare_stmt(list_t *tokens, env_t *env) {
-    declare_stmt_t *declare = malloc(sizeof(declare_stmt_t));
-    declare->init_expr = NULL;
-    token_t *next = list_pop(tokens);
-    declare->type = token_to_builtin_type(next->type); 
-    next = list_peek(tokens);
-    if (next->type != TOK_IDENT) {
-        debug("Error in parse_declare_stmt: No identifier found following the type.\n");
-        return NULL;
+static node_id_t parse_declare_stmt(token_buf_t *tokens, env_t *env) {
+    node_id_t init_expr = NODE_NONE;
+    token_t *next = pop_token(tokens);
+    builtin_type_t type = token_to_builtin_type(next->type); 
+    next = peek_token(tokens);
+    if (!next || next->type != TOK_IDENT) {
+        UNREACHABLE("parse_declare_stmt: No identifier found following the type.\n");
     }
 
-    declare->name = next->ident;
-    debug("parse_declare_stmt: Found variable %s\n", string_get(declare->name));
+    string_t *name = token_ident(tokens, next);
+    debug("parse_declare_stmt: Found variable %s\n", string_get(name));
 
-    if (map_contains(env->homes, declare->name)) {
+    if (env_in_scope(env, name)) {
         UNREACHABLE("parse_declare_stmt: variable is redeclared!\n");
     }
-    env_add(env, declare->name, declare->type, false);
+    var_info_t *var_info = env_add(env, name, type, false);
+    if (fast)
+        fast_declare(var_info);
 
-    list_pop(tokens);
-    next = list_peek(tokens);
+    pop_token(tokens);
+    next = peek_token(tokens);
+    if (!next) {
+        UNREACHABLE("parse_declare_stmt: input ended after the variable's name\n");
+    }
     if (next->type != TOK_SEMICOLON) {
         debug("parse_declare_stmt: Found init_expr\n");
         expect_next(tokens, TOK_ASSIGN);
-        declare->init_expr = parse_expr(tokens, env);
+        init_expr = parse_expr(tokens, env);
+        if (fast)
+            fast_init(var_info);
     }
     expect_next(tokens, TOK_SEMICOLON);
     debug("parse_declare_stmt: Returning\n");
-    return declare;
-}
-
-static block_or_single_t *parse_block_or_single(list_t *tokens, env_t *env) {
-    block_or_single_t *ret = malloc(sizeof(block_or_single_t));
-    if (check_next(tokens, TOK_OPEN_BRACE)) {
-        debug("Parsing block\n");
-        ret->type = BLOCK;
-        ret->block = parse_block(tokens, env);
-    } else {
-        debug("Parsing single\n");
-        ret->type = SINGLE;
-        ret->single = parse_stmt(tokens, env);
-        if (ret->single->type == STMT_DECLARE) {
-            UNREACHABLE("Error: in single of block or single, statement cannot be a declare");
-        }
-    }
-    return ret;
+    return ast_add(ast, NODE_DECLARE, 0, type, var_info->index, init_expr);
+}
+
+static void begin_stmt_list(token_buf_t *tokens, bool scoped) {
+    expect_next(tokens, TOK_OPEN_BRACE);
+    debug("parsing statement list\n");
+    stmt_frame_t *frame = push_stmt_frame(STMT_LIST);
+    frame->mark = scratch_len;
+    frame->scoped = scoped;
 }
 
-static if_stmt_t *parse_if_stmt(list_t *tokens, env_t *env) {
+static void begin_if_stmt(token_buf_t *tokens, env_t *env) {
     expect_next(tokens, TOK_IF);
     debug("parse_if_stmt: found if\n");
-    if_stmt_t *ret = malloc(sizeof(if_stmt_t));
     expect_next(tokens, TOK_OPEN_PAREN);
-    ret->cond = parse_expr(tokens, env);
+    node_id_t cond = parse_expr(tokens, env);
     debug("parse_if_stmt: got cond\n");
     expect_next(tokens, TOK_CLOSE_PAREN);
-
-    ret->then = malloc(sizeof(block_or_single_t));
-    ret->then = parse_block_or_single(tokens, env);
-    ret->els = NULL;
-    if (check_next(tokens, TOK_ELSE)) {
-        debug("parse_if_stmt: found else\n");
-        list_pop(tokens);
-        ret->els = parse_block_or_single(tokens, env);
-    }
-    debug("parse_if_stmt: done\n");
-    return ret;
+    stmt_frame_t *frame = push_stmt_frame(STMT_IF_THEN);
+    frame->nodes[0] = cond;
+    if (fast)
+        fast_if_cond(frame->labels);
 }
 
 // A for statement init clause is either a declaration or an optional expression.
-static stmt_t *parse_for_init_clause(list_t *tokens, env_t *env) {
-    token_t *curr_token = list_peek(tokens);
+static node_id_t parse_for_init_clause(token_buf_t *tokens, env_t *env) {
+    token_t *curr_token = peek_token(tokens);
+    if (!curr_token) {
+        UNREACHABLE("parse_for_init_clause: input ended in a for statement\n");
+    }
     if (is_type(curr_token->type))
-        return parse_stmt(tokens, env);
+        return parse_declare_stmt(tokens, env);
 
-    stmt_t *ret = malloc(sizeof(stmt_t));
-    ret->type = STMT_EXPR; 
-    ret->expr = parse_optional_expr(tokens, env, TOK_SEMICOLON);
+    node_id_t expr = parse_optional_expr(tokens, env, TOK_SEMICOLON);
     expect_next(tokens, TOK_SEMICOLON);
-    return ret;
+    return ast_add(ast, NODE_EXPR_STMT, 0, TYPE_VOID, expr, 0);
 }
 
-static for_stmt_t *parse_for_stmt(list_t *tokens, env_t *env) {
+static void begin_for_stmt(token_buf_t *tokens, env_t *env) {
     expect_next(tokens, TOK_FOR);
     debug("parse_for_stmt: found for\n");
 
-    for_stmt_t *ret = malloc(sizeof(for_stmt_t));
-    ret->env = env_new(env);
+    // init, cond, post
+    node_id_t clauses[3];
+    int labels[3];
+    if (fast)
+        fast_for_begin(labels);
+
+    // The init clause gets its own scope, which is popped once the body is done
+    env_push_scope(env);
     expect_next(tokens, TOK_OPEN_PAREN);
-    ret->init = parse_for_init_clause(tokens, ret->env);
+    clauses[0] = parse_for_init_clause(tokens, env);
 
     debug("for: got init\n");
-    ret->cond = parse_optional_expr(tokens, ret->env, TOK_SEMICOLON);
+    if (fast)
+        fast_for_cond(labels);
+    clauses[1] = parse_optional_expr(tokens, env, TOK_SEMICOLON);
     // For loops with no cond should run forever - replace the cond with a nonzero int.
-    if (ret->cond->type == NULL_EXPR) {
-        ret->cond = new_primary_int(1);
+    if (clauses[1] == NODE_NONE) {
+        if (fast)
+            fast_int(1);
+        clauses[1] = new_primary_int(1);
     }
     expect_next(tokens, TOK_SEMICOLON);
     debug("for: got cond\n");
-    ret->post = parse_optional_expr(tokens, ret->env, TOK_CLOSE_PAREN);
+    if (fast)
+        fast_for_post(labels);
+    clauses[2] = parse_optional_expr(tokens, env, TOK_CLOSE_PAREN);
     expect_next(tokens, TOK_CLOSE_PAREN);
     debug("for: got post\n");
-    ret->body = parse_block_or_single(tokens, ret->env);
-    return ret;
+    if (fast)
+        fast_for_body();
+
+    stmt_frame_t *frame = push_stmt_frame(STMT_FOR_BODY);
+    for (int i = 0; i < 3; i++) {
+        frame->nodes[i] = clauses[i];
+        frame->labels[i] = labels[i];
+    }
+    frame->break_label = labels[1];
+    frame->continue_label = labels[2];
 }
 
-static while_stmt_t *parse_while_stmt(list_t *tokens, env_t *env) {
+static void begin_while_stmt(token_buf_t *tokens, env_t *env) {
     expect_next(tokens, TOK_WHILE);
     debug("parse_while_stmt: found while\n");
-    while_stmt_t *ret = malloc(sizeof(while_stmt_t));
+    int labels[2];
+    if (fast)
+        fast_loop_begin(labels);
     expect_next(tokens, TOK_OPEN_PAREN);
-    ret->cond = parse_expr(tokens, env);
+    node_id_t cond = parse_expr(tokens, env);
     debug("parse_while_stmt: got cond\n");
     expect_next(tokens, TOK_CLOSE_PAREN);
-    ret->body = parse_block_or_single(tokens, env);
-    debug("parse_while_stmt: got body\n");
-    return ret;
+    if (fast)
+        fast_while_body(labels);
+
+    stmt_frame_t *frame = push_stmt_frame(STMT_WHILE_BODY);
+    frame->nodes[0] = cond;
+    frame->labels[0] = frame->continue_label = labels[0];
+    frame->labels[1] = frame->break_label = labels[1];
 }
 
-static do_stmt_t *parse_do_stmt(list_t *tokens, env_t *env) {
-    expect_next(tokens, TOK_DO);
-    debug("parse_do_stmt: do found\n");
-    do_stmt_t *ret = malloc(sizeof(do_stmt_t));
-    ret->body = parse_block_or_single(tokens, env);
+static node_id_t end_do_stmt(token_buf_t *tokens, env_t *env, stmt_frame_t *frame, node_id_t body) {
     debug("parse_do_stmt: got body\n");
-
     expect_next(tokens, TOK_WHILE);
     expect_next(tokens, TOK_OPEN_PAREN);
-    ret->cond = parse_expr(tokens, env);
+    node_id_t cond = parse_expr(tokens, env);
     debug("parse_do_stmt: got cond\n");
     expect_next(tokens, TOK_CLOSE_PAREN);
     expect_next(tokens, TOK_SEMICOLON);
-    return ret;
+    if (fast)
+        fast_do_end(frame->labels);
+    return ast_add(ast, NODE_DO, 0, TYPE_VOID, body, cond);
 }
 
-static list_t *parse_stmt_list(list_t *tokens, env_t *env) {
-    expect_next(tokens, TOK_OPEN_BRACE);
-    list_t *stmt_list = list_new();
-    token_t *curr;
-    debug("parsing statement list\n");
-    while ((curr = list_peek(tokens)) && curr->type != TOK_CLOSE_BRACE) {
-        list_push(stmt_list, parse_stmt(tokens, env));
+// Parses a statement that doesn't contain other statements and returns it. Statements that do are
+// started by pushing a frame for them instead, and NODE_NONE is returned.
+static node_id_t parse_stmt(token_buf_t *tokens, env_t *env) {
+    token_t *curr = peek_token(tokens);
+    if (!curr) {
+        UNREACHABLE("Parse failed");
     }
-    debug("done parsing statement list\n");
-    expect_next(tokens, TOK_CLOSE_BRACE);
-    return stmt_list;
-}
-
-static block_t *parse_block(list_t *tokens, env_t *outer) {
-    block_t *block = malloc(sizeof(block_t));
-    block->env = env_new(outer);
-    block->stmts = parse_stmt_list(tokens, block->env);
-    return block;
-}
-
-static stmt_t *parse_stmt(list_t *tokens, env_t *env) {
-    if (!tokens || !env)
-        return NULL;
-    stmt_t *ret = malloc(sizeof(stmt_t));
-    token_t *curr = list_peek(tokens);
 
     if (curr->type == TOK_OPEN_BRACE) {
-        ret->block = parse_block(tokens, env);
-        ret->type = STMT_BLOCK;
-        return ret;
+        env_push_scope(env);
+        begin_stmt_list(tokens, true);
+        return NODE_NONE;
     }
 
     if (curr->type == TOK_RETURN) {
         debug("parse_stmt: Found return statement\n");
-        return_stmt_t *ret_stmt = parse_return_stmt(tokens, env);
-        if (!ret_stmt)
-            return NULL;
-        ret->type = STMT_RETURN;
-        ret->ret = ret_stmt;
-        return ret;
+        return parse_return_stmt(tokens, env);
     }
 
     if (curr->type == TOK_IF) {
-        if_stmt_t *if_stmt = parse_if_stmt(tokens, env);
-        ret->type = STMT_IF;
-        ret->if_stmt = if_stmt;
-        return ret;
+        begin_if_stmt(tokens, env);
+        return NODE_NONE;
     }
 
     if (curr->type == TOK_FOR) {
-        ret->for_stmt = parse_for_stmt(tokens, env);
-        ret->type = STMT_FOR;
-        return ret;
+        begin_for_stmt(tokens, env);
+        return NODE_NONE;
     }
 
     if (curr->type == TOK_WHILE) {
-        ret->while_stmt = parse_while_stmt(tokens, env);
-        ret->type = STMT_WHILE;
-        return ret;
+        begin_while_stmt(tokens, env);
+        return NODE_NONE;
     }
 
     if (curr->type == TOK_DO) {
         debug("Found do stmt\n");
-        ret->do_stmt = parse_do_stmt(tokens, env);
-        ret->type = STMT_DO;
-        return ret;
+        expect_next(tokens, TOK_DO);
+        stmt_frame_t *frame = push_stmt_frame(STMT_DO_BODY);
+        if (fast) {
+            fast_loop_begin(frame->labels);
+            frame->continue_label = frame->labels[0];
+            frame->break_label = frame->labels[1];
+        }
+        return NODE_NONE;
     }
 
     if (match(tokens, TOK_BREAK)) {
         debug("parse_stmt: Found break\n");
         expect_next(tokens, TOK_SEMICOLON);
-        ret->type = STMT_BREAK;
-        return ret;
+        if (fast)
+            fast_jump(stmt_frames[num_stmt_frames - 1].break_label);
+        return ast_add(ast, NODE_BREAK, 0, TYPE_VOID, 0, 0);
     }
 
     if (match(tokens, TOK_CONTINUE)) {
         debug("parse_stmt: Found continue\n");
         expect_next(tokens, TOK_SEMICOLON);
-        ret->type = STMT_CONTINUE;
-        return ret;
+        if (fast)
+            fast_jump(stmt_frames[num_stmt_frames - 1].continue_label);
+        return ast_add(ast, NODE_CONTINUE, 0, TYPE_VOID, 0, 0);
     }
 
     // The first token in a declaration is a type
     if (is_type(curr->type)) {
         debug("parse_stmt: Found declaration statement\n");
-        declare_stmt_t *declare = parse_declare_stmt(tokens, env);
-        if (!declare)
-            return NULL;
-        ret->type = STMT_DECLARE;
-        ret->declare = declare;
-        return ret;
+        return parse_declare_stmt(tokens, env);
     }
 
     // Otherwise, try to parse an expression
     if (match(tokens, TOK_SEMICOLON)) {
         debug("parse_stmt: Found null expr stmt\n");
-        ret->type = STMT_NULL;
-        return ret;
+        return ast_add(ast, NODE_EMPTY, 0, TYPE_VOID, 0, 0);
     }
 
     debug("parse_stmt: Found nonnull expr stmt\n");
-    expr_t *expr = parse_expr(tokens, env);
-    ret->type = STMT_EXPR;
-    ret->expr = expr; 
+    node_id_t expr = parse_expr(tokens, env);
     expect_next(tokens, TOK_SEMICOLON);
-    return ret;
+    return ast_add(ast, NODE_EXPR_STMT, 0, TYPE_VOID, expr, 0);
+}
+
+// Parses the statements between a pair of braces and returns them as a NODE_BLOCK. Nested
+// statements push a frame and are finished off here once their last child is done, rather than
+// being parsed recursively.
+static node_id_t parse_stmt_list(token_buf_t *tokens, env_t *env) {
+    int base = num_stmt_frames;
+    begin_stmt_list(tokens, false);
+
+    // the statement that was just finished, if any
+    node_id_t done = NODE_NONE;
+    for (;;) {
+        stmt_frame_t *frame = &stmt_frames[num_stmt_frames - 1];
+        if (done == NODE_NONE) {
+            token_t *curr = peek_token(tokens);
+            if (frame->kind == STMT_LIST && (!curr || curr->type == TOK_CLOSE_BRACE)) {
+                debug("done parsing statement list\n");
+                expect_next(tokens, TOK_CLOSE_BRACE);
+                uint32_t num_stmts = scratch_len - frame->mark;
+                done = ast_add(ast, NODE_BLOCK, 0, TYPE_VOID, scratch_pop_to_extra(frame->mark), num_stmts);
+                if (frame->scoped)
+                    env_pop_scope(env);
+                if (--num_stmt_frames == base)
+                    return done;
+                continue;
+            }
+            done = parse_stmt(tokens, env);
+            continue;
+        }
+
+        if (frame->kind == STMT_LIST) {
+            scratch_push(done);
+            done = NODE_NONE;
+            continue;
+        }
+
+        // Everything else was waiting on a block or a single statement
+        if (ast->kind[done] == NODE_DECLARE) {
+            UNREACHABLE("Error: in single of block or single, statement cannot be a declare");
+        }
+
+        node_id_t body = done;
+        uint32_t clauses[4];
+        switch (frame->kind) {
+            case STMT_IF_THEN:
+                if (check_next(tokens, TOK_ELSE)) {
+                    debug("parse_if_stmt: found else\n");
+                    pop_token(tokens);
+                    if (fast)
+                        fast_if_else(frame->labels);
+                    frame->kind = STMT_IF_ELSE;
+                    frame->nodes[1] = body;
+                    done = NODE_NONE;
+                    continue;
+                }
+                if (fast)
+                    fast_if_end(frame->labels, false);
+                clauses[0] = body;
+                clauses[1] = NODE_NONE;
+                done = ast_add(ast, NODE_IF, 0, TYPE_VOID, frame->nodes[0], ast_add_extra(ast, clauses, 2));
+                break;
+            case STMT_IF_ELSE:
+                debug("parse_if_stmt: done\n");
+                if (fast)
+                    fast_if_end(frame->labels, true);
+                clauses[0] = frame->nodes[1];
+                clauses[1] = body;
+                done = ast_add(ast, NODE_IF, 0, TYPE_VOID, frame->nodes[0], ast_add_extra(ast, clauses, 2));
+                break;
+            case STMT_FOR_BODY:
+                for (int i = 0; i < 3; i++)
+                    clauses[i] = frame->nodes[i];
+                clauses[3] = body;
+                if (fast)
+                    fast_for_end(frame->labels);
+                env_pop_scope(env);
+                done = ast_add(ast, NODE_FOR, 0, TYPE_VOID, ast_add_extra(ast, clauses, 4), 0);
+                break;
+            case STMT_WHILE_BODY:
+                debug("parse_while_stmt: got body\n");
+                if (fast)
+                    fast_while_end(frame->labels);
+                done = ast_add(ast, NODE_WHILE, 0, TYPE_VOID, frame->nodes[0], body);
+                break;
+            case STMT_DO_BODY:
+                done = end_do_stmt(tokens, env, frame, body);
+                break;
+            default:
+                UNREACHABLE("parse_stmt_list: unexpected frame\n");
+        }
+        num_stmt_frames--;
+    }
 }
 
 // Parses var and adds it to the passed in environment
-// Returns the name of the variable
-static string_t *parse_param(list_t *tokens, env_t *env) {
-    token_t *type_token = list_pop(tokens);
+// Returns the info for the variable
+static var_info_t *parse_param(token_buf_t *tokens, env_t *env) {
+    token_t *type_token = pop_token(tokens);
     token_t *curr = expect_next(tokens, TOK_IDENT);
 
     // The parameter should automatically be declared when it's a parameter.
-    env_add(env, curr->ident, token_to_builtin_type(type_token->type), true);
-    return curr->ident;
+    string_t *ident = token_ident(tokens, curr);
+    return env_add(env, ident, token_to_builtin_type(type_token->type), true);
 }
 
-// Parses the type, name, and parameters of a function definition.
-static fn_def_t *parse_fn_declaration(list_t *tokens) {
-    fn_def_t *fn = malloc(sizeof(fn_def_t));
+// Parses the type, name, and parameters of a function definition. This leaves the function's scope
+// open so the body can be parsed in it.
+static fn_def_t *parse_fn_declaration(token_buf_t *tokens) {
+    fn_def_t *fn = arena_alloc(ast_arena, sizeof(fn_def_t));
 
     // TODO The only difference between a function declaration and definition
-    // is that stmts will be NULL in a declaration
-    fn->stmts = NULL; 
+    // is that body will be NODE_NONE in a declaration
+    fn->body = NODE_NONE;
     fn->params = NULL;
+    fn->first_token = tokens->pos;
 
-    fn->env = env_new(global_env);
+    fn->vars = env_push_fn(global_env);
+    ast_forget_shared(ast);
 
     // first token should be a type
-    token_t *curr = list_pop(tokens);
+    token_t *curr = pop_token(tokens);
     if (!curr) {
         UNREACHABLE("parse_fn_declaration: No more tokens but there should be more?\n");
     }
@@ -835,7 +1257,7 @@ static fn_def_t *parse_fn_declaration(list_t *tokens) {
 
     // next should be an identifier
     curr = expect_next(tokens, TOK_IDENT);
-    fn->name = curr->ident;
+    fn->name = token_ident(tokens, curr);
 
     debug("parse_fn_declaration: Parsing function %s\n", string_get(fn->name));
 
@@ -852,9 +1274,9 @@ static fn_def_t *parse_fn_declaration(list_t *tokens) {
     }
 
     // Parse parameter list
-    fn->params = list_new();
-    while (tokens->len) {
-        list_push(fn->params, parse_param(tokens, fn->env));
+    fn->params = list_new_in(ast_arena);
+    while (tokens_left(tokens)) {
+        list_push(fn->params, parse_param(tokens, global_env));
         if (match(tokens, TOK_CLOSE_PAREN)) {
             break;
         }
@@ -864,7 +1286,8 @@ static fn_def_t *parse_fn_declaration(list_t *tokens) {
 }
 
 static bool fn_def_is_equal(fn_def_t *fn1, fn_def_t *fn2) {
-    if (string_eq(fn1->name, fn2->name) != 0) {
+    // Names are interned, so they can be compared by pointer
+    if (fn1->name != fn2->name) {
         // Should never see this case...
         return false;
     }
@@ -891,19 +1314,14 @@ static bool fn_def_is_equal(fn_def_t *fn1, fn_def_t *fn2) {
 
     list_node_t *n1 = list_first(fn1->params);
     list_node_t *n2 = list_first(fn2->params);
-    string_t *v1_name;
-    string_t *v2_name;
     var_info_t *v1;
     var_info_t *v2;
     for (int i = 0; i < fn1->params->len; i++) {
-        v1_name = n1->data;
-        v2_name = n2->data;
-
-        v1 = map_get(fn1->env->homes, v1_name);
-        v2 = map_get(fn2->env->homes, v2_name);
+        v1 = n1->data;
+        v2 = n2->data;
 
         if (v1->type != v2->type) {
-            debug("mismatching param types for param %s\n", string_get(v1_name));
+            debug("mismatching param types for param %s\n", string_get(v1->name));
             return false;
         }
 
@@ -914,34 +1332,344 @@ static bool fn_def_is_equal(fn_def_t *fn1, fn_def_t *fn2) {
     return true;
 }
 
-program_t *parse(list_t *tokens) {
-    program = malloc(sizeof(program_t));
-    program->fn_defs = map_new();
-    global_env = env_new(NULL);
+// Starts this thread's stacks and symbol table over in arena
+static void parse_thread_begin(arena_t *arena) {
+    ast_arena = arena;
+    scratch = NULL;
+    scratch_len = scratch_capacity = 0;
+    expr_frames = NULL;
+    num_expr_frames = expr_frames_capacity = 0;
+    operands = NULL;
+    operand_label_marks = NULL;
+    num_operands = operands_capacity = operand_label_marks_capacity = 0;
+    stmt_frames = NULL;
+    num_stmt_frames = stmt_frames_capacity = 0;
+    global_env = env_new(arena);
+}
 
-    while (tokens->len) {
-        fn_def_t *next_fn = parse_fn_declaration(tokens);
-        fn_def_t *prev_decl = map_get(program->fn_defs, next_fn->name);
+// Adds a declaration that was just parsed to the program, or checks that it matches the earlier one
+// with its name. Returns the earlier one, or next_fn if there wasn't one.
+static fn_def_t *declare_fn(fn_def_t *next_fn) {
+    fn_def_t *prev_decl = map_get(program->fn_defs, next_fn->name);
+
+    if (!prev_decl) {
+        // This is the first declaration, which we need to put in the map
+        next_fn->index = program->fn_defs->len;
+        prev_decl = next_fn;
+        map_set(program->fn_defs, next_fn->name, prev_decl);
+    } else if (!fn_def_is_equal(next_fn, prev_decl)) {
+        UNREACHABLE("Compilation error: Function declarations don't match\n");
+    }
+    next_fn->index = prev_decl->index;
+    num_visible_fns = program->fn_defs->len;
+    return prev_decl;
+}
 
-        if (!prev_decl) {
-            // This is the first declaration, which we need to put in the map
-            map_set(program->fn_defs, next_fn->name, next_fn);
-            prev_decl = next_fn; 
-        } else if (!fn_def_is_equal(next_fn, prev_decl)) {
-            UNREACHABLE("Compilation error: Function declarations don't match\n");
-        }
+static void parse_serial(token_buf_t *tokens) {
+    while (tokens_left(tokens)) {
+        fn_def_t *next_fn = parse_fn_declaration(tokens);
+        fn_def_t *prev_decl = declare_fn(next_fn);
 
         if (!match(tokens, TOK_SEMICOLON)) {
             // This means that we have a body for the function declaration
-            if (prev_decl->stmts != NULL) {
+            if (prev_decl->body != NODE_NONE) {
                 UNREACHABLE("Compilation error: Function redefined\n");
             }
 
             // We have a definition with statements, so parse the statements and update
             // definition in the map.
-            next_fn->stmts = parse_stmt_list(tokens, next_fn->env);
+            ast_mark_t mark = ast_mark(ast);
+            if (fast)
+                fast_fn_begin(next_fn);
+            next_fn->body = parse_stmt_list(tokens, global_env);
+            map_set(program->fn_defs, next_fn->name, next_fn);
+
+            // Its code is done, so only the fact that it has a body matters now
+            if (fast) {
+                fast_fn_end(program);
+                ast_rewind(ast, mark);
+            }
+        }
+        next_fn->end_token = tokens->pos;
+        env_pop_scope(global_env);
+    }
+}
+
+// Stands in for the body of a definition that's still being parsed
+#define NODE_PENDING ((node_id_t)-1)
+
+// A function definition for parse_parallel's threads to parse
+typedef struct {
+    // where its declaration starts in the tokens, and one past its closing brace
+    int start;
+    int end;
+    int num_visible_fns;
+
+    // What parsing it made, and where its nodes are in the ast of the thread that parsed it
+    fn_def_t *fn_def;
+    ast_t *ast;
+    ast_mark_t ast_start;
+    ast_mark_t ast_end;
+
+    // where its nodes go in the program's ast
+    ast_mark_t at;
+} body_job_t;
+
+typedef struct {
+    program_t *program;
+    token_buf_t *tokens;
+    bool share_exprs;
+
+    body_job_t *jobs;
+    int num_jobs;
+    int jobs_capacity;
+    atomic_int next;
+
+    // one ast for each thread
+    ast_t **asts;
+    atomic_int num_asts;
+
+    atomic_bool failed;
+} parse_work_t;
+
+// Skips over the body that starts at the next token by matching braces, and returns false if they
+// don't match. Every identifier in it is interned on the way, so the threads that parse it only
+// ever look names up.
+static bool skip_body(token_buf_t *tokens) {
+    token_t *curr = peek_token(tokens);
+    if (!curr || curr->type != TOK_OPEN_BRACE)
+        return false;
+
+    int depth = 0;
+    while (tokens_left(tokens)) {
+        curr = pop_token(tokens);
+        if (curr->type == TOK_OPEN_BRACE)
+            depth++;
+        else if (curr->type == TOK_CLOSE_BRACE && --depth == 0)
+            return true;
+        else if (curr->type == TOK_IDENT)
+            token_ident(tokens, curr);
+    }
+    return false;
+}
+
+// Adds every declaration to the program like parse_serial does, but only finds where each body is
+// instead of parsing it. Returns false if something's wrong that parse_serial would report.
+static bool find_bodies(token_buf_t *tokens, parse_work_t *work) {
+    jmp_buf on_error;
+    jmp_buf *prev_jump = parse_jump_use(&on_error, false);
+    if (setjmp(on_error)) {
+        parse_jump_done(prev_jump);
+        return false;
+    }
+
+    bool found = true;
+    while (tokens_left(tokens)) {
+        int start = tokens->pos;
+        fn_def_t *next_fn = parse_fn_declaration(tokens);
+        fn_def_t *prev_decl = declare_fn(next_fn);
+
+        if (!match(tokens, TOK_SEMICOLON)) {
+            if (prev_decl->body != NODE_NONE || !skip_body(tokens)) {
+                found = false;
+                break;
+            }
+            next_fn->body = NODE_PENDING;
             map_set(program->fn_defs, next_fn->name, next_fn);
+
+            work->jobs = grow(work->jobs, work->num_jobs, &work->jobs_capacity, sizeof(body_job_t));
+            body_job_t *job = &work->jobs[work->num_jobs++];
+            job->start = start;
+            job->end = tokens->pos;
+            job->num_visible_fns = num_visible_fns;
         }
+        next_fn->end_token = tokens->pos;
+        env_pop_scope(global_env);
     }
+    parse_jump_done(prev_jump);
+    return found;
+}
+
+// Parses definitions into this thread's own arena and ast until there are none left, and returns
+// the arena
+static void *parse_body_worker(void *arg) {
+    parse_work_t *work = arg;
+    arena_t *arena = arena_new();
+    program = work->program;
+    parse_thread_begin(arena);
+    ast = ast_new();
+    ast->share = work->share_exprs;
+    work->asts[atomic_fetch_add(&work->num_asts, 1)] = ast;
+
+    jmp_buf on_error;
+    jmp_buf *prev_jump = parse_jump_use(&on_error, false);
+    if (setjmp(on_error)) {
+        atomic_store(&work->failed, true);
+        parse_jump_done(prev_jump);
+        return arena;
+    }
+
+    // Each thread consumes tokens with its own copy of the buffer
+    token_buf_t tokens = *work->tokens;
+    for (int i; !atomic_load(&work->failed) && (i = atomic_fetch_add(&work->next, 1)) < work->num_jobs;) {
+        body_job_t *job = &work->jobs[i];
+        tokens.pos = job->start;
+        num_visible_fns = job->num_visible_fns;
+        job->ast = ast;
+        job->ast_start = ast_mark(ast);
+        job->fn_def = parse_fn_declaration(&tokens);
+        job->fn_def->body = parse_stmt_list(&tokens, global_env);
+        job->fn_def->end_token = tokens.pos;
+        env_pop_scope(global_env);
+        job->ast_end = ast_mark(ast);
+
+        // If the body didn't end where its braces did, let parse_serial say what's wrong with it
+        if (tokens.pos != job->end)
+            atomic_store(&work->failed, true);
+    }
+    parse_jump_done(prev_jump);
+    return arena;
+}
+
+static void *copy_body_worker(void *arg) {
+    parse_work_t *work = arg;
+    program = work->program;
+    for (int i; (i = atomic_fetch_add(&work->next, 1)) < work->num_jobs;) {
+        body_job_t *job = &work->jobs[i];
+        job->fn_def->body += ast_copy(program->ast, job->at, job->ast, job->ast_start, job->ast_end);
+    }
+    return NULL;
+}
+
+// Adds every declaration to the program in one pass that skips over the bodies, then parses the
+// bodies on num_threads threads at once and copies their nodes into the program's ast in the order
+// they came in. Returns false if there was an error, without reporting it.
+static bool parse_parallel(token_buf_t *tokens, int num_threads, bool share_exprs) {
+    parse_work_t work;
+    work.program = program;
+    work.tokens = tokens;
+    work.share_exprs = share_exprs;
+    work.jobs = NULL;
+    work.num_jobs = work.jobs_capacity = 0;
+    atomic_init(&work.failed, false);
+    if (!find_bodies(tokens, &work))
+        return false;
+
+    if (num_threads > work.num_jobs)
+        num_threads = work.num_jobs;
+    work.asts = malloc(sizeof(ast_t *) * num_threads);
+    atomic_init(&work.num_asts, 0);
+    atomic_init(&work.next, 0);
+    run_threads(num_threads, parse_body_worker, &work, ast_arena);
+
+    if (!atomic_load(&work.failed)) {
+        ast_mark_t at = ast_mark(program->ast);
+        for (int i = 0; i < work.num_jobs; i++) {
+            body_job_t *job = &work.jobs[i];
+            job->at = at;
+            at.len += job->ast_end.len - job->ast_start.len;
+            at.extra_len += job->ast_end.extra_len - job->ast_start.extra_len;
+            at.names_len += job->ast_end.names_len - job->ast_start.names_len;
+        }
+        ast_resize(program->ast, at);
+        atomic_store(&work.next, 0);
+        run_threads(num_threads, copy_body_worker, &work, ast_arena);
+
+        // The definitions replace what find_bodies put in the map
+        for (int i = 0; i < work.num_jobs; i++) {
+            fn_def_t *fn_def = work.jobs[i].fn_def;
+            fn_def->index = ((fn_def_t *)map_get(program->fn_defs, fn_def->name))->index;
+            map_set(program->fn_defs, fn_def->name, fn_def);
+        }
+    }
+
+    for (int i = 0; i < atomic_load(&work.num_asts); i++)
+        ast_free(work.asts[i]);
+    free(work.asts);
+    return !atomic_load(&work.failed);
+}
+
+// Starts the program over with no functions
+static void program_begin(arena_t *arena, bool share_exprs) {
+    parse_thread_begin(arena);
+    program->fn_defs = map_new_in(arena);
+    program->ast = ast = ast_new();
+    ast->share = share_exprs && !fast;
+}
+
+program_t *parse(token_buf_t *tokens, arena_t *arena, bool share_exprs, int num_threads) {
+    fast = fast_enabled();
+    kept_fns = NULL;
+    program = arena_alloc(arena, sizeof(program_t));
+
+    // One-pass mode generates code in the order functions are parsed, so it has to be serial
+    if (num_threads > 1 && !fast) {
+        int start = tokens->pos;
+        program_begin(arena, share_exprs);
+        if (parse_parallel(tokens, num_threads, share_exprs))
+            return program;
+        debug("parse: parsing again on one thread to find the error\n");
+        ast_free(program->ast);
+        tokens->pos = start;
+    }
+
+    program_begin(arena, share_exprs);
+    jmp_buf on_error;
+    jmp_buf *prev_jump = parse_jump_use(&on_error, true);
+    if (setjmp(on_error)) {
+        parse_jump_done(prev_jump);
+        ast_free(program->ast);
+        return NULL;
+    }
+    parse_serial(tokens);
+    parse_jump_done(prev_jump);
+    return program;
+}
+
+program_t *parse_begin(arena_t *arena, bool share_exprs) {
+    fast = false;
+    kept_fns = calloc(1, sizeof(kept_fns_t));
+    kept_fns_resize(64);
+    program = arena_alloc(arena, sizeof(program_t));
+    program_begin(arena, share_exprs);
     return program;
 }
+
+void parse_end(program_t *prog) {
+    ast_free(prog->ast);
+    free(kept_fns->fns);
+    free(kept_fns->chars);
+    free(kept_fns->param_types);
+    free(kept_fns->slots);
+    free(kept_fns);
+    kept_fns = NULL;
+}
+
+fn_def_t *parse_decl(token_buf_t *tokens, ast_t *fn_ast, arena_t *fn_arena) {
+    // Nothing about the last declaration is needed anymore, so everything starts over in fn_arena
+    parse_thread_begin(fn_arena);
+    ast = fn_ast;
+    jmp_buf on_error;
+    jmp_buf *prev_jump = parse_jump_use(&on_error, true);
+    if (setjmp(on_error)) {
+        parse_jump_done(prev_jump);
+        return NULL;
+    }
+
+    fn_def_t *next_fn = parse_fn_declaration(tokens);
+    int kept = declare_kept_fn(next_fn);
+    if (!match(tokens, TOK_SEMICOLON)) {
+        if (kept_fns->fns[kept].defined) {
+            UNREACHABLE("Compilation error: Function redefined\n");
+        }
+
+        // The code is generated from next_fn, so only the fact that it has a body matters to the
+        // program
+        kept_fns->fns[kept].defined = true;
+        next_fn->body = parse_stmt_list(tokens, global_env);
+    }
+    next_fn->end_token = tokens->pos;
+    env_pop_scope(global_env);
+    parse_jump_done(prev_jump);
+    return next_fn;
+}
@@ -0,0 +1,167 @@
+#include "scan.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t';
+}
+
+static bool is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static char *scan_whitespace_scalar(char *p) {
+    while (is_space(*p))
+        p++;
+    return p;
+}
+
+static char *scan_ident_scalar(char *p) {
+    while (is_ident(*p))
+        p++;
+    return p;
+}
+
+static char *scan_digits_scalar(char *p) {
+    while (*p >= '0' && *p <= '9')
+        p++;
+    return p;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * All of the vector kernels work the same way: round p down to an aligned block, compute a bitmask
+ * of which bytes in the block are in the class, and look for the first byte at or after p that
+ * isn't. Bytes before p are treated as in the class so they're skipped.
+ *
+ * The range checks use signed compares, so bytes >= 0x80 are negative and never match.
+ */
+
+// lo <= v <= hi
+#define SSE2_IN_RANGE(v, lo, hi)\
+    _mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8((lo) - 1)), \
+                  _mm_cmplt_epi8((v), _mm_set1_epi8((hi) + 1)))
+
+#define AVX2_IN_RANGE(v, lo, hi)\
+    _mm256_and_si256(_mm256_cmpgt_epi8((v), _mm256_set1_epi8((lo) - 1)), \
+                     _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), (v)))
+
+static __m128i sse2_whitespace(__m128i v) {
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+}
+
+static __m128i sse2_ident(__m128i v) {
+    // setting 0x20 lowercases letters without turning anything else into a letter
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(_mm_or_si128(SSE2_IN_RANGE(lower, 'a', 'z'), SSE2_IN_RANGE(v, '0', '9')),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+static __m128i sse2_digits(__m128i v) {
+    return SSE2_IN_RANGE(v, '0', '9');
+}
+
+#define SSE2_SCAN(name, class_fn)\
+    static char *name(char *p) {\
+        uintptr_t offset = (uintptr_t)p & 15;\
+        char *block = p - offset;\
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(class_fn(_mm_load_si128((__m128i*)block)));\
+        uint32_t outside = ~(mask | ((1u << offset) - 1)) & 0xffff;\
+        while (!outside) {\
+            block += 16;\
+            mask = (uint32_t)_mm_movemask_epi8(class_fn(_mm_load_si128((__m128i*)block)));\
+            outside = ~mask & 0xffff;\
+        }\
+        return block + __builtin_ctz(outside);\
+    }
+
+SSE2_SCAN(scan_whitespace_sse2, sse2_whitespace)
+SSE2_SCAN(scan_ident_sse2, sse2_ident)
+SSE2_SCAN(scan_digits_sse2, sse2_digits)
+
+__attribute__((target("avx2")))
+static __m256i avx2_whitespace(__m256i v) {
+    return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+}
+
+__attribute__((target("avx2")))
+static __m256i avx2_ident(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(_mm256_or_si256(AVX2_IN_RANGE(lower, 'a', 'z'),
+                                           AVX2_IN_RANGE(v, '0', '9')),
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+__attribute__((target("avx2")))
+static __m256i avx2_digits(__m256i v) {
+    return AVX2_IN_RANGE(v, '0', '9');
+}
+
+#define AVX2_SCAN(name, class_fn)\
+    __attribute__((target("avx2")))\
+    static char *name(char *p) {\
+        uintptr_t offset = (uintptr_t)p & 31;\
+        char *block = p - offset;\
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(class_fn(_mm256_load_si256((__m256i*)block)));\
+        uint32_t outside = ~(mask | (uint32_t)((1ull << offset) - 1));\
+        while (!outside) {\
+            block += 32;\
+            mask = (uint32_t)_mm256_movemask_epi8(class_fn(_mm256_load_si256((__m256i*)block)));\
+            outside = ~mask;\
+        }\
+        return block + __builtin_ctz(outside);\
+    }
+
+AVX2_SCAN(scan_whitespace_avx2, avx2_whitespace)
+AVX2_SCAN(scan_ident_avx2, avx2_ident)
+AVX2_SCAN(scan_digits_avx2, avx2_digits)
+
+#endif
+
+char *(*scan_whitespace)(char *p) = scan_whitespace_scalar;
+char *(*scan_ident)(char *p) = scan_ident_scalar;
+char *(*scan_digits)(char *p) = scan_digits_scalar;
+
+scan_level_t scan_best_level(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SCAN_SSE2;
+#endif
+    return SCAN_SCALAR;
+}
+
+void scan_set_level(scan_level_t level) {
+    switch (level) {
+#ifdef SCAN_X86
+        case SCAN_AVX2:
+            scan_whitespace = scan_whitespace_avx2;
+            scan_ident = scan_ident_avx2;
+            scan_digits = scan_digits_avx2;
+            return;
+        case SCAN_SSE2:
+            scan_whitespace = scan_whitespace_sse2;
+            scan_ident = scan_ident_sse2;
+            scan_digits = scan_digits_sse2;
+            return;
+#endif
+        default:
+            scan_whitespace = scan_whitespace_scalar;
+            scan_ident = scan_ident_scalar;
+            scan_digits = scan_digits_scalar;
+            return;
+    }
+}
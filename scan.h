@@ -0,0 +1,32 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ * Kernels the tokenizer uses to skip over runs of characters. Each takes a pointer into a NUL
+ * terminated buffer and returns a pointer to the first character that isn't part of the run.
+ *
+ * There are scalar, SSE2 and AVX2 versions. The vector versions only ever do aligned loads, so
+ * they can read a little past the terminator without crossing into another page.
+ */
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+} scan_level_t;
+
+// Returns the best level the CPU we're running on supports
+scan_level_t scan_best_level(void);
+
+// Picks which versions the scan_* pointers below use
+void scan_set_level(scan_level_t level);
+
+// ' ', '\n' or '\t'
+extern char *(*scan_whitespace)(char *p);
+
+// letters, digits or '_'
+extern char *(*scan_ident)(char *p);
+
+// '0' to '9'
+extern char *(*scan_digits)(char *p);
+
+#endif
@@ -0,0 +1,326 @@
+#include "compile.h"
+#include "compiler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/*
+ * A request is a request_header_t, with the client's working directory, stdout and stderr attached
+ * as file descriptors, followed by args_len bytes of arguments, each one NUL terminated. The reply
+ * is the compile's result as an int32_t.
+ */
+#define REQUEST_MAGIC (0x43425251)
+#define MAX_ARGS_LEN (1 << 20)
+
+// How long the server waits for the next part of a request before giving up on the client
+#define REQUEST_TIMEOUT_SECS (30)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t args_len;
+} request_header_t;
+
+enum {
+    REQUEST_CWD,
+    REQUEST_STDOUT,
+    REQUEST_STDERR,
+    REQUEST_NUM_FDS,
+};
+
+static bool read_full(int fd, void *p, size_t len) {
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p = (char *)p + n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p = (const char *)p + n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool socket_address(char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path is too long\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+// Binds a socket at path and listens on it. A socket nobody's listening on was left behind by a
+// server that's gone, so it's replaced. Only this user can connect to it.
+static int listen_on(char *path) {
+    struct sockaddr_un addr;
+    if (!socket_address(path, &addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (err < 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) < 0
+                && errno == ECONNREFUSED) {
+            unlink(path);
+            err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        } else {
+            errno = EADDRINUSE;
+        }
+        if (probe >= 0)
+            close(probe);
+    }
+    if (err < 0 || chmod(path, 0600) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads a request's header and its file descriptors. Returns false if it isn't one. Any descriptors
+// past the ones a request has are closed.
+static bool read_header(int conn, request_header_t *header, int *fds) {
+    char control[CMSG_SPACE(sizeof(int) * REQUEST_NUM_FDS)];
+    struct iovec iov = {.iov_base = header, .iov_len = sizeof(*header)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t n;
+    while ((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+
+    int num_fds = 0;
+    for (int i = 0; i < REQUEST_NUM_FDS; i++)
+        fds[i] = -1;
+    struct cmsghdr *cmsg;
+    for (cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int *received = (int *)CMSG_DATA(cmsg);
+        for (size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+            if (num_fds < REQUEST_NUM_FDS)
+                fds[num_fds++] = received[i];
+            else
+                close(received[i]);
+        }
+    }
+
+    // The rest of the header can come separately, but the descriptors only come with the first part
+    if (n <= 0 || !read_full(conn, (char *)header + n, sizeof(*header) - n))
+        return false;
+    return num_fds == REQUEST_NUM_FDS && header->magic == REQUEST_MAGIC
+           && header->args_len <= MAX_ARGS_LEN;
+}
+
+// Splits the NUL terminated arguments in buf into argv, which has room for all of them, and
+// returns how many there are
+static int split_args(char *buf, uint32_t len, char **argv) {
+    int argc = 0;
+    for (uint32_t i = 0; i < len; i += strlen(buf + i) + 1)
+        argv[argc++] = buf + i;
+    return argc;
+}
+
+// Compiles in a child process with the client's working directory, stdout and stderr in place of
+// the server's. Whatever the compile does, even exiting on a bug in the compiler or crashing, only
+// ends the child. The server is already set up, so the child starts out that way too.
+static int run_request(char *args, uint32_t args_len, int *fds) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (fchdir(fds[REQUEST_CWD]) < 0)
+            _exit(255);
+        dup2(fds[REQUEST_STDOUT], STDOUT_FILENO);
+        dup2(fds[REQUEST_STDERR], STDERR_FILENO);
+        char **argv = malloc(sizeof(char *) * (args_len + 1));
+        int argc = split_args(args, args_len, argv);
+        int ret = compiler_main(argc, argv);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(ret ? 255 : 0);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return -1;
+        }
+    }
+    if (WIFSIGNALED(status))
+        dprintf(fds[REQUEST_STDERR], "compiler crashed: %s\n", strsignal(WTERMSIG(status)));
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Whoever's on the other end of conn has to be the user the server's running as
+static bool same_user(int conn) {
+    // struct ucred, which needs _GNU_SOURCE, and that clashes with the REG_ names in signal.h
+    struct {
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+    } cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+}
+
+static void serve_request(int conn) {
+    request_header_t header;
+    int fds[REQUEST_NUM_FDS];
+    int32_t status = -1;
+    struct timeval timeout = {.tv_sec = REQUEST_TIMEOUT_SECS, .tv_usec = 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (read_header(conn, &header, fds)) {
+        char *args = malloc(header.args_len + 1);
+        if (read_full(conn, args, header.args_len)) {
+            // Make sure the last argument ends
+            args[header.args_len] = '\0';
+            status = run_request(args, header.args_len, fds);
+        }
+        free(args);
+    }
+    for (int i = 0; i < REQUEST_NUM_FDS; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    write_full(conn, &status, sizeof(status));
+}
+
+// Each connection is served by a child of its own, so a slow or idle client only holds up itself.
+// The server never waits for them, so they're reaped as soon as they exit.
+int compiler_serve(char *socket_path) {
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0)
+        return -1;
+
+    // A client that goes away shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    debug("compiler_serve: listening on %s\n", socket_path);
+    while (1) {
+        int conn = accept(listen_fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+        if (!same_user(conn)) {
+            close(conn);
+            continue;
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0)
+            perror("fork");
+        if (pid == 0) {
+            // run_request waits for its own child
+            signal(SIGCHLD, SIG_DFL);
+            close(listen_fd);
+            serve_request(conn);
+            _exit(0);
+        }
+        close(conn);
+    }
+}
+
+int compiler_request(char *socket_path, int argc, char **argv) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr))
+        return -1;
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(socket_path);
+        return -1;
+    }
+
+    // Every argument with its NUL
+    uint32_t args_len = 0;
+    for (int i = 0; i < argc; i++)
+        args_len += strlen(argv[i]) + 1;
+    char *args = malloc(args_len);
+    char *p = args;
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], len);
+        p += len;
+    }
+
+    int fds[REQUEST_NUM_FDS];
+    fds[REQUEST_CWD] = open(".", O_RDONLY | O_DIRECTORY);
+    fds[REQUEST_STDOUT] = STDOUT_FILENO;
+    fds[REQUEST_STDERR] = STDERR_FILENO;
+    if (fds[REQUEST_CWD] < 0) {
+        perror(".");
+        return -1;
+    }
+
+    request_header_t header = {.magic = REQUEST_MAGIC, .args_len = args_len};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t n;
+    while ((n = sendmsg(conn, &msg, 0)) < 0 && errno == EINTR)
+        ;
+    int32_t status;
+    bool ok = n > 0 && write_full(conn, (char *)&header + n, sizeof(header) - n)
+              && write_full(conn, args, args_len) && read_full(conn, &status, sizeof(status));
+    if (!ok) {
+        fprintf(stderr, "%s: the server went away\n", socket_path);
+        status = -1;
+    }
+    close(fds[REQUEST_CWD]);
+    close(conn);
+    free(args);
+    return status;
+}
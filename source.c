@@ -0,0 +1,113 @@
+#include "source.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SOURCE_READ_CHUNK (1 << 20)
+
+// Maps the file, followed by at least one zeroed page so that buf is always NUL terminated.
+static int map_file(source_t *source, int fd, size_t len) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map_len = (len / page + 1) * page;
+
+    // Reserve the whole range with anonymous zero pages, then map the file over the front of it
+    char *buf = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        return -1;
+
+    if (len && mmap(buf, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(buf, map_len);
+        return -1;
+    }
+
+    // We're going to read the whole thing front to back
+    madvise(buf, map_len, MADV_SEQUENTIAL);
+    source->buf = buf;
+    source->len = len;
+    source->map_len = map_len;
+    source->released = 0;
+    return 0;
+}
+
+// For pipes and such where we can't know the size up front
+static int read_file(source_t *source, int fd) {
+    size_t capacity = SOURCE_READ_CHUNK;
+    size_t len = 0;
+    char *buf = malloc(capacity + 1);
+    if (!buf)
+        return -1;
+
+    while (1) {
+        if (len == capacity) {
+            capacity *= 2;
+            char *bigger = realloc(buf, capacity + 1);
+            if (!bigger) {
+                free(buf);
+                return -1;
+            }
+            buf = bigger;
+        }
+
+        ssize_t nread = read(fd, buf + len, capacity - len);
+        if (nread < 0) {
+            free(buf);
+            return -1;
+        }
+        if (nread == 0)
+            break;
+        len += nread;
+    }
+
+    buf[len] = '\0';
+    source->buf = buf;
+    source->len = len;
+    source->map_len = 0;
+    source->released = 0;
+    return 0;
+}
+
+source_t *source_open(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    source_t *source = malloc(sizeof(source_t));
+    struct stat st;
+    int err;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        err = map_file(source, fd, st.st_size);
+    } else {
+        err = read_file(source, fd);
+    }
+    close(fd);
+
+    if (err < 0) {
+        free(source);
+        return NULL;
+    }
+    return source;
+}
+
+void source_release(source_t *source, size_t len) {
+    if (!source->map_len)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    len = len / page * page;
+    if (len <= source->released)
+        return;
+    madvise(source->buf + source->released, len - source->released, MADV_DONTNEED);
+    source->released = len;
+}
+
+void source_close(source_t *source) {
+    if (!source)
+        return;
+    if (source->map_len)
+        munmap(source->buf, source->map_len);
+    else
+        free(source->buf);
+    free(source);
+}
@@ -0,0 +1,29 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+/*
+ * A read-only view of an input file. Regular files are mapped straight into memory, anything else
+ * (like a pipe) is read into one buffer. Either way, buf is followed by at least one NUL byte so
+ * the tokenizer can treat it as a C string.
+ */
+typedef struct {
+    char *buf;
+    size_t len;
+
+    // size of the mapping, or 0 if buf was malloc'd
+    size_t map_len;
+
+    // how much of the front of the mapping source_release has given back
+    size_t released;
+} source_t;
+
+source_t *source_open(char *filename);
+void source_close(source_t *source);
+
+// Says the first len bytes won't be read again, so the pages they're on can be reclaimed. Only a
+// mapped file gives anything back. Reading them anyway still works, it just goes back to the file.
+void source_release(source_t *source, size_t len);
+
+#endif
@@ -3,50 +3,45 @@
 #define STRING_DEFAULT_CAPACITY (8)
 
 static void realloc_string(string_t *string) {
+    string->buf = arena_realloc(string->arena, string->buf, string->capacity, string->capacity * 2);
     string->capacity *= 2;
-    string->buf = realloc(string->buf, string->capacity);
-}
-
-string_t *file_to_string(char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp)
-        return NULL;
-    char buf[1024];
-    string_t *new = string_new(); 
-    while (1) {
-        int nread = fread(buf, 1, sizeof(buf), fp);
-        if (nread == 0)
-            break;
-        string_append(new, buf, nread);
-    }
-
-    string_append(new, "\n\n", 2);
-    return new;
 }
 
 string_t *string_new(void) {
-    string_t *new = malloc(sizeof(string_t));
-    if (string_init(new) < 0)
-        return NULL;
-    return new;
+    return string_new_in(NULL);
 }
 
-int string_init(string_t *string) {
+static int string_init_in(string_t *string, arena_t *arena) {
     if (!string)
         return -1;
-    string->buf = malloc(sizeof(char) * STRING_DEFAULT_CAPACITY);
+    string->arena = arena;
+    string->buf = arena_alloc(arena, sizeof(char) * STRING_DEFAULT_CAPACITY);
     if (!string->buf)
         return -1;
     string->len = 0;
     string->capacity = STRING_DEFAULT_CAPACITY;
+    string->hash = 0;
     return 0;
 }
 
+// Allocates the string and its buffer in arena
+string_t *string_new_in(arena_t *arena) {
+    string_t *new = arena_alloc(arena, sizeof(string_t));
+    if (string_init_in(new, arena) < 0)
+        return NULL;
+    return new;
+}
+
+int string_init(string_t *string) {
+    return string_init_in(string, NULL);
+}
+
 void string_add(string_t *string, char c) {
     if (string->len >= string->capacity) {
         realloc_string(string);
     }
     string->buf[string->len++] = c;
+    string->hash = 0;
 }
 
 void string_append(string_t *string, char *s, int len) {
@@ -61,8 +56,9 @@ char *string_get(string_t *string) {
     return string->buf;
 }
 
+// Arena backed strings are released along with their arena, so this does nothing for them.
 void string_free(string_t *string) {
-    if (!string)
+    if (!string || string->arena)
         return;
     if (string->buf)
         free(string->buf);
@@ -74,7 +70,11 @@ int string_eq(string_t *s1, string_t *s2) {
     // that's invalid
     if (!s1 || !s2)
         return -1;
-    
+
+    // Interned strings are only ever equal to themselves
+    if (s1 == s2)
+        return 0;
+
     if (s1->len != s2->len)
         return -1;
 
@@ -86,3 +86,17 @@ int string_eq(string_t *s1, string_t *s2) {
     }
     return 0;
 }
+
+// FNV-1a. The result is cached in the string until it's modified.
+uint32_t string_hash(string_t *string) {
+    if (string->hash)
+        return string->hash;
+
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < string->len; i++) {
+        hash ^= (unsigned char)string->buf[i];
+        hash *= 16777619u;
+    }
+    string->hash = hash;
+    return hash;
+}
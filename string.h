@@ -3,20 +3,30 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#include "arena.h"
 
 typedef struct {
     char *buf;
     int len;
     int capacity;
+
+    // cached by string_hash, 0 if it hasn't been computed yet
+    uint32_t hash;
+
+    // NULL if buf is heap allocated
+    arena_t *arena;
 } string_t;
 
-string_t *file_to_string(char *filename);
 string_t *string_new(void);
+string_t *string_new_in(arena_t *arena);
 int string_init(string_t *string);
 void string_add(string_t *string, char c);
 void string_append(string_t *string, char *s, int len);
 char *string_get(string_t *string);
 void string_free(string_t *string);
 int string_eq(string_t *s1, string_t *s2);
+uint32_t string_hash(string_t *string);
 
 #endif
@@ -0,0 +1,137 @@
+#include "compile.h"
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+// Generates a program with thousands of functions with an empty cache, again with everything
+// cached, and again with one function changed. Checks that the code is byte for byte the same as
+// generating it without a cache each time, and reports the hits, misses, and how long gen_asm took.
+
+#define NUM_FNS (20000)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// If edited is set, f1's loop starts at 1 instead of 0
+static source_t *make_program(int num_fns, bool edited) {
+    string_t *s = string_new();
+    char line[512];
+    for (int i = 0; i < num_fns; i++) {
+        int len = snprintf(line, sizeof(line),
+                           "int f%d(int a, int b) {\n"
+                           "    int s = 0;\n"
+                           "    for (int i = %d; i < a && s < 100; i = i + (b > 1 ? 2 : 1)) {\n"
+                           "        if (i == 3) continue;\n"
+                           "        s += i > b ? i - b : b - i;\n"
+                           "        while (s > 50) s = s / 2 - (s || !b);\n"
+                           "    }\n"
+                           "    return s;\n"
+                           "}\n",
+                           i, edited && i == 1);
+        string_append(s, line, len);
+    }
+    char *main_fn = "int main() { return f0(10, 2); }\n";
+    string_append(s, main_fn, strlen(main_fn));
+    string_add(s, '\0');
+
+    source_t *source = malloc(sizeof(source_t));
+    source->buf = s->buf;
+    source->len = s->len - 1;
+    source->map_len = 0;
+    free(s);
+    return source;
+}
+
+// Generates source's code, using cache_dir if it's set, and returns what print_asm wrote
+static string_t *generate(source_t *source, char *cache_dir, double *elapsed) {
+    arena_t *token_arena = arena_new();
+    arena_t *ast_arena = arena_new();
+    arena_t *instr_arena = arena_new();
+    token_buf_t *tokens = tokenize(source, token_arena, 1);
+    program_t *prog = parse(tokens, ast_arena, false, 1);
+    alloc_homes(prog);
+
+    fn_cache_t *cache = NULL;
+    if (cache_dir) {
+        cache = fn_cache_open(cache_dir);
+        fn_cache_add_keys(cache, prog, tokens);
+    }
+    double start = now();
+    list_t *fns = gen_asm(prog, instr_arena, 1, cache);
+    *elapsed = now() - start;
+    if (cache) {
+        printf("%8d %8d ", atomic_load(&cache->hits), atomic_load(&cache->misses));
+        fn_cache_close(cache);
+    }
+
+    FILE *out = tmpfile();
+    int fd = fileno(out);
+    print_asm(fns, fd);
+    string_t *bytes = string_new();
+    char buf[4096];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        string_append(bytes, buf, n);
+    fclose(out);
+    ast_free(prog->ast);
+    arena_free(instr_arena);
+    arena_free(ast_arena);
+    arena_free(token_arena);
+    return bytes;
+}
+
+static void run(char *name, source_t *source, char *cache_dir) {
+    double plain_time, cached_time;
+    string_t *plain = generate(source, NULL, &plain_time);
+    printf("%-8s ", name);
+    string_t *cached = generate(source, cache_dir, &cached_time);
+    if (plain->len != cached->len || memcmp(plain->buf, cached->buf, plain->len)) {
+        printf("\noutput differs with the cache %s\n", name);
+        exit(-1);
+    }
+    printf("%10.2f %10.2f\n", plain_time * 1e3, cached_time * 1e3);
+    string_free(plain);
+    string_free(cached);
+}
+
+static void remove_dir(char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[4096];
+    while (d && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d)
+        closedir(d);
+    rmdir(dir);
+}
+
+int main(void) {
+    char cache_dir[] = "/tmp/bench_cache-XXXXXX";
+    if (!mkdtemp(cache_dir)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    source_t *source = make_program(NUM_FNS, false);
+    source_t *edited = make_program(NUM_FNS, true);
+
+    printf("%d functions\n", NUM_FNS);
+    printf("%-8s %8s %8s %10s %10s\n", "cache", "hits", "misses", "plain ms", "cached ms");
+    run("empty", source, cache_dir);
+    run("full", source, cache_dir);
+    run("edited", edited, cache_dir);
+
+    remove_dir(cache_dir);
+    free(source->buf);
+    free(source);
+    free(edited->buf);
+    free(edited);
+    return 0;
+}
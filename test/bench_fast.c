@@ -0,0 +1,116 @@
+#include "compile.h"
+#include <time.h>
+#include <unistd.h>
+
+// Compiles generated programs both ways - building the whole AST and then generating code, and
+// generating each function's code while it's parsed (--fast) - checks that the two outputs are
+// byte for byte the same, and reports how long each took.
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static source_t *string_to_source(string_t *s) {
+    string_add(s, '\0');
+    source_t *source = malloc(sizeof(source_t));
+    source->buf = s->buf;
+    source->len = s->len - 1;
+    source->map_len = 0;
+    return source;
+}
+
+// num_fns functions that each call the one before them. If held is set they're all declared first
+// and then defined in reverse, so none of their code can be printed until the last one is done.
+static source_t *make_program(int num_fns, bool held) {
+    string_t *s = string_new();
+    char line[256];
+    for (int i = 0; held && i < num_fns; i++) {
+        int len = snprintf(line, sizeof(line), "int f%d(int a, int b);\n", i);
+        string_append(s, line, len);
+    }
+    for (int n = 0; n < num_fns; n++) {
+        int i = held ? num_fns - 1 - n : n;
+        int len = snprintf(line, sizeof(line),
+                           "int f%d(int a, int b) {\n"
+                           "    int s = 0;\n"
+                           "    for (int i = 0; i < a && s < 100; i = i + (b > 1 ? 2 : 1)) {\n"
+                           "        if (i == 3) continue;\n"
+                           "        s += i > b ? i - b : b - i;\n"
+                           "    }\n",
+                           i);
+        string_append(s, line, len);
+        if (i)
+            len = snprintf(line, sizeof(line), "    if (s) return f%d(s, a); else return b;\n}\n", i - 1);
+        else
+            len = snprintf(line, sizeof(line), "    return s;\n}\n");
+        string_append(s, line, len);
+    }
+    int len = snprintf(line, sizeof(line), "int main() { return f%d(10, 2); }\n", held ? 0 : num_fns - 1);
+    string_append(s, line, len);
+    return string_to_source(s);
+}
+
+// Compiles source into a temporary file and returns what was written to it
+static string_t *compile(source_t *source, bool fast, double *elapsed) {
+    arena_t *token_arena = arena_new();
+    arena_t *ast_arena = arena_new();
+    arena_t *instr_arena = arena_new();
+    FILE *out = tmpfile();
+    int fd = fileno(out);
+
+    double start = now();
+    token_buf_t *tokens = tokenize(source, token_arena, 1);
+    if (fast)
+        fast_begin(instr_arena, fd, false);
+    program_t *prog = parse(tokens, ast_arena, false, 1);
+    if (fast) {
+        fast_end(prog);
+        print_asm_flush();
+    } else {
+        alloc_homes(prog);
+        print_asm(gen_asm(prog, instr_arena, 1, NULL), fd);
+    }
+    *elapsed = now() - start;
+
+    string_t *bytes = string_new();
+    char buf[4096];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        string_append(bytes, buf, n);
+    fclose(out);
+
+    ast_free(prog->ast);
+    arena_free(instr_arena);
+    arena_free(ast_arena);
+    arena_free(token_arena);
+    return bytes;
+}
+
+static void run(int num_fns, bool held) {
+    source_t *source = make_program(num_fns, held);
+    double tree_time, fast_time;
+    string_t *tree = compile(source, false, &tree_time);
+    string_t *fast = compile(source, true, &fast_time);
+    if (tree->len != fast->len || memcmp(tree->buf, fast->buf, tree->len)) {
+        printf("output differs with %d functions\n", num_fns);
+        exit(-1);
+    }
+    printf("%-8s %8d %10d %10.2f %10.2f %8.2f\n", held ? "held" : "in order", num_fns, tree->len,
+           tree_time * 1e3, fast_time * 1e3, tree_time / fast_time);
+    string_free(tree);
+    string_free(fast);
+    free(source->buf);
+    free(source);
+}
+
+int main(void) {
+    printf("%-8s %8s %10s %10s %10s %8s\n", "order", "fns", "bytes", "tree ms", "fast ms", "speedup");
+    for (int held = 0; held <= 1; held++) {
+        for (int num_fns = 10; num_fns <= 100000; num_fns *= 10)
+            run(num_fns, held);
+    }
+    return 0;
+}
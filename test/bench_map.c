@@ -0,0 +1,46 @@
+#include "map.h"
+#include <stdio.h>
+#include <time.h>
+
+// Measures the average cost of a map_get as the number of keys in the map grows. With a hash table
+// the time per lookup should stay roughly flat.
+
+#define NUM_LOOKUPS (1000000)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_lookup(int num_keys) {
+    map_t *map = map_new();
+    string_t **keys = malloc(sizeof(string_t*) * num_keys);
+    char buf[32];
+
+    for (int i = 0; i < num_keys; i++) {
+        int len = snprintf(buf, sizeof(buf), "var_%d", i);
+        keys[i] = string_new();
+        string_append(keys[i], buf, len);
+        map_set(map, keys[i], keys[i]);
+    }
+
+    // Walk the keys with a stride so we don't just hit the same few slots
+    volatile void *sink;
+    double start = now();
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+        sink = map_get(map, keys[(i * 7919L) % num_keys]);
+    }
+    double elapsed = now() - start;
+    (void)sink;
+
+    printf("%8d keys: %6.1f ns/lookup\n", num_keys, elapsed * 1e9 / NUM_LOOKUPS);
+}
+
+int main(void) {
+    int sizes[] = {10, 100, 1000, 10000, 100000};
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_lookup(sizes[i]);
+    }
+    return 0;
+}
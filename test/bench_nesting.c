@@ -0,0 +1,135 @@
+#include "compile.h"
+#include <time.h>
+
+// Compiles programs that nest one construct deeper and deeper, and reports how long each phase
+// takes per level of nesting. Parsing and codegen keep their own stacks instead of recursing, so
+// the time per level should stay flat all the way up to a million levels.
+
+#define MAX_DEPTH (1000000)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static source_t *string_to_source(string_t *s) {
+    string_add(s, '\0');
+    source_t *source = malloc(sizeof(source_t));
+    source->buf = s->buf;
+    source->len = s->len - 1;
+    source->map_len = 0;
+    return source;
+}
+
+static void repeat(string_t *s, char *text, int times) {
+    int len = strlen(text);
+    for (int i = 0; i < times; i++)
+        string_append(s, text, len);
+}
+
+// ((((1))))
+static source_t *make_parens(int depth) {
+    string_t *s = string_new();
+    repeat(s, "int main() { return ", 1);
+    repeat(s, "(", depth);
+    repeat(s, "1", 1);
+    repeat(s, ")", depth);
+    repeat(s, "; }\n", 1);
+    return string_to_source(s);
+}
+
+// if (x == 0) x = 1; else if (x == 1) x = 2; else ...
+static source_t *make_else_ifs(int depth) {
+    string_t *s = string_new();
+    repeat(s, "int main() { int x = 0; ", 1);
+    repeat(s, "if (x == 0) x = 1; else ", depth);
+    repeat(s, "x = 2; return x; }\n", 1);
+    return string_to_source(s);
+}
+
+// 1 + 1 + 1 + ...
+static source_t *make_sum(int depth) {
+    string_t *s = string_new();
+    repeat(s, "int main() { return 1", 1);
+    repeat(s, " + 1", depth);
+    repeat(s, "; }\n", 1);
+    return string_to_source(s);
+}
+
+// {{{{ x = x + 1; }}}}
+static source_t *make_blocks(int depth) {
+    string_t *s = string_new();
+    repeat(s, "int main() { int x = 0; ", 1);
+    repeat(s, "{", depth);
+    repeat(s, "x = x + 1;", 1);
+    repeat(s, "}", depth);
+    repeat(s, " return x; }\n", 1);
+    return string_to_source(s);
+}
+
+// ~~~~1
+static source_t *make_unary(int depth) {
+    string_t *s = string_new();
+    repeat(s, "int main() { return ", 1);
+    repeat(s, "~", depth);
+    repeat(s, "1; }\n", 1);
+    return string_to_source(s);
+}
+
+typedef struct {
+    const char *name;
+    source_t *(*make)(int depth);
+} shape_t;
+
+static const shape_t shapes[] = {
+    {"parens", make_parens},
+    {"else if", make_else_ifs},
+    {"sum", make_sum},
+    {"blocks", make_blocks},
+    {"unary", make_unary},
+};
+
+static void run(const shape_t *shape, int depth) {
+    source_t *source = shape->make(depth);
+    arena_t *token_arena = arena_new();
+    arena_t *ast_arena = arena_new();
+    arena_t *instr_arena = arena_new();
+
+    double start = now();
+    token_buf_t *tokens = tokenize(source, token_arena, 1);
+    double tokenized = now();
+    program_t *prog = parse(tokens, ast_arena, false, 1);
+    double parsed = now();
+    alloc_homes(prog);
+    double allocated = now();
+    list_t *instrs = gen_asm(prog, instr_arena, 1, NULL);
+    double generated = now();
+    if (!instrs || !instrs->len) {
+        printf("%s: no output at depth %d\n", shape->name, depth);
+        exit(-1);
+    }
+
+    printf("%-8s %8d %10.1f %10.1f %10.1f %10.1f %10.1f\n", shape->name, depth,
+           (tokenized - start) * 1e9 / depth, (parsed - tokenized) * 1e9 / depth,
+           (allocated - parsed) * 1e9 / depth, (generated - allocated) * 1e9 / depth,
+           (generated - start) * 1e9 / depth);
+
+    ast_free(prog->ast);
+    arena_free(instr_arena);
+    arena_free(ast_arena);
+    arena_free(token_arena);
+    free(source->buf);
+    free(source);
+}
+
+int main(void) {
+    printf("ns per level of nesting\n");
+    printf("%-8s %8s %10s %10s %10s %10s %10s\n", "shape", "depth", "tokenize", "parse", "alloc",
+           "gen_asm", "total");
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        for (int depth = 100; depth <= MAX_DEPTH; depth *= 10)
+            run(&shapes[i], depth);
+    }
+    return 0;
+}
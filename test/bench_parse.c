@@ -0,0 +1,101 @@
+#include "compile.h"
+#include <time.h>
+#include <unistd.h>
+
+// Parses a program with thousands of functions on more and more threads, checks that the code it
+// compiles to is byte for byte the same as parsing them one at a time, and reports how long parse
+// took. Its time should go down with each thread until there are no more cores.
+
+#define NUM_FNS (20000)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static source_t *make_program(int num_fns) {
+    string_t *s = string_new();
+    char line[512];
+    for (int i = 0; i < num_fns; i++) {
+        int len = snprintf(line, sizeof(line),
+                           "int f%d(int a, int b);\n"
+                           "int f%d(int a, int b) {\n"
+                           "    int s = 0;\n"
+                           "    for (int i = 0; i < a && s < 100; i = i + (b > 1 ? 2 : 1)) {\n"
+                           "        if (i == 3) continue;\n"
+                           "        s += i > b ? i - b : b - i;\n"
+                           "        while (s > 50) s = s / 2 - (s || !b);\n"
+                           "    }\n"
+                           "    return s + (a > 0 ? f%d(a - 1, b) : 0);\n"
+                           "}\n",
+                           i, i, i ? i - 1 : i);
+        string_append(s, line, len);
+    }
+    char *main_fn = "int main() { return f0(10, 2); }\n";
+    string_append(s, main_fn, strlen(main_fn));
+    string_add(s, '\0');
+
+    source_t *source = malloc(sizeof(source_t));
+    source->buf = s->buf;
+    source->len = s->len - 1;
+    source->map_len = 0;
+    free(s);
+    return source;
+}
+
+// Parses source on num_threads threads and returns what print_asm wrote for it
+static string_t *compile(source_t *source, int num_threads, double *elapsed) {
+    arena_t *token_arena = arena_new();
+    arena_t *ast_arena = arena_new();
+    arena_t *instr_arena = arena_new();
+    token_buf_t *tokens = tokenize(source, token_arena, 1);
+
+    double start = now();
+    program_t *prog = parse(tokens, ast_arena, false, num_threads);
+    *elapsed = now() - start;
+
+    alloc_homes(prog);
+    list_t *fns = gen_asm(prog, instr_arena, 1, NULL);
+
+    FILE *out = tmpfile();
+    int fd = fileno(out);
+    print_asm(fns, fd);
+    string_t *bytes = string_new();
+    char buf[4096];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        string_append(bytes, buf, n);
+    fclose(out);
+    ast_free(prog->ast);
+    arena_free(instr_arena);
+    arena_free(ast_arena);
+    arena_free(token_arena);
+    return bytes;
+}
+
+int main(void) {
+    source_t *source = make_program(NUM_FNS);
+
+    printf("%d functions, %ld cores\n", NUM_FNS, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %10s %8s\n", "threads", "ms", "speedup");
+    double serial_time;
+    string_t *serial = compile(source, 1, &serial_time);
+    printf("%8d %10.2f %8.2f\n", 1, serial_time * 1e3, 1.0);
+    for (int num_threads = 2; num_threads <= 16; num_threads *= 2) {
+        double elapsed;
+        string_t *parallel = compile(source, num_threads, &elapsed);
+        if (parallel->len != serial->len || memcmp(parallel->buf, serial->buf, serial->len)) {
+            printf("output differs with %d threads\n", num_threads);
+            exit(-1);
+        }
+        printf("%8d %10.2f %8.2f\n", num_threads, elapsed * 1e3, serial_time / elapsed);
+        string_free(parallel);
+    }
+
+    string_free(serial);
+    free(source->buf);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "compile.h"
+#include "compiler.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Compiles generated programs of growing size three ways - the whole input at once, a function at a
+// time (--stream), and a function at a time with each step on its own thread (--pipeline) - checks
+// that the outputs are byte for byte the same, and reports how long each took and how much memory
+// it needed at most. Each compile runs in a child process of its own, so its peak is its own. It's
+// done for assembly, then again for object files (-c).
+//
+// Streaming has to remember every function's declaration, so its peak can't be completely flat. But
+// nothing else about a function should outlive it, so it fails if the peak of either streaming mode
+// grows by more than MAX_BYTES_PER_FN for every function added. An object file's code is written out
+// as it goes too, but its symbols and relocations are kept until the end, so it gets
+// MAX_OBJ_BYTES_PER_FN.
+
+#define MAX_BYTES_PER_FN (128)
+#define MAX_OBJ_BYTES_PER_FN (512)
+
+static char dir[] = "/tmp/bench_stream-XXXXXX";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *path(char *name) {
+    static char bufs[2][256];
+    static int next = 0;
+    char *buf = bufs[next];
+    next = !next;
+    snprintf(buf, sizeof(bufs[0]), "%s/%s", dir, name);
+    return buf;
+}
+
+// num_fns functions of about the same size, each calling the one before it
+static void make_program(char *filename, int num_fns) {
+    FILE *f = fopen(filename, "w");
+    for (int i = 0; i < num_fns; i++) {
+        fprintf(f, "int f%d(int a, int b) {\n"
+                   "    int s = 0;\n"
+                   "    for (int i = 0; i < a && s < 100; i = i + (b > 1 ? 2 : 1)) {\n"
+                   "        int t = i > b ? i - b : b - i;\n"
+                   "        if (i == 3) continue;\n"
+                   "        s += t * 2 + (t > 4 ? t : -t);\n"
+                   "    }\n", i);
+        if (i)
+            fprintf(f, "    if (s) return f%d(s, a); else return b;\n}\n", i - 1);
+        else
+            fprintf(f, "    return s;\n}\n");
+    }
+    fprintf(f, "int main() { return f%d(10, 2); }\n", num_fns - 1);
+    fclose(f);
+}
+
+// Compiles filename to outfile in a child process, and returns its peak RSS in kB
+static long compile(char *filename, char *outfile, bool stream, bool pipeline, bool object,
+                    double *elapsed) {
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        compiler_options_t options = {0};
+        options.num_threads = 1;
+        options.stream = stream;
+        options.pipeline = pipeline;
+        options.object = object;
+        compiler_ctx_t *ctx = compiler_new(&options);
+        _exit(compiler_compile(ctx, filename, outfile) ? 1 : 0);
+    }
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    *elapsed = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("compile failed\n");
+        exit(-1);
+    }
+    return usage.ru_maxrss;
+}
+
+static bool same_file(char *a, char *b) {
+    FILE *fa = fopen(a, "r");
+    FILE *fb = fopen(b, "r");
+    int ca, cb;
+    do {
+        ca = fgetc(fa);
+        cb = fgetc(fb);
+    } while (ca == cb && ca != EOF);
+    fclose(fa);
+    fclose(fb);
+    return ca == cb;
+}
+
+// Runs the whole benchmark for assembly or for object files, and returns whether it passed
+static bool run(bool object) {
+    int sizes[] = {1000, 10000, 100000};
+    int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    long stream_peaks[3], pipeline_peaks[3];
+    printf("%s\n", object ? "object files:" : "assembly:");
+    printf("%10s %12s %12s %12s %12s %12s %12s\n", "fns", "whole ms", "whole kB", "stream ms", "stream kB",
+           "pipeline ms", "pipeline kB");
+    for (int i = 0; i < num_sizes; i++) {
+        char *input = strdup(path("input.c"));
+        make_program(input, sizes[i]);
+        double whole_time, stream_time, pipeline_time;
+        long whole_rss = compile(input, path("whole.out"), false, false, object, &whole_time);
+        long stream_rss = compile(input, path("stream.out"), true, false, object, &stream_time);
+        long pipeline_rss = compile(input, path("pipeline.out"), false, true, object, &pipeline_time);
+        free(input);
+        if (!same_file(path("whole.out"), path("stream.out")) ||
+            !same_file(path("whole.out"), path("pipeline.out"))) {
+            printf("outputs differ for %d functions\n", sizes[i]);
+            return false;
+        }
+        printf("%10d %12.1f %12ld %12.1f %12ld %12.1f %12ld\n", sizes[i], whole_time * 1000, whole_rss,
+               stream_time * 1000, stream_rss, pipeline_time * 1000, pipeline_rss);
+        stream_peaks[i] = stream_rss;
+        pipeline_peaks[i] = pipeline_rss;
+    }
+
+    int added = sizes[num_sizes - 1] - sizes[0];
+    long stream_per_fn = (stream_peaks[num_sizes - 1] - stream_peaks[0]) * 1024 / added;
+    long pipeline_per_fn = (pipeline_peaks[num_sizes - 1] - pipeline_peaks[0]) * 1024 / added;
+    printf("peak grows by %ld bytes per function streaming, %ld bytes pipelined\n", stream_per_fn,
+           pipeline_per_fn);
+    int max_per_fn = object ? MAX_OBJ_BYTES_PER_FN : MAX_BYTES_PER_FN;
+    if (stream_per_fn > max_per_fn || pipeline_per_fn > max_per_fn) {
+        printf("more than %d bytes per function\n", max_per_fn);
+        return false;
+    }
+    return true;
+}
+
+int main(void) {
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        return -1;
+    }
+    if (!run(false) || !run(true))
+        return -1;
+
+    unlink(path("input.c"));
+    unlink(path("whole.out"));
+    unlink(path("stream.out"));
+    unlink(path("pipeline.out"));
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "compile.h"
+#include "scan.h"
+#include <time.h>
+#include <unistd.h>
+
+// Compares tokenize() against the previous lexer, which tried every keyword and special char with
+// strncmp at each token start. The corpus avoids identifiers that start with a keyword, since the
+// old lexer splits those up, so both lexers should produce the same number of tokens.
+//
+// Then runs tokenize() with each level of scan kernels over a corpus that looks machine generated,
+// with deep indentation and long identifiers.
+//
+// Last, lexes a big corpus on 1 to 16 threads, and checks that every thread count gives exactly
+// the same tokens as lexing it serially.
+
+#define CORPUS_FUNCTIONS (20000)
+#define ROUNDS (5)
+#define BIG_CORPUS_COPIES (20)
+
+static const char *old_keywords[] = {
+    "return", "int", "char", "void", "&&", "||", "==", "!=", "<=", ">=", "++", "--", "+=", "-=",
+    "if", "else", "for", "while", "do", "break", "continue", NULL,
+};
+
+static const char old_special_chars[] = "+-*/={}()[];-~!<>?:%,";
+
+static bool old_startswith(char *s1, const char *s2) {
+    return !strncmp(s1, s2, strlen(s2));
+}
+
+static int old_tokenize(char *buf) {
+    int num_tokens = 0;
+    while (*buf) {
+        if (*buf == ' ' || *buf == '\n' || *buf == '\t') {
+            buf++;
+            continue;
+        }
+
+        num_tokens++;
+        if (isdigit(*buf)) {
+            char *end;
+            strtol(buf, &end, 10);
+            buf = end;
+            continue;
+        }
+
+        int i;
+        for (i = 0; old_keywords[i]; i++) {
+            if (old_startswith(buf, old_keywords[i]))
+                break;
+        }
+        if (old_keywords[i]) {
+            buf += strlen(old_keywords[i]);
+            continue;
+        }
+
+        if (strchr(old_special_chars, *buf)) {
+            buf++;
+            continue;
+        }
+
+        if (isalpha(*buf) || *buf == '_') {
+            while (isalpha(*buf) || isdigit(*buf) || *buf == '_')
+                buf++;
+            continue;
+        }
+        fprintf(stderr, "old_tokenize: bad input\n");
+        exit(-1);
+    }
+    return num_tokens;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static source_t *string_to_source(string_t *s) {
+    string_add(s, '\0');
+    source_t *source = malloc(sizeof(source_t));
+    source->buf = s->buf;
+    source->len = s->len - 1;
+    source->map_len = 0;
+    return source;
+}
+
+static source_t *make_generated_corpus(void) {
+    string_t *s = string_new();
+    char buf[512];
+    for (int i = 0; i < CORPUS_FUNCTIONS; i++) {
+        int len = snprintf(buf, sizeof(buf),
+            "int generated_module_%d_compute_intermediate_value(int first_argument_value) {\n"
+            "                                int accumulated_partial_result_%d = first_argument_value;\n"
+            "                                                                accumulated_partial_result_%d"
+            " = accumulated_partial_result_%d + 123456789;\n"
+            "                                return accumulated_partial_result_%d;\n"
+            "}\n", i, i, i, i, i);
+        string_append(s, buf, len);
+    }
+    return string_to_source(s);
+}
+
+static double time_tokenize(source_t *corpus, int num_threads) {
+    double best = 1e9;
+    for (int round = 0; round < ROUNDS; round++) {
+        arena_t *arena = arena_new();
+        double start = now();
+        tokenize(corpus, arena, num_threads);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+        arena_free(arena);
+    }
+    return best;
+}
+
+static source_t *make_corpus(void) {
+    string_t *s = string_new();
+    char buf[512];
+    for (int i = 0; i < CORPUS_FUNCTIONS; i++) {
+        int len = snprintf(buf, sizeof(buf),
+            "int function_%d(int alpha, int beta) {\n"
+            "    int gamma_value = alpha * %d + beta;\n"
+            "    for (int k = 0; k < 10; k++) {\n"
+            "        gamma_value += (k >= 3 && alpha != beta) ? k : -k;\n"
+            "    }\n"
+            "    while (gamma_value > 100) gamma_value -= 7;\n"
+            "    return gamma_value %% 13;\n"
+            "}\n", i, i);
+        string_append(s, buf, len);
+    }
+    return string_to_source(s);
+}
+
+int main(void) {
+    source_t *corpus = make_corpus();
+    printf("corpus: %.1f MB\n", corpus->len / 1e6);
+
+    double best_old = 1e9;
+    double best_new = 1e9;
+    int old_count = 0;
+    int new_count = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now();
+        old_count = old_tokenize(corpus->buf);
+        double elapsed = now() - start;
+        if (elapsed < best_old)
+            best_old = elapsed;
+
+        arena_t *arena = arena_new();
+        start = now();
+        new_count = tokenize(corpus, arena, 1)->len;
+        elapsed = now() - start;
+        if (elapsed < best_new)
+            best_new = elapsed;
+        arena_free(arena);
+    }
+
+    if (old_count != new_count) {
+        printf("token counts differ: old %d, new %d\n", old_count, new_count);
+        return -1;
+    }
+
+    printf("%d tokens\n", new_count);
+    printf("old lexer: %7.1f ms (%.1f MB/s)\n", best_old * 1e3, corpus->len / 1e6 / best_old);
+    printf("tokenize:  %7.1f ms (%.1f MB/s)\n", best_new * 1e3, corpus->len / 1e6 / best_new);
+
+    source_t *generated = make_generated_corpus();
+    printf("\ngenerated corpus: %.1f MB\n", generated->len / 1e6);
+    const char *level_names[] = {"scalar", "sse2", "avx2"};
+    for (scan_level_t level = SCAN_SCALAR; level <= scan_best_level(); level++) {
+        scan_set_level(level);
+        double elapsed = time_tokenize(generated, 1);
+        printf("%-6s %7.1f ms (%.1f MB/s)\n", level_names[level], elapsed * 1e3,
+               generated->len / 1e6 / elapsed);
+    }
+
+    // Both corpora, over and over
+    string_t *s = string_new();
+    for (int i = 0; i < BIG_CORPUS_COPIES; i++) {
+        string_append(s, corpus->buf, corpus->len);
+        string_append(s, generated->buf, generated->len);
+    }
+    source_t *big = string_to_source(s);
+    printf("\nbig corpus: %.1f MB, %ld cores\n", big->len / 1e6, sysconf(_SC_NPROCESSORS_ONLN));
+    arena_t *serial_arena = arena_new();
+    token_buf_t *serial = tokenize(big, serial_arena, 1);
+    double serial_time = time_tokenize(big, 1);
+    for (int num_threads = 1; num_threads <= 16; num_threads *= 2) {
+        arena_t *arena = arena_new();
+        token_buf_t *tokens = tokenize(big, arena, num_threads);
+        if (tokens->len != serial->len || memcmp(tokens->tokens, serial->tokens, sizeof(token_t) * serial->len)) {
+            printf("tokens differ with %d threads\n", num_threads);
+            return -1;
+        }
+        arena_free(arena);
+
+        double elapsed = time_tokenize(big, num_threads);
+        printf("%2d threads %7.1f ms (%.1f MB/s) %5.2fx\n", num_threads, elapsed * 1e3,
+               big->len / 1e6 / elapsed, serial_time / elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "compile.h"
+#include <assert.h>
+
+void test_ast_null(void) {
+    printf("test ast null...");
+    ast_t *ast = ast_new();
+    assert(ast->len == 1);
+    assert(ast->kind[NODE_NONE] == NODE_NULL_EXPR);
+    assert(ast->c_type[NODE_NONE] == TYPE_VOID);
+    ast_free(ast);
+    printf("OK\n");
+}
+
+void test_ast_nodes(void) {
+    printf("test ast nodes...");
+    ast_t *ast = ast_new();
+    node_id_t lhs = ast_add(ast, NODE_INT, 0, TYPE_INT, (uint32_t)-5, 0);
+    node_id_t rhs = ast_add(ast, NODE_INT, 0, TYPE_INT, 7, 0);
+    node_id_t bin = ast_add(ast, NODE_BIN, BIN_ADD, TYPE_INT, lhs, rhs);
+    assert(ast->kind[bin] == NODE_BIN && ast->op[bin] == BIN_ADD);
+    assert(ast->a[bin] == lhs && ast->b[bin] == rhs);
+    assert((int32_t)ast->a[lhs] == -5);
+
+    // Lots of nodes, so the arrays have to grow
+    for (int i = 0; i < 100000; i++) {
+        assert(ast_add(ast, NODE_INT, 0, TYPE_INT, i, 0) == (node_id_t)i + 4);
+    }
+    assert(ast->a[50004] == 50000);
+    assert(ast->a[bin] == lhs);
+    ast_free(ast);
+    printf("OK\n");
+}
+
+void test_ast_extra(void) {
+    printf("test ast extra...");
+    ast_t *ast = ast_new();
+    uint32_t first[] = {1, 2, 3};
+    assert(ast_add_extra(ast, first, 3) == 0);
+    assert(ast_add_extra(ast, NULL, 0) == 3);
+
+    uint32_t big[1000];
+    for (int i = 0; i < 1000; i++)
+        big[i] = i;
+    assert(ast_add_extra(ast, big, 1000) == 3);
+    assert(ast->extra[2] == 3);
+    assert(ast->extra[3 + 999] == 999);
+
+    string_t *name = intern("foo", 3);
+    uint32_t index = ast_add_name(ast, name);
+    assert(ast->names[index] == name);
+    ast_free(ast);
+    printf("OK\n");
+}
+
+void test_ast_share(void) {
+    printf("test ast share...");
+    ast_t *ast = ast_new();
+
+    // Off by default
+    assert(ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 1, 0) != ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 1, 0));
+
+    ast->share = true;
+    node_id_t x = ast_add_expr(ast, NODE_VAR, 0, TYPE_INT, 0, 0);
+    node_id_t y = ast_add_expr(ast, NODE_VAR, 0, TYPE_INT, 1, 0);
+    node_id_t xy = ast_add_expr(ast, NODE_BIN, BIN_MUL, TYPE_INT, x, y);
+    node_id_t one = ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 1, 0);
+    node_id_t sum = ast_add_expr(ast, NODE_BIN, BIN_ADD, TYPE_INT, xy, one);
+
+    // x * y + 1 again
+    uint32_t len = ast->len;
+    node_id_t x2 = ast_add_expr(ast, NODE_VAR, 0, TYPE_INT, 0, 0);
+    node_id_t y2 = ast_add_expr(ast, NODE_VAR, 0, TYPE_INT, 1, 0);
+    node_id_t xy2 = ast_add_expr(ast, NODE_BIN, BIN_MUL, TYPE_INT, x2, y2);
+    node_id_t sum2 = ast_add_expr(ast, NODE_BIN, BIN_ADD, TYPE_INT, xy2, ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 1, 0));
+    assert(sum2 == sum);
+    assert(ast->len == len);
+
+    // y * x and x * y are different
+    assert(ast_add_expr(ast, NODE_BIN, BIN_MUL, TYPE_INT, y, x) != xy);
+
+    // A shadowing x is a different var index, so it's a different node
+    node_id_t inner_x = ast_add_expr(ast, NODE_VAR, 0, TYPE_INT, 2, 0);
+    assert(inner_x != x);
+    assert(ast_add_expr(ast, NODE_BIN, BIN_MUL, TYPE_INT, inner_x, y) != xy);
+
+    // Anything with side effects, or built on something with side effects, is never shared
+    node_id_t inc = ast_add_expr(ast, NODE_UNARY, UNARY_POSTINC, TYPE_INT, x, 0);
+    assert(ast_add_expr(ast, NODE_UNARY, UNARY_POSTINC, TYPE_INT, x, 0) != inc);
+    node_id_t inc_sum = ast_add_expr(ast, NODE_BIN, BIN_ADD, TYPE_INT, inc, one);
+    assert(ast_add_expr(ast, NODE_BIN, BIN_ADD, TYPE_INT, inc, one) != inc_sum);
+    node_id_t neg = ast_add_expr(ast, NODE_UNARY, UNARY_MATH_NEG, TYPE_INT, x, 0);
+    assert(ast_add_expr(ast, NODE_UNARY, UNARY_MATH_NEG, TYPE_INT, x, 0) == neg);
+
+    // Nothing is shared across functions
+    ast_forget_shared(ast);
+    assert(ast_add_expr(ast, NODE_VAR, 0, TYPE_INT, 0, 0) != x);
+
+    // Enough distinct nodes that the table has to grow, and they all stay shared
+    ast_forget_shared(ast);
+    node_id_t first = ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 0, 0);
+    for (int i = 1; i < 10000; i++)
+        ast_add_expr(ast, NODE_INT, 0, TYPE_INT, i, 0);
+    len = ast->len;
+    for (int i = 0; i < 10000; i++)
+        assert(ast_add_expr(ast, NODE_INT, 0, TYPE_INT, i, 0) == first + (node_id_t)i);
+    assert(ast->len == len);
+    ast_free(ast);
+    printf("OK\n");
+}
+
+void test_ast_rewind(void) {
+    printf("test ast rewind...");
+    ast_t *ast = ast_new();
+    ast->share = true;
+    node_id_t one = ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 1, 0);
+    ast_mark_t mark = ast_mark(ast);
+
+    uint32_t children[] = {one, one};
+    ast_add_extra(ast, children, 2);
+    ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 2, 0);
+    ast_rewind(ast, mark);
+    assert(ast->len == mark.len);
+    assert(ast->extra_len == mark.extra_len);
+
+    // The dropped node can't be handed out again, and neither can anything from before the mark
+    node_id_t two = ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 2, 0);
+    assert(two == mark.len);
+    assert(ast->a[two] == 2);
+    assert(ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 1, 0) != one);
+
+    // Rewinding to before the start of the last function forgets what both functions shared, so
+    // ids that get handed out again are never mixed up with the nodes they used to be
+    mark = ast_mark(ast);
+    ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 3, 0);
+    ast_forget_shared(ast);
+    ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 4, 0);
+    ast_rewind(ast, mark);
+    ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 5, 0);
+    node_id_t four = ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 4, 0);
+    assert(four == ast->len - 1);
+    assert(ast->a[four] == 4);
+    node_id_t three = ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 3, 0);
+    assert(three == ast->len - 1);
+    assert(ast_add_expr(ast, NODE_INT, 0, TYPE_INT, 3, 0) == three);
+    ast_free(ast);
+    printf("OK\n");
+}
+
+void test_ast_copy(void) {
+    printf("test ast copy...");
+
+    // x = f(1, 2) ? 3 : 4; in one ast, after some other function
+    ast_t *src = ast_new();
+    ast_add(src, NODE_INT, 0, TYPE_INT, 9, 0);
+    ast_add_name(src, NULL);
+    ast_mark_t start = ast_mark(src);
+    string_t *f = intern("f", 1);
+    uint32_t call[] = {ast_add_name(src, f), 2, ast_add(src, NODE_INT, 0, TYPE_INT, 1, 0),
+                       ast_add(src, NODE_INT, 0, TYPE_INT, 2, 0)};
+    node_id_t cond = ast_add(src, NODE_FN_CALL, 0, TYPE_INT, ast_add_extra(src, call, 4), 0);
+    uint32_t clauses[] = {ast_add(src, NODE_INT, 0, TYPE_INT, 3, 0), ast_add(src, NODE_INT, 0, TYPE_INT, 4, 0)};
+    node_id_t ternary = ast_add(src, NODE_TERNARY, 0, TYPE_INT, cond, ast_add_extra(src, clauses, 2));
+    node_id_t x = ast_add(src, NODE_VAR, 0, TYPE_INT, 0, 0);
+    node_id_t assign = ast_add(src, NODE_ASSIGN, 0, TYPE_INT, x, ternary);
+    node_id_t decl = ast_add(src, NODE_DECLARE, 0, TYPE_VOID, 0, NODE_NONE);
+    uint32_t stmts[] = {decl, ast_add(src, NODE_EXPR_STMT, 0, TYPE_VOID, assign, 0)};
+    node_id_t block = ast_add(src, NODE_BLOCK, 0, TYPE_VOID, ast_add_extra(src, stmts, 2), 2);
+    ast_mark_t end = ast_mark(src);
+
+    // Copied into another ast that already has something in it
+    ast_t *ast = ast_new();
+    ast_add(ast, NODE_EMPTY, 0, TYPE_VOID, 0, 0);
+    ast_mark_t at = ast_mark(ast);
+    ast_mark_t size = at;
+    size.len += end.len - start.len;
+    size.extra_len += end.extra_len - start.extra_len;
+    size.names_len += end.names_len - start.names_len;
+    ast_resize(ast, size);
+    block += ast_copy(ast, at, src, start, end);
+    assert(ast->len == size.len);
+
+    uint32_t *copied_stmts = ast->extra + ast->a[block];
+    assert(ast->kind[block] == NODE_BLOCK && ast->b[block] == 2);
+    assert(ast->kind[copied_stmts[0]] == NODE_DECLARE && ast->b[copied_stmts[0]] == NODE_NONE);
+    node_id_t copied_assign = ast->a[copied_stmts[1]];
+    assert(ast->kind[copied_assign] == NODE_ASSIGN);
+    assert(ast->kind[ast->a[copied_assign]] == NODE_VAR);
+    node_id_t copied_ternary = ast->b[copied_assign];
+    assert(ast->kind[copied_ternary] == NODE_TERNARY);
+    assert(ast->a[ast->extra[ast->b[copied_ternary] + 1]] == 4);
+    uint32_t *copied_call = ast->extra + ast->a[ast->a[copied_ternary]];
+    assert(ast->names[copied_call[0]] == f);
+    assert(copied_call[1] == 2);
+    assert(ast->a[copied_call[2]] == 1 && ast->a[copied_call[3]] == 2);
+    for (uint32_t id = at.len; id < ast->len; id++)
+        assert(ast->kind[id] == src->kind[id - at.len + start.len]);
+
+    ast_free(src);
+    ast_free(ast);
+    printf("OK\n");
+}
+
+int main(void) {
+    test_ast_null();
+    test_ast_nodes();
+    test_ast_extra();
+    test_ast_share();
+    test_ast_rewind();
+    test_ast_copy();
+    return 0;
+}
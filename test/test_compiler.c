@@ -0,0 +1,624 @@
+#include "compile.h"
+#include "compiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+static char dir[] = "/tmp/test_compiler-XXXXXX";
+
+static char *good =
+    "int f(int a, int b);\n"
+    "int main() { int x = 0; for (int i = 0; i < 10; i = i + 1) x = f(x, i); return x ? x : -1; }\n"
+    "int f(int a, int b) { while (a > 20) a = a / 2; return a + b; }\n";
+
+// Doesn't parse
+static char *bad = "int main() { return (1; }\n";
+
+// Doesn't tokenize
+static char *bad_token = "int main() { return 1 @ 2; }\n";
+
+// Parse, but only codegen finds what's wrong with them
+static char *bad_break = "int main() { break; return 0; }\n";
+static char *bad_params = "int f(int a, int b, int c, int d, int e, int g, int h) { return h; }\n"
+                          "int main() { return 0; }\n";
+
+// Good until the next path but one, so there can be one for the input and one for the output
+static char *path(char *name) {
+    static _Thread_local char bufs[2][256];
+    static _Thread_local int next = 0;
+    char *buf = bufs[next];
+    next = !next;
+    snprintf(buf, sizeof(bufs[0]), "%s/%s", dir, name);
+    return buf;
+}
+
+static void write_file(char *name, char *text) {
+    FILE *f = fopen(path(name), "w");
+    fputs(text, f);
+    fclose(f);
+}
+
+static string_t *read_file(char *name) {
+    FILE *f = fopen(path(name), "r");
+    string_t *s = string_new();
+    int c;
+    while ((c = fgetc(f)) != EOF)
+        string_add(s, c);
+    fclose(f);
+    return s;
+}
+
+static compiler_options_t options(void) {
+    compiler_options_t o = {0};
+    o.num_threads = 1;
+    return o;
+}
+
+void test_compiler_again(void) {
+    printf("test compiler again...");
+    compiler_options_t o = options();
+    compiler_ctx_t *ctx = compiler_new(&o);
+    assert(compiler_compile(ctx, path("good.c"), path("first.s")) == 0);
+    assert(compiler_compile(ctx, path("good.c"), path("second.s")) == 0);
+    assert(ctx->names == NULL);
+    compiler_free(ctx);
+
+    string_t *first = read_file("first.s");
+    string_t *second = read_file("second.s");
+    assert(first->len > 0);
+    assert(string_eq(first, second) == 0);
+    string_free(first);
+    string_free(second);
+    printf("OK\n");
+}
+
+void test_compiler_errors(void) {
+    printf("test compiler errors...");
+    for (int fast = 0; fast < 2; fast++) {
+        compiler_options_t o = options();
+        o.fast = fast;
+        compiler_ctx_t *ctx = compiler_new(&o);
+        assert(compiler_compile(ctx, path("bad.c"), path("bad.s")) == -1);
+        assert(compiler_compile(ctx, path("bad_token.c"), path("bad.s")) == -1);
+        assert(compiler_compile(ctx, path("missing.c"), path("bad.s")) == -1);
+
+        // Nothing's left over from the ones that failed
+        assert(compiler_compile(ctx, path("good.c"), path("after.s")) == 0);
+        compiler_free(ctx);
+
+        string_t *first = read_file("first.s");
+        string_t *after = read_file("after.s");
+        assert(string_eq(first, after) == 0);
+        string_free(first);
+        string_free(after);
+    }
+    printf("OK\n");
+}
+
+void test_compiler_error_file(void) {
+    printf("test compiler error file...");
+    compiler_options_t o = options();
+    compiler_ctx_t *ctx = compiler_new(&o);
+    char *errors = NULL;
+    size_t len = 0;
+    ctx->errors = open_memstream(&errors, &len);
+    assert(compiler_compile(ctx, path("bad_token.c"), path("bad.s")) == -1);
+    fclose(ctx->errors);
+    compiler_free(ctx);
+    assert(strstr(errors, "UNRECOGNIZED TOKEN IN INPUT: @"));
+    free(errors);
+    printf("OK\n");
+}
+
+void test_compiler_all(void) {
+    printf("test compiler all...");
+    write_file("good2.c", good);
+    write_file("good3.c", good);
+    char *names[] = {"good.c", "bad.c", "good2.c", "missing.c", "good3.c"};
+    char *filenames[5];
+    for (int i = 0; i < 5; i++)
+        filenames[i] = strdup(path(names[i]));
+    compiler_options_t o = options();
+    o.num_threads = 3;
+    unlink(path("bad.s"));
+
+    // The others still compile
+    assert(compiler_compile_all(&o, filenames, 5) == -1);
+    string_t *first = read_file("first.s");
+    char *outputs[] = {"good.s", "good2.s", "good3.s"};
+    for (int i = 0; i < 3; i++) {
+        string_t *out = read_file(outputs[i]);
+        assert(string_eq(first, out) == 0);
+        string_free(out);
+    }
+    string_free(first);
+    assert(access(path("bad.s"), F_OK) != 0);
+
+    assert(compiler_compile_all(&o, filenames + 2, 1) == 0);
+    for (int i = 0; i < 5; i++)
+        free(filenames[i]);
+    printf("OK\n");
+}
+
+void test_compiler_all_report(void) {
+    printf("test compiler all report...");
+    char *filenames[] = {strdup(path("bad_token.c")), strdup(path("good2.c"))};
+    compiler_options_t o = options();
+
+    // compiler_compile_all reports to stderr, so that's pointed at a file for a while
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    FILE *f = fopen(path("report.txt"), "w");
+    dup2(fileno(f), STDERR_FILENO);
+    fclose(f);
+    assert(compiler_compile_all(&o, filenames, 2) == -1);
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    // Every line has the file's name in front, and the blank line after the error isn't one of them
+    string_t *report = read_file("report.txt");
+    char expected[512];
+    snprintf(expected, sizeof(expected), "%s: UNRECOGNIZED TOKEN IN INPUT: @ 2; }\n%s: failed\n",
+             filenames[0], filenames[0]);
+    assert(strcmp(string_get(report), expected) == 0);
+    string_free(report);
+    free(filenames[0]);
+    free(filenames[1]);
+    printf("OK\n");
+}
+
+void test_compiler_all_codegen_errors(void) {
+    printf("test compiler all codegen errors...");
+    write_file("break.c", bad_break);
+    write_file("params.c", bad_params);
+    char *names[] = {"good.c", "break.c", "good2.c", "params.c", "good3.c"};
+    char *filenames[5];
+    for (int i = 0; i < 5; i++)
+        filenames[i] = strdup(path(names[i]));
+    unlink(path("good2.s"));
+    unlink(path("good3.s"));
+
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    FILE *f = fopen(path("report.txt"), "w");
+    dup2(fileno(f), STDERR_FILENO);
+    fclose(f);
+    compiler_options_t o = options();
+    int ret = compiler_compile_all(&o, filenames, 5);
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    assert(ret == -1);
+
+    // Each bad file fails on its own, with its error and its name in the report, and the files after
+    // it still compile
+    string_t *report = read_file("report.txt");
+    char line[512];
+    for (int i = 1; i < 5; i += 2) {
+        snprintf(line, sizeof(line), "%s: failed\n", filenames[i]);
+        assert(strstr(string_get(report), line));
+    }
+    assert(strstr(string_get(report), "instr_jump: null label"));
+    assert(strstr(string_get(report), "Don't support more than 6 parameters"));
+    string_free(report);
+
+    string_t *first = read_file("first.s");
+    char *outputs[] = {"good2.s", "good3.s"};
+    for (int i = 0; i < 2; i++) {
+        string_t *out = read_file(outputs[i]);
+        assert(string_eq(first, out) == 0);
+        string_free(out);
+    }
+    string_free(first);
+    assert(access(path("break.s"), F_OK) != 0);
+    assert(access(path("params.s"), F_OK) != 0);
+    for (int i = 0; i < 5; i++)
+        free(filenames[i]);
+    printf("OK\n");
+}
+
+// Output only replaces the output file once the compile has worked, in every mode
+void test_compiler_no_partial_output(void) {
+    printf("test compiler no partial output...");
+    for (int mode = 0; mode < 8; mode++) {
+        compiler_options_t o = options();
+        o.fast = mode % 4 == 1;
+        o.stream = mode % 4 == 2;
+        o.pipeline = mode % 4 == 3;
+        o.object = mode >= 4;
+        compiler_ctx_t *ctx = compiler_new(&o);
+        write_file("kept.s", "kept\n");
+        assert(compiler_compile(ctx, path("break.c"), path("kept.s")) == -1);
+        assert(compiler_compile(ctx, path("params.c"), path("new.s")) == -1);
+        compiler_free(ctx);
+
+        string_t *kept = read_file("kept.s");
+        assert(strcmp(string_get(kept), "kept\n") == 0);
+        string_free(kept);
+        assert(access(path("new.s"), F_OK) != 0);
+    }
+
+    // Something that's already there and isn't a regular file is written to, not replaced
+    unlink(path("link.s"));
+    symlink(path("target.s"), path("link.s"));
+    compiler_options_t o = options();
+    compiler_ctx_t *ctx = compiler_new(&o);
+    assert(compiler_compile(ctx, path("good.c"), path("link.s")) == 0);
+    compiler_free(ctx);
+    struct stat st;
+    assert(lstat(path("link.s"), &st) == 0 && S_ISLNK(st.st_mode));
+    string_t *first = read_file("first.s");
+    string_t *target = read_file("target.s");
+    assert(string_eq(first, target) == 0);
+    string_free(first);
+    string_free(target);
+
+    // Nothing but the inputs and outputs is left behind
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+        assert(!strstr(entry->d_name, ".tmp."));
+    closedir(d);
+    printf("OK\n");
+}
+
+// Failing to write the output fails the compile, in every mode, and leaves the process able to carry on
+void test_compiler_write_failure(void) {
+    printf("test compiler write failure...");
+    for (int mode = 0; mode < 8; mode++) {
+        compiler_options_t o = options();
+        o.fast = mode % 4 == 1;
+        o.stream = mode % 4 == 2;
+        o.pipeline = mode % 4 == 3;
+        o.object = mode >= 4;
+        compiler_ctx_t *ctx = compiler_new(&o);
+        char *errors = NULL;
+        size_t len = 0;
+        ctx->errors = open_memstream(&errors, &len);
+        assert(compiler_compile(ctx, path("good.c"), "/dev/full") == -1);
+        fclose(ctx->errors);
+        assert(strstr(errors, "write failed"));
+        free(errors);
+
+        ctx->errors = NULL;
+        assert(compiler_compile(ctx, path("good.c"), path("after.s")) == 0);
+        compiler_free(ctx);
+    }
+    printf("OK\n");
+}
+
+// Compiles name with the cache in cache_dir and checks how many functions it found there
+static void check_cache(char *name, char *expected) {
+    compiler_options_t o = options();
+    o.cache_dir = strdup(path("cache"));
+    o.cache_stats = true;
+    compiler_ctx_t *ctx = compiler_new(&o);
+    char *errors = NULL;
+    size_t len = 0;
+    ctx->errors = open_memstream(&errors, &len);
+    assert(compiler_compile(ctx, path(name), path("cached.s")) == 0);
+    fclose(ctx->errors);
+    compiler_free(ctx);
+    free(o.cache_dir);
+    assert(strcmp(errors, expected) == 0);
+    free(errors);
+}
+
+// Two programs sharing a cache don't push each other out of it
+void test_compiler_cache_shared(void) {
+    printf("test compiler cache shared...");
+    write_file("other.c", "int g(int a) { return a * 3; }\nint main() { return g(2); }\n");
+    for (int i = 0; i < 2; i++) {
+        check_cache("good.c", i ? "cache: 2 hits, 0 misses\n" : "cache: 0 hits, 2 misses\n");
+        check_cache("other.c", i ? "cache: 2 hits, 0 misses\n" : "cache: 0 hits, 2 misses\n");
+    }
+    check_cache("good.c", "cache: 2 hits, 0 misses\n");
+
+    string_t *first = read_file("first.s");
+    string_t *out = read_file("cached.s");
+    assert(string_eq(first, out) == 0);
+    string_free(first);
+    string_free(out);
+    printf("OK\n");
+}
+
+// Compiling a file on its own finds the code a batch with it in cached
+void test_compiler_cache_batch(void) {
+    printf("test compiler cache batch...");
+    write_file("batch.c", "int k(int a) { return a - 1; }\nint main() { return k(5); }\n");
+    compiler_options_t o = options();
+    o.cache_dir = strdup(path("cache"));
+    char *filenames[] = {strdup(path("batch.c")), strdup(path("other.c"))};
+    assert(compiler_compile_all(&o, filenames, 2) == 0);
+    check_cache("batch.c", "cache: 2 hits, 0 misses\n");
+    check_cache("other.c", "cache: 2 hits, 0 misses\n");
+    free(filenames[0]);
+    free(filenames[1]);
+    free(o.cache_dir);
+
+    unlink(path("cache/fns.log"));
+    rmdir(path("cache"));
+    printf("OK\n");
+}
+
+// Compiles name both ways and checks that the outputs are the same
+static void check_stream(char *name, bool object) {
+    compiler_options_t o = options();
+    o.object = object;
+    compiler_ctx_t *ctx = compiler_new(&o);
+    assert(compiler_compile(ctx, path(name), path("whole.out")) == 0);
+    ctx->options.stream = true;
+    assert(compiler_compile(ctx, path(name), path("stream.out")) == 0);
+    compiler_free(ctx);
+
+    string_t *whole = read_file("whole.out");
+    string_t *streamed = read_file("stream.out");
+    assert(whole->len > 0);
+    assert(string_eq(whole, streamed) == 0);
+    string_free(whole);
+    string_free(streamed);
+}
+
+void test_compiler_stream(void) {
+    printf("test compiler stream...");
+
+    // Defined in the order they're declared, so streaming them changes nothing
+    write_file("ordered.c", "int f(int a, int b) { while (a > 20) a = a / 2; return a + b; }\n"
+                            "int main() { int x = 0; for (int i = 0; i < 10; i = i + 1) x = f(x, i); return x; }\n");
+    check_stream("ordered.c", false);
+    check_stream("ordered.c", true);
+
+    // Big enough that declarations and identifiers straddle the windows the input is lexed in
+    FILE *f = fopen(path("long.c"), "w");
+    for (int i = 0; i < 3000; i++)
+        fprintf(f, "int function_number_%d(int a) { int x = a; if (x) { x = x + %d; } return x; }\n", i, i);
+    fprintf(f, "int main() { return function_number_2999(1); }\n");
+    fclose(f);
+    check_stream("long.c", false);
+    check_stream("long.c", true);
+
+    // Functions come out as they're defined, after the ones that were declared before them
+    compiler_options_t o = options();
+    o.stream = true;
+    compiler_ctx_t *ctx = compiler_new(&o);
+    assert(compiler_compile(ctx, path("good.c"), path("stream.out")) == 0);
+    string_t *out = read_file("stream.out");
+    char *main_label = strstr(string_get(out), "main:");
+    char *f_label = strstr(string_get(out), "f:");
+    assert(main_label && f_label && main_label < f_label);
+    string_free(out);
+
+    assert(compiler_compile(ctx, path("bad.c"), path("bad.s")) == -1);
+    assert(compiler_compile(ctx, path("bad_token.c"), path("bad.s")) == -1);
+
+    // Only each function's signature is kept, but that's still enough to check declarations and calls
+    write_file("redefined.c", "int f(int a) { return a; }\nint f(int a) { return a; }\n");
+    write_file("mismatch.c", "int f(int a, int b);\nint f(int a) { return a; }\n");
+    write_file("args.c", "int f(int a, int b) { return a; }\nint main() { return f(1); }\n");
+    assert(compiler_compile(ctx, path("redefined.c"), path("bad.s")) == -1);
+    assert(compiler_compile(ctx, path("mismatch.c"), path("bad.s")) == -1);
+    assert(compiler_compile(ctx, path("args.c"), path("bad.s")) == -1);
+    assert(compiler_compile(ctx, path("ordered.c"), path("stream.out")) == 0);
+    compiler_free(ctx);
+
+    // An object's header is written last, so one can't be streamed into a pipe, rather than kept
+    // in memory until the end
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    for (int pipeline = 0; pipeline < 2; pipeline++) {
+        o.object = true;
+        o.pipeline = pipeline;
+        ctx = compiler_new(&o);
+        char *errors = NULL;
+        size_t len = 0;
+        ctx->errors = open_memstream(&errors, &len);
+        assert(compiler_compile(ctx, path("ordered.c"), NULL) == -1);
+        fclose(ctx->errors);
+        compiler_free(ctx);
+        assert(strstr(errors, "can't stream an object file"));
+        free(errors);
+    }
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    printf("OK\n");
+}
+
+// Compiles name with --stream and with --pipeline, and checks that the outputs are the same
+static void check_pipeline(char *name, bool object) {
+    compiler_options_t o = options();
+    o.object = object;
+    o.stream = true;
+    compiler_ctx_t *ctx = compiler_new(&o);
+    assert(compiler_compile(ctx, path(name), path("stream.out")) == 0);
+    ctx->options.pipeline = true;
+    assert(compiler_compile(ctx, path(name), path("pipeline.out")) == 0);
+    compiler_free(ctx);
+
+    string_t *streamed = read_file("stream.out");
+    string_t *piped = read_file("pipeline.out");
+    assert(streamed->len > 0);
+    assert(string_eq(streamed, piped) == 0);
+    string_free(streamed);
+    string_free(piped);
+}
+
+void test_compiler_pipeline(void) {
+    printf("test compiler pipeline...");
+    check_pipeline("good.c", false);
+    check_pipeline("long.c", false);
+    check_pipeline("long.c", true);
+
+    // A failure anywhere leaves nothing behind for the next compile
+    compiler_options_t o = options();
+    o.pipeline = true;
+    o.pipeline_stats = true;
+    compiler_ctx_t *ctx = compiler_new(&o);
+    char *errors = NULL;
+    size_t len = 0;
+    ctx->errors = open_memstream(&errors, &len);
+    assert(compiler_compile(ctx, path("bad.c"), path("bad.s")) == -1);
+    assert(compiler_compile(ctx, path("bad_token.c"), path("bad.s")) == -1);
+    assert(compiler_compile(ctx, path("ordered.c"), path("pipeline.out")) == 0);
+    fclose(ctx->errors);
+    compiler_free(ctx);
+
+    assert(strstr(errors, "UNRECOGNIZED TOKEN IN INPUT: @"));
+    assert(strstr(errors, "pipeline: codegen queue: 2 functions"));
+    free(errors);
+    printf("OK\n");
+}
+
+void test_compiler_server(void) {
+    printf("test compiler server...");
+    write_file("truncated.c", "int main() { int");
+    char *socket_path = strdup(path("server.sock"));
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == 0) {
+        // Its own output doesn't matter, only the clients'
+        freopen("/dev/null", "w", stdout);
+        _exit(compiler_serve(socket_path));
+    }
+    for (int i = 0; i < 1000 && access(socket_path, F_OK) != 0; i++)
+        usleep(1000);
+    struct stat st;
+    assert(stat(socket_path, &st) == 0 && (st.st_mode & 0777) == 0600);
+
+    // A client that connects and never sends anything doesn't hold up the others. If it did, the
+    // alarm ends the test.
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, socket_path);
+    int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(connect(idle, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    alarm(30);
+
+    // Messages go to the client's stderr and stdout, so they're pointed at a file for a while
+    fflush(stdout);
+    fflush(stderr);
+    int saved[] = {dup(STDOUT_FILENO), dup(STDERR_FILENO)};
+    FILE *f = fopen(path("report.txt"), "w");
+    dup2(fileno(f), STDOUT_FILENO);
+    dup2(fileno(f), STDERR_FILENO);
+    fclose(f);
+
+    // The input that used to crash the compiler fails the request, but the server carries on
+    char *bad_args[] = {"-o", strdup(path("bad.s")), strdup(path("truncated.c"))};
+    char *good_args[] = {"-o", strdup(path("server.s")), strdup(path("good.c"))};
+    assert(compiler_request(socket_path, 3, bad_args) == -1);
+    assert(compiler_request(socket_path, 3, good_args) == 0);
+    assert(compiler_request(socket_path, 3, bad_args) == -1);
+    assert(compiler_request(socket_path, 3, good_args) == 0);
+
+    // So does one whose output can't be written
+    char *full_args[] = {"-o", "/dev/full", good_args[2]};
+    assert(compiler_request(socket_path, 3, full_args) == -1);
+    assert(compiler_request(socket_path, 3, good_args) == 0);
+    alarm(0);
+    close(idle);
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved[0], STDOUT_FILENO);
+    dup2(saved[1], STDERR_FILENO);
+    close(saved[0]);
+    close(saved[1]);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    string_t *report = read_file("report.txt");
+    assert(strstr(string_get(report), "Reached unreachable branch"));
+    assert(strstr(string_get(report), "write failed"));
+    assert(!strstr(string_get(report), "crashed"));
+    assert(!strstr(string_get(report), "went away"));
+    string_free(report);
+    string_t *first = read_file("first.s");
+    string_t *out = read_file("server.s");
+    assert(string_eq(first, out) == 0);
+    string_free(first);
+    string_free(out);
+
+    for (int i = 1; i < 3; i++) {
+        free(bad_args[i]);
+        free(good_args[i]);
+    }
+    free(socket_path);
+    printf("OK\n");
+}
+
+static void *compile_worker(void *arg) {
+    char *outfile = arg;
+    compiler_options_t o = options();
+    o.num_threads = 2;
+    compiler_ctx_t *ctx = compiler_new(&o);
+    for (int i = 0; i < 20; i++)
+        assert(compiler_compile(ctx, path("good.c"), path(outfile)) == 0);
+    compiler_free(ctx);
+    return NULL;
+}
+
+void test_compiler_threads(void) {
+    printf("test compiler threads...");
+    char *outfiles[] = {"t0.s", "t1.s", "t2.s", "t3.s"};
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, compile_worker, outfiles[i]);
+    for (int i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+
+    string_t *first = read_file("first.s");
+    for (int i = 0; i < 4; i++) {
+        string_t *out = read_file(outfiles[i]);
+        assert(string_eq(first, out) == 0);
+        string_free(out);
+    }
+    string_free(first);
+    printf("OK\n");
+}
+
+int main(void) {
+    assert(mkdtemp(dir));
+    write_file("good.c", good);
+    write_file("bad.c", bad);
+    write_file("bad_token.c", bad_token);
+
+    test_compiler_again();
+    test_compiler_errors();
+    test_compiler_threads();
+    test_compiler_error_file();
+    test_compiler_all();
+    test_compiler_all_report();
+    test_compiler_all_codegen_errors();
+    test_compiler_no_partial_output();
+    test_compiler_write_failure();
+    test_compiler_cache_shared();
+    test_compiler_cache_batch();
+    test_compiler_stream();
+    test_compiler_pipeline();
+    test_compiler_server();
+
+    char *files[] = {"good.c", "bad.c", "bad_token.c", "first.s", "second.s", "bad.s", "after.s",
+                     "t0.s", "t1.s", "t2.s", "t3.s", "good2.c", "good3.c", "good.s", "good2.s",
+                     "good3.s", "ordered.c", "long.c", "whole.out", "stream.out",
+                     "pipeline.out", "report.txt", "truncated.c", "server.sock",
+                     "server.s", "redefined.c", "mismatch.c", "args.c",
+                     "break.c", "params.c", "break.s", "params.s", "kept.s", "link.s", "target.s",
+                     "other.c", "cached.s", "batch.c", "batch.s", "other.s"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        unlink(path(files[i]));
+    rmdir(dir);
+    return 0;
+}
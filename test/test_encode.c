@@ -0,0 +1,184 @@
+#include "compile.h"
+#include <string.h>
+#include <assert.h>
+
+static arena_t *arena;
+
+static output_t instr(opcode_t op, int num_args, operand_t src, operand_t dst) {
+    output_t out;
+    out.type = OUTPUT_INSTR;
+    out.instr.op = op;
+    out.instr.num_args = num_args;
+    out.instr.src = src;
+    out.instr.dst = dst;
+    return out;
+}
+
+static output_t label(int id) {
+    output_t out;
+    out.type = OUTPUT_LABEL;
+    out.label.name = NULL;
+    out.label.id = id;
+    out.label.linkage = LABEL_LOCAL;
+    return out;
+}
+
+static output_t fn_label(char *name) {
+    output_t out;
+    out.type = OUTPUT_LABEL;
+    out.label.name = intern(name, strlen(name));
+    out.label.linkage = LABEL_GLOBAL;
+    return out;
+}
+
+static operand_t reg(reg_t r) {
+    return (operand_t){.type = OPERAND_REG, .reg = r};
+}
+
+static operand_t imm(imm_t i) {
+    return (operand_t){.type = OPERAND_IMM, .imm = i};
+}
+
+static operand_t mem(reg_t r, int64_t offset) {
+    return (operand_t){.type = OPERAND_MEM_LOC, .mem = {.reg = r, .offset = offset}};
+}
+
+static operand_t local(int id) {
+    return (operand_t){.type = OPERAND_LOCAL_LABEL, .local_label = id};
+}
+
+static operand_t none(void) {
+    return (operand_t){.type = OPERAND_REG, .reg = REG_RAX};
+}
+
+// Wraps a single function's worth of outputs up the way gen_asm would
+static list_t *new_fns(output_buf_t **buf) {
+    *buf = arena_alloc(arena, sizeof(output_buf_t));
+    (*buf)->outputs = arena_alloc(arena, sizeof(output_t) * 2048);
+    (*buf)->len = 0;
+    (*buf)->capacity = 2048;
+    (*buf)->arena = arena;
+    list_t *fns = list_new_in(arena);
+    list_push(fns, *buf);
+    return fns;
+}
+
+static void push(output_buf_t *buf, output_t out) {
+    assert(buf->len < buf->capacity);
+    buf->outputs[buf->len++] = out;
+}
+
+static void check_one(output_t out, const uint8_t *expected, size_t len) {
+    output_buf_t *buf;
+    list_t *fns = new_fns(&buf);
+    push(buf, out);
+    object_t *obj = encode(fns, arena);
+    assert(obj->text_len == len);
+    assert(memcmp(obj->text, expected, len) == 0);
+}
+
+#define CHECK(out, ...) do {\
+    const uint8_t expected[] = {__VA_ARGS__};\
+    check_one(out, expected, sizeof(expected));\
+} while (0)
+
+// Expected bytes are what gas emits for the same instruction
+void test_encode_instrs(void) {
+    printf("test encode instrs...");
+    CHECK(instr(OP_MOV, 2, reg(REG_RSP), reg(REG_RBP)), 0x48, 0x89, 0xe5);
+    CHECK(instr(OP_MOV, 2, imm(5), reg(REG_RAX)), 0x48, 0xc7, 0xc0, 0x05, 0x00, 0x00, 0x00);
+    CHECK(instr(OP_MOV, 2, imm(0x100000000), reg(REG_RAX)),
+          0x48, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00);
+    CHECK(instr(OP_MOV, 2, reg(REG_RDI), mem(REG_RBP, -8)), 0x48, 0x89, 0x7d, 0xf8);
+    CHECK(instr(OP_MOV, 2, mem(REG_RBP, -256), reg(REG_RAX)), 0x48, 0x8b, 0x85, 0x00, 0xff, 0xff, 0xff);
+    CHECK(instr(OP_MOV, 2, reg(REG_R9), mem(REG_RSP, 0)), 0x4c, 0x89, 0x0c, 0x24);
+    CHECK(instr(OP_ADD, 2, imm(-16), reg(REG_RSP)), 0x48, 0x83, 0xc4, 0xf0);
+    CHECK(instr(OP_ADD, 2, imm(-1024), reg(REG_RSP)), 0x48, 0x81, 0xc4, 0x00, 0xfc, 0xff, 0xff);
+    CHECK(instr(OP_ADD, 2, imm(1), mem(REG_RBP, -8)), 0x48, 0x83, 0x45, 0xf8, 0x01);
+    CHECK(instr(OP_SUB, 2, reg(REG_RAX), reg(REG_RCX)), 0x48, 0x29, 0xc1);
+    CHECK(instr(OP_CMP, 2, imm(0), reg(REG_RAX)), 0x48, 0x83, 0xf8, 0x00);
+    CHECK(instr(OP_MUL, 2, reg(REG_RCX), reg(REG_RAX)), 0x48, 0x0f, 0xaf, 0xc1);
+    CHECK(instr(OP_XCHG, 2, reg(REG_RAX), reg(REG_RCX)), 0x48, 0x91);
+    CHECK(instr(OP_PUSH, 1, reg(REG_RBP), none()), 0x55);
+    CHECK(instr(OP_PUSH, 1, reg(REG_R11), none()), 0x41, 0x53);
+    CHECK(instr(OP_POP, 1, reg(REG_R10), none()), 0x41, 0x5a);
+    CHECK(instr(OP_NEG, 1, reg(REG_RAX), none()), 0x48, 0xf7, 0xd8);
+    CHECK(instr(OP_NOT, 1, reg(REG_RAX), none()), 0x48, 0xf7, 0xd0);
+    CHECK(instr(OP_DIV, 1, reg(REG_RCX), none()), 0x48, 0xf7, 0xf9);
+    CHECK(instr(OP_SETLE, 1, reg(REG_AL), none()), 0x0f, 0x9e, 0xc0);
+    CHECK(instr(OP_CQO, 0, none(), none()), 0x48, 0x99);
+    CHECK(instr(OP_RET, 0, none(), none()), 0xc3);
+    printf("OK\n");
+}
+
+static object_t *jump_over(opcode_t op, int num_pushes) {
+    output_buf_t *buf;
+    list_t *fns = new_fns(&buf);
+    push(buf, instr(op, 1, local(0), none()));
+    for (int i = 0; i < num_pushes; i++)
+        push(buf, instr(OP_PUSH, 1, reg(REG_RAX), none()));
+    push(buf, label(0));
+    return encode(fns, arena);
+}
+
+void test_encode_jumps(void) {
+    printf("test encode jumps...");
+
+    // Largest forward distance that fits in a byte
+    object_t *obj = jump_over(OP_JE, 127);
+    assert(obj->text_len == 2 + 127);
+    assert(obj->text[0] == 0x74 && obj->text[1] == 127);
+
+    obj = jump_over(OP_JE, 128);
+    assert(obj->text_len == 6 + 128);
+    assert(obj->text[0] == 0x0f && obj->text[1] == 0x84 && obj->text[2] == 128);
+
+    obj = jump_over(OP_JMP, 1000);
+    assert(obj->text_len == 5 + 1000);
+    assert(obj->text[0] == 0xe9);
+
+    // Backwards jumps are relative to the end of the jump too
+    output_buf_t *buf;
+    list_t *fns = new_fns(&buf);
+    push(buf, label(0));
+    push(buf, instr(OP_PUSH, 1, reg(REG_RAX), none()));
+    push(buf, instr(OP_JNE, 1, local(0), none()));
+    obj = encode(fns, arena);
+    assert(obj->text_len == 3);
+    assert(obj->text[1] == 0x75 && obj->text[2] == (uint8_t)-3);
+    printf("OK\n");
+}
+
+void test_encode_calls(void) {
+    printf("test encode calls...");
+    output_buf_t *buf;
+    list_t *fns = new_fns(&buf);
+    push(buf, fn_label("main"));
+    push(buf, instr(OP_CALL, 1, (operand_t){.type = OPERAND_LABEL, .label = intern("foo", 3)}, none()));
+    push(buf, instr(OP_RET, 0, none(), none()));
+    object_t *obj = encode(fns, arena);
+
+    assert(obj->text_len == 6);
+    assert(obj->num_relocs == 1);
+    assert(obj->relocs[0].offset == 1);
+    assert(obj->relocs[0].addend == -4);
+
+    obj_sym_t *foo = obj->relocs[0].sym;
+    assert(foo == map_get(obj->syms, intern("foo", 3)));
+    assert(foo->offset == -1);
+
+    obj_sym_t *main_sym = map_get(obj->syms, intern("main", 4));
+    assert(main_sym->offset == 0);
+    assert(main_sym->size == 6);
+    assert(main_sym->binding == SYM_GLOBAL);
+    printf("OK\n");
+}
+
+int main(void) {
+    arena = arena_new();
+    test_encode_instrs();
+    test_encode_jumps();
+    test_encode_calls();
+    arena_free(arena);
+    return 0;
+}
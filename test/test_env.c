@@ -0,0 +1,62 @@
+#include "env.h"
+#include "intern.h"
+#include <stdio.h>
+#include <assert.h>
+
+void test_env_shadow(void) {
+    printf("test env shadow...");
+    env_t *env = env_new(NULL);
+    string_t *x = intern("x", 1);
+    var_table_t *fn = env_push_fn(env);
+
+    var_info_t *outer = env_add(env, x, TYPE_INT, true);
+    assert(env_get(env, x) == outer);
+    assert(env_in_scope(env, x));
+
+    env_push_scope(env);
+    assert(env_get(env, x) == outer);
+    assert(!env_in_scope(env, x));
+    var_info_t *inner = env_add(env, x, TYPE_INT, true);
+    assert(env_get(env, x) == inner);
+    assert(inner->shadowed == outer);
+    env_pop_scope(env);
+
+    assert(env_get(env, x) == outer);
+    env_pop_scope(env);
+    assert(env_get(env, x) == NULL);
+
+    assert(fn->num_vars == 2);
+    assert(fn->num_scopes == 2);
+    assert(fn->scopes[1].parent == 0);
+    assert(inner->scope == 1);
+    printf("OK\n");
+}
+
+void test_env_deep(void) {
+    printf("test env deep...");
+    env_t *env = env_new(NULL);
+    string_t *x = intern("x", 1);
+    string_t *y = intern("y", 1);
+    var_table_t *fn = env_push_fn(env);
+    var_info_t *top = env_add(env, y, TYPE_INT, true);
+
+    for (int i = 0; i < 10000; i++) {
+        env_push_scope(env);
+        env_add(env, x, TYPE_INT, true);
+    }
+    assert(env_get(env, y) == top);
+    assert(env_get(env, x)->scope == 10000);
+    for (int i = 0; i < 10000; i++)
+        env_pop_scope(env);
+
+    assert(env_get(env, x) == NULL);
+    assert(fn->num_vars == 10001);
+    env_pop_scope(env);
+    printf("OK\n");
+}
+
+int main(void) {
+    test_env_shadow();
+    test_env_deep();
+    return 0;
+}
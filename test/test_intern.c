@@ -0,0 +1,65 @@
+#include "intern.h"
+#include <stdio.h>
+#include <assert.h>
+
+void test_intern_same(void) {
+    printf("test intern same...");
+    char buf[] = "foo foo";
+    string_t *s1 = intern(buf, 3);
+    string_t *s2 = intern(buf + 4, 3);
+    assert(s1 == s2);
+    assert(s1->len == 3);
+    assert(string_eq(s1, s2) == 0);
+    printf("OK\n");
+}
+
+void test_intern_different(void) {
+    printf("test intern different...");
+    string_t *s1 = intern("foo", 3);
+    string_t *s2 = intern("foobar", 6);
+    string_t *s3 = intern("foobar", 3);
+    assert(s1 != s2);
+    assert(s1 == s3);
+    assert(string_eq(s1, s2) != 0);
+    printf("OK\n");
+}
+
+void test_intern_terminated(void) {
+    printf("test intern terminated...");
+    string_t *s = intern("bar baz", 3);
+    char *c = string_get(s);
+    assert(c[3] == '\0');
+
+    // string_get shouldn't have changed the interned string
+    assert(s->len == 3);
+    assert(s == intern("bar", 3));
+    printf("OK\n");
+}
+
+void test_intern_tables(void) {
+    printf("test intern tables...");
+    string_t *outer = intern("qux", 3);
+    intern_table_t *table = intern_table_new();
+    intern_table_t *prev = intern_use(table);
+    assert(intern_current() == table);
+
+    // A new table doesn't have anything from the old one
+    string_t *inner = intern("qux", 3);
+    assert(inner != outer);
+    assert(string_eq(inner, outer) == 0);
+    assert(inner == intern("qux", 3));
+
+    assert(intern_use(prev) == table);
+    intern_table_free(table);
+    assert(intern_current() == prev);
+    assert(outer == intern("qux", 3));
+    printf("OK\n");
+}
+
+int main(void) {
+    test_intern_same();
+    test_intern_different();
+    test_intern_terminated();
+    test_intern_tables();
+    return 0;
+}
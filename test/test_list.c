@@ -53,11 +53,45 @@ void test_list_for_each(void) {
     }
 }
 
+void test_list_arena(void) {
+    printf("testing arena list\n");
+    arena_t *arena = arena_new();
+    list_t *list = list_new_in(arena);
+    assert(list->arena == arena);
+
+    int items[100];
+    for (int i = 0; i < 100; i++) {
+        items[i] = i;
+        list_push(list, &items[i]);
+    }
+    assert(list->len == 100);
+    assert(list_pop(list) == &items[0]);
+    assert(list_peek(list) == &items[1]);
+
+    list_t *other = list_new_in(arena);
+    int x = 3;
+    list_push(other, &x);
+    list_concat(list, other);
+    assert(list->len == 100);
+
+    int i = 1;
+    int *item_in_list;
+    list_for_each(list, item_in_list) {
+        if (i < 100)
+            assert(*item_in_list == i);
+        else
+            assert(item_in_list == &x);
+        i++;
+    }
+    arena_free(arena);
+}
+
 int main(void) {
     test_list_push();
     test_list_pop();
     test_list_concat();
     test_list_for_each();
+    test_list_arena();
     printf("tests pass\n");
     return 0;
 }
@@ -79,10 +79,84 @@ void test_map_for_each(void) {
     printf("OK\n");
 }
 
+void test_map_many_keys(void) {
+    printf("test map many keys...");
+    map_t *map = map_new();
+    int n = 10000;
+    int *vals = malloc(sizeof(int) * n);
+    string_t **keys = malloc(sizeof(string_t*) * n);
+    char buf[32];
+
+    for (int i = 0; i < n; i++) {
+        int len = snprintf(buf, sizeof(buf), "key%d", i);
+        keys[i] = from_char(buf, len);
+        vals[i] = i;
+        assert(map_set(map, keys[i], &vals[i]) == 0);
+    }
+    assert(map->len == n);
+
+    // lookups should work with a different string_t that has the same contents
+    for (int i = 0; i < n; i++) {
+        int len = snprintf(buf, sizeof(buf), "key%d", i);
+        string_t *lookup = from_char(buf, len);
+        assert(map_contains(map, lookup));
+        assert(*(int*)map_get(map, lookup) == i);
+        string_free(lookup);
+    }
+
+    string_t *missing = from_char("nope", 4);
+    assert(!map_contains(map, missing));
+    assert(map_get(map, missing) == NULL);
+
+    // resizing must not change insertion order
+    pair_t *pair;
+    int i = 0;
+    map_for_each(map, pair) {
+        assert(pair->key == keys[i]);
+        i++;
+    }
+    assert(i == n);
+
+    printf("OK\n");
+}
+
+void test_map_arena(void) {
+    printf("test map arena...");
+    arena_t *arena = arena_new();
+    map_t *map = map_new_in(arena);
+    assert(map->arena == arena);
+
+    int n = 1000;
+    string_t **keys = arena_alloc(arena, sizeof(string_t*) * n);
+    int *vals = arena_alloc(arena, sizeof(int) * n);
+    char buf[32];
+    for (int i = 0; i < n; i++) {
+        int len = snprintf(buf, sizeof(buf), "key%d", i);
+        keys[i] = string_new_in(arena);
+        string_append(keys[i], buf, len);
+        vals[i] = i;
+        assert(map_set(map, keys[i], &vals[i]) == 0);
+    }
+
+    for (int i = 0; i < n; i++) {
+        assert(*(int*)map_get(map, keys[i]) == i);
+    }
+
+    pair_t *pair;
+    int i = 0;
+    map_for_each(map, pair) {
+        assert(pair->key == keys[i++]);
+    }
+    arena_free(arena);
+    printf("OK\n");
+}
+
 int main(void) {
     test_map_init();
     test_map_set_get();
     test_map_set_get_mult();
     test_map_for_each();
+    test_map_many_keys();
+    test_map_arena();
     return 0;
 }
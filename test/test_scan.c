@@ -0,0 +1,75 @@
+#include "scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const char alphabet[] = "  \n\t\t  abcxyzABCXYZ_0123456789+-;(){}#\x80\xff";
+
+static void fill_random(char *buf, int len) {
+    for (int i = 0; i < len; i++) {
+        // Mostly long runs, with an occasional change of class
+        if (i && rand() % 8)
+            buf[i] = buf[i - 1];
+        else
+            buf[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+    buf[len] = '\0';
+}
+
+static void check_level(scan_level_t level, char *buf, int len) {
+    for (int i = 0; i < len; i++) {
+        scan_set_level(SCAN_SCALAR);
+        char *ws = scan_whitespace(buf + i);
+        char *ident = scan_ident(buf + i);
+        char *digits = scan_digits(buf + i);
+
+        scan_set_level(level);
+        assert(scan_whitespace(buf + i) == ws);
+        assert(scan_ident(buf + i) == ident);
+        assert(scan_digits(buf + i) == digits);
+    }
+}
+
+void test_scan_matches_scalar(void) {
+    printf("test scan matches scalar...");
+    int len = 4096;
+    char *buf = aligned_alloc(64, len + 64);
+    for (int round = 0; round < 20; round++) {
+        fill_random(buf, len);
+        check_level(SCAN_SSE2, buf, len);
+        check_level(scan_best_level(), buf, len);
+    }
+    free(buf);
+    printf("OK\n");
+}
+
+// The vector kernels shouldn't fault when the terminator is the last byte before an unmapped page
+void test_scan_page_end(void) {
+    printf("test scan page end...");
+    long page = sysconf(_SC_PAGESIZE);
+    char *pages = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(pages != MAP_FAILED);
+    assert(mprotect(pages + page, page, PROT_NONE) == 0);
+
+    char *buf = pages + page - 100;
+    memset(buf, ' ', 40);
+    memset(buf + 40, 'a', 59);
+    buf[99] = '\0';
+
+    scan_set_level(scan_best_level());
+    assert(scan_whitespace(buf) == buf + 40);
+    assert(scan_ident(buf + 40) == buf + 99);
+    assert(scan_digits(buf + 40) == buf + 40);
+    assert(scan_whitespace(buf + 99) == buf + 99);
+    munmap(pages, page * 2);
+    printf("OK\n");
+}
+
+int main(void) {
+    test_scan_matches_scalar();
+    test_scan_page_end();
+    return 0;
+}
@@ -1,8 +1,47 @@
 #include "string.h"
 #include <stdio.h>
+#include <assert.h>
+
+void test_string_append(void) {
+    printf("test string append...");
+    string_t *s = string_new();
+    string_append(s, "hello world", 11);
+    assert(s->len == 11);
+    assert(s->arena == NULL);
+    assert(s->buf[0] == 'h' && s->buf[10] == 'd');
+    string_free(s);
+    printf("OK\n");
+}
+
+void test_string_arena(void) {
+    printf("test string arena...");
+    arena_t *arena = arena_new();
+    string_t *s1 = string_new_in(arena);
+    string_t *s2 = string_new_in(arena);
+    assert(s1->arena == arena);
+
+    // interleave appends so the strings can't just grow in place
+    for (int i = 0; i < 1000; i++) {
+        string_add(s1, 'a' + i % 26);
+        string_add(s2, 'z' - i % 26);
+    }
+    assert(s1->len == 1000 && s2->len == 1000);
+    for (int i = 0; i < 1000; i++) {
+        assert(s1->buf[i] == 'a' + i % 26);
+        assert(s2->buf[i] == 'z' - i % 26);
+    }
+
+    string_t *s3 = string_new_in(arena);
+    string_append(s3, s1->buf, 1000);
+    assert(string_eq(s1, s3) == 0);
+    assert(string_hash(s1) == string_hash(s3));
+    assert(string_eq(s1, s2) != 0);
+    arena_free(arena);
+    printf("OK\n");
+}
 
 int main(void) {
-    string_t test;
-    printf("test string\n");
+    test_string_append();
+    test_string_arena();
     return 0;
 }
@@ -0,0 +1,63 @@
+#include "threads.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define NUM_ITEMS 100000
+
+static void *push_all(void *arg) {
+    spsc_queue_t *queue = arg;
+    for (uintptr_t i = 1; i <= NUM_ITEMS; i++)
+        spsc_push(queue, (void *)i);
+    spsc_push(queue, NULL);
+    return NULL;
+}
+
+void test_spsc_capacity(void) {
+    printf("test spsc capacity...");
+    spsc_queue_t *queue = spsc_queue_new(5);
+    assert(queue->capacity == 8);
+
+    // Fills up and drains a few times over, so head and tail wrap around the slots
+    for (uintptr_t round = 0; round < 3; round++) {
+        for (uintptr_t i = 0; i < 8; i++)
+            spsc_push(queue, (void *)(round * 8 + i));
+        for (uintptr_t i = 0; i < 8; i++)
+            assert(spsc_pop(queue) == (void *)(round * 8 + i));
+    }
+    assert(queue->pushes == 24);
+    assert(queue->max_depth == 8);
+    assert(queue->depth_sum == 3 * (0 + 1 + 2 + 3 + 4 + 5 + 6 + 7));
+    assert(queue->push_stalls == 0 && queue->pop_stalls == 0);
+    spsc_queue_free(queue);
+    printf("OK\n");
+}
+
+void test_spsc_threads(void) {
+    printf("test spsc threads...");
+    spsc_queue_t *queue = spsc_queue_new(4);
+    pthread_t pusher;
+    pthread_create(&pusher, NULL, push_all, queue);
+
+    // Everything comes out once, in the order it went in
+    uintptr_t expected = 1;
+    void *item;
+    while ((item = spsc_pop(queue)))
+        assert((uintptr_t)item == expected++);
+    pthread_join(pusher, NULL);
+    assert(expected == NUM_ITEMS + 1);
+    assert(queue->pushes == NUM_ITEMS + 1);
+    assert(queue->max_depth <= 4);
+
+    // A queue this small can't have kept up without one side or the other waiting
+    assert(queue->push_stalls + queue->pop_stalls > 0);
+    spsc_queue_free(queue);
+    printf("OK\n");
+}
+
+int main(void) {
+    test_spsc_capacity();
+    test_spsc_threads();
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "threads.h"
+#include "compile.h"
+#include <pthread.h>
+#include <sched.h>
+
+typedef struct {
+    void *(*worker)(void *);
+    void *arg;
+    intern_table_t *names;
+    FILE *errors;
+} thread_start_t;
+
+static _Thread_local FILE *errors = NULL;
+
+FILE *error_file(FILE *usual) {
+    return errors ? errors : usual;
+}
+
+FILE *error_file_use(FILE *file) {
+    FILE *prev = errors;
+    errors = file;
+    return prev;
+}
+
+static _Thread_local jmp_buf *error_jump = NULL;
+
+_Noreturn void compile_error(const char *file, int line, const char *msg) {
+    fprintf(error_file(stdout), "%s line %d: Reached unreachable branch with message - %s\n", file, line,
+            msg);
+    compile_abort();
+}
+
+_Noreturn void compile_abort(void) {
+    if (error_jump)
+        longjmp(*error_jump, 1);
+    exit(-1);
+}
+
+jmp_buf *error_jump_use(jmp_buf *on_error) {
+    jmp_buf *prev = error_jump;
+    error_jump = on_error;
+    return prev;
+}
+
+// Workers intern names into the same table as the thread that started them, and report errors to
+// the same place
+static void *thread_main(void *arg) {
+    thread_start_t *start = arg;
+    intern_use(start->names);
+    error_file_use(start->errors);
+    return start->worker(start->arg);
+}
+
+void run_threads(int num_threads, void *(*worker)(void *), void *arg, arena_t *arena) {
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+    thread_start_t start = {.worker = worker, .arg = arg, .names = intern_current(), .errors = errors};
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, thread_main, &start)) {
+            UNREACHABLE("run_threads: failed to start a thread\n");
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        void *worker_arena;
+        pthread_join(threads[i], &worker_arena);
+        if (worker_arena)
+            arena_adopt(arena, worker_arena);
+    }
+    free(threads);
+}
+
+spsc_queue_t *spsc_queue_new(size_t capacity) {
+    spsc_queue_t *queue = aligned_alloc(64, sizeof(spsc_queue_t));
+    memset(queue, 0, sizeof(spsc_queue_t));
+    queue->capacity = 1;
+    while (queue->capacity < capacity)
+        queue->capacity *= 2;
+    queue->items = malloc(sizeof(void *) * queue->capacity);
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return queue;
+}
+
+void spsc_queue_free(spsc_queue_t *queue) {
+    free(queue->items);
+    free(queue);
+}
+
+// The item has to be in its slot before the popper can see the new tail, and the popper has to be
+// done with a slot before the pusher can see the new head, hence the acquires and releases
+void spsc_push(spsc_queue_t *queue, void *item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t depth = tail - atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (depth == queue->capacity) {
+        queue->push_stalls++;
+        do {
+            sched_yield();
+            depth = tail - atomic_load_explicit(&queue->head, memory_order_acquire);
+        } while (depth == queue->capacity);
+    }
+
+    queue->items[tail & (queue->capacity - 1)] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    queue->pushes++;
+    queue->depth_sum += depth;
+    if (depth + 1 > queue->max_depth)
+        queue->max_depth = depth + 1;
+}
+
+void *spsc_pop(spsc_queue_t *queue) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (atomic_load_explicit(&queue->tail, memory_order_acquire) == head) {
+        queue->pop_stalls++;
+        while (atomic_load_explicit(&queue->tail, memory_order_acquire) == head)
+            sched_yield();
+    }
+
+    void *item = queue->items[head & (queue->capacity - 1)];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return item;
+}
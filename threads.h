@@ -0,0 +1,79 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include "arena.h"
+
+/*
+ * Runs worker(arg) on num_threads threads at once and waits for all of them to finish. The workers
+ * usually take turns pulling jobs off a shared atomic counter in arg. A worker returns NULL, or an
+ * arena it allocated its results in, which is moved into arena so it lives as long as the caller's.
+ * Workers intern into the caller's intern table, and report errors wherever the caller does.
+ */
+void run_threads(int num_threads, void *(*worker)(void *), void *arg, arena_t *arena);
+
+// Where this thread reports errors in the program it's compiling, which is usual (stdout or stderr,
+// depending on the error) unless error_file_use has set somewhere else
+FILE *error_file(FILE *usual);
+
+// Sends this thread's errors to file, or back to the usual place if it's NULL. Returns where they
+// went before.
+FILE *error_file_use(FILE *file);
+
+/*
+ * Some errors in the program are only found deep inside a phase, like a break outside of a loop
+ * during codegen. UNREACHABLE reports them with compile_error, which then jumps to wherever this
+ * thread's compile said to go, so that it can fail without taking the process with it. With nowhere
+ * to go, it exits. compile_abort does the same for errors that have already been reported.
+ *
+ * A jump can't cross threads, so workers that can hit these set up their own.
+ */
+_Noreturn void compile_error(const char *file, int line, const char *msg);
+_Noreturn void compile_abort(void);
+
+// Sends this thread's compile errors to on_error, or to exit if it's NULL. Returns where they went
+// before, for putting back once whatever set it is done.
+jmp_buf *error_jump_use(jmp_buf *on_error);
+
+/*
+ * A bounded queue that one thread pushes onto and one other thread pops off, without taking a lock.
+ * head and tail only ever grow, and each is written by one side only, so the queue is full when they
+ * are capacity apart and empty when they're equal.
+ *
+ * A push onto a full queue, or a pop off an empty one, yields until the other side has caught up,
+ * and counts as a stall. Each counter is only touched by the side it belongs to, so they can be read
+ * once both are done.
+ */
+typedef struct {
+    void **items;
+    size_t capacity; // a power of 2
+
+    // Next slot to pop and next slot to push. They're kept apart so the two threads don't keep
+    // taking each other's cache line.
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+
+    // Kept by the pushing thread. depth_sum is the number of items already waiting, summed over
+    // every push.
+    _Alignas(64) size_t pushes;
+    size_t push_stalls;
+    size_t max_depth;
+    size_t depth_sum;
+
+    // Kept by the popping thread
+    _Alignas(64) size_t pop_stalls;
+} spsc_queue_t;
+
+// Makes a queue with room for capacity items, rounded up to a power of 2
+spsc_queue_t *spsc_queue_new(size_t capacity);
+void spsc_queue_free(spsc_queue_t *queue);
+
+// Adds item to the back of the queue, waiting for room if there isn't any
+void spsc_push(spsc_queue_t *queue, void *item);
+
+// Takes the item at the front of the queue, waiting for one if there isn't any
+void *spsc_pop(spsc_queue_t *queue);
+
+#endif
@@ -1,4 +1,19 @@
 #include "compile.h"
+#include "scan.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * The tokenizer is table driven. Every byte is first looked up in a character class table, which
+ * decides whether we're looking at whitespace, a number, an identifier/keyword or a punctuator.
+ * Keywords are recognized with a perfect hash once the whole identifier has been scanned, and
+ * punctuators are recognized by a small DFA that always takes the longest match.
+ *
+ * The tables are generated from the keywords and puncts lists below by lexer_init. Runs of
+ * whitespace, identifier characters and digits are skipped with the vector kernels in scan.c.
+ */
 
 typedef struct {
     char *keyword;
@@ -6,15 +21,26 @@ typedef struct {
 } keyword_pair_t;
 
 typedef struct {
-    char c;
+    char *punct;
     token_type_t type;
-} special_char_pair_t;
+} punct_pair_t;
 
 static const keyword_pair_t keywords[] = {
     {"return", TOK_RETURN},
     {"int", TOK_INT_TYPE},
     {"char", TOK_CHAR_TYPE},
     {"void", TOK_VOID_TYPE},
+    {"if", TOK_IF},
+    {"else", TOK_ELSE},
+    {"for", TOK_FOR},
+    {"while", TOK_WHILE},
+    {"do", TOK_DO},
+    {"break", TOK_BREAK},
+    {"continue", TOK_CONTINUE},
+    {NULL, 0},
+};
+
+static const punct_pair_t puncts[] = {
     {"&&", TOK_AND},
     {"||", TOK_OR},
     {"==", TOK_EQ},
@@ -25,191 +51,469 @@ static const keyword_pair_t keywords[] = {
     {"--", TOK_DECREMENT},
     {"+=", TOK_PLUS_EQ},
     {"-=", TOK_MINUS_EQ},
-    {"if", TOK_IF},
-    {"else", TOK_ELSE},
-    {"for", TOK_FOR},
-    {"while", TOK_WHILE},
-    {"do", TOK_DO},
-    {"break", TOK_BREAK},
-    {"continue", TOK_CONTINUE},
+    {"+", TOK_PLUS},
+    {"-", TOK_MINUS},
+    {"*", TOK_MULT},
+    {"/", TOK_DIV},
+    {"=", TOK_ASSIGN},
+    {"{", TOK_OPEN_BRACE},
+    {"}", TOK_CLOSE_BRACE},
+    {"(", TOK_OPEN_PAREN},
+    {")", TOK_CLOSE_PAREN},
+    {"[", TOK_OPEN_BRACKET},
+    {"]", TOK_CLOSE_BRACKET},
+    {";", TOK_SEMICOLON},
+    {"~", TOK_TILDE},
+    {"!", TOK_BANG},
+    {"<", TOK_LT},
+    {">", TOK_GT},
+    {"?", TOK_QUESTION},
+    {":", TOK_COLON},
+    {"%", TOK_MODULO},
+    {",", TOK_COMMA},
     {NULL, 0},
 };
 
-static const special_char_pair_t special_chars[] = {
-    {'+', TOK_PLUS},
-    {'-', TOK_MINUS},
-    {'*', TOK_MULT},
-    {'/', TOK_DIV},
-    {'=', TOK_ASSIGN},
-    {'{', TOK_OPEN_BRACE},
-    {'}', TOK_CLOSE_BRACE},
-    {'(', TOK_OPEN_PAREN},
-    {')', TOK_CLOSE_PAREN},
-    {'[', TOK_OPEN_BRACKET},
-    {']', TOK_CLOSE_BRACKET},
-    {';', TOK_SEMICOLON},
-    {'-', TOK_MINUS},
-    {'~', TOK_TILDE},
-    {'!', TOK_BANG},
-    {'<', TOK_LT},
-    {'>', TOK_GT},
-    {'?', TOK_QUESTION},
-    {':', TOK_COLON},
-    {'%', TOK_MODULO},
-    {',', TOK_COMMA},
-    {0, 0},
-};
+// Character classes. An identifier can start with CC_ALPHA and continue with CC_ALPHA or CC_DIGIT.
+#define CC_SPACE (1 << 0)
+#define CC_ALPHA (1 << 1)
+#define CC_DIGIT (1 << 2)
+#define CC_PUNCT (1 << 3)
 
-// returns true if s1 starts with s2
-static bool startswith(char *s1, char *s2) {
-    return !strncmp(s1, s2, strlen(s2));
-}
+static unsigned char char_class[256];
 
-static bool is_whitespace(char c) {
-    switch (c) {
-        case ' ':
-        case '\n':
-        case '\t':
-            return true;
-        default:
-            return false;
+// Keywords are hashed on their first and last characters and their length. These constants give
+// no collisions for the current keyword set - lexer_init will complain if that stops being true.
+#define KEYWORD_TABLE_SIZE (16)
+#define keyword_hash(p, len) (((unsigned char)(p)[0] + 8 * (unsigned char)(p)[(len) - 1] + (len)) \
+                              & (KEYWORD_TABLE_SIZE - 1))
+
+typedef struct {
+    char *keyword;
+    int len;
+    token_type_t type;
+} keyword_entry_t;
+
+static keyword_entry_t keyword_table[KEYWORD_TABLE_SIZE];
+
+// Punctuator DFA. State 0 is the start state and also means "no transition".
+#define PUNCT_MAX_STATES (64)
+
+static unsigned char punct_next[PUNCT_MAX_STATES][256];
+static token_type_t punct_accept[PUNCT_MAX_STATES];
+
+// The tables are built once, by whichever compile gets there first, and only read after that
+static pthread_once_t lexer_ready = PTHREAD_ONCE_INIT;
+
+static void lexer_init(void) {
+    char_class[' '] = char_class['\n'] = char_class['\t'] = CC_SPACE;
+    for (int c = 'a'; c <= 'z'; c++)
+        char_class[c] = CC_ALPHA;
+    for (int c = 'A'; c <= 'Z'; c++)
+        char_class[c] = CC_ALPHA;
+    char_class['_'] = CC_ALPHA;
+    for (int c = '0'; c <= '9'; c++)
+        char_class[c] = CC_DIGIT;
+
+    for (int i = 0; keywords[i].keyword; i++) {
+        int len = strlen(keywords[i].keyword);
+        keyword_entry_t *entry = &keyword_table[keyword_hash(keywords[i].keyword, len)];
+        if (entry->keyword) {
+            fprintf(stderr, "lexer_init: keywords %s and %s collide\n", entry->keyword,
+                    keywords[i].keyword);
+            exit(-1);
+        }
+        entry->keyword = keywords[i].keyword;
+        entry->len = len;
+        entry->type = keywords[i].type;
     }
-}
 
-static int string_literal(char *p, token_t *token) {
-    if (*p != '"')
-        return -1;
-    (void)token;
-    return -1;
-}
+    // Build a trie of the punctuators, which is our DFA
+    int num_states = 1;
+    for (int i = 0; puncts[i].punct; i++) {
+        int state = 0;
+        for (char *p = puncts[i].punct; *p; p++) {
+            unsigned char c = *p;
+            char_class[c] |= CC_PUNCT;
+            if (!punct_next[state][c]) {
+                if (num_states >= PUNCT_MAX_STATES) {
+                    fprintf(stderr, "lexer_init: too many punctuator states\n");
+                    exit(-1);
+                }
+                punct_next[state][c] = num_states++;
+            }
+            state = punct_next[state][c];
+        }
+        punct_accept[state] = puncts[i].type;
+    }
 
-static int char_literal(char *p, token_t *token) {
-    if (*p != '\'')
-        return -1;
-    (void)token;
-    return -1;
+    scan_set_level(scan_best_level());
 }
 
 // TODO only handles decimal integers
 static int number_literal(char *p, token_t *token) {
-    if (!isdigit(*p))
-        return -1;
-    char *end = p;
+    char *end = scan_digits(p);
+
+    // Saturates at LONG_MAX like strtol
+    long value = 0;
+    for (char *d = p; d < end; d++) {
+        if (value > (LONG_MAX - (*d - '0')) / 10) {
+            value = LONG_MAX;
+            break;
+        }
+        value = value * 10 + (*d - '0');
+    }
     token->type = TOK_INT_LIT;
-    token->int_literal = strtol(p, &end, 10);
+    token->int_literal = value;
     return end - p;
 }
 
-static int keyword(char *p, token_t *token) {
-    int i = 0;
-    while (keywords[i].keyword != NULL) {
-        if (startswith(p, keywords[i].keyword)) {
-            token->type = keywords[i].type;
-            return strlen(keywords[i].keyword);
-        }
-        i++;
+// Scans an identifier, then checks whether it's actually a keyword
+static int identifier(char *p, char *src, token_t *token) {
+    // an identifier can consist of numbers, letters, underscores
+    char *end = scan_ident(p + 1);
+    int len = end - p;
+
+    keyword_entry_t *entry = &keyword_table[keyword_hash(p, len)];
+    if (entry->len == len && !memcmp(p, entry->keyword, len)) {
+        token->type = entry->type;
+        return len;
     }
-    return -1;
+
+    token->type = TOK_IDENT;
+    token->offset = p - src;
+    token->len = len;
+    return len;
 }
 
-static int special_char(char *p, token_t *token) {
-    int i = 0;
-    while (special_chars[i].c) {
-        if (*p == special_chars[i].c) {
-            token->type = special_chars[i].type;
-            return 1;
+// Runs the punctuator DFA as far as it goes, then backs up to the last accepting state
+static int punctuator(char *p, token_t *token) {
+    int state = 0;
+    int len = 0;
+    int accept_len = -1;
+    while ((state = punct_next[state][(unsigned char)p[len]])) {
+        len++;
+        if (punct_accept[state]) {
+            token->type = punct_accept[state];
+            accept_len = len;
         }
-        i++;
     }
-    return -1;
+    return accept_len;
 }
 
-static int identifier(char *p, token_t *token) {
-    // identifiers can only begin with a letter or underscore
-    if (!isalpha(*p) && *p != '_')
-        return -1;
-
-    // an identifier can consist of numbers, letters, underscores
-    token->type = TOK_IDENT;
-    token->ident = string_new();
-    while (*p) {
-        if (!isalpha(*p) && !isdigit(*p) && *p != '_')
-            break;
-        string_add(token->ident, *p++);
-    }
-    return token->ident->len;
+static void unrecognized_token(char *s) {
+    fprintf(error_file(stderr), "UNRECOGNIZED TOKEN IN INPUT: %s\n", s);
 }
 
-static void unrecognized_token(char *s) {
-    fprintf(stderr, "UNRECOGNIZED TOKEN IN INPUT: %s\n", s);
-    exit(-1);
+#define TOKEN_BUF_DEFAULT_CAPACITY (64)
+
+static token_buf_t *token_buf_new(arena_t *arena) {
+    token_buf_t *ret = arena_alloc(arena, sizeof(token_buf_t));
+    ret->arena = arena;
+    ret->len = 0;
+    ret->pos = 0;
+    ret->capacity = TOKEN_BUF_DEFAULT_CAPACITY;
+    ret->tokens = arena_alloc(arena, sizeof(token_t) * ret->capacity);
+    return ret;
 }
 
-// returns a list of tokens
-list_t *tokenize(string_t *input) {
-    if (!input || input->len == 0)
-        return NULL;
+// Returns a pointer to a new slot at the end of the buffer
+static token_t *token_buf_push(token_buf_t *buf) {
+    if (buf->len >= buf->capacity) {
+        buf->tokens = arena_realloc(buf->arena, buf->tokens, sizeof(token_t) * buf->capacity,
+                                    sizeof(token_t) * buf->capacity * 2);
+        buf->capacity *= 2;
+    }
+    return &buf->tokens[buf->len];
+}
 
-    char *buf = string_get(input);
-    list_t *token_list = list_new();
+// Lexes from buf up to end or the first NUL, whichever comes first, and appends the tokens to out.
+// Returns where it stopped, which is an unrecognized token if it's before end and isn't a NUL. A
+// token that starts before end is always finished, even if it runs past it.
+static char *lex(char *buf, char *end, char *src, token_buf_t *out) {
     token_t *curr_token;
-
     int advance;
-    while (*buf) {
-        if (is_whitespace(*buf)) {
-            buf++;
+    while (buf < end && *buf) {
+        unsigned char cls = char_class[(unsigned char)*buf];
+        if (cls & CC_SPACE) {
+            buf = scan_whitespace(buf + 1);
             continue;
         }
 
-        advance = 0;
-        
-        // freeing stuff is for squares
-        curr_token = malloc(sizeof(token_t));
-
-        advance = string_literal(buf, curr_token);
-        if (advance > 0)
-            goto next;
-
-        advance = number_literal(buf, curr_token);
-        if (advance > 0)
-            goto next;
-
-        advance = char_literal(buf, curr_token);
-        if (advance > 0)
-            goto next;
-
-        advance = keyword(buf, curr_token);
-        if (advance > 0) {
-            char next_char = *(buf + advance);
-            // TODO how to make this less hacky?
-            if (curr_token->type == TOK_RETURN 
-                && !is_whitespace(next_char)
-                && next_char != ';') {
-                printf("Bad input program: malformed keyword\n");
-                exit(-1);
-            }
-            goto next;
+        // Fields a token doesn't use are zeroed, so two token streams can be compared with memcmp
+        curr_token = token_buf_push(out);
+        curr_token->len = 0;
+        curr_token->offset = 0;
+        if (cls & CC_DIGIT) {
+            advance = number_literal(buf, curr_token);
+        } else if (cls & CC_ALPHA) {
+            advance = identifier(buf, src, curr_token);
+        } else if (cls & CC_PUNCT) {
+            advance = punctuator(buf, curr_token);
+        } else {
+            advance = -1;
         }
 
-        advance = special_char(buf, curr_token);
-        if (advance > 0)
-            goto next;
+        if (advance <= 0)
+            return buf;
 
-        advance = identifier(buf, curr_token);
-        if (advance > 0)
-            goto next;
+        // the token was written in place, so just commit it
+        out->len++;
+        buf += advance;
+    }
+    return buf;
+}
 
-        unrecognized_token(buf);
+/*
+ * Big inputs are split into chunks that are lexed on several threads at once. A chunk always
+ * starts right after a run of whitespace, which no token can contain, so each one lexes the same
+ * as it would have as part of the whole input. The chunks' tokens are then copied into one buffer
+ * in order.
+ */
 
-next:
-        list_push(token_list, curr_token);
-        buf += advance;
+// Inputs smaller than this aren't worth starting threads for
+#define MIN_CHUNK_SIZE (256 * 1024)
+#define CHUNKS_PER_THREAD (4)
+
+typedef struct {
+    char *start;
+    char *end;
+
+    // where lex stopped, and the tokens it found in a buffer of its own
+    char *stop;
+    token_buf_t *tokens;
+
+    // where the first token of the chunk goes in the final buffer
+    int at;
+} chunk_t;
+
+typedef struct {
+    chunk_t *chunks;
+    int num_chunks;
+    atomic_int next;
+
+    char *src;
+    token_buf_t *out;
+} lex_work_t;
+
+static void *lex_worker(void *arg) {
+    lex_work_t *work = arg;
+    for (int i; (i = atomic_fetch_add(&work->next, 1)) < work->num_chunks;) {
+        chunk_t *chunk = &work->chunks[i];
+        chunk->tokens = token_buf_new(arena_new());
+        chunk->stop = lex(chunk->start, chunk->end, work->src, chunk->tokens);
+    }
+    return NULL;
+}
+
+static void *copy_worker(void *arg) {
+    lex_work_t *work = arg;
+    for (int i; (i = atomic_fetch_add(&work->next, 1)) < work->num_chunks;) {
+        chunk_t *chunk = &work->chunks[i];
+        memcpy(work->out->tokens + chunk->at, chunk->tokens->tokens, sizeof(token_t) * chunk->tokens->len);
+    }
+    return NULL;
+}
+
+// Splits input into about num_chunks chunks, each of which starts after a run of whitespace.
+// Returns how many there are.
+static int split_chunks(source_t *input, int num_chunks, chunk_t *chunks) {
+    char *end = input->buf + input->len;
+    size_t size = input->len / num_chunks;
+    char *start = input->buf;
+    int n = 0;
+    while (start < end) {
+        char *split = n == num_chunks - 1 || (size_t)(end - start) <= size ? end : start + size;
+        while (split < end && !(char_class[(unsigned char)*split] & CC_SPACE))
+            split++;
+        if (split < end)
+            split = scan_whitespace(split);
+        chunks[n].start = start;
+        chunks[n++].end = split;
+        start = split;
+    }
+    return n;
+}
+
+static bool token_equal(token_t *a, token_t *b) {
+    if (a->type != b->type)
+        return false;
+    if (a->type == TOK_IDENT)
+        return a->offset == b->offset && a->len == b->len;
+    if (a->type == TOK_INT_LIT)
+        return a->int_literal == b->int_literal;
+    return true;
+}
+
+// Lexes across the seam between two chunks again, from the start of the run of non-whitespace
+// before it through the first token after it, and checks that the last two tokens that come out
+// are the ones on either side of the seam in the chunks.
+static bool seam_ok(chunk_t *before, chunk_t *after, char *src) {
+    char *p = after->start;
+    while (p > before->start && (char_class[(unsigned char)p[-1]] & CC_SPACE))
+        p--;
+    while (p > before->start && !(char_class[(unsigned char)p[-1]] & CC_SPACE))
+        p--;
+
+    token_buf_t *seam = token_buf_new(NULL);
+    char *stop = lex(p, after->start + 1, src, seam);
+    bool ok = stop > after->start && seam->len >= 2
+              && token_equal(&seam->tokens[seam->len - 2], &before->tokens->tokens[before->tokens->len - 1])
+              && token_equal(&seam->tokens[seam->len - 1], &after->tokens->tokens[0]);
+    free(seam->tokens);
+    free(seam);
+    return ok;
+}
+
+// Lexes input in chunks on num_threads threads into token_buf. Returns false, having added nothing,
+// if a seam didn't lex the same way it did in the chunks. Sets *bad if there's an unrecognized token.
+static bool tokenize_parallel(source_t *input, int num_threads, token_buf_t *token_buf, bool *bad) {
+    lex_work_t work;
+    int max_chunks = num_threads * CHUNKS_PER_THREAD;
+    if ((size_t)max_chunks > input->len / MIN_CHUNK_SIZE)
+        max_chunks = input->len / MIN_CHUNK_SIZE;
+    work.chunks = malloc(sizeof(chunk_t) * max_chunks);
+    work.num_chunks = split_chunks(input, max_chunks, work.chunks);
+    work.src = input->buf;
+    work.out = token_buf;
+    atomic_init(&work.next, 0);
+    run_threads(num_threads, lex_worker, &work, NULL);
+
+    // Everything after an unrecognized token or a NUL is ignored, like it is when lexing serially
+    int num_chunks = work.num_chunks;
+    int num_used = 0;
+    int len = 0;
+    while (num_used < num_chunks) {
+        chunk_t *chunk = &work.chunks[num_used++];
+        chunk->at = len;
+        len += chunk->tokens->len;
+        if (chunk->stop < chunk->end)
+            break;
+    }
+
+    bool ok = true;
+    for (int i = 1; ok && i < num_used; i++) {
+        if (work.chunks[i - 1].tokens->len && work.chunks[i].tokens->len)
+            ok = seam_ok(&work.chunks[i - 1], &work.chunks[i], input->buf);
+    }
+
+    if (ok) {
+        token_buf->tokens = arena_realloc(token_buf->arena, token_buf->tokens,
+                                          sizeof(token_t) * token_buf->capacity, sizeof(token_t) * len);
+        token_buf->len = token_buf->capacity = len;
+        work.num_chunks = num_used;
+        atomic_store(&work.next, 0);
+        run_threads(num_threads, copy_worker, &work, NULL);
+
+        chunk_t *last = &work.chunks[num_used - 1];
+        if (last->stop < last->end && *last->stop) {
+            unrecognized_token(last->stop);
+            *bad = true;
+        }
+    }
+
+    for (int i = 0; i < num_chunks; i++)
+        arena_free(work.chunks[i].tokens->arena);
+    free(work.chunks);
+    return ok;
+}
+
+// returns a buffer of tokens. The buffer and the tokens are allocated in arena. With num_threads > 1,
+// big inputs are lexed on that many threads at once. Returns NULL if there's an unrecognized token.
+token_buf_t *tokenize(source_t *input, arena_t *arena, int num_threads) {
+    if (!input || input->len == 0)
+        return NULL;
+
+    token_buf_t *token_buf = token_buf_new(arena);
+    token_buf->src = input->buf;
+
+    pthread_once(&lexer_ready, lexer_init);
+    bool bad = false;
+    if (num_threads > 1 && input->len >= 2 * MIN_CHUNK_SIZE && tokenize_parallel(input, num_threads, token_buf, &bad))
+        return bad ? NULL : token_buf;
+
+    char *stop = lex(input->buf, input->buf + input->len, input->buf, token_buf);
+    if (*stop) {
+        unrecognized_token(stop);
+        return NULL;
     }
+    return token_buf;
+}
 
-    return token_list;
+/*
+ * Streaming mode. The input is lexed a window at a time, and the tokens are handed out one top-level
+ * declaration at a time, so only the declaration being compiled and the rest of the window it ended
+ * in are ever kept. lex always finishes a token that starts before the end of the window, so the
+ * windows don't need to line up with anything.
+ */
+
+#define STREAM_WINDOW_SIZE (64 * 1024)
+
+token_stream_t *tokenize_begin(source_t *input, arena_t *arena) {
+    pthread_once(&lexer_ready, lexer_init);
+    token_stream_t *stream = arena_alloc(arena, sizeof(token_stream_t));
+    stream->input = input;
+    stream->tokens = token_buf_new(arena);
+    stream->tokens->src = input->buf;
+    stream->num_lexed = 0;
+    stream->next = stream->window = input->buf;
+    return stream;
 }
 
-void print_token(token_t *token) {
+// Lexes the next window onto the end of the tokens. Returns false if there's an unrecognized token.
+static bool lex_window(token_stream_t *stream) {
+    char *end = stream->input->buf + stream->input->len;
+    char *window_end = end - stream->next > STREAM_WINDOW_SIZE ? stream->next + STREAM_WINDOW_SIZE : end;
+    char *stop = lex(stream->next, window_end, stream->input->buf, stream->tokens);
+    if (stop < window_end && *stop) {
+        unrecognized_token(stop);
+        return false;
+    }
+
+    // Everything after a NUL is ignored, like it is when the whole input is lexed at once
+    stream->window = stream->next;
+    stream->next = stop < window_end ? end : stop;
+    return true;
+}
+
+bool tokenize_next(token_stream_t *stream) {
+    token_buf_t *tokens = stream->tokens;
+    int done = tokens->len;
+    tokens->len = stream->num_lexed - done;
+    tokens->pos = 0;
+    memmove(tokens->tokens, tokens->tokens + done, sizeof(token_t) * tokens->len);
+
+    // The tokens that are left all came from the last window, so nothing before it is needed
+    source_release(stream->input, stream->window - stream->input->buf);
+
+    char *end = stream->input->buf + stream->input->len;
+    int depth = 0;
+    int i = 0;
+    while (1) {
+        for (; i < tokens->len; i++) {
+            token_type_t type = tokens->tokens[i].type;
+            if (type == TOK_OPEN_BRACE) {
+                depth++;
+            } else if ((type == TOK_CLOSE_BRACE && --depth <= 0) || (type == TOK_SEMICOLON && depth == 0)) {
+                stream->num_lexed = tokens->len;
+                tokens->len = i + 1;
+                return true;
+            }
+        }
+
+        // Whatever's left at the end of the input is the last declaration, finished or not
+        if (stream->next >= end) {
+            stream->num_lexed = tokens->len;
+            return true;
+        }
+        if (!lex_window(stream)) {
+            stream->num_lexed = tokens->len = 0;
+            return false;
+        }
+    }
+}
+
+void print_token(char *src, token_t *token) {
     if (!token)
         return;
 
@@ -224,30 +528,24 @@ void print_token(token_t *token) {
     }
 
     if (token->type == TOK_IDENT) {
-        printf("identifier: %s\n", string_get(token->ident));
+        printf("identifier: %.*s\n", (int)token->len, src + token->offset);
         return;
     }
 
-    // try special chars and keywords now
-    keyword_pair_t keyword;
-    int i = 0;
-    do {
-        keyword = keywords[i++];
-        if (token->type == keyword.type) {
-            printf("keyword: %s\n", keyword.keyword);
+    // try keywords and punctuators now
+    for (int i = 0; keywords[i].keyword; i++) {
+        if (token->type == keywords[i].type) {
+            printf("keyword: %s\n", keywords[i].keyword);
             return;
         }
-    } while (keyword.keyword);
-
-    special_char_pair_t special;
-    i = 0;
-    do {
-        special = special_chars[i++];
-        if (token->type == special.type) {
-            printf("special char: %c\n", special.c);
+    }
+
+    for (int i = 0; puncts[i].punct; i++) {
+        if (token->type == puncts[i].type) {
+            printf("special char: %s\n", puncts[i].punct);
             return;
         }
-    } while (special.c);
+    }
 
     printf("UNKNOWN TOKEN!!!!!!\n");
 }
@@ -3,6 +3,8 @@
 
 #include "string.h"
 #include "list.h"
+#include "arena.h"
+#include "source.h"
 
 #include <stdio.h>
 #include <stdbool.h>
@@ -66,15 +68,55 @@ typedef enum token_type {
     TOK_DO,
     TOK_BREAK,
     TOK_CONTINUE,
+
+    // not a token, just one past the last one
+    NUM_TOKEN_TYPES,
 } token_type_t;
 
+// 16 bytes, so four tokens fit in a cache line.
+// Identifiers don't own a copy of their name, they refer back to a span of the source buffer.
 typedef struct token {
     token_type_t type;
+
+    // length of an identifier
+    uint32_t len;
     union {
         int int_literal;
         char char_literal;
-        string_t *ident;
+
+        // offset of an identifier from the start of the source buffer
+        size_t offset;
     };
 } token_t;
 
+// The tokens of a whole input, stored by value in one growable array. The parser consumes them
+// by advancing pos, so looking ahead or backtracking is just indexing.
+typedef struct {
+    token_t *tokens;
+    int len;
+    int capacity;
+
+    // index of the next token to be consumed
+    int pos;
+
+    // where the tokens array is allocated
+    arena_t *arena;
+
+    // the buffer that identifier spans point into. Needs to outlive the tokens.
+    char *src;
+} token_buf_t;
+
+// Streaming mode's tokenizer (see tokenize_next). Input is lexed a window at a time, and handed out
+// one top-level declaration at a time. tokens holds the declaration being handed out, from 0 to len,
+// followed by whatever's been lexed after it, up to num_lexed.
+typedef struct {
+    source_t *input;
+    token_buf_t *tokens;
+    int num_lexed;
+
+    // where lexing picks up, and where the window it's in started
+    char *next;
+    char *window;
+} token_stream_t;
+
 #endif